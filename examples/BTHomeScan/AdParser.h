@@ -0,0 +1,63 @@
+/// @file AdParser.h
+/// @brief Helpers for walking BLE advertising data (AD) structures.
+///
+/// AD data is a sequence of [length][type][length - 1 bytes]. All helpers
+/// stop at the first zero-length or truncated structure.
+
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+/// AD types used by the scanner and decoders.
+enum : uint8_t {
+    AD_FLAGS          = 0x01,
+    AD_NAME_SHORT     = 0x08,
+    AD_NAME_COMPLETE  = 0x09,
+    AD_TX_POWER       = 0x0A,
+    AD_SERVICE_DATA16 = 0x16,
+    AD_MANUFACTURER   = 0xFF,
+};
+
+/// Call fn(type, payload, payloadLen) for every AD structure. fn returns
+/// false to stop early.
+template <typename Fn>
+inline void forEachAd(const uint8_t *data, size_t len, Fn fn) {
+    size_t i = 0;
+    while (i + 1 < len) {
+        uint8_t fieldLen = data[i];
+        if (fieldLen == 0 || i + 1 + fieldLen > len)
+            break;
+        if (!fn(data[i + 1], &data[i + 2], (size_t)fieldLen - 1))
+            break;
+        i += 1 + fieldLen;
+    }
+}
+
+/// Find the first AD structure of the given type. Returns its payload (after
+/// the type byte) and sets adLen, or nullptr if absent.
+inline const uint8_t *findAd(const uint8_t *data, size_t len, uint8_t type,
+                             size_t &adLen) {
+    const uint8_t *found = nullptr;
+    forEachAd(data, len, [&](uint8_t t, const uint8_t *p, size_t n) {
+        if (t != type)
+            return true;
+        found = p;
+        adLen = n;
+        return false;
+    });
+    return found;
+}
+
+/// Find 16-bit UUID service data for uuid. Returns the bytes after the UUID.
+inline const uint8_t *findServiceData16(const uint8_t *data, size_t len,
+                                        uint16_t uuid, size_t &sdLen) {
+    const uint8_t *found = nullptr;
+    forEachAd(data, len, [&](uint8_t t, const uint8_t *p, size_t n) {
+        if (t != AD_SERVICE_DATA16 || n < 2 || (uint16_t)(p[0] | (p[1] << 8)) != uuid)
+            return true;
+        found = p + 2;
+        sdLen = n - 2;
+        return false;
+    });
+    return found;
+}
@@ -0,0 +1,323 @@
+#include "AdaptiveScan.h"
+
+#include <cstring>
+
+#include "Arena.h"
+
+// Below this an interval is a burst repeat or a scan response, not a period.
+static constexpr uint32_t MIN_PERIOD_US = 20000;
+// Windows closer together than this are merged; stopping and restarting the
+// radio for a shorter pause costs more than it saves.
+static constexpr int64_t MIN_SLEEP_US = 50000;
+// A locked device that misses this many predictions in a row is unlocked and
+// left to the discovery scan.
+static constexpr uint8_t MAX_MISS_RUN = 8;
+
+static inline uint32_t absDiff(int64_t a, int64_t b) {
+    int64_t d = a - b;
+    return (uint32_t)(d < 0 ? -d : d);
+}
+
+AdaptiveScan::AdaptiveScan()
+    : AdaptiveScan(Config()) {
+}
+
+AdaptiveScan::AdaptiveScan(const Config &cfg, Arena *arena)
+    : _cfg(cfg) {
+    if (_cfg.maxDevices == 0)
+        _cfg.maxDevices = 1;
+    if (_cfg.minSamples == 0)
+        _cfg.minSamples = 1;
+    _devices = arena ? arena->createArray<Device>(_cfg.maxDevices)
+                     : new Device[_cfg.maxDevices]();
+    _ownsDevices = !arena;
+}
+
+AdaptiveScan::~AdaptiveScan() {
+    if (_ownsDevices)
+        delete[] _devices;
+}
+
+// ---------------------------------------------------------------------------
+// Device table
+// ---------------------------------------------------------------------------
+AdaptiveScan::Device *AdaptiveScan::slot(const uint8_t mac[6]) {
+    Device *freeSlot = nullptr;
+    Device *oldest = nullptr;
+    for (uint8_t i = 0; i < _cfg.maxDevices; i++) {
+        Device &d = _devices[i];
+        if (!d.used) {
+            if (!freeSlot)
+                freeSlot = &d;
+            continue;
+        }
+        if (memcmp(d.mac, mac, 6) == 0)
+            return &d;
+        if (!oldest || d.lastUs < oldest->lastUs)
+            oldest = &d;
+    }
+
+    // New device: take a free slot or evict the one heard from longest ago.
+    Device *d = freeSlot ? freeSlot : oldest;
+    memset(d, 0, sizeof(*d));
+    memcpy(d->mac, mac, 6);
+    d->used = true;
+    return d;
+}
+
+bool AdaptiveScan::learned(const uint8_t mac[6], uint32_t &periodUs, uint32_t &jitterUs) const {
+    for (uint8_t i = 0; i < _cfg.maxDevices; i++) {
+        const Device &d = _devices[i];
+        if (!d.used || memcmp(d.mac, mac, 6) != 0)
+            continue;
+        if (d.samples < _cfg.minSamples)
+            return false;
+        periodUs = d.periodUs;
+        jitterUs = d.jitterUs;
+        return true;
+    }
+    return false;
+}
+
+void AdaptiveScan::restore(const uint8_t mac[6], uint32_t periodUs, uint32_t jitterUs) {
+    if (periodUs < MIN_PERIOD_US)
+        return;
+    Device *d = slot(mac);
+    d->periodUs = periodUs;
+    d->jitterUs = jitterUs;
+    d->samples = _cfg.minSamples;
+    d->lastUs = 0;
+    d->expectedUs = 0;
+}
+
+uint32_t AdaptiveScan::guardFor(const Device &d) const {
+    uint64_t g = (uint64_t)_cfg.minGuardUs + 2ull * d.jitterUs;
+    g = (g * _guardScale) >> 8;
+    if (g < _cfg.minGuardUs)
+        g = _cfg.minGuardUs;
+    if (g > _cfg.maxGuardUs)
+        g = _cfg.maxGuardUs;
+    return (uint32_t)g;
+}
+
+// ---------------------------------------------------------------------------
+// Learning
+// ---------------------------------------------------------------------------
+void AdaptiveScan::observe(const uint8_t mac[6], int64_t captureUs) {
+    Device *d = slot(mac);
+    if (d->lastUs == 0) {
+        d->lastUs = captureUs;
+        // Restored with a trusted period: predict from the first sighting
+        if (d->samples >= _cfg.minSamples)
+            d->expectedUs = captureUs + d->periodUs;
+        return;
+    }
+
+    int64_t delta = captureUs - d->lastUs;
+    if (delta <= 0)
+        return; // duplicate or out of order
+
+    bool locked = d->samples >= _cfg.minSamples;
+
+    if (d->expectedUs != 0 && absDiff(captureUs, d->expectedUs) <= guardFor(*d)) {
+        count(true);
+        d->missRun = 0;
+        d->expectedUs = 0;
+    }
+
+    if (delta < MIN_PERIOD_US) {
+        rearm(*d);
+        return;
+    }
+
+    if (d->periodUs == 0) {
+        d->periodUs = (uint32_t)delta;
+        d->samples = 1;
+    } else {
+        uint32_t n = (uint32_t)((delta + d->periodUs / 2) / d->periodUs);
+        if (n == 0) {
+            // Faster than the learned period: only relearn while untrusted,
+            // otherwise it is a repeat inside an advert burst.
+            if (locked) {
+                rearm(*d);
+                return;
+            }
+            d->periodUs = (uint32_t)delta;
+            d->samples = 1;
+        } else {
+            uint32_t err = absDiff(delta, (int64_t)n * d->periodUs);
+            uint32_t tol = d->periodUs / 16 + n * (d->periodUs / 256);
+            if (tol < _cfg.minGuardUs)
+                tol = _cfg.minGuardUs;
+
+            if (err <= tol) {
+                uint32_t estimate = (uint32_t)(delta / n);
+                if (d->samples < _cfg.minSamples)
+                    d->periodUs = (uint32_t)(((uint64_t)d->periodUs * d->samples + estimate) / (d->samples + 1));
+                else
+                    d->periodUs += ((int32_t)estimate - (int32_t)d->periodUs) / 8;
+                d->jitterUs += ((int32_t)err - (int32_t)d->jitterUs) / 8;
+                if (d->samples < 255)
+                    d->samples++;
+            } else {
+                d->periodUs = (uint32_t)delta;
+                d->samples = 1;
+                d->jitterUs = 0;
+            }
+        }
+    }
+
+    d->lastUs = captureUs;
+    d->expectedUs = d->samples >= _cfg.minSamples ? captureUs + d->periodUs : 0;
+}
+
+// Keep a locked device scheduled after an observation that did not update
+// its timing (burst repeat) but may have consumed its pending prediction.
+void AdaptiveScan::rearm(Device &d) {
+    if (d.expectedUs == 0 && d.samples >= _cfg.minSamples)
+        d.expectedUs = d.lastUs + d.periodUs;
+}
+
+void AdaptiveScan::count(bool hit) {
+    _predicted++;
+    _epochPredicted++;
+    if (hit) {
+        _hits++;
+        _epochHits++;
+    } else {
+        _misses++;
+    }
+}
+
+// Count predictions whose window has passed without an observation.
+void AdaptiveScan::expire(int64_t nowUs) {
+    for (uint8_t i = 0; i < _cfg.maxDevices; i++) {
+        Device &d = _devices[i];
+        if (!d.used || d.expectedUs == 0)
+            continue;
+        while (d.expectedUs != 0 &&
+                d.expectedUs + guardFor(d) + _cfg.settleUs < nowUs) {
+            count(false);
+            if (++d.missRun >= MAX_MISS_RUN) {
+                d.samples = 0;
+                d.missRun = 0;
+                d.expectedUs = 0;
+            } else {
+                d.expectedUs += d.periodUs;
+            }
+        }
+    }
+}
+
+void AdaptiveScan::endEpochIfDue(int64_t nowUs) {
+    int64_t elapsed = nowUs - _epochStartUs;
+    if (_epochPredicted < _cfg.epochPredictions &&
+            elapsed < (int64_t)_cfg.discoveryEveryUs)
+        return;
+
+    if (_epochPredicted > 0) {
+        uint32_t rate = (uint32_t)_epochHits * 100 / _epochPredicted;
+        if (rate < _cfg.targetHitPercent) {
+            _guardScale = _guardScale * 3 / 2;
+            if (_guardScale > 256 * 64)
+                _guardScale = 256 * 64;
+        } else {
+            _guardScale = _guardScale * 7 / 8;
+            if (_guardScale < 128)
+                _guardScale = 128;
+        }
+    }
+    if (elapsed > 0) {
+        uint64_t duty = _epochScannedUs * 100 / (uint64_t)elapsed;
+        _dutyPercent = duty > 100 ? 100 : (uint8_t)duty;
+    }
+
+    _epochStartUs = nowUs;
+    _epochScannedUs = 0;
+    _epochPredicted = 0;
+    _epochHits = 0;
+}
+
+// ---------------------------------------------------------------------------
+// Scheduling
+// ---------------------------------------------------------------------------
+AdaptiveScan::Window AdaptiveScan::next(int64_t nowUs) {
+    if (_epochStartUs == 0) {
+        _epochStartUs = nowUs;
+        _nextDiscoveryUs = nowUs;
+    }
+
+    expire(nowUs);
+    endEpochIfDue(nowUs);
+
+    if (nowUs >= _nextDiscoveryUs) {
+        _nextDiscoveryUs = nowUs + _cfg.discoveryEveryUs;
+        return {nowUs, nowUs + (int64_t)_cfg.discoveryLenUs};
+    }
+
+    // Earliest predicted window among locked devices.
+    Window w = {_nextDiscoveryUs, _nextDiscoveryUs};
+    bool any = false;
+    for (uint8_t i = 0; i < _cfg.maxDevices; i++) {
+        const Device &d = _devices[i];
+        if (!d.used || d.expectedUs == 0)
+            continue;
+        uint32_t g = guardFor(d);
+        int64_t s = d.expectedUs - g;
+        if (!any || s < w.startUs) {
+            w.startUs = s;
+            w.endUs = d.expectedUs + g;
+        }
+        any = true;
+    }
+
+    // Nothing learned yet: keep scanning until the next discovery window.
+    if (!any || w.startUs >= _nextDiscoveryUs)
+        return {nowUs, _nextDiscoveryUs};
+
+    // Grow the window over every arrival that overlaps or nearly touches it.
+    bool grown = true;
+    while (grown) {
+        grown = false;
+        for (uint8_t i = 0; i < _cfg.maxDevices; i++) {
+            const Device &d = _devices[i];
+            if (!d.used || d.expectedUs == 0)
+                continue;
+            uint32_t g = guardFor(d);
+            int64_t s = d.expectedUs - g;
+            int64_t e = d.expectedUs + g;
+            if (s <= w.endUs + MIN_SLEEP_US && e > w.endUs) {
+                w.endUs = e;
+                grown = true;
+            }
+        }
+    }
+
+    if (w.startUs - nowUs < MIN_SLEEP_US)
+        w.startUs = nowUs;
+    if (w.endUs + MIN_SLEEP_US >= _nextDiscoveryUs)
+        w.endUs = _nextDiscoveryUs;
+    return w;
+}
+
+void AdaptiveScan::scanned(int64_t startUs, int64_t endUs) {
+    if (endUs > startUs)
+        _epochScannedUs += (uint64_t)(endUs - startUs);
+}
+
+AdaptiveScan::Stats AdaptiveScan::stats() const {
+    Stats s = {};
+    s.predicted   = _predicted;
+    s.hits        = _hits;
+    s.misses      = _misses;
+    s.dutyPercent = _dutyPercent;
+    s.guardScale  = _guardScale;
+    for (uint8_t i = 0; i < _cfg.maxDevices; i++) {
+        if (!_devices[i].used)
+            continue;
+        s.tracked++;
+        if (_devices[i].samples >= _cfg.minSamples)
+            s.locked++;
+    }
+    return s;
+}
@@ -0,0 +1,117 @@
+/// @file AdaptiveScan.h
+/// @brief Scan window scheduler driven by learned per-device advert timing.
+///
+/// Each known device's advertising period and phase are learned from capture
+/// timestamps. next() then returns the next window the radio should scan so
+/// that the predicted arrivals are covered, instead of scanning at ~100% duty.
+///
+/// The guard around each predicted arrival shrinks while the hit rate stays
+/// above the target and widens when expected adverts are missed. A periodic
+/// discovery window (full scan) keeps finding new devices and relearning ones
+/// whose timing drifted.
+///
+/// The policy itself is plain C++ with no RTOS calls; only the optional
+/// arena (Arena.cpp, which uses the heap_caps API) ties it to the platform,
+/// so the host build links Arena.cpp against extras/host/shim (see
+/// extras/sim/adaptive_scan_sim.cpp). Not thread-safe; the caller
+/// serializes observe() and next().
+
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+class Arena;
+
+class AdaptiveScan {
+public:
+    struct Config {
+        uint8_t  maxDevices = 32;           ///< Tracked device slots
+        uint8_t  minSamples = 3;            ///< Consistent intervals before a period is trusted
+        uint32_t minGuardUs = 15000;        ///< Smallest half-window around an arrival
+        uint32_t maxGuardUs = 1000000;      ///< Largest half-window around an arrival
+        uint32_t settleUs = 250000;         ///< Allowed capture-to-observe lag before a miss is counted
+        uint32_t discoveryEveryUs = 60000000; ///< Period of the full discovery scan
+        uint32_t discoveryLenUs = 5000000;  ///< Length of the full discovery scan
+        uint8_t  targetHitPercent = 90;     ///< Hit rate the guard is tuned towards
+        uint16_t epochPredictions = 64;     ///< Predictions per guard adjustment
+    };
+
+    struct Window {
+        int64_t startUs;
+        int64_t endUs;
+    };
+
+    struct Stats {
+        uint32_t predicted;   ///< Arrivals predicted inside a scheduled window
+        uint32_t hits;        ///< Predicted arrivals actually observed
+        uint32_t misses;      ///< Predicted arrivals never observed
+        uint16_t tracked;     ///< Devices in the table
+        uint16_t locked;      ///< Devices with a trusted period
+        uint8_t  dutyPercent; ///< Scanned time / elapsed time, last epoch
+        uint32_t guardScale;  ///< Current guard multiplier (x1/256)
+    };
+
+    AdaptiveScan();
+    /// With arena (see Arena.h), the device table comes from it instead of
+    /// the heap.
+    explicit AdaptiveScan(const Config &cfg, Arena *arena = nullptr);
+    ~AdaptiveScan();
+
+    AdaptiveScan(const AdaptiveScan &) = delete;
+    AdaptiveScan &operator=(const AdaptiveScan &) = delete;
+
+    /// Record an advert from a known device captured at captureUs.
+    void observe(const uint8_t mac[6], int64_t captureUs);
+
+    /// Trusted period and jitter of a device, to persist across reboots.
+    /// Returns false if it is not tracked or its period is not trusted yet.
+    bool learned(const uint8_t mac[6], uint32_t &periodUs, uint32_t &jitterUs) const;
+
+    /// Seed a device with the period and jitter of a previous run. The
+    /// period is trusted straight away; the phase is taken from the
+    /// device's next advert.
+    void restore(const uint8_t mac[6], uint32_t periodUs, uint32_t jitterUs);
+
+    /// Next window to scan. startUs <= nowUs means "scan now until endUs".
+    Window next(int64_t nowUs);
+
+    /// Report that the radio actually scanned [startUs, endUs).
+    void scanned(int64_t startUs, int64_t endUs);
+
+    Stats stats() const;
+
+private:
+    struct Device {
+        uint8_t  mac[6];
+        uint8_t  samples;     ///< Consistent intervals seen (saturating)
+        uint8_t  missRun;     ///< Consecutive predicted arrivals missed
+        bool     used;
+        int64_t  lastUs;      ///< Last observed capture time (phase anchor)
+        int64_t  expectedUs;  ///< Next predicted arrival, 0 = none pending
+        uint32_t periodUs;    ///< Learned advertising period
+        uint32_t jitterUs;    ///< Mean absolute deviation from the period
+    };
+
+    Device *slot(const uint8_t mac[6]);
+    uint32_t guardFor(const Device &d) const;
+    void rearm(Device &d);
+    void expire(int64_t nowUs);
+    void endEpochIfDue(int64_t nowUs);
+    void count(bool hit);
+
+    Config _cfg;
+    Device *_devices = nullptr;
+    bool _ownsDevices = false;  ///< _devices is from the heap, not an arena
+
+    int64_t _nextDiscoveryUs = 0;
+    int64_t _epochStartUs = 0;
+    uint64_t _epochScannedUs = 0;
+    uint16_t _epochPredicted = 0;
+    uint16_t _epochHits = 0;
+    uint32_t _guardScale = 256;
+
+    uint32_t _predicted = 0;
+    uint32_t _hits = 0;
+    uint32_t _misses = 0;
+    uint8_t _dutyPercent = 100;
+};
@@ -0,0 +1,204 @@
+/// @file AdvertFrame.h
+/// @brief Byte-stream framing of raw adverts between gateways and hosts.
+///
+/// A gateway in raw-forward mode (BLEScanner::forward()) writes every advert
+/// as one frame; host tools read them back from serial ports, sockets or
+/// files with AdvertFrameReader. Header-only and free of Arduino/FreeRTOS
+/// dependencies so firmware and host share it.
+///
+/// Frame payload, little-endian:
+/// @code
+///   u8  type (FRAME_RAW_ADVERT)
+///   i64 timeUs  (gateway clock)
+///   u8  mac[6], addrType, i8 rssi, u8 flags, u8 len
+///   u8  data[len]
+///   u16 CRC-16/CCITT-FALSE of everything above
+/// @endcode
+/// The payload is COBS-encoded and terminated by a 0x00 byte, so a reader
+/// can join a stream at any point and resynchronise after corruption.
+/// Other frame types (see DecodedFrame.h) share the framing and the CRC.
+
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include "AdvertSource.h"
+
+enum : uint8_t {
+    FRAME_RAW_ADVERT = 0x01,
+    FRAME_DECODED    = 0x02,    ///< See DecodedFrame.h
+};
+
+static constexpr size_t FRAME_HEADER_BYTES = 1 + 8 + 6 + 4;
+static constexpr size_t FRAME_MAX_PAYLOAD = FRAME_HEADER_BYTES + ADVERT_MAX_DATA + 2;
+/// COBS adds one byte per 254, plus the leading code byte and the delimiter.
+static constexpr size_t FRAME_MAX_ENCODED = FRAME_MAX_PAYLOAD + FRAME_MAX_PAYLOAD / 254 + 2;
+
+inline uint16_t frameCrc16(const uint8_t *data, size_t len) {
+    uint16_t crc = 0xFFFF;
+    for (size_t i = 0; i < len; i++) {
+        crc ^= (uint16_t)data[i] << 8;
+        for (int b = 0; b < 8; b++)
+            crc = (crc & 0x8000) ? (uint16_t)((crc << 1) ^ 0x1021) : (uint16_t)(crc << 1);
+    }
+    return crc;
+}
+
+/// COBS-encode len bytes into out (at least len + len / 254 + 1 bytes).
+/// Returns the encoded length, without a delimiter.
+inline size_t cobsEncode(const uint8_t *in, size_t len, uint8_t *out) {
+    size_t codeIdx = 0, o = 1;
+    uint8_t code = 1;
+    for (size_t i = 0; i < len; i++) {
+        if (in[i] == 0) {
+            out[codeIdx] = code;
+            codeIdx = o++;
+            code = 1;
+            continue;
+        }
+        out[o++] = in[i];
+        if (++code == 0xFF) {
+            out[codeIdx] = code;
+            codeIdx = o++;
+            code = 1;
+        }
+    }
+    out[codeIdx] = code;
+    return o;
+}
+
+/// Decode one COBS block (delimiter excluded) into out. Returns the decoded
+/// length, or 0 if the block is malformed.
+inline size_t cobsDecode(const uint8_t *in, size_t len, uint8_t *out) {
+    size_t i = 0, o = 0;
+    while (i < len) {
+        uint8_t code = in[i++];
+        if (code == 0 || i + code - 1 > len)
+            return 0;
+        for (uint8_t k = 1; k < code; k++)
+            out[o++] = in[i++];
+        if (code != 0xFF && i < len)
+            out[o++] = 0;
+    }
+    return o;
+}
+
+/// Encode one advert as a complete frame (delimiter included) into out,
+/// which must hold FRAME_MAX_ENCODED bytes. Returns the frame length.
+inline size_t encodeAdvertFrame(const AdvertHeader &hdr, const uint8_t *data, uint8_t *out) {
+    uint8_t payload[FRAME_MAX_PAYLOAD];
+    size_t n = 0;
+    payload[n++] = FRAME_RAW_ADVERT;
+    uint64_t t = (uint64_t)hdr.timeUs;
+    for (int i = 0; i < 8; i++)
+        payload[n++] = (uint8_t)(t >> (8 * i));
+    memcpy(payload + n, hdr.mac, 6);
+    n += 6;
+    payload[n++] = hdr.addrType;
+    payload[n++] = (uint8_t)hdr.rssi;
+    payload[n++] = hdr.flags;
+    payload[n++] = hdr.len;
+    memcpy(payload + n, data, hdr.len);
+    n += hdr.len;
+    uint16_t crc = frameCrc16(payload, n);
+    payload[n++] = (uint8_t)crc;
+    payload[n++] = (uint8_t)(crc >> 8);
+
+    size_t e = cobsEncode(payload, n, out);
+    out[e++] = 0;
+    return e;
+}
+
+/// Decode a frame payload (already COBS-decoded). data must hold
+/// ADVERT_MAX_DATA bytes. Returns false on a bad length, type or CRC.
+inline bool decodeAdvertFrame(const uint8_t *payload, size_t len,
+                              AdvertHeader &hdr, uint8_t *data) {
+    if (len < FRAME_HEADER_BYTES + 2 || payload[0] != FRAME_RAW_ADVERT)
+        return false;
+    uint16_t crc = (uint16_t)(payload[len - 2] | (payload[len - 1] << 8));
+    if (frameCrc16(payload, len - 2) != crc)
+        return false;
+
+    uint64_t t = 0;
+    for (int i = 0; i < 8; i++)
+        t |= (uint64_t)payload[1 + i] << (8 * i);
+    hdr.timeUs = (int64_t)t;
+    memcpy(hdr.mac, payload + 9, 6);
+    hdr.addrType = payload[15];
+    hdr.rssi = (int8_t)payload[16];
+    hdr.flags = payload[17];
+    hdr.len = payload[18];
+    if (FRAME_HEADER_BYTES + hdr.len + 2 != len)
+        return false;
+    memcpy(data, payload + FRAME_HEADER_BYTES, hdr.len);
+    return true;
+}
+
+/// Splits a byte stream into COBS-decoded frame payloads of at most
+/// MaxPayload bytes. Feed it whatever was read; it calls fn(payload, len)
+/// per complete frame, which returns false if the frame is invalid, and
+/// counts the good and bad ones.
+template <size_t MaxPayload>
+class FrameReader {
+public:
+    static constexpr size_t MAX_ENCODED = MaxPayload + MaxPayload / 254 + 2;
+
+    template <typename Fn>
+    void feed(const uint8_t *bytes, size_t len, Fn fn) {
+        for (size_t i = 0; i < len; i++) {
+            uint8_t b = bytes[i];
+            if (b != 0) {
+                if (_len < sizeof(_buf))
+                    _buf[_len++] = b;
+                else
+                    _overflow = true;
+                continue;
+            }
+            // Delimiter: complete frame (empty ones are keep-alives/resync)
+            if (_len > 0) {
+                uint8_t payload[MAX_ENCODED];
+                size_t n = _overflow ? 0 : cobsDecode(_buf, _len, payload);
+                if (n > 0 && n <= MaxPayload && fn((const uint8_t *)payload, n))
+                    _frames++;
+                else
+                    _errors++;
+            }
+            _len = 0;
+            _overflow = false;
+        }
+    }
+
+    /// Drop a partial frame, e.g. between UDP datagrams.
+    void reset() {
+        _len = 0;
+        _overflow = false;
+    }
+
+    uint64_t frames() const { return _frames; }
+    uint64_t errors() const { return _errors; }
+
+private:
+    uint8_t _buf[MAX_ENCODED];
+    size_t _len = 0;
+    bool _overflow = false;
+    uint64_t _frames = 0;
+    uint64_t _errors = 0;
+};
+
+/// Incremental raw advert frame parser for byte streams. Feed it whatever
+/// was read; it calls fn(hdr, data) per valid frame and counts the bad ones.
+class AdvertFrameReader : public FrameReader<FRAME_MAX_PAYLOAD> {
+public:
+    template <typename Fn>
+    void feed(const uint8_t *bytes, size_t len, Fn fn) {
+        FrameReader::feed(bytes, len, [&](const uint8_t *payload, size_t n) {
+            AdvertHeader hdr;
+            uint8_t data[ADVERT_MAX_DATA];
+            if (!decodeAdvertFrame(payload, n, hdr, data))
+                return false;
+            fn(hdr, (const uint8_t *)data);
+            return true;
+        });
+    }
+};
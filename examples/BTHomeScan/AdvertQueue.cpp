@@ -0,0 +1,472 @@
+#include "AdvertQueue.h"
+
+#include <Arduino.h>
+#include <cstring>
+
+#include "esp_timer.h"
+
+#include "Arena.h"
+
+// Records evicted at most per push before giving up on the incoming advert.
+static constexpr int MAX_EVICT_PER_PUSH = 8;
+
+AdvertQueue::~AdvertQueue() {
+    if (_created)
+        _ring.free();
+    if (_spillCreated)
+        _spillRing.free();
+    if (_draining)
+        _drainRing.free();
+    if (_lock)
+        vSemaphoreDelete(_lock);
+    if (_ownsTags)
+        delete[] _tags;
+}
+
+// NOSPLIT items cost an 8-byte header and are padded to 4 bytes.
+size_t AdvertQueue::itemBytes(size_t payload) {
+    return 8 + ((payload + 3) & ~(size_t)3);
+}
+
+void AdvertQueue::setSpill(const Spill &spill) {
+    if (!_created)
+        _spill = spill;
+}
+
+void AdvertQueue::setMover(TaskHandle_t task) {
+    xSemaphoreTake(_lock, portMAX_DELAY);
+    _mover = task;
+    xSemaphoreGive(_lock);
+}
+
+// Create a NOSPLIT ring of bytes with heap caps, or from arena.
+static bool createRing(espidf::RingBuffer &ring, size_t bytes, UBaseType_t caps, Arena *arena) {
+    if (arena) {
+        bytes &= ~(size_t)3;
+        auto *storage = (uint8_t *)arena->allocate(bytes, 4);
+        auto *buf = arena->create<StaticRingbuffer_t>();
+        if (!storage || !buf)
+            return false;
+        ring.create(bytes, RINGBUF_TYPE_NOSPLIT, storage, buf);
+    } else {
+        ring.create(bytes, RINGBUF_TYPE_NOSPLIT, caps);
+    }
+    return (RingbufHandle_t)ring != nullptr;
+}
+
+bool AdvertQueue::begin(size_t bytes, UBaseType_t caps, const Policy &policy,
+                        Arena *arena) {
+    _policy = policy;
+    if (arena) {
+        auto *lock = arena->create<StaticSemaphore_t>();
+        _lock = lock ? xSemaphoreCreateMutexStatic(lock) : nullptr;
+    } else {
+        _lock = xSemaphoreCreateMutex();
+    }
+    if (!_lock)
+        return false;
+
+    if (!createRing(_ring, bytes, caps, arena))
+        return false;
+    _created = true;
+
+    if (_spill.bytes) {
+        _spillCreated = createRing(_spillRing, _spill.bytes, _spill.caps, arena);
+        if (!_spillCreated)
+            log_e("overflow ring allocation failed (%u bytes), queue runs without it",
+                  (unsigned)_spill.bytes);
+    }
+
+    // One tag per smallest possible record
+    _tagCap = capacity() / itemBytes(sizeof(AdvertHeader)) + 1;
+    _tags = arena ? arena->createArray<Tag>(_tagCap) : new Tag[_tagCap];
+    _ownsTags = !arena;
+    return _tags != nullptr;
+}
+
+bool AdvertQueue::resize(size_t bytes, UBaseType_t caps, Arena *arena) {
+    if (!_created)
+        return false;
+    xSemaphoreTake(_lock, portMAX_DELAY);
+    finishDrain();
+    bool draining = _draining;
+    size_t oldBytes = _ring.get_total_size();
+    xSemaphoreGive(_lock);
+    if (draining)
+        return false;
+
+    espidf::RingBuffer ring;
+    if (!createRing(ring, bytes, caps, arena))
+        return false;
+    // One tag per smallest possible record, in the old ring too
+    size_t tagCap = (oldBytes + ring.get_total_size() +
+                     (_spillCreated ? _spillRing.get_total_size() : 0)) /
+                    itemBytes(sizeof(AdvertHeader)) + 1;
+    Tag *tags = arena ? arena->createArray<Tag>(tagCap) : new Tag[tagCap];
+    if (!tags) {
+        ring.free();
+        return false;
+    }
+
+    // The queued hot records become the drain tier where they are
+    xSemaphoreTake(_lock, portMAX_DELAY);
+    for (size_t i = 0; i < _tagCount; i++)
+        tags[i] = _tags[(_tagHead + i) % _tagCap];
+    Tag *oldTags = _ownsTags ? _tags : nullptr;
+    _tags = tags;
+    _ownsTags = !arena;
+    _tagCap = tagCap;
+    _tagHead = 0;
+    _drainRing = _ring;
+    _drainCount = _tagCount - _spillCount;
+    _drainBytes = _hotBytes;
+    _draining = true;
+    _ringGen++;
+    _ring = ring;
+    _hotBytes = 0;
+    _hwmBytes = 0;
+    xSemaphoreGive(_lock);
+    delete[] oldTags;
+    return true;
+}
+
+// Free the drain ring once it is empty and no pop() still holds one of its
+// items (those are counted under the old hot ring's generation). Caller
+// holds _lock, under which pop() counts its items.
+void AdvertQueue::finishDrain() {
+    if (!_draining || _drainCount || _popOut[(_ringGen - 1) & 1].load() != 0)
+        return;
+    _drainRing.free();  // from an arena, its space is not reclaimed
+    _draining = false;
+}
+
+// All rings
+size_t AdvertQueue::capacity() const {
+    return _ring.get_total_size() + (_spillCreated ? _spillRing.get_total_size() : 0) +
+           (_draining ? _drainRing.get_total_size() : 0);
+}
+
+// Bytes that must stay free for classes with a higher priority than cls.
+// Caller holds _lock.
+size_t AdvertQueue::reserveAbove(AdvertClass cls) const {
+    size_t percent = 0;
+    for (int c = 0; c < cls; c++)
+        percent += _policy.reservePercent[c];
+    if (percent > 100)
+        percent = 100;
+    return capacity() * percent / 100;
+}
+
+// Forget the oldest record, which has just been taken from its ring.
+void AdvertQueue::popTag() {
+    if (_tagCount == 0)
+        return;
+    const Tag &t = _tags[_tagHead];
+    _classBytes[t.cls] -= t.bytes;
+    _usedBytes -= t.bytes;
+    if (_spillCount) {
+        _spillBytes -= t.bytes;
+        _spillCount--;
+    } else if (_drainCount) {
+        _drainBytes -= t.bytes;
+        _drainCount--;
+    } else {
+        _hotBytes -= t.bytes;
+    }
+    _tagHead = (_tagHead + 1) % _tagCap;
+    _tagCount--;
+}
+
+// Drop the oldest record if it is of class cls or lower. Caller holds _lock.
+bool AdvertQueue::evictHead(AdvertClass cls) {
+    if (_tagCount == 0 || _tags[_tagHead].cls < cls)
+        return false;
+
+    espidf::RingBuffer &ring = _spillCount ? _spillRing : _drainCount ? _drainRing : _ring;
+    size_t size = 0;
+    void *item = ring.receive(&size, 0);
+    if (!item)
+        return false;
+    ring.return_item(item);
+    _cls[_tags[_tagHead].cls].evicted++;
+    popTag();
+    return true;
+}
+
+// Move the oldest record not yet in the overflow ring (from the drain ring
+// while it has any) to its tail, which keeps the queue order since
+// everything there is older. Caller holds _lock.
+bool AdvertQueue::moveHead() {
+    if (!_spillCreated || _spillCount == _tagCount)
+        return false;
+    const Tag &t = _tags[(_tagHead + _spillCount) % _tagCap];
+
+    // Claim the overflow space first: a record taken off the hot ring
+    // cannot be put back. The padding rides along; pop() trims to hdr.len.
+    void *dst = nullptr;
+    if (_spillRing.send_acquire(&dst, t.bytes - 8, 0) != pdTRUE) {
+        _spillFull++;
+        return false;
+    }
+    espidf::RingBuffer &ring = _drainCount ? _drainRing : _ring;
+    size_t size = 0;
+    void *src = ring.receive(&size, 0);
+    if (src) {
+        memcpy(dst, src, size);
+        ring.return_item(src);
+    } else {
+        // Cannot happen while the tags count a hot record; keep the
+        // accounting whole with an empty record
+        memset(dst, 0, sizeof(AdvertHeader));
+    }
+    _spillRing.send_complete(dst);
+
+    if (_drainCount) {
+        _drainBytes -= t.bytes;
+        _drainCount--;
+    } else {
+        _hotBytes -= t.bytes;
+    }
+    _spillBytes += t.bytes;
+    _spillCount++;
+    if (_spillBytes > _spillHwmBytes)
+        _spillHwmBytes = _spillBytes;
+    return true;
+}
+
+size_t AdvertQueue::spill() {
+    if (!_spillCreated)
+        return 0;
+    size_t low = _ring.get_total_size() * _spill.lowPercent / 100;
+    size_t moved = 0;
+    while (true) {
+        xSemaphoreTake(_lock, portMAX_DELAY);
+        bool ok = _hotBytes > low && moveHead();
+        if (ok)
+            _spilled++;
+        else
+            _moverPending = false;
+        xSemaphoreGive(_lock);
+        if (!ok)
+            return moved;
+        moved++;
+    }
+}
+
+bool AdvertQueue::push(AdvertClass cls, const AdvertHeader &hdr, const uint8_t *data) {
+    if (!_created)
+        return false;
+
+    size_t total = sizeof(AdvertHeader) + hdr.len;
+    size_t need = itemBytes(total);
+
+    // The BLE stack task must not wait behind the consumer
+    if (xSemaphoreTake(_lock, 0) != pdTRUE) {
+        _lockBusy.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    // Under the lock: resize() changes the capacity it is a share of
+    size_t reserve = reserveAbove(cls);
+    for (int attempt = 0; ; attempt++) {
+        void *item = nullptr;
+        bool admitted = _usedBytes + need + reserve <= capacity() && _tagCount < _tagCap;
+        if (admitted && _hotBytes + need <= _ring.get_total_size() &&
+                _ring.send_acquire(&item, total, 0) == pdTRUE) {
+            memcpy(item, &hdr, sizeof(AdvertHeader));
+            memcpy((uint8_t *)item + sizeof(AdvertHeader), data, hdr.len);
+            if (_ring.send_complete(item) != pdTRUE) {
+                _queueFull++;
+                _cls[cls].dropped++;
+                xSemaphoreGive(_lock);
+                return false;
+            }
+
+            Tag &t = _tags[(_tagHead + _tagCount) % _tagCap];
+            t.cls = cls;
+            t.bytes = (uint16_t)need;
+            if (_tagCount == 0)
+                _firstPendingUs = esp_timer_get_time();
+            _tagCount++;
+            _usedBytes += need;
+            _hotBytes += need;
+            _classBytes[cls] += need;
+            if (_hotBytes > _hwmBytes)
+                _hwmBytes = _hotBytes;
+            if (_classBytes[cls] > _cls[cls].hwmBytes)
+                _cls[cls].hwmBytes = _classBytes[cls];
+            _cls[cls].queued++;
+            _ring.update_high_watermark();
+
+            // Wake the consumer once the batch is full, or on the first record
+            // so it can start timing maxDelayMs.
+            TaskHandle_t waiter = nullptr;
+            if (_waiter && (_tagCount >= _wake.minItems ||
+                            (_tagCount == 1 && _wake.maxDelayMs))) {
+                waiter = _waiter;
+                _wakeups++;
+            }
+            // And the mover once the hot ring passes its threshold
+            TaskHandle_t mover = nullptr;
+            if (_mover && !_moverPending &&
+                    _hotBytes * 100 >= _ring.get_total_size() * _spill.highPercent) {
+                mover = _mover;
+                _moverPending = true;
+            }
+            xSemaphoreGive(_lock);
+            if (waiter)
+                xTaskNotifyGive(waiter);
+            if (mover)
+                xTaskNotifyGive(mover);
+            return true;
+        }
+
+        // Within budget but the hot ring is full: make room in the
+        // overflow ring rather than refuse
+        if (admitted && attempt < MAX_EVICT_PER_PUSH && moveHead()) {
+            _spilledInline++;
+            continue;
+        }
+
+        if (!_policy.dropOldest[cls] || attempt >= MAX_EVICT_PER_PUSH ||
+                !evictHead(cls)) {
+            _cls[cls].dropped++;
+            xSemaphoreGive(_lock);
+            return false;
+        }
+    }
+}
+
+bool AdvertQueue::pop(AdvertHeader &hdr, uint8_t *data, AdvertClass *cls) {
+    if (!_created)
+        return false;
+
+    // Overflow records are older than drain ones, and those than hot ones.
+    // Only the dequeue and the tag are done under the lock; the item stays
+    // ours until returned, so the copy (from PSRAM, with an overflow ring)
+    // runs with push() free to proceed. The ring is held by value: resize()
+    // may swap the members meanwhile, and counts on _popOut not to free it.
+    xSemaphoreTake(_lock, portMAX_DELAY);
+    finishDrain();
+    espidf::RingBuffer ring = _spillCount ? _spillRing : _drainCount ? _drainRing : _ring;
+    std::atomic<uint32_t> *out =
+        _spillCount ? nullptr : &_popOut[(_drainCount ? _ringGen - 1 : _ringGen) & 1];
+    size_t size = 0;
+    void *item = ring.receive(&size, 0);
+    if (!item) {
+        xSemaphoreGive(_lock);
+        return false;
+    }
+    if (out)
+        out->fetch_add(1);
+    if (cls)
+        *cls = _tagCount ? (AdvertClass)_tags[_tagHead].cls : ADV_CLASS_UNKNOWN;
+    popTag();
+    xSemaphoreGive(_lock);
+
+    memcpy(&hdr, item, sizeof(AdvertHeader));
+    size_t dataLen = size - sizeof(AdvertHeader);
+    if (dataLen > hdr.len)
+        dataLen = hdr.len;
+    memcpy(data, (uint8_t *)item + sizeof(AdvertHeader), dataLen);
+    hdr.len = (uint8_t)dataLen;
+    ring.return_item(item);
+    if (out)
+        out->fetch_sub(1);
+    return true;
+}
+
+void AdvertQueue::setWake(const Wake &wake) {
+    if (!_lock)
+        return;
+    xSemaphoreTake(_lock, portMAX_DELAY);
+    _wake = wake;
+    if (_wake.minItems == 0)
+        _wake.minItems = 1;
+    xSemaphoreGive(_lock);
+}
+
+size_t AdvertQueue::available() const {
+    if (!_created)
+        return 0;
+    xSemaphoreTake(_lock, portMAX_DELAY);
+    size_t n = _tagCount;
+    xSemaphoreGive(_lock);
+    return n;
+}
+
+void AdvertQueue::setWaiter(TaskHandle_t task) {
+    xSemaphoreTake(_lock, portMAX_DELAY);
+    _waiter = task;
+    xSemaphoreGive(_lock);
+}
+
+bool AdvertQueue::wait(TickType_t timeout, AdvertQueue *priority) {
+    if (!_created)
+        return false;
+    if (priority && !priority->_created)
+        priority = nullptr;
+
+    TaskHandle_t self = xTaskGetCurrentTaskHandle();
+    TickType_t start = xTaskGetTickCount();
+    if (priority)
+        priority->setWaiter(self);
+    while (true) {
+        // Register before sampling the count so a push in between still
+        // notifies us (the notification stays pending until we take it).
+        xSemaphoreTake(_lock, portMAX_DELAY);
+        _waiter = self;
+        size_t n = _tagCount;
+        int64_t firstUs = _firstPendingUs;
+        Wake wake = _wake;
+        xSemaphoreGive(_lock);
+
+        bool urgent = priority && priority->available() > 0;
+        bool ready = urgent || n >= wake.minItems;
+        TickType_t block = portMAX_DELAY;
+        if (!ready && n > 0 && wake.maxDelayMs) {
+            int64_t leftUs = (int64_t)wake.maxDelayMs * 1000 - (esp_timer_get_time() - firstUs);
+            if (leftUs <= 0)
+                ready = true;
+            else
+                block = pdMS_TO_TICKS((uint32_t)(leftUs / 1000)) + 1;
+        }
+
+        TickType_t elapsed = xTaskGetTickCount() - start;
+        if (!ready && timeout != portMAX_DELAY) {
+            if (elapsed >= timeout)
+                ready = true;   // timed out, report whatever is queued
+            else if (timeout - elapsed < block)
+                block = timeout - elapsed;
+        }
+
+        if (ready) {
+            setWaiter(nullptr);
+            if (priority)
+                priority->setWaiter(nullptr);
+            return urgent || n > 0;
+        }
+        ulTaskNotifyTake(pdTRUE, block);
+    }
+}
+
+AdvertQueue::Stats AdvertQueue::stats() const {
+    Stats s = {};
+    if (!_created)
+        return s;
+    xSemaphoreTake(_lock, portMAX_DELAY);
+    s.totalBytes = _ring.get_total_size();
+    s.hwmBytes   = _hwmBytes;
+    s.usedBytes  = _hotBytes + _drainBytes;
+    s.queueFull  = _queueFull;
+    s.lockBusy   = _lockBusy.load(std::memory_order_relaxed);
+    s.wakeups    = _wakeups;
+    s.spillBytes     = _spillCreated ? _spillRing.get_total_size() : 0;
+    s.spillHwmBytes  = _spillHwmBytes;
+    s.spillUsedBytes = _spillBytes;
+    s.spilled        = _spilled;
+    s.spilledInline  = _spilledInline;
+    s.spillFull      = _spillFull;
+    memcpy(s.cls, _cls, sizeof(_cls));
+    xSemaphoreGive(_lock);
+    return s;
+}
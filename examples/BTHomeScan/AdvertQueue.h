@@ -0,0 +1,221 @@
+/// @file AdvertQueue.h
+/// @brief Class-aware advert queue with reserved capacity and drop-oldest.
+///
+/// Wraps the NOSPLIT ring buffer that carries AdvertHeader + AD byte records
+/// from the BLE callback to the consumer. Every record has an admission
+/// class; lower classes cannot eat into the space reserved for higher ones,
+/// so a burst of random beacons cannot crowd out a button press.
+///
+/// A class with drop-oldest enabled evicts queued records of the same or a
+/// lower class (oldest first) instead of being refused. The ring cannot be
+/// peeked, so a small shadow FIFO of class tags mirrors its order.
+///
+/// A consumer can block in wait() instead of polling: the producer sends it a
+/// task notification as soon as a record is committed, or, with a coalescing
+/// Wake policy, once enough records are queued or the oldest has waited long
+/// enough.
+///
+/// The ring can be backed by a second, larger overflow ring (setSpill(),
+/// typically in PSRAM): records are always written to the small hot ring,
+/// and a mover task moves the oldest of them to the overflow ring once the
+/// hot ring fills past a threshold. If the mover falls behind, push() moves
+/// records itself rather than refuse one. Overflow records are always older
+/// than hot ones, so pop() takes from the overflow ring first and the
+/// consumer sees one queue in arrival order. Admission reserves then apply
+/// to both rings together.
+///
+/// resize() swaps in a new hot ring without copying: the old one keeps its
+/// records as a drain ring, read after the overflow ring and before the new
+/// hot ring, and is freed once the last of them has been popped.
+
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#include "esp_heap_caps.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "ringbuffer.hpp"
+
+#include "AdvertSource.h"
+
+class Arena;
+
+/// Admission classes, highest priority first.
+enum AdvertClass : uint8_t {
+    ADV_CLASS_TRIGGER = 0,  ///< BTHome trigger-based adverts (buttons, doors)
+    ADV_CLASS_KNOWN   = 1,  ///< Devices that have been decoded before
+    ADV_CLASS_UNKNOWN = 2,  ///< Everything else
+    ADV_CLASS_COUNT
+};
+
+class AdvertQueue {
+public:
+    struct Policy {
+        /// Percent of capacity only this class or higher may use. The lowest
+        /// class has nothing below it, so its entry is ignored.
+        uint8_t reservePercent[ADV_CLASS_COUNT] = {10, 30, 0};
+        /// Evict older records of this class or lower instead of refusing.
+        bool dropOldest[ADV_CLASS_COUNT] = {false, false, false};
+    };
+
+    /// When a blocked consumer is woken. The defaults wake on every record.
+    struct Wake {
+        uint16_t minItems = 1;      ///< Wake once this many records are queued
+        uint32_t maxDelayMs = 0;    ///< ...or the oldest has waited this long (0 = no limit)
+    };
+
+    /// Overflow tier, see setSpill().
+    struct Spill {
+        size_t bytes = 0;                       ///< Overflow ring size, 0 = none
+        UBaseType_t caps = MALLOC_CAP_SPIRAM;   ///< Heap caps of the overflow ring
+        uint8_t highPercent = 50;   ///< Wake the mover once the hot ring is this full
+        uint8_t lowPercent = 25;    ///< The mover empties the hot ring down to this
+    };
+
+    struct ClassStats {
+        uint32_t queued;    ///< Records admitted
+        uint32_t dropped;   ///< Records refused (no space within policy)
+        uint32_t evicted;   ///< Queued records evicted by drop-oldest
+        size_t hwmBytes;    ///< Peak ring bytes held by this class
+    };
+
+    struct Stats {
+        size_t totalBytes;  ///< Ring capacity
+        size_t hwmBytes;    ///< Peak ring bytes used
+        size_t usedBytes;   ///< Ring bytes used now, with a draining old ring
+        uint32_t queueFull; ///< send_complete failures
+        uint32_t lockBusy;  ///< Adverts dropped because the queue was locked
+        uint32_t wakeups;   ///< Notifications sent to a waiting consumer
+        size_t spillBytes;      ///< Overflow ring capacity, 0 without one
+        size_t spillHwmBytes;   ///< Peak overflow ring bytes used
+        size_t spillUsedBytes;  ///< Overflow ring bytes used now
+        uint32_t spilled;       ///< Records moved to the overflow ring by spill()
+        uint32_t spilledInline; ///< Records moved by push(), the hot ring being full
+        uint32_t spillFull;     ///< Moves refused, overflow ring full
+        ClassStats cls[ADV_CLASS_COUNT];
+    };
+
+    AdvertQueue() = default;
+    ~AdvertQueue();
+
+    AdvertQueue(const AdvertQueue &) = delete;
+    AdvertQueue &operator=(const AdvertQueue &) = delete;
+
+    /// Allocate the ring (in memory with the given heap caps) and tag FIFO,
+    /// or take them from arena if given (see Arena.h; caps are then
+    /// ignored and bytes rounded down to a multiple of 4).
+    bool begin(size_t bytes, UBaseType_t caps, const Policy &policy,
+               Arena *arena = nullptr);
+
+    /// Replace the hot ring with one of bytes (heap caps, or from arena).
+    /// Nothing is copied or dropped: the queued records stay in the old ring,
+    /// which pop() drains first and then frees. The lock is held only to
+    /// swap the rings and copy the tag FIFO. Returns false if the new ring
+    /// cannot be allocated or the previous resize is still draining (the
+    /// queue is then unchanged). The old ring's arena space is not reclaimed.
+    bool resize(size_t bytes, UBaseType_t caps, Arena *arena = nullptr);
+
+    /// Add an overflow ring (see above), allocated by begin() with
+    /// spill.caps, or from its arena if given. If that fails the queue runs
+    /// without one. Call before begin().
+    void setSpill(const Spill &spill);
+
+    /// Task to notify when the hot ring fills past spill.highPercent; it
+    /// should then call spill(). Without one, records only move when push()
+    /// finds the hot ring full.
+    void setMover(TaskHandle_t task);
+
+    /// Move the oldest hot records to the overflow ring until the hot ring
+    /// is down to spill.lowPercent or the overflow ring is full. Takes the
+    /// lock once per record, so push() is never held up for long. Returns
+    /// the records moved.
+    size_t spill();
+
+    /// Queue one advert. Called from the BLE stack task; never blocks, on
+    /// space or on the lock: if another task holds it, the advert is
+    /// dropped and counted in lockBusy. Returns false if it was dropped.
+    bool push(AdvertClass cls, const AdvertHeader &hdr, const uint8_t *data);
+
+    /// Dequeue the oldest record. data must hold ADVERT_MAX_DATA bytes.
+    /// The copy runs outside the lock. Returns false if the queue is empty.
+    bool pop(AdvertHeader &hdr, uint8_t *data, AdvertClass *cls = nullptr);
+
+    /// Block the calling task until the Wake condition holds or timeout
+    /// expires. Uses the task's notification value, so the caller must not
+    /// rely on it for anything else. Returns true if records are queued.
+    ///
+    /// If priority is given, a record in it also ends the wait at once
+    /// (whatever this queue's Wake policy), e.g. a trigger fast lane.
+    bool wait(TickType_t timeout, AdvertQueue *priority = nullptr);
+
+    void setWake(const Wake &wake);
+
+    /// Records currently queued.
+    size_t available() const;
+
+    Stats stats() const;
+
+private:
+    static size_t itemBytes(size_t payload);
+    void setWaiter(TaskHandle_t task);
+    size_t capacity() const;
+    size_t reserveAbove(AdvertClass cls) const;
+    bool evictHead(AdvertClass cls);
+    bool moveHead();
+    void popTag();
+    void finishDrain();
+
+    espidf::RingBuffer _ring;
+    bool _created = false;
+    espidf::RingBuffer _spillRing;
+    bool _spillCreated = false;
+    Spill _spill;
+    espidf::RingBuffer _drainRing;  ///< The hot ring before the last resize()
+    bool _draining = false;
+    uint32_t _ringGen = 0;      ///< resize() count; _drainRing is generation - 1
+    /// pop() items taken but not yet returned, by ring generation parity.
+    /// Written without the lock.
+    std::atomic<uint32_t> _popOut[2] = {};
+    bool _ownsTags = false;     ///< _tags is from the heap, not an arena
+    Policy _policy;
+    SemaphoreHandle_t _lock = nullptr;
+
+    // Shadow FIFO of (class, bytes) in queue order, guarded by _lock. The
+    // first _spillCount records are in the overflow ring, the next
+    // _drainCount in the drain ring, the rest in the hot ring.
+    struct Tag {
+        uint8_t cls;
+        uint16_t bytes;
+    };
+    Tag *_tags = nullptr;
+    size_t _tagCap = 0;
+    size_t _tagHead = 0;
+    size_t _tagCount = 0;
+    size_t _spillCount = 0;
+    size_t _drainCount = 0;
+
+    size_t _usedBytes = 0;      ///< Both rings
+    size_t _hotBytes = 0;
+    size_t _hwmBytes = 0;       ///< Hot ring
+    size_t _drainBytes = 0;
+    size_t _spillBytes = 0;
+    size_t _spillHwmBytes = 0;
+    size_t _classBytes[ADV_CLASS_COUNT] = {};
+    uint32_t _queueFull = 0;
+    std::atomic<uint32_t> _lockBusy{0};  ///< Written without the lock
+    ClassStats _cls[ADV_CLASS_COUNT] = {};
+    uint32_t _spilled = 0;
+    uint32_t _spilledInline = 0;
+    uint32_t _spillFull = 0;
+    TaskHandle_t _mover = nullptr;
+    bool _moverPending = false;     ///< Notified, spill() not yet run
+
+    // Consumer wake-up, guarded by _lock
+    Wake _wake;
+    TaskHandle_t _waiter = nullptr;
+    int64_t _firstPendingUs = 0;    ///< When the queue last went non-empty
+    uint32_t _wakeups = 0;
+};
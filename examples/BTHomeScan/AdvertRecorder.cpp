@@ -0,0 +1,306 @@
+#include "AdvertRecorder.h"
+
+#include <Arduino.h>
+#include <cstring>
+
+AdvertRecorder::~AdvertRecorder() {
+    if (_ring)
+        heap_caps_free(_ring);
+}
+
+bool AdvertRecorder::allocRing(size_t bytes, UBaseType_t caps) {
+    if (_ring)
+        return false;
+    bytes &= ~(size_t)7;
+    if (bytes < captureRecordBytes(ADVERT_MAX_DATA))
+        return false;
+    // Records hold an int64; keep them 8-byte aligned
+    _ring = (uint8_t *)heap_caps_aligned_alloc(8, bytes, caps);
+    if (!_ring) {
+        log_e("AdvertRecorder: cannot allocate %u bytes", (unsigned)bytes);
+        return false;
+    }
+    _cap = bytes;
+    return true;
+}
+
+bool AdvertRecorder::begin(size_t bytes, UBaseType_t caps) {
+    return allocRing(bytes, caps);
+}
+
+bool AdvertRecorder::beginPartition(const char *label, size_t stagingBytes) {
+    const esp_partition_t *part =
+        esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, label);
+    if (!part) {
+        log_e("AdvertRecorder: no data partition '%s'", label);
+        return false;
+    }
+    if (!allocRing(stagingBytes, MALLOC_CAP_DEFAULT))
+        return false;
+    _part = part;
+    scanPartition();
+    log_i("AdvertRecorder: partition '%s' holds %u records (%u of %u bytes)", label,
+          (unsigned)_flashRecords, (unsigned)_flashEnd, (unsigned)_part->size);
+    return true;
+}
+
+// Find the end of the records already in the partition: the first header
+// that is still erased. Record headers are written last, so a record cut off
+// by a reset is not counted.
+bool AdvertRecorder::scanPartition() {
+    size_t pos = 0;
+    CaptureRecord r;
+    while (pos + sizeof(r) <= _part->size) {
+        if (esp_partition_read(_part, pos, &r, sizeof(r)) != ESP_OK)
+            return false;
+        if (r.seq == CAPTURE_SEQ_WRAP)
+            break;
+        size_t size = captureRecordBytes(r.len);
+        if (pos + size > _part->size)
+            break;
+        pos += size;
+        _flashRecords++;
+        _seq = r.seq + 1;
+    }
+    _flashEnd = pos;
+    // The rest of the sector holding the end is erased
+    _erasedTo = (pos + _part->erase_size - 1) / _part->erase_size * _part->erase_size;
+    _flashFull = pos + sizeof(r) > _part->size;
+    return true;
+}
+
+// ---------------------------------------------------------------------------
+// Ring (caller holds _mux)
+// ---------------------------------------------------------------------------
+
+// Drop the oldest record, skipping a wrap marker in front of it.
+void AdvertRecorder::evictOldest() {
+    const CaptureRecord *r = (const CaptureRecord *)(_ring + _head);
+    if (r->seq == CAPTURE_SEQ_WRAP) {
+        _used -= _cap - _head;
+        _head = 0;
+        r = (const CaptureRecord *)_ring;
+    }
+    size_t size = captureRecordBytes(r->len);
+    _head += size;
+    if (_head == _cap)
+        _head = 0;
+    _used -= size;
+    _recordBytes -= size;
+    _count--;
+}
+
+// Space for a need-byte record at the tail, evicting the oldest records if
+// overwrite is set. Records never straddle the end of the ring: if the tail
+// end is too short, a wrap marker fills it and the record goes to offset 0.
+uint8_t *AdvertRecorder::reserve(size_t need, bool overwrite) {
+    if (need > _cap)
+        return nullptr;
+    while (true) {
+        if (_count == 0)
+            _head = _tail = _used = 0;
+        if (_used < _cap) {
+            size_t at = SIZE_MAX;
+            if (_tail >= _head) {
+                if (_cap - _tail >= need) {
+                    at = _tail;
+                } else if (_head >= need) {
+                    ((CaptureRecord *)(_ring + _tail))->seq = CAPTURE_SEQ_WRAP;
+                    _used += _cap - _tail;
+                    at = 0;
+                }
+            } else if (_head - _tail >= need) {
+                at = _tail;
+            }
+            if (at != SIZE_MAX) {
+                _tail = at + need;
+                if (_tail == _cap)
+                    _tail = 0;
+                _used += need;
+                _recordBytes += need;
+                _count++;
+                return _ring + at;
+            }
+        }
+        if (!overwrite || _count == 0)
+            return nullptr;
+        evictOldest();
+        _overwritten++;
+    }
+}
+
+bool AdvertRecorder::popOldest(uint8_t *out, size_t outLen) {
+    if (_count == 0)
+        return false;
+    const CaptureRecord *r = (const CaptureRecord *)(_ring + _head);
+    if (r->seq == CAPTURE_SEQ_WRAP)
+        r = (const CaptureRecord *)_ring;
+    size_t size = captureRecordBytes(r->len);
+    if (size > outLen)
+        return false;
+    memcpy(out, r, size);
+    evictOldest();
+    return true;
+}
+
+// ---------------------------------------------------------------------------
+// Recording
+// ---------------------------------------------------------------------------
+bool AdvertRecorder::record(const AdvertHeader &hdr, const uint8_t *data) {
+    if (!_ring)
+        return false;
+
+    CaptureRecord r;
+    r.len = hdr.len;
+    r.addrType = hdr.addrType;
+    r.rssi = hdr.rssi;
+    r.flags = hdr.flags;
+    r.timeUs = hdr.timeUs;
+    memcpy(r.mac, hdr.mac, 6);
+    r.reserved = 0;
+    size_t need = captureRecordBytes(hdr.len);
+
+    portENTER_CRITICAL(&_mux);
+    r.seq = _seq++;
+    if (_seq == CAPTURE_SEQ_WRAP)
+        _seq = 0;
+    // The flash staging ring must not lose what is not on flash yet
+    uint8_t *p = (_paused || _flashFull) ? nullptr : reserve(need, _part == nullptr);
+    if (!p) {
+        _dropped++;
+        portEXIT_CRITICAL(&_mux);
+        return false;
+    }
+    memcpy(p, &r, sizeof(r));
+    memcpy(p + sizeof(r), data, hdr.len);
+    _recorded++;
+    portEXIT_CRITICAL(&_mux);
+    return true;
+}
+
+size_t AdvertRecorder::flush() {
+    if (!_part)
+        return 0;
+
+    alignas(8) uint8_t rec[captureRecordBytes(ADVERT_MAX_DATA)];
+    size_t written = 0;
+    while (!_flashFull) {
+        portENTER_CRITICAL(&_mux);
+        bool got = popOldest(rec, sizeof(rec));
+        portEXIT_CRITICAL(&_mux);
+        if (!got)
+            break;
+
+        size_t size = captureRecordBytes(((const CaptureRecord *)rec)->len);
+        if (_flashEnd + size > _part->size) {
+            portENTER_CRITICAL(&_mux);
+            _flashFull = true;
+            _dropped++;
+            portEXIT_CRITICAL(&_mux);
+            log_i("AdvertRecorder: partition full after %u records", (unsigned)_flashRecords);
+            break;
+        }
+        while (_erasedTo < _flashEnd + size) {
+            esp_partition_erase_range(_part, _erasedTo, _part->erase_size);
+            _erasedTo += _part->erase_size;
+        }
+        // Body first, header last: an interrupted write leaves an erased
+        // header, which scanPartition() treats as the end.
+        esp_partition_write(_part, _flashEnd + sizeof(CaptureRecord),
+                            rec + sizeof(CaptureRecord), size - sizeof(CaptureRecord));
+        esp_partition_write(_part, _flashEnd, rec, sizeof(CaptureRecord));
+        _flashEnd += size;
+        _flashRecords++;
+        written++;
+    }
+    return written;
+}
+
+// ---------------------------------------------------------------------------
+// Export
+// ---------------------------------------------------------------------------
+bool AdvertRecorder::writeRing(Print &out) {
+    // Paused: record() leaves the ring alone, so it can be read unlocked
+    CaptureFileHeader fh;
+    captureFileHeader(fh, _count, _recordBytes, _dropped);
+    bool ok = out.write((const uint8_t *)&fh, sizeof(fh)) == sizeof(fh);
+
+    size_t pos = _head;
+    for (uint32_t i = 0; i < _count && ok; i++) {
+        const CaptureRecord *r = (const CaptureRecord *)(_ring + pos);
+        if (r->seq == CAPTURE_SEQ_WRAP) {
+            pos = 0;
+            r = (const CaptureRecord *)_ring;
+        }
+        size_t size = captureRecordBytes(r->len);
+        ok = out.write(_ring + pos, size) == size;
+        pos += size;
+        if (pos == _cap)
+            pos = 0;
+    }
+    return ok;
+}
+
+bool AdvertRecorder::writePartition(Print &out) {
+    CaptureFileHeader fh;
+    captureFileHeader(fh, _flashRecords, _flashEnd, _dropped);
+    bool ok = out.write((const uint8_t *)&fh, sizeof(fh)) == sizeof(fh);
+
+    uint8_t chunk[512];
+    for (size_t pos = 0; pos < _flashEnd && ok; pos += sizeof(chunk)) {
+        size_t n = _flashEnd - pos < sizeof(chunk) ? _flashEnd - pos : sizeof(chunk);
+        ok = esp_partition_read(_part, pos, chunk, n) == ESP_OK &&
+             out.write(chunk, n) == n;
+    }
+    return ok;
+}
+
+bool AdvertRecorder::exportTo(Print &out) {
+    if (!_ring)
+        return false;
+    if (_part) {
+        // Staging keeps recording; flush() and exportTo() share a task
+        flush();
+        return writePartition(out);
+    }
+
+    portENTER_CRITICAL(&_mux);
+    _paused = true;
+    portEXIT_CRITICAL(&_mux);
+    bool ok = writeRing(out);
+    portENTER_CRITICAL(&_mux);
+    _paused = false;
+    portEXIT_CRITICAL(&_mux);
+    return ok;
+}
+
+void AdvertRecorder::clear() {
+    if (!_ring)
+        return;
+    if (_part) {
+        esp_partition_erase_range(_part, 0, _part->size);
+        _flashEnd = 0;
+        _erasedTo = _part->size;
+        _flashRecords = 0;
+    }
+    portENTER_CRITICAL(&_mux);
+    _head = _tail = _used = 0;
+    _count = 0;
+    _recordBytes = 0;
+    _seq = 0;
+    _flashFull = false;
+    portEXIT_CRITICAL(&_mux);
+}
+
+AdvertRecorder::Stats AdvertRecorder::stats() const {
+    Stats s = {};
+    portENTER_CRITICAL(&_mux);
+    s.recorded = _recorded;
+    s.overwritten = _overwritten;
+    s.dropped = _dropped;
+    s.records = _part ? _flashRecords : _count;
+    s.bytes = _part ? _flashEnd : _recordBytes;
+    s.capacity = _part ? _part->size : _cap;
+    portEXIT_CRITICAL(&_mux);
+    return s;
+}
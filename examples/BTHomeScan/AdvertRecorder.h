@@ -0,0 +1,109 @@
+/// @file AdvertRecorder.h
+/// @brief Keeps raw adverts for later export, to reproduce field issues.
+///
+/// Attach a recorder with BLEScanner::setRecorder() and every advert the
+/// radio delivers is appended as a CaptureRecord (see CaptureFormat.h)
+/// before queue admission, so adverts the queue dropped are kept too.
+/// exportTo() writes the capture as a file (e.g. to Serial); read it on the
+/// host with CaptureFile or extras/host/capture.
+///
+/// Two stores:
+///   - RAM ring (begin()): preallocated, e.g. in PSRAM; the oldest records
+///     are overwritten when full.
+///   - Flash partition (beginPartition()): records go to a small RAM
+///     staging ring from the scan callback and flush() moves them to flash,
+///     so the callback never waits for flash. Recording stops when the
+///     partition is full, and a capture survives a reboot: beginPartition()
+///     appends to it and exportTo() works straight away.
+///
+/// record() only takes a spinlock and copies the record, and can be called
+/// from the BLE stack task.
+
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+#include "esp_heap_caps.h"
+#include "esp_partition.h"
+#include "freertos/FreeRTOS.h"
+
+#include "CaptureFormat.h"
+
+class Print;
+
+class AdvertRecorder {
+public:
+    struct Stats {
+        uint32_t recorded;      ///< Adverts appended
+        uint32_t overwritten;   ///< Oldest records lost to the RAM ring wrapping
+        uint32_t dropped;       ///< Adverts not kept (too big, paused, staging or flash full)
+        uint32_t records;       ///< Records currently held
+        uint64_t bytes;         ///< Record bytes currently held
+        uint64_t capacity;      ///< Ring or partition size
+    };
+
+    AdvertRecorder() = default;
+    ~AdvertRecorder();
+
+    AdvertRecorder(const AdvertRecorder &) = delete;
+    AdvertRecorder &operator=(const AdvertRecorder &) = delete;
+
+    /// Record into a RAM ring of bytes, allocated with the given heap caps.
+    bool begin(size_t bytes, UBaseType_t caps = MALLOC_CAP_SPIRAM);
+
+    /// Record into the data partition with this label (add one to the
+    /// partition table), through a RAM staging ring of stagingBytes.
+    /// Records already in the partition are kept and appended to.
+    bool beginPartition(const char *label, size_t stagingBytes = 8192);
+
+    /// Append one advert. Returns false if it was dropped.
+    bool record(const AdvertHeader &hdr, const uint8_t *data);
+
+    /// Flash mode: write staged records to the partition, erasing sectors as
+    /// needed. Call regularly from a task that may block (e.g. loop()).
+    /// Returns the number of records written; no-op in RAM mode.
+    size_t flush();
+
+    /// Write the whole capture (header and records, oldest first) to out.
+    /// Recording pauses meanwhile; adverts arriving then count as dropped.
+    /// Flash mode flushes first.
+    bool exportTo(Print &out);
+
+    /// Discard every record (flash mode: erase the partition).
+    void clear();
+
+    Stats stats() const;
+
+private:
+    bool allocRing(size_t bytes, UBaseType_t caps);
+    uint8_t *reserve(size_t need, bool overwrite);
+    bool popOldest(uint8_t *out, size_t outLen);
+    void evictOldest();
+    bool scanPartition();
+    bool writeRing(Print &out);
+    bool writePartition(Print &out);
+
+    mutable portMUX_TYPE _mux = portMUX_INITIALIZER_UNLOCKED;
+
+    // Ring of records, guarded by _mux
+    uint8_t *_ring = nullptr;
+    size_t _cap = 0;
+    size_t _head = 0;           ///< Oldest record (or wrap marker)
+    size_t _tail = 0;           ///< Next write
+    size_t _used = 0;           ///< Bytes from head to tail, wrap padding included
+    uint32_t _count = 0;
+    uint64_t _recordBytes = 0;  ///< Bytes of records in the ring
+    bool _paused = false;
+
+    uint32_t _seq = 0;
+    uint32_t _recorded = 0;
+    uint32_t _overwritten = 0;
+    uint32_t _dropped = 0;
+
+    // Flash mode
+    const esp_partition_t *_part = nullptr;
+    size_t _flashEnd = 0;       ///< End of the records in the partition
+    size_t _erasedTo = 0;       ///< Partition erased from _flashEnd up to here
+    uint32_t _flashRecords = 0;
+    bool _flashFull = false;
+};
@@ -0,0 +1,97 @@
+/// @file AdvertSource.h
+/// @brief Radio backend interface delivering raw BLE advertisement bytes.
+///
+/// BLEScanner does not talk to a BLE stack directly. An AdvertSource owns the
+/// radio (or a replay of one), and hands every received advert to an
+/// AdvertSink as an address, RSSI, capture time and the raw AD structures, so
+/// no per-field String copies are made on the hot path.
+///
+/// Backends:
+///   - BluedroidSource  — Arduino-ESP32 Bluedroid, raw GAP scan results (default)
+///   - NimBLESource     — NimBLE-Arduino, raw ble_gap_disc() events
+///                        (build with -DBTHOME_USE_NIMBLE)
+///   - HostReplaySource — Linux/macOS: replays a capture file or a generator
+///
+/// The ESP32 backends are compiled in by build flag and returned from
+/// defaultAdvertSource(). Any other source can be passed to
+/// BLEScanner::setAdvertSource() before begin().
+
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+/// Fixed part of a received advertisement. Also the on-queue record header:
+/// records are an AdvertHeader followed by len bytes of AD structures.
+struct AdvertHeader {
+    int64_t timeUs;     ///< Capture time in microseconds (esp_timer / host clock)
+    uint8_t mac[6];     ///< Device address, most significant byte first
+    uint8_t addrType;   ///< BLE address type (0 public, 1 random, ...)
+    int8_t  rssi;       ///< Received signal strength in dBm
+    uint8_t flags;      ///< ADV_FLAG_* bits
+    uint8_t len;        ///< Number of AD bytes following the header
+};
+
+/// AdvertHeader::flags
+enum : uint8_t {
+    ADV_FLAG_SCAN_RSP = 0x01,   ///< Data is a scan response
+    ADV_FLAG_SCANNABLE = 0x02,  ///< Scannable advert: with active scanning a response follows
+    ADV_FLAG_MERGED = 0x04,     ///< Advert followed by its scan response (ScanResponseMerger.h)
+};
+
+/// Longest AD payload kept per advert (legacy adv + scan response is 62).
+static constexpr size_t ADVERT_MAX_DATA = 255;
+
+/// An advert as seen in AdvertSink::onAdvert(). data is only valid for the
+/// duration of the call.
+struct RawAdvert {
+    AdvertHeader hdr;
+    const uint8_t *data;
+};
+
+/// Receives adverts from a source. Called from the radio stack's task (or the
+/// replay thread on the host); must not block.
+class AdvertSink {
+public:
+    virtual ~AdvertSink() {}
+    virtual void onAdvert(const RawAdvert &adv) = 0;
+};
+
+/// Scan settings, in the same units as BLEScanner::begin().
+struct ScanParams {
+    uint16_t intervalMs = 100;
+    uint16_t windowMs = 99;
+    bool active = false;
+};
+
+class AdvertSource {
+public:
+    /// Called when a scan ends on its own (duration elapsed or stack stopped
+    /// it), not when stop() is called.
+    typedef void (*EndCallback)(void *arg);
+
+    virtual ~AdvertSource() {}
+
+    /// Bring up the stack and apply params. Called once from the scan task.
+    virtual bool init(const ScanParams &params, AdvertSink *sink) = 0;
+
+    /// Apply new params to the next start(). Called from the scan task while
+    /// not scanning. Returns false if the source cannot change them after
+    /// init().
+    virtual bool setParams(const ScanParams &params) {
+        (void)params;
+        return false;
+    }
+
+    /// Start scanning without blocking. durationMs = 0 scans until stop().
+    virtual bool start(uint32_t durationMs, EndCallback onEnd, void *arg) = 0;
+
+    /// Stop a running scan. No-op if not scanning.
+    virtual void stop() = 0;
+
+    /// Short backend name for logs and stats.
+    virtual const char *name() const = 0;
+};
+
+/// Source compiled in for this target (Bluedroid or NimBLE on ESP32, nullptr
+/// on the host where a HostReplaySource must be supplied instead).
+AdvertSource *defaultAdvertSource();
@@ -0,0 +1,55 @@
+#include "Arena.h"
+
+#include <Arduino.h>
+#include <cstdlib>
+
+#ifdef ESP_PLATFORM
+#include "esp_heap_caps.h"
+#endif
+
+Arena::~Arena() {
+    if (!_owned)
+        return;
+#ifdef ESP_PLATFORM
+    heap_caps_free(_base);
+#else
+    free(_base);
+#endif
+}
+
+void Arena::begin(void *buffer, size_t bytes) {
+    _base = (uint8_t *)buffer;
+    _size = buffer ? bytes : 0;
+    _used = 0;
+}
+
+bool Arena::begin(size_t bytes, uint32_t caps) {
+    if (_base)
+        return false;
+#ifdef ESP_PLATFORM
+    void *p = heap_caps_malloc(bytes, caps);
+#else
+    (void)caps;
+    void *p = malloc(bytes);
+#endif
+    if (!p) {
+        log_e("Arena: cannot allocate %u bytes", (unsigned)bytes);
+        return false;
+    }
+    begin(p, bytes);
+    _owned = true;
+    return true;
+}
+
+void *Arena::allocate(size_t bytes, size_t align) {
+    uintptr_t start = ((uintptr_t)_base + _used + align - 1) & ~(uintptr_t)(align - 1);
+    size_t offset = start - (uintptr_t)_base;
+    if (!_base || offset > _size || bytes > _size - offset) {
+        _failed++;
+        log_e("Arena: out of memory (%u bytes wanted, %u of %u used)", (unsigned)bytes,
+              (unsigned)_used, (unsigned)_size);
+        return nullptr;
+    }
+    _used = offset + bytes;
+    return _base + offset;
+}
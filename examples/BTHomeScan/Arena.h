@@ -0,0 +1,74 @@
+/// @file Arena.h
+/// @brief Bump allocator over one block of memory, for a heap-free scanner.
+///
+/// Hands out aligned pieces of a single block, either a buffer the caller
+/// owns (a static array, so the memory map is fixed at link time) or one
+/// allocation made by begin(bytes, caps) at startup (e.g. in PSRAM).
+/// Nothing is freed piece by piece: everything lives as long as the arena,
+/// which suits objects created once at startup and kept forever.
+///
+/// BLEScanner::setArena() takes its Impl, queues, rings, device tables,
+/// mutexes and task stacks from an arena, so a running gateway never
+/// touches the general heap (see JsonPool.h for the JSON documents).
+///
+/// @code
+///   static uint8_t scannerMemory[48 * 1024];
+///   static Arena arena(scannerMemory, sizeof(scannerMemory));
+///   BLEScanner::instance().setArena(&arena);   // before any other call
+/// @endcode
+
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <utility>
+
+class Arena {
+public:
+    Arena() = default;
+    Arena(void *buffer, size_t bytes) { begin(buffer, bytes); }
+    ~Arena();
+
+    Arena(const Arena &) = delete;
+    Arena &operator=(const Arena &) = delete;
+
+    /// Use buffer (not freed by the arena).
+    void begin(void *buffer, size_t bytes);
+
+    /// Allocate the block once, with the given heap caps (ignored on the
+    /// host). Returns false if out of memory or already started.
+    bool begin(size_t bytes, uint32_t caps);
+
+    /// bytes aligned to align (a power of two), nullptr if the arena is
+    /// exhausted.
+    void *allocate(size_t bytes, size_t align = alignof(std::max_align_t));
+
+    /// Construct a T in the arena, nullptr if it does not fit. Its
+    /// destructor is never run by the arena.
+    template <typename T, typename... Args>
+    T *create(Args &&...args) {
+        void *p = allocate(sizeof(T), alignof(T));
+        return p ? new (p) T(std::forward<Args>(args)...) : nullptr;
+    }
+
+    /// n value-initialized Ts, nullptr if they do not fit.
+    template <typename T>
+    T *createArray(size_t n) {
+        T *p = (T *)allocate(n * sizeof(T), alignof(T));
+        if (p)
+            for (size_t i = 0; i < n; i++)
+                new (p + i) T();
+        return p;
+    }
+
+    size_t used() const { return _used; }
+    size_t capacity() const { return _size; }
+    uint32_t failed() const { return _failed; }     ///< Requests that did not fit
+
+private:
+    uint8_t *_base = nullptr;
+    size_t _size = 0;
+    size_t _used = 0;
+    uint32_t _failed = 0;
+    bool _owned = false;
+};
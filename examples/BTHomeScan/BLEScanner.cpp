@@ -1,79 +1,165 @@
 #include "BLEScanner.h"
 
 #include <Arduino.h>
-#include <vector>
-#include <string>
+#include <algorithm>
+#include <atomic>
+#include <cstring>
 
-#include "freertos/ringbuf.h"
-#include "ringbuffer.hpp"
 #include "esp_timer.h"
 
-#include <BLEDevice.h>
-#include <BLEScan.h>
-#include <BLEAdvertisedDevice.h>
-
 #include "BTHomeDecoder.h"
+#include "BTHomeTrace.h"
+#include "AdaptiveScan.h"
+#include "AdParser.h"
+#include "Arena.h"
+#include "AdvertFrame.h"
+#include "AdvertRecorder.h"
+#include "AdvertSource.h"
+#include "DecodedFrame.h"
+#include "DeviceDecoders.h"
+#include "HexUtil.h"
+#include "HistoryStore.h"
+#include "MacSet.h"
+#include "ScanResponseMerger.h"
+#include "StateStore.h"
+#include "WindowAggregator.h"
 
-// ---------------------------------------------------------------------------
-// Timing helper (replaces fmicro.h dependency)
-// ---------------------------------------------------------------------------
-static inline float fseconds() {
-    return ((float)esp_timer_get_time()) * 1.0e-6f;
-}
+// CPU shares in Stats::tasks need FreeRTOS run-time stats
+// (CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS)
+#if defined(configGENERATE_RUN_TIME_STATS) && configGENERATE_RUN_TIME_STATS
+#define BTHOME_RUN_TIME_STATS 1
+#else
+#define BTHOME_RUN_TIME_STATS 0
+#endif
 
 // ---------------------------------------------------------------------------
-// Hex conversion helpers
+// Helpers
 // ---------------------------------------------------------------------------
-static bool hexStringToVector(const String &hexStr, std::vector<uint8_t> &buffer) {
-    size_t len = hexStr.length();
-    if (len & 1)
-        return false;
+static void macToString(const uint8_t mac[6], char *out, bool colons) {
+    static const char HEX_CHARS[] = "0123456789ABCDEF";
+    for (int i = 0; i < 6; i++) {
+        *out++ = HEX_CHARS[mac[i] >> 4];
+        *out++ = HEX_CHARS[mac[i] & 0x0F];
+        if (colons && i < 5)
+            *out++ = ':';
+    }
+    *out = '\0';
+}
 
-    buffer.clear();
-    if (len == 0)
-        return true;
+static TickType_t msToTicks(uint32_t ms) {
+    return ms == BLEScanner::WAIT_FOREVER ? portMAX_DELAY : pdMS_TO_TICKS(ms);
+}
 
-    buffer.resize(len / 2);
-    uint8_t *out = buffer.data();
-    const char *in = hexStr.c_str();
-
-    for (size_t i = 0; i < len; i += 2) {
-        uint8_t val = 0;
-        for (int j = 0; j < 2; j++) {
-            uint8_t nibble;
-            char c = in[i + j];
-            if (c >= '0' && c <= '9')
-                nibble = c - '0';
-            else if (c >= 'A' && c <= 'F')
-                nibble = c - 'A' + 10;
-            else if (c >= 'a' && c <= 'f')
-                nibble = c - 'a' + 10;
-            else {
-                buffer.clear();
-                return false;
-            }
-            val = (val << 4) | nibble;
-        }
-        *out++ = val;
+// Statistics counter bumped on one task (BLE stack, scan, consumer) and read
+// by stats() on any other. Relaxed atomics: lock-free for 32 bits on the
+// ESP32; 64-bit totals take a short critical section in libatomic.
+template <typename T>
+class Counter {
+public:
+    void operator++(int) { _v.fetch_add(1, std::memory_order_relaxed); }
+    void operator+=(T v) { _v.fetch_add(v, std::memory_order_relaxed); }
+    void set(T v) { _v.store(v, std::memory_order_relaxed); }
+    /// Keep the largest value seen. Single writer.
+    void raise(T v) {
+        if (v > _v.load(std::memory_order_relaxed))
+            _v.store(v, std::memory_order_relaxed);
     }
-    return true;
+    operator T() const { return _v.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<T> _v{0};
+};
+
+// Adds the wall time until the end of the scope to a task's busy time
+// (Stats::tasks). Not CPU time: blocking on a mutex and preemption inside
+// the scope count too.
+class BusyScope {
+public:
+    explicit BusyScope(Counter<uint64_t> &busyUs)
+        : _busyUs(busyUs), _startUs(esp_timer_get_time()) {}
+    ~BusyScope() { _busyUs += (uint64_t)(esp_timer_get_time() - _startUs); }
+
+    BusyScope(const BusyScope &) = delete;
+    BusyScope &operator=(const BusyScope &) = delete;
+
+private:
+    Counter<uint64_t> &_busyUs;
+    int64_t _startUs;
+};
+
+// Scanner objects come from the arena when there is one (setArena()),
+// otherwise from the heap.
+template <typename T, typename... Args>
+static T *make(Arena *arena, Args &&...args) {
+    if (arena)
+        return arena->create<T>(std::forward<Args>(args)...);
+    return new T(std::forward<Args>(args)...);
 }
 
-static void bytesToHexString(const uint8_t *data, size_t len, String &hexStr) {
-    static const char HEX_CHARS[] = "0123456789ABCDEF";
-    hexStr = "";
-    if (len == 0)
-        return;
-    hexStr.reserve(len * 2);
-    for (size_t i = 0; i < len; i++) {
-        hexStr += HEX_CHARS[data[i] >> 4];
-        hexStr += HEX_CHARS[data[i] & 0x0F];
+template <typename T>
+static void destroy(Arena *arena, T *p) {
+    if (!arena)
+        delete p;
+    else if (p)
+        p->~T();    // its arena space is not reclaimed
+}
+
+static SemaphoreHandle_t createMutex(Arena *arena) {
+    if (!arena)
+        return xSemaphoreCreateMutex();
+    auto *buf = arena->create<StaticSemaphore_t>();
+    return buf ? xSemaphoreCreateMutexStatic(buf) : nullptr;
+}
+
+static SemaphoreHandle_t createBinary(Arena *arena) {
+    if (!arena)
+        return xSemaphoreCreateBinary();
+    auto *buf = arena->create<StaticSemaphore_t>();
+    return buf ? xSemaphoreCreateBinaryStatic(buf) : nullptr;
+}
+
+static bool createTask(Arena *arena, TaskFunction_t fn, const char *name,
+                       uint32_t stackBytes, void *arg, UBaseType_t priority,
+                       TaskHandle_t *handle) {
+    if (!arena)
+        return xTaskCreate(fn, name, stackBytes, arg, priority, handle) == pdPASS;
+    auto *stack = (StackType_t *)arena->allocate(stackBytes, 16);
+    auto *tcb = arena->create<StaticTask_t>();
+    if (!stack || !tcb)
+        return false;
+    *handle = xTaskCreateStatic(fn, name, stackBytes, arg, priority, stack, tcb);
+    return *handle != nullptr;
+}
+
+static bool createRing(Arena *arena, espidf::RingBuffer &ring, size_t bytes, UBaseType_t caps) {
+    if (arena) {
+        bytes &= ~(size_t)3;
+        auto *storage = (uint8_t *)arena->allocate(bytes, 4);
+        auto *buf = arena->create<StaticRingbuffer_t>();
+        if (!storage || !buf)
+            return false;
+        ring.create(bytes, RINGBUF_TYPE_NOSPLIT, storage, buf);
+    } else {
+        ring.create(bytes, RINGBUF_TYPE_NOSPLIT, caps);
     }
+    return (RingbufHandle_t)ring != nullptr;
 }
 
-// // Non-static — also used by BTHomeDecoder.cpp
-bool stringToHexString(const String &str, String &hexStr) {
-    bytesToHexString((const uint8_t *)str.c_str(), str.length(), hexStr);
+// A BTHome key as 32 hex characters.
+static bool parseKey(const char *hexKey, uint8_t key[16]) {
+    if (strlen(hexKey) != 32) {
+        log_e("BTHome key must be 32 hex characters");
+        return false;
+    }
+    for (int i = 0; i < 16; i++) {
+        int hi = hexNibble(hexKey[2 * i]);
+        int lo = hexNibble(hexKey[2 * i + 1]);
+        if (hi < 0 || lo < 0) {
+            log_e("BTHome key is not valid hex");
+            return false;
+        }
+        key[i] = (uint8_t)((hi << 4) | lo);
+    }
     return true;
 }
 
@@ -81,134 +167,554 @@ bool stringToHexString(const String &str, String &hexStr) {
 // BLEScanner::Impl — hidden state
 // ---------------------------------------------------------------------------
 struct BLEScanner::Impl {
-    espidf::RingBuffer *queue = nullptr;
-    BLEScan *pBLEScan = nullptr;
+    Arena *arena = nullptr;     ///< Source of everything below when set
+    AdvertQueue *queue = nullptr;
+    AdvertQueue::Policy queuePolicy;
+    AdvertQueue::Spill spill;           ///< Overflow ring of queue, off by default
+    TaskHandle_t spillTaskHandle = nullptr;
+    AdvertQueue *fastQueue = nullptr;   ///< Trigger-based BTHome adverts only
+    size_t fastLaneBytes = 512;
+    AdvertQueue::Wake wake;
+    // Devices decoded recently, in two generations: inserts go to the
+    // current one, and when it fills up the older one is cleared and takes
+    // over, so devices not seen for a whole generation age out.
+    MacSet<128> known[2];
+    uint8_t knownCur = 0;
+    Counter<uint32_t> knownRotations;
+    AdvertSource *source = nullptr;
+    AdvertRecorder *volatile recorder = nullptr;
+    ScanResponseMerger *merger = nullptr;   ///< Active scanning only
+    uint32_t mergeWindowMs = 0;
+    HistoryStore *history = nullptr;
+    DecoderRegistry decoders;
     BTHomeDecoder bthDecoder;
-    const char *bthKey = "";
 
     uint32_t scanTimeMs = 15000;
-    uint16_t scanInterval = 100;
+    uint16_t scanInterval = 100;    ///< These two guarded by paramsLock once started
     uint16_t scanWindow = 99;
-    bool activeScan = false;
+    std::atomic<bool> activeScan{false};    ///< Also read by onAdvert() without the lock
+    SemaphoreHandle_t paramsLock = nullptr;
+    std::atomic<bool> paramsChanged{false};     ///< reconfigure() set new ones
+    SemaphoreHandle_t paramsTaken = nullptr;    ///< Given when the scan task takes them
+
+    Counter<uint32_t> acquireFail;
+    Counter<uint32_t> received;
+    Counter<uint32_t> decoded;
+
+    // Capture-to-dequeue latency per admission class
+    Counter<uint32_t> latencyCount[ADV_CLASS_COUNT];
+    Counter<uint64_t> latencyTotalUs[ADV_CLASS_COUNT];
+    Counter<uint32_t> latencyMaxUs[ADV_CLASS_COUNT];
+
+    TaskHandle_t scanTaskHandle = nullptr;
+    int64_t scanStoppedUs = 0;  ///< When the last scan ended (0 = never ran)
+    Counter<uint32_t> scanRestarts;
+    Counter<uint64_t> scanGapUs;
+    Counter<uint32_t> maxScanGapUs;
+
+    AdaptiveScan *adaptive = nullptr;
+    SemaphoreHandle_t adaptiveLock = nullptr;
+
+    WindowAggregator::Config windowConfig;
+    WindowAggregator *window = nullptr;   ///< process() emits window summaries
+    WindowSummary summary;                ///< Too big for the caller's stack
+
+    // Per-device state, persisted through a StateStore (slot i = store slot i).
+    // Written by the decoding task, copied by saveState() on another.
+    DeviceState devices[StateStore::MAX_DEVICES] = {};
+    int64_t deviceSeenUs[StateStore::MAX_DEVICES] = {};
+    SemaphoreHandle_t deviceLock = nullptr;
+    StateStore *state = nullptr;
+    uint32_t stateIntervalMs = 300000;
+    int64_t stateSavedUs = 0;
+    bool bthKeySet = false;     ///< setBTHomeKey() called, overrides the stored key
+    bool replayProtection = false;
+    Counter<uint32_t> replayed;
+    uint16_t restoredDevices = 0;
+    uint32_t restoreUs = 0;
+    int64_t beganUs = 0;
+    int64_t firstDecodeUs = 0;
+
+    // Fan-out to independent consumers, fed by fanoutTask
+    struct Consumer {
+        espidf::RingBuffer ring;    ///< Decoded frame payloads
+        DecodedFrame frame;         ///< consume() scratch, too big for its stack
+        Counter<uint32_t> delivered;
+        Counter<uint32_t> taken;
+        Counter<uint32_t> dropped;
+        Counter<uint32_t> maxLag;
+    };
+    Consumer *consumers[BLEScanner::MAX_CONSUMERS] = {};
+    uint8_t consumerCount = 0;
+    TaskHandle_t fanoutTaskHandle = nullptr;
+
+    struct Subscriber {
+        bool used = false;
+        SubscriptionFilter filter;
+        SubscriptionCallback callback = nullptr;
+        void *ctx = nullptr;
+        QueueHandle_t queue = nullptr;
+    };
+
+    // What the decode path reads and reconfigure() may replace: the key and
+    // the subscriptions. Readers pin the published copy in a ReadSection
+    // and never lock; writers (holding configLock) edit the other copy,
+    // publish it and wait out the readers of the old one, which the last of
+    // them signals on drained.
+    struct Live {
+        uint8_t bthKey[16];
+        bool hasBthKey = false;
+        Subscriber subs[BLEScanner::MAX_SUBSCRIPTIONS];
+        uint8_t subCount = 0;
+    };
+    Live live[2];
+    std::atomic<Live *> current{&live[0]};
+    std::atomic<uint32_t> epoch{0};
+    std::atomic<uint32_t> readers[2] = {};     ///< In sections, by epoch parity
+    SemaphoreHandle_t drained = nullptr;
+    SemaphoreHandle_t configLock = nullptr;
+    Counter<uint32_t> routed;
+    Counter<uint32_t> subDropped;
+
+    Counter<uint32_t> reconfigs;
+    Counter<uint32_t> reconfigLastUs;
+    Counter<uint32_t> reconfigMaxUs;
+
+    // Per-task load (Stats::tasks). The radio and consumer tasks are not
+    // ours: they are noted when they do the scanner's work.
+    Counter<uint64_t> busyUs[BLEScanner::TASK_COUNT];
+#if BTHOME_RUN_TIME_STATS
+    // Run-time counters at the previous stats() call
+    Counter<uint64_t> cpuLast[BLEScanner::TASK_COUNT];
+    Counter<uint64_t> cpuLastTotal;
+#endif
+    TaskHandle_t volatile radioTask = nullptr;
+    TaskHandle_t volatile consumerTask = nullptr;
+    uint32_t taskStackSize = 0;
+
+    explicit Impl(Arena *a = nullptr) : arena(a) {
+        configLock = createMutex(arena);
+        paramsLock = createMutex(arena);
+        paramsTaken = createBinary(arena);
+        drained = createBinary(arena);
+        deviceLock = createMutex(arena);
+        windowConfig.windowMs = 0;  // off until setWindowAggregation()
+        decoders.add(DecoderRegistry::SERVICE_DATA_16, 0xFCD2, decodeBTHome, this);
+        registerDeviceDecoders(decoders);
+    }
+
+    // Runs inside a ReadSection, like every decode
+    static bool decodeBTHome(const uint8_t *sd, size_t len, const AdvertHeader &hdr,
+                             void *ctx, DecodedAdvert &out) {
+        auto *impl = static_cast<Impl *>(ctx);
+        const Live *l = impl->current.load();
+        return impl->bthDecoder.decode(sd, len, hdr.mac, l->hasBthKey ? l->bthKey : nullptr,
+                                       out);
+    }
+
+    /// Lock-free; called from the BLE callback.
+    bool isKnown(const uint8_t mac[6]) const {
+        return known[0].contains(mac) || known[1].contains(mac);
+    }
 
-    uint32_t queueFull = 0;
-    uint32_t acquireFail = 0;
-    uint32_t received = 0;
-    uint32_t decoded = 0;
+    /// Consumer side only (single writer).
+    void markKnown(const uint8_t mac[6]) {
+        if (known[knownCur].contains(mac))
+            return;
+        // Rotate at 3/4 full, which also keeps the probe sequences short
+        if (known[knownCur].size() >= 128 * 3 / 4) {
+            knownCur ^= 1;
+            known[knownCur].clear();
+            knownRotations++;
+        }
+        known[knownCur].insert(mac);
+    }
 };
 
 // Singleton storage — the Impl pointer lives on the single instance.
 static BLEScanner::Impl *s_impl = nullptr;
 
-static bool decodeBTHome(JsonObject BLEdata, JsonDocument &json,
-                         BTHomeDecoder &decoder, const char *key) {
-    std::vector<uint8_t> sd;
-    if (!hexStringToVector(BLEdata["sd"], sd))
-        return false;
+// ---------------------------------------------------------------------------
+// Live configuration (read-copy-update)
+// ---------------------------------------------------------------------------
 
-    BTHomeDecodeResult bthRes = decoder.parseBTHomeV2(
-                                    std::string(sd.begin(), sd.end()),
-                                    BLEdata["mac"],
-                                    key);
+// Pins the published Live for its scope. Registers under the current epoch's
+// parity, retrying if a writer flipped it meanwhile; never blocks.
+class ReadSection {
+public:
+    explicit ReadSection(BLEScanner::Impl *impl) : _impl(impl) {
+        while (true) {
+            _slot = impl->epoch.load() & 1;
+            impl->readers[_slot]++;
+            if ((impl->epoch.load() & 1) == _slot)
+                break;
+            leave();
+        }
+        live = impl->current.load();
+    }
+    ~ReadSection() { leave(); }
 
-    if (bthRes.isBTHome && bthRes.decryptionSucceeded) {
-        JsonObject root = json.to<JsonObject>();
-        root["bthome_version"] = bthRes.bthomeVersion;
-        JsonArray measArr = root["measurements"].to<JsonArray>();
+    ReadSection(const ReadSection &) = delete;
+    ReadSection &operator=(const ReadSection &) = delete;
 
-        for (auto &m : bthRes.measurements) {
-            JsonObject obj = measArr.add<JsonObject>();
-            obj["object_id"] = m.objectID;
-            obj["name"]      = m.name;
-            obj["value"]     = m.value;
-            obj["unit"]      = m.unit;
-        }
-        return true;
+    const BLEScanner::Impl::Live *live;
+
+private:
+    // The last reader out of a retired epoch wakes the writer waiting on it
+    void leave() {
+        if (--_impl->readers[_slot] == 0 && (_impl->epoch.load() & 1) != _slot)
+            xSemaphoreGive(_impl->drained);
     }
-    return false;
+
+    BLEScanner::Impl *_impl;
+    uint32_t _slot;
+};
+
+// Publish a copy of the live configuration changed by edit, and return once
+// no reader can still see the old one. Caller holds configLock, and must not
+// be inside a ReadSection (e.g. a subscription callback): it would wait for
+// itself.
+template <typename Fn>
+static void publish(BLEScanner::Impl *impl, Fn edit) {
+    BLEScanner::Impl::Live *cur = impl->current.load();
+    BLEScanner::Impl::Live *next = cur == &impl->live[0] ? &impl->live[1] : &impl->live[0];
+    *next = *cur;
+    edit(*next);
+    impl->current.store(next);
+    xSemaphoreTake(impl->drained, 0);   // left over from an earlier publish
+    uint32_t old = impl->epoch.fetch_add(1);
+    while (impl->readers[old & 1].load() != 0)
+        xSemaphoreTake(impl->drained, portMAX_DELAY);
 }
 
 // ---------------------------------------------------------------------------
-// BLE scan callback — enqueues raw advertisement data as MsgPack
+// Advert sink — classifies and enqueues the raw advert (AdvertHeader + AD bytes)
 // ---------------------------------------------------------------------------
-class ScanCallback : public BLEAdvertisedDeviceCallbacks {
-    void onResult(BLEAdvertisedDevice advertisedDevice) override {
+
+// Trigger-based BTHome adverts (advInfo bit 2, never encrypted) first,
+// then devices we have decoded before, then everything else.
+static AdvertClass classify(const RawAdvert &adv) {
+    size_t sdLen = 0;
+    const uint8_t *sd = findServiceData16(adv.data, adv.hdr.len, 0xFCD2, sdLen);
+    if (sd && sdLen >= 1 && (sd[0] & 0x04))
+        return ADV_CLASS_TRIGGER;
+    if (s_impl->isKnown(adv.hdr.mac))
+        return ADV_CLASS_KNOWN;
+    return ADV_CLASS_UNKNOWN;
+}
+
+static void enqueue(const RawAdvert &adv, void *) {
+    AdvertClass cls = classify(adv);
+    // Trigger events skip the bulk FIFO; if the fast lane is full they
+    // still get the trigger reserve of the main queue.
+    if (cls == ADV_CLASS_TRIGGER && s_impl->fastQueue &&
+            s_impl->fastQueue->push(cls, adv.hdr, adv.data))
+        return;
+    if (!s_impl->queue->push(cls, adv.hdr, adv.data))
+        s_impl->acquireFail++;
+}
+
+class ScanSink : public AdvertSink {
+    void onAdvert(const RawAdvert &adv) override {
         if (!s_impl || !s_impl->queue)
             return;
+        BTHOME_TRACE_SCOPE(TRACE_SINK, adv.hdr.mac);
+        BusyScope busy(s_impl->busyUs[BLEScanner::TASK_RADIO]);
+        s_impl->radioTask = xTaskGetCurrentTaskHandle();
 
-        JsonDocument doc;
-        JsonObject BLEdata = doc.to<JsonObject>();
+        AdvertRecorder *rec = s_impl->recorder;
+        if (rec)
+            rec->record(adv.hdr, adv.data);
 
-        String mac = advertisedDevice.getAddress().toString();
-        mac.toUpperCase();
-        BLEdata["mac"] = (char *)mac.c_str();
-        BLEdata["rssi"] = (int)advertisedDevice.getRSSI();
+        // Captures keep the reports as received; the queue gets them merged
+        if (s_impl->merger && s_impl->activeScan)
+            s_impl->merger->add(adv);
+        else
+            enqueue(adv, nullptr);
+    }
+};
 
-        if (advertisedDevice.haveName())
-            BLEdata["name"] = (char *)advertisedDevice.getName().c_str();
+static ScanSink s_sink;
 
-        if (advertisedDevice.haveManufacturerData()) {
-            String hexData;
-            stringToHexString(advertisedDevice.getManufacturerData(), hexData);
-            BLEdata["mfd"] = hexData;
-        }
+// ---------------------------------------------------------------------------
+// Scan task (runs forever on its own RTOS task)
+// ---------------------------------------------------------------------------
 
-        if (advertisedDevice.haveServiceUUID())
-            BLEdata["svcuuid"] = (char *)advertisedDevice.getServiceUUID().toString().c_str();
+// Called by the BLE stack when a scan ends on its own. In continuous mode
+// that is the only time the scan stops, so wake the task to restart it.
+static void onScanComplete(void *) {
+    if (!s_impl)
+        return;
+    s_impl->scanStoppedUs = esp_timer_get_time();
+    if (s_impl->scanTaskHandle)
+        xTaskNotifyGive(s_impl->scanTaskHandle);
+}
 
-        int sdCount = advertisedDevice.getServiceDataUUIDCount();
-        if (sdCount > 0) {
-            int idx = sdCount - 1;
-            BLEdata["svduuid"] = (char *)advertisedDevice.getServiceDataUUID(idx).toString().c_str();
-            String hexData;
-            stringToHexString(advertisedDevice.getServiceData(idx), hexData);
-            BLEdata["sd"] = hexData;
+// Account the time between the previous scan ending and the one about to
+// start, so restart gaps show up in stats().
+static void noteScanStart(BLEScanner::Impl *impl) {
+    impl->scanRestarts++;
+    if (impl->scanStoppedUs == 0)
+        return;
+    int64_t gap = esp_timer_get_time() - impl->scanStoppedUs;
+    if (gap < 0)
+        gap = 0;
+    impl->scanGapUs += (uint64_t)gap;
+    impl->maxScanGapUs.raise(gap > UINT32_MAX ? UINT32_MAX : (uint32_t)gap);
+}
+
+// ulTaskNotifyTake() for the scan task. While scan responses are merged,
+// wake every merge window to send on adverts whose response did not come.
+static uint32_t waitNotify(BLEScanner::Impl *impl, TickType_t ticks) {
+    ScanResponseMerger *merger = impl->merger;
+    if (!merger)
+        return ulTaskNotifyTake(pdTRUE, ticks);
+    TickType_t start = xTaskGetTickCount();
+    while (true) {
+        TickType_t block = pdMS_TO_TICKS(merger->windowMs()) + 1;
+        if (ticks != portMAX_DELAY) {
+            TickType_t elapsed = xTaskGetTickCount() - start;
+            if (elapsed >= ticks)
+                return 0;
+            if (ticks - elapsed < block)
+                block = ticks - elapsed;
         }
+        uint32_t n = ulTaskNotifyTake(pdTRUE, block);
+        {
+            BusyScope busy(impl->busyUs[BLEScanner::TASK_SCAN]);
+            merger->poll(esp_timer_get_time());
+        }
+        if (n)
+            return n;
+    }
+}
+
+// A scan ended: no response can come for adverts still held.
+static void scanEnded(BLEScanner::Impl *impl) {
+    if (!impl->merger)
+        return;
+    BusyScope busy(impl->busyUs[BLEScanner::TASK_SCAN]);
+    impl->merger->flush();
+}
 
-        if (advertisedDevice.haveTXPower())
-            BLEdata["txpwr"] = (int8_t)advertisedDevice.getTXPower();
+// Take up scan parameters set by reconfigure(). Called between scans.
+static void applyParams(BLEScanner::Impl *impl) {
+    if (!impl->paramsChanged.load())
+        return;
+    BusyScope busy(impl->busyUs[BLEScanner::TASK_SCAN]);
+    ScanParams params;
+    xSemaphoreTake(impl->paramsLock, portMAX_DELAY);
+    params.intervalMs = impl->scanInterval;
+    params.windowMs = impl->scanWindow;
+    params.active = impl->activeScan;
+    impl->paramsChanged = false;
+    xSemaphoreGive(impl->paramsLock);
+    xSemaphoreGive(impl->paramsTaken);
+    if (!impl->source->setParams(params))
+        log_e("advert source %s cannot change scan parameters", impl->source->name());
+}
 
-        BLEdata["time"] = fseconds();
+static void scanTask(void *param) {
+    auto *impl = static_cast<BLEScanner::Impl *>(param);
 
-        void *ble_adv = nullptr;
-        size_t total = measureMsgPack(BLEdata);
-        if (s_impl->queue->send_acquire((void **)&ble_adv, total, 0) != pdTRUE) {
-            s_impl->acquireFail++;
-            return;
+    ScanParams params;
+    params.intervalMs = impl->scanInterval;
+    params.windowMs = impl->scanWindow;
+    params.active = impl->activeScan;
+    // Sources deliver every advert (duplicates included) to the sink and keep
+    // no result lists of their own.
+    if (!impl->source->init(params, &s_sink)) {
+        log_e("advert source %s failed to init", impl->source->name());
+        vTaskDelete(nullptr);
+        return;
+    }
+    log_i("BLE scanning with %s", impl->source->name());
+
+    if (impl->scanTimeMs == 0 && impl->adaptive) {
+        // Adaptive: scan only the windows the scheduler asks for. Planned
+        // off-time is not a gap, so scanStoppedUs is cleared after each stop.
+        while (true) {
+            int64_t now = esp_timer_get_time();
+            xSemaphoreTake(impl->adaptiveLock, portMAX_DELAY);
+            AdaptiveScan::Window w = impl->adaptive->next(now);
+            xSemaphoreGive(impl->adaptiveLock);
+
+            if (w.startUs > now) {
+                vTaskDelay(pdMS_TO_TICKS((uint32_t)((w.startUs - now) / 1000)) + 1);
+                continue;
+            }
+
+            ulTaskNotifyTake(pdTRUE, 0);
+            applyParams(impl);
+            noteScanStart(impl);
+            int64_t started = esp_timer_get_time();
+            if (!impl->source->start(0, onScanComplete, nullptr)) {
+                log_e("BLE scan start failed, retrying");
+                delay(100);
+                continue;
+            }
+            waitNotify(impl, pdMS_TO_TICKS((uint32_t)((w.endUs - started) / 1000)) + 1);
+            impl->source->stop();
+            scanEnded(impl);
+            int64_t stopped = esp_timer_get_time();
+            impl->scanStoppedUs = 0;
+
+            xSemaphoreTake(impl->adaptiveLock, portMAX_DELAY);
+            impl->adaptive->scanned(started, stopped);
+            xSemaphoreGive(impl->adaptiveLock);
         }
+    }
 
-        size_t n = serializeMsgPack(BLEdata, ble_adv, total);
-        if (n != total) {
-            log_e("serializeMsgPack: expected %u got %u", total, n);
-        } else {
-            if (s_impl->queue->send_complete(ble_adv) != pdTRUE) {
-                s_impl->queueFull++;
-            } else {
-                s_impl->queue->update_high_watermark();
+    if (impl->scanTimeMs == 0) {
+        // Continuous: one open-ended scan, restarted only if the stack ends it
+        // or reconfigure() changes the scan parameters.
+        while (true) {
+            applyParams(impl);
+            noteScanStart(impl);
+            if (!impl->source->start(0, onScanComplete, nullptr)) {
+                log_e("BLE scan start failed, retrying");
+                impl->scanStoppedUs = esp_timer_get_time();
+                delay(100);
+                continue;
+            }
+            waitNotify(impl, portMAX_DELAY);
+            if (impl->paramsChanged.load()) {
+                impl->source->stop();
+                impl->scanStoppedUs = esp_timer_get_time();
+                scanEnded(impl);
+                continue;
             }
+            scanEnded(impl);
+            log_d("BLE scan ended, restarting");
         }
     }
-};
+
+    // Periodic: the source ends each scan after scanTimeMs (sources with
+    // second resolution round up, so sub-second values never mean forever).
+    while (true) {
+        applyParams(impl);
+        noteScanStart(impl);
+        if (!impl->source->start(impl->scanTimeMs, onScanComplete, nullptr)) {
+            log_e("BLE scan start failed, retrying");
+            impl->scanStoppedUs = esp_timer_get_time();
+            delay(100);
+            continue;
+        }
+        waitNotify(impl, portMAX_DELAY);
+        scanEnded(impl);
+        delay(1);
+    }
+}
 
 // ---------------------------------------------------------------------------
-// Scan task (runs forever on its own RTOS task)
+// Persistent device state
 // ---------------------------------------------------------------------------
-static void scanTask(void *param) {
-    auto *impl = static_cast<BLEScanner::Impl *>(param);
 
-    BLEDevice::init("");
-    impl->pBLEScan = BLEDevice::getScan();
-    impl->pBLEScan->setAdvertisedDeviceCallbacks(new ScanCallback(), true, true);
-    impl->pBLEScan->setActiveScan(impl->activeScan);
-    impl->pBLEScan->setInterval(impl->scanInterval);
-    impl->pBLEScan->setWindow(impl->scanWindow);
+// Bulk-load the state store into the device table, known-device set and
+// adaptive scheduler. Runs in begin(), before the scan task exists.
+static void restoreState(BLEScanner::Impl *impl) {
+    int64_t t0 = esp_timer_get_time();
+    StateStore *store = impl->state;
+    store->load();
+    if (!impl->bthKeySet && store->key()) {
+        xSemaphoreTake(impl->configLock, portMAX_DELAY);
+        publish(impl, [&](BLEScanner::Impl::Live &l) {
+            memcpy(l.bthKey, store->key(), 16);
+            l.hasBthKey = true;
+        });
+        xSemaphoreGive(impl->configLock);
+    }
+    uint16_t n = 0;
+    for (uint16_t i = 0; i < StateStore::MAX_DEVICES; i++) {
+        const DeviceState *d = store->device(i);
+        if (!d)
+            continue;
+        impl->devices[i] = *d;
+        impl->markKnown(d->mac);
+        if (impl->adaptive && (d->flags & DeviceState::HAS_PERIOD))
+            impl->adaptive->restore(d->mac, d->periodUs, d->jitterUs);
+        n++;
+    }
+    impl->restoredDevices = n;
+    impl->stateSavedUs = t0;
+    impl->restoreUs = (uint32_t)(esp_timer_get_time() - t0);
+    log_i("restored %u devices in %u us", n, impl->restoreUs);
+}
+
+// Device table slot of mac: its own, a free one, or the least recently
+// seen (which is forgotten).
+static DeviceState *deviceSlot(BLEScanner::Impl *impl, const uint8_t mac[6], int64_t nowUs) {
+    int free = -1, oldest = 0;
+    for (int i = 0; i < StateStore::MAX_DEVICES; i++) {
+        DeviceState &d = impl->devices[i];
+        if (!d.flags) {
+            if (free < 0)
+                free = i;
+            continue;
+        }
+        if (memcmp(d.mac, mac, 6) == 0) {
+            impl->deviceSeenUs[i] = nowUs;
+            return &d;
+        }
+        if (impl->deviceSeenUs[i] < impl->deviceSeenUs[oldest])
+            oldest = i;
+    }
+    int i = free >= 0 ? free : oldest;
+    DeviceState &d = impl->devices[i];
+    memset(&d, 0, sizeof(d));
+    memcpy(d.mac, mac, 6);
+    d.flags = DeviceState::USED;
+    impl->deviceSeenUs[i] = nowUs;
+    return &d;
+}
 
-    while (true) {
-        BLEScanResults *foundDevices = impl->pBLEScan->start(impl->scanTimeMs / 1000, false);
-        log_d("Devices found: %d", foundDevices->getCount());
-        impl->pBLEScan->clearResults();
-        delay(1);
+// Update the device's counter and packet id from a decoded advert. Returns
+// false if replay protection rejects it. Caller holds deviceLock.
+static bool trackDeviceLocked(BLEScanner::Impl *impl, const RawAdvert &adv,
+                              const DecodedAdvert &res) {
+    DeviceState *d = deviceSlot(impl, adv.hdr.mac, adv.hdr.timeUs);
+
+    if (res.isEncrypted) {
+        size_t sdLen = 0;
+        const uint8_t *sd = findServiceData16(adv.data, adv.hdr.len, 0xFCD2, sdLen);
+        BTHomeCipher c;
+        if (!sd || !BTHomeDecoder::cipherParams(sd, sdLen, adv.hdr.mac, c))
+            return true;
+        uint32_t counter = (uint32_t)c.nonce[9] | (uint32_t)c.nonce[10] << 8 |
+                           (uint32_t)c.nonce[11] << 16 | (uint32_t)c.nonce[12] << 24;
+        if (impl->replayProtection && (d->flags & DeviceState::HAS_COUNTER) &&
+                counter <= d->counter) {
+            impl->replayed++;
+            return false;
+        }
+        d->counter = counter;
+        d->flags |= DeviceState::HAS_COUNTER;
+        return true;
+    }
+
+    for (uint8_t i = 0; i < res.count; i++) {
+        if (res.values[i].objectID != 0x00)
+            continue;
+        uint8_t id = (uint8_t)res.values[i].raw;
+        if (impl->replayProtection && (d->flags & DeviceState::HAS_PACKET_ID) &&
+                id == d->packetId) {
+            impl->replayed++;
+            return false;
+        }
+        d->packetId = id;
+        d->flags |= DeviceState::HAS_PACKET_ID;
+        break;
     }
+    return true;
+}
+
+static bool trackDevice(BLEScanner::Impl *impl, const RawAdvert &adv, const DecodedAdvert &res) {
+    if (strcmp(res.protocol, "bthome") != 0)
+        return true;
+    xSemaphoreTake(impl->deviceLock, portMAX_DELAY);
+    bool ok = trackDeviceLocked(impl, adv, res);
+    xSemaphoreGive(impl->deviceLock);
+    return ok;
 }
 
 // ---------------------------------------------------------------------------
@@ -219,36 +725,346 @@ BLEScanner &BLEScanner::instance() {
     return s;
 }
 
-void BLEScanner::setBTHomeKey(const char *hexKey) {
+// Create the state on first use: from the arena when setArena() passes one,
+// otherwise from the heap.
+BLEScanner::Impl *BLEScanner::ensureImpl(Arena *arena) {
     if (!_impl) {
-        _impl = new Impl();
+        _impl = make<Impl>(arena, arena);
         s_impl = _impl;
     }
-    _impl->bthKey = hexKey ? hexKey : "";
+    return _impl;
 }
 
-void BLEScanner::setActiveScan(bool active) {
-    if (!_impl) {
-        _impl = new Impl();
-        s_impl = _impl;
+bool BLEScanner::setArena(Arena *arena) {
+    if (_impl) {
+        log_e("setArena() must come before any other BLEScanner call");
+        return false;
     }
+    if (!arena)
+        return false;
+    return ensureImpl(arena) != nullptr;
+}
+
+void BLEScanner::setBTHomeKey(const char *hexKey) {
+    ensureImpl();
+    // Parsed once here so the decode path never touches the hex string
+    uint8_t key[16] = {};
+    bool hasKey = hexKey && *hexKey && parseKey(hexKey, key);
+    _impl->bthKeySet = true;
+    xSemaphoreTake(_impl->configLock, portMAX_DELAY);
+    publish(_impl, [&](Impl::Live &l) {
+        memcpy(l.bthKey, key, 16);
+        l.hasBthKey = hasKey;
+    });
+    xSemaphoreGive(_impl->configLock);
+}
+
+bool BLEScanner::registerDecoder(DecoderRegistry::Kind kind, uint16_t id,
+                                 AdvertDecoderFn fn, void *ctx) {
+    ensureImpl();
+    if (_started)
+        return false;
+    return _impl->decoders.add(kind, id, fn, ctx);
+}
+
+void BLEScanner::setActiveScan(bool active) {
+    ensureImpl();
     _impl->activeScan = active;
 }
 
+void BLEScanner::setAdvertSource(AdvertSource *source) {
+    ensureImpl();
+    if (!_started)
+        _impl->source = source;
+}
+
+void BLEScanner::setQueuePolicy(const AdvertQueue::Policy &policy) {
+    ensureImpl();
+    if (!_started)
+        _impl->queuePolicy = policy;
+}
+
+void BLEScanner::setQueueSpill(size_t bytes, uint8_t highPercent, UBaseType_t caps) {
+    ensureImpl();
+    if (_started)
+        return;
+    _impl->spill.bytes = bytes;
+    _impl->spill.caps = caps;
+    _impl->spill.highPercent = highPercent;
+    _impl->spill.lowPercent = highPercent / 2;
+}
+
+void BLEScanner::setScanResponseMerge(uint32_t windowMs) {
+    ensureImpl();
+    if (!_started)
+        _impl->mergeWindowMs = windowMs;
+}
+
+void BLEScanner::setFastLane(size_t bytes) {
+    ensureImpl();
+    if (!_started)
+        _impl->fastLaneBytes = bytes;
+}
+
+void BLEScanner::setWakePolicy(uint16_t minItems, uint32_t maxDelayMs) {
+    ensureImpl();
+    _impl->wake.minItems = minItems;
+    _impl->wake.maxDelayMs = maxDelayMs;
+    if (_impl->queue)
+        _impl->queue->setWake(_impl->wake);
+}
+
+void BLEScanner::setRecorder(AdvertRecorder *recorder) {
+    ensureImpl();
+    _impl->recorder = recorder;
+}
+
+bool BLEScanner::setHistory(HistoryStore *history) {
+    ensureImpl();
+    // With consumers the fan-out task appends, and nothing else could read
+    if (history && _impl->consumerCount) {
+        log_e("history cannot be kept with addConsumer() consumers");
+        return false;
+    }
+    _impl->history = history;
+    return true;
+}
+
+void BLEScanner::setWindowAggregation(uint32_t windowMs, uint16_t slots, bool variance) {
+    ensureImpl();
+    if (_started)
+        return;
+    _impl->windowConfig.windowMs = windowMs;
+    _impl->windowConfig.slots = slots;
+    _impl->windowConfig.variance = variance;
+}
+
+void BLEScanner::setStateStore(StateStore *store, uint32_t saveIntervalMs) {
+    ensureImpl();
+    if (_started)
+        return;
+    _impl->state = store;
+    _impl->stateIntervalMs = saveIntervalMs;
+}
+
+void BLEScanner::setReplayProtection(bool enable) {
+    ensureImpl();
+    _impl->replayProtection = enable;
+}
+
+int BLEScanner::addConsumer(size_t bytes, UBaseType_t caps) {
+    ensureImpl();
+    if (_started || _impl->consumerCount >= MAX_CONSUMERS)
+        return -1;
+    if (_impl->history) {
+        log_e("consumers cannot be added while a history store is attached");
+        return -1;
+    }
+    auto *c = make<Impl::Consumer>(_impl->arena);
+    if (!c || !createRing(_impl->arena, c->ring, bytes, caps)) {
+        log_e("consumer ring allocation failed (%u bytes)", bytes);
+        destroy(_impl->arena, c);
+        return -1;
+    }
+    _impl->consumers[_impl->consumerCount] = c;
+    return _impl->consumerCount++;
+}
+
+size_t BLEScanner::saveState(bool force) {
+    if (!_impl || !_impl->state || !_started)
+        return 0;
+    int64_t now = esp_timer_get_time();
+    if (!force && now - _impl->stateSavedUs < (int64_t)_impl->stateIntervalMs * 1000)
+        return 0;
+    _impl->stateSavedUs = now;
+
+    StateStore *store = _impl->state;
+    xSemaphoreTake(_impl->configLock, portMAX_DELAY);
+    const Impl::Live *live = _impl->current.load();
+    store->setKey(live->hasBthKey ? live->bthKey : nullptr);
+    xSemaphoreGive(_impl->configLock);
+    if (_impl->adaptive)
+        xSemaphoreTake(_impl->adaptiveLock, portMAX_DELAY);
+    for (uint16_t i = 0; i < StateStore::MAX_DEVICES; i++) {
+        // The fan-out task may be updating the table (addConsumer())
+        xSemaphoreTake(_impl->deviceLock, portMAX_DELAY);
+        DeviceState d = _impl->devices[i];
+        xSemaphoreGive(_impl->deviceLock);
+        if (!d.flags) {
+            store->setDevice(i, nullptr);
+            continue;
+        }
+        // Periods learned this run replace the restored ones
+        if (_impl->adaptive &&
+                _impl->adaptive->learned(d.mac, d.periodUs, d.jitterUs))
+            d.flags |= DeviceState::HAS_PERIOD;
+        store->setDevice(i, &d);
+    }
+    if (_impl->adaptive)
+        xSemaphoreGive(_impl->adaptiveLock);
+    return store->flush();
+}
+
+void BLEScanner::setAdaptiveScan(bool enable) {
+    ensureImpl();
+    if (_started)
+        return;
+    if (enable && !_impl->adaptive) {
+        _impl->adaptive = make<AdaptiveScan>(_impl->arena, AdaptiveScan::Config(), _impl->arena);
+        _impl->adaptiveLock = createMutex(_impl->arena);
+    } else if (!enable && _impl->adaptive) {
+        destroy(_impl->arena, _impl->adaptive);
+        _impl->adaptive = nullptr;
+        vSemaphoreDelete(_impl->adaptiveLock);
+        _impl->adaptiveLock = nullptr;
+    }
+}
+
+static constexpr uint32_t SPILL_STACK = 2048;
+
+// Stack headroom, busy time and CPU share of every task the scanner's work
+// ran on, and a stack size for begin() from the tasks it creates with one.
+static void taskStats(BLEScanner::Impl *impl, BLEScanner::Stats &s) {
+    const TaskHandle_t handles[BLEScanner::TASK_COUNT] = {
+        impl->radioTask, impl->scanTaskHandle, impl->spillTaskHandle,
+        impl->fanoutTaskHandle, impl->consumerTask};
+    const uint32_t stacks[BLEScanner::TASK_COUNT] = {
+        0, impl->taskStackSize, SPILL_STACK, impl->taskStackSize, 0};
+    int64_t elapsed = esp_timer_get_time() - impl->beganUs;
+#if BTHOME_RUN_TIME_STATS
+    // The counters may be 32 bits and wrap; differences in their own type
+    // stay right across one wrap
+    using RunTime = decltype(ulTaskGetRunTimeCounter(nullptr));
+    RunTime total = portGET_RUN_TIME_COUNTER_VALUE();
+    RunTime span = (RunTime)(total - (RunTime)impl->cpuLastTotal);
+    impl->cpuLastTotal.set(total);
+#endif
+
+    uint32_t deepest = 0;
+    for (int i = 0; i < BLEScanner::TASK_COUNT; i++) {
+        BLEScanner::TaskStats &ts = s.tasks[i];
+        ts.busyUs = impl->busyUs[i];
+        ts.busyPercent = elapsed > 0 ? (uint8_t)std::min<uint64_t>(100, ts.busyUs * 100 / elapsed)
+                                    : 0;
+        if (!handles[i])
+            continue;
+        ts.name = pcTaskGetName(handles[i]);
+#if BTHOME_RUN_TIME_STATS
+        RunTime ran = ulTaskGetRunTimeCounter(handles[i]);
+        RunTime last = (RunTime)impl->cpuLast[i];
+        impl->cpuLast[i].set(ran);
+        // A task seen for the first time has no interval yet
+        if (last && span) {
+            ts.cpuPercent = (uint8_t)std::min<uint64_t>(
+                100, (uint64_t)(RunTime)(ran - last) * 100 / span);
+            ts.hasCpu = true;
+        }
+#endif
+        ts.stackBytes = stacks[i];
+        // Words in FreeRTOS, bytes on ESP-IDF where StackType_t is 8 bits
+        ts.stackFreeMin = (uint32_t)(uxTaskGetStackHighWaterMark(handles[i]) * sizeof(StackType_t));
+        if ((i == BLEScanner::TASK_SCAN || i == BLEScanner::TASK_FANOUT) &&
+                ts.stackFreeMin < ts.stackBytes)
+            deepest = std::max(deepest, ts.stackBytes - ts.stackFreeMin);
+    }
+    if (deepest) {
+        uint32_t suggested = deepest + std::max<uint32_t>(deepest / 4, 512);
+        s.suggestedStackSize = (suggested + 255) & ~255u;
+    }
+}
+
 BLEScanner::Stats BLEScanner::stats() const {
     Stats s = {};
     if (!_impl || !_impl->queue)
         return s;
-    s.hwmBytes    = _impl->queue->get_high_watermark();
-    s.totalBytes  = _impl->queue->get_total_size();
+    AdvertQueue::Stats qs = _impl->queue->stats();
+    s.hwmBytes    = qs.hwmBytes;
+    s.totalBytes  = qs.totalBytes;
     s.hwmPercent  = s.totalBytes > 0 ? (uint8_t)((s.hwmBytes * 100) / s.totalBytes) : 0;
-    s.queueFull   = _impl->queueFull;
+    s.usedBytes      = qs.usedBytes;
+    s.spillBytes     = qs.spillBytes;
+    s.spillHwmBytes  = qs.spillHwmBytes;
+    s.spillUsedBytes = qs.spillUsedBytes;
+    s.spilled        = qs.spilled;
+    s.spilledInline  = qs.spilledInline;
+    s.spillFull      = qs.spillFull;
+    s.queueFull   = qs.queueFull;
     s.acquireFail = _impl->acquireFail;
+    s.lockBusy    = qs.lockBusy;
+    s.knownRotations = _impl->knownRotations;
     s.received    = _impl->received;
     s.decoded     = _impl->decoded;
+    s.wakeups     = qs.wakeups;
+    s.routed      = _impl->routed;
+    s.subDropped  = _impl->subDropped;
+    if (_impl->merger) {
+        ScanResponseMerger::Stats ms = _impl->merger->stats();
+        s.mergeHeld    = ms.held;
+        s.merged       = ms.merged;
+        s.mergeAlone   = ms.alone + ms.evicted;
+        s.mergeOrphans = ms.orphans;
+    }
+    s.reconfigs      = _impl->reconfigs;
+    s.reconfigLastUs = _impl->reconfigLastUs;
+    s.reconfigMaxUs  = _impl->reconfigMaxUs;
+    memcpy(s.cls, qs.cls, sizeof(s.cls));
+    if (_impl->fastQueue)
+        s.fastLane = _impl->fastQueue->stats().cls[ADV_CLASS_TRIGGER];
+    for (int c = 0; c < ADV_CLASS_COUNT; c++) {
+        uint32_t n = _impl->latencyCount[c];
+        s.latencyAvgUs[c] = n ? (uint32_t)(_impl->latencyTotalUs[c] / n) : 0;
+        s.latencyMaxUs[c] = _impl->latencyMaxUs[c];
+    }
+    s.scanRestarts = _impl->scanRestarts;
+    s.scanGapUs    = _impl->scanGapUs;
+    s.maxScanGapUs = _impl->maxScanGapUs;
+    s.dutyPercent  = 100;
+    if (_impl->window) {
+        WindowAggregator::Stats ws = _impl->window->stats();
+        s.windowSummaries = ws.summaries;
+        s.windowOverflow  = ws.overflow;
+        s.windowDiscarded = ws.discarded;
+    }
+    s.replayed        = _impl->replayed;
+    s.restoredDevices = _impl->restoredDevices;
+    s.restoreUs       = _impl->restoreUs;
+    s.firstDecodeMs   = _impl->firstDecodeUs
+                            ? (uint32_t)((_impl->firstDecodeUs - _impl->beganUs) / 1000) : 0;
+    s.consumerCount = _impl->consumerCount;
+    for (uint8_t i = 0; i < _impl->consumerCount; i++) {
+        Impl::Consumer *c = _impl->consumers[i];
+        ConsumerStats &cs = s.consumers[i];
+        cs.taken     = c->taken;      // before delivered, so lag cannot wrap
+        cs.delivered = c->delivered;
+        cs.dropped   = c->dropped;
+        cs.lag       = cs.delivered - cs.taken;
+        cs.maxLag    = c->maxLag;
+        cs.freeBytes = c->ring.curr_free_size();
+    }
+    taskStats(_impl, s);
+    if (_impl->adaptive) {
+        xSemaphoreTake(_impl->adaptiveLock, portMAX_DELAY);
+        AdaptiveScan::Stats as = _impl->adaptive->stats();
+        xSemaphoreGive(_impl->adaptiveLock);
+        s.adaptivePredicted = as.predicted;
+        s.adaptiveHits      = as.hits;
+        s.dutyPercent       = as.dutyPercent;
+    }
     return s;
 }
 
+static void fanoutTask(void *param);
+
+// Moves queued adverts to the overflow ring whenever the queue asks
+static void spillTask(void *param) {
+    auto *impl = static_cast<BLEScanner::Impl *>(param);
+    while (true) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        BusyScope busy(impl->busyUs[BLEScanner::TASK_SPILL]);
+        impl->queue->spill();
+    }
+}
+
 void BLEScanner::begin(size_t ringBufSize,
                        uint32_t scanTimeMs,
                        uint16_t scanInterval,
@@ -258,80 +1074,727 @@ void BLEScanner::begin(size_t ringBufSize,
                        UBaseType_t ringBufCap) {
     if (_started)
         return;
-    _started = true;
 
-    if (!_impl) {
-        _impl = new Impl();
-        s_impl = _impl;
+    ensureImpl();
+
+    if (!_impl->source)
+        _impl->source = defaultAdvertSource();
+    if (!_impl->source) {
+        log_e("no advert source, call setAdvertSource() before begin()");
+        return;
     }
+    _started = true;
 
     _impl->scanTimeMs = scanTimeMs;
     _impl->scanInterval = scanInterval;
     _impl->scanWindow = scanWindow;
 
-    _impl->queue = new espidf::RingBuffer();
-    _impl->queue->create(ringBufSize, RINGBUF_TYPE_NOSPLIT, ringBufCap);
+    Arena *arena = _impl->arena;
+    _impl->queue = make<AdvertQueue>(arena);
+    if (_impl->queue)
+        _impl->queue->setSpill(_impl->spill);
+    if (!_impl->queue ||
+            !_impl->queue->begin(ringBufSize, ringBufCap, _impl->queuePolicy, arena)) {
+        log_e("advert queue allocation failed (%u bytes)", ringBufSize);
+        destroy(arena, _impl->queue);
+        _impl->queue = nullptr;
+        _started = false;
+        return;
+    }
+    _impl->queue->setWake(_impl->wake);
+
+    if (_impl->fastLaneBytes) {
+        // Small and in internal RAM, default policy (trigger class only)
+        _impl->fastQueue = make<AdvertQueue>(arena);
+        if (!_impl->fastQueue ||
+                !_impl->fastQueue->begin(_impl->fastLaneBytes,
+                                         MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT,
+                                         AdvertQueue::Policy(), arena)) {
+            log_e("trigger fast lane allocation failed, using the main queue");
+            destroy(arena, _impl->fastQueue);
+            _impl->fastQueue = nullptr;
+        }
+    }
+
+    if (_impl->mergeWindowMs) {
+        _impl->merger = make<ScanResponseMerger>(arena, enqueue, nullptr);
+        if (!_impl->merger || !_impl->merger->begin(_impl->mergeWindowMs, arena)) {
+            log_e("scan response merging disabled, cannot allocate it");
+            destroy(arena, _impl->merger);
+            _impl->merger = nullptr;
+        }
+    }
+
+    if (_impl->windowConfig.windowMs && !_impl->window) {
+        _impl->window = make<WindowAggregator>(arena);
+        if (!_impl->window || !_impl->window->begin(_impl->windowConfig, arena)) {
+            log_e("window aggregation disabled, cannot allocate %u slots",
+                  _impl->windowConfig.slots);
+            destroy(arena, _impl->window);
+            _impl->window = nullptr;
+        }
+    }
+
+    if (_impl->state)
+        restoreState(_impl);
 
-    xTaskCreate(scanTask, "ble_scan", taskStackSize, _impl, taskPriority, nullptr);
+    // Above the consumer, so bursts move out of the ring before it fills
+    if (_impl->queue->stats().spillBytes) {
+        if (createTask(arena, spillTask, "ble_spill", SPILL_STACK, _impl, taskPriority + 1,
+                       &_impl->spillTaskHandle))
+            _impl->queue->setMover(_impl->spillTaskHandle);
+        else
+            log_e("cannot create the spill task, the queue spills only when full");
+    }
+
+    _impl->beganUs = esp_timer_get_time();
+    _impl->taskStackSize = taskStackSize;
+    if (!createTask(arena, scanTask, "ble_scan", taskStackSize, _impl, taskPriority,
+                    &_impl->scanTaskHandle))
+        log_e("cannot create the scan task");
+    if (_impl->consumerCount &&
+            !createTask(arena, fanoutTask, "ble_fanout", taskStackSize, _impl, taskPriority,
+                        &_impl->fanoutTaskHandle))
+        log_e("cannot create the fan-out task");
 }
 
-bool BLEScanner::deliver(JsonDocument &rawDoc, JsonDocument &outDoc) {
-    bool decoded = false;
-    std::vector<uint8_t> mfd;
+bool BLEScanner::reconfigure(const RuntimeConfig &config, uint32_t timeoutMs) {
+    if (!_impl || !_impl->queue)
+        return false;
+    Impl *impl = _impl;
+    int64_t t0 = esp_timer_get_time();
+
+    uint8_t key[16] = {};
+    bool hasKey = config.bthomeKey && *config.bthomeKey;
+    if (hasKey && !parseKey(config.bthomeKey, key))
+        return false;
+
+    xSemaphoreTake(impl->configLock, portMAX_DELAY);
+    bool ok = true;
+
+    // Scan parameters wait for the next scan boundary; in continuous mode
+    // that is now, the scan task stops the scan to take them up.
+    bool scanChange = config.scanInterval || config.scanWindow || config.activeScan >= 0;
+    if (scanChange) {
+        xSemaphoreTake(impl->paramsLock, portMAX_DELAY);
+        xSemaphoreTake(impl->paramsTaken, 0);  // from an earlier change
+        if (config.scanInterval)
+            impl->scanInterval = config.scanInterval;
+        if (config.scanWindow)
+            impl->scanWindow = config.scanWindow;
+        if (config.activeScan >= 0)
+            impl->activeScan = config.activeScan != 0;
+        impl->paramsChanged = true;
+        xSemaphoreGive(impl->paramsLock);
+        if (impl->scanTimeMs == 0 && !impl->adaptive && impl->scanTaskHandle)
+            xTaskNotifyGive(impl->scanTaskHandle);
+    }
+
+    if (config.bthomeKey) {
+        impl->bthKeySet = true;
+        publish(impl, [&](Impl::Live &l) {
+            memcpy(l.bthKey, key, 16);
+            l.hasBthKey = hasKey;
+        });
+    }
+
+    if (config.ringBufSize &&
+            !impl->queue->resize(config.ringBufSize, config.ringBufCap, impl->arena)) {
+        log_e("advert queue resize failed (%u bytes), keeping the old one",
+              (unsigned)config.ringBufSize);
+        ok = false;
+    }
+
+    if (config.taskPriority >= 0) {
+        UBaseType_t prio = (UBaseType_t)config.taskPriority;
+        if (impl->scanTaskHandle)
+            vTaskPrioritySet(impl->scanTaskHandle, prio);
+        if (impl->fanoutTaskHandle)
+            vTaskPrioritySet(impl->fanoutTaskHandle, prio);
+        if (impl->spillTaskHandle)
+            vTaskPrioritySet(impl->spillTaskHandle, prio + 1);
+    }
+
+    xSemaphoreGive(impl->configLock);
 
-    if (rawDoc["svduuid"].is<const char*>() &&
-            String(rawDoc["svduuid"]).indexOf("fcd2") != -1) {
-        decoded = decodeBTHome(rawDoc.as<JsonObject>(), outDoc,
-                               _impl->bthDecoder, _impl->bthKey);
+    // Wait for the scan boundary without configLock, so subscribe() and
+    // the like are not held up by it
+    if (scanChange) {
+        TickType_t start = xTaskGetTickCount();
+        TickType_t timeout = msToTicks(timeoutMs);
+        while (impl->paramsChanged.load()) {
+            TickType_t waited = xTaskGetTickCount() - start;
+            if (timeout != portMAX_DELAY && waited >= timeout) {
+                ok = false;     // taken up at the next scan boundary
+                break;
+            }
+            xSemaphoreTake(impl->paramsTaken,
+                           timeout == portMAX_DELAY ? portMAX_DELAY : timeout - waited);
+        }
+        xSemaphoreGive(impl->paramsTaken);  // wake any other reconfigure() waiting
     }
-    return decoded;
+
+    int64_t took = esp_timer_get_time() - t0;
+    uint32_t tookUs = took > UINT32_MAX ? UINT32_MAX : (uint32_t)took;
+    impl->reconfigs++;
+    impl->reconfigLastUs.set(tookUs);
+    impl->reconfigMaxUs.raise(tookUs);
+    return ok;
+}
+
+// ---------------------------------------------------------------------------
+// Consumer side
+// ---------------------------------------------------------------------------
+
+// Dequeue the next advert, trigger fast lane first, and record its
+// capture-to-dequeue latency.
+static bool popAdvert(BLEScanner::Impl *impl, RawAdvert &adv, uint8_t *data) {
+    AdvertClass cls = ADV_CLASS_TRIGGER;
+    if (!(impl->fastQueue && impl->fastQueue->pop(adv.hdr, data)) &&
+            !impl->queue->pop(adv.hdr, data, &cls))
+        return false;
+    adv.data = data;
+    impl->received++;
+    BTHOME_TRACE_SINCE(TRACE_QUEUE, adv.hdr.timeUs, adv.hdr.mac);
+
+    int64_t lat = esp_timer_get_time() - adv.hdr.timeUs;
+    if (lat < 0)
+        lat = 0;
+    uint32_t latUs = lat > UINT32_MAX ? UINT32_MAX : (uint32_t)lat;
+    impl->latencyCount[cls]++;
+    impl->latencyTotalUs[cls] += latUs;
+    impl->latencyMaxUs[cls].raise(latUs);
+    return true;
+}
+
+static size_t pending(const BLEScanner::Impl *impl) {
+    return impl->queue->available() +
+           (impl->fastQueue ? impl->fastQueue->available() : 0);
+}
+
+// Run the registered decoders and, on success, learn the device for queue
+// admission and adaptive scanning.
+static bool decodeAdvert(BLEScanner::Impl *impl, const RawAdvert &adv, DecodedAdvert &res) {
+    BTHOME_TRACE_SCOPE(TRACE_DECODE, adv.hdr.mac);
+    res.clear();
+    if (!impl->decoders.decode(adv, res) || res.count + res.skipped == 0)
+        return false;
+    if (!trackDevice(impl, adv, res))
+        return false;
+    impl->decoded++;
+    if (!impl->firstDecodeUs)
+        impl->firstDecodeUs = esp_timer_get_time();
+    impl->markKnown(adv.hdr.mac);
+
+    // Decoded devices feed the adaptive scheduler with their capture times
+    if (impl->adaptive) {
+        xSemaphoreTake(impl->adaptiveLock, portMAX_DELAY);
+        impl->adaptive->observe(adv.hdr.mac, adv.hdr.timeUs);
+        xSemaphoreGive(impl->adaptiveLock);
+    }
+
+    if (impl->history)
+        impl->history->add(adv.hdr.mac, adv.hdr.timeUs / 1000, res);
+    return true;
+}
+
+// True if any subscriber wants this device. objects gets the union of the
+// object ids they selected, all is set if one of them takes every object.
+static bool subscribedObjects(const BLEScanner::Impl::Live *live, const uint8_t mac[6],
+                              uint32_t objects[8], bool &all) {
+    bool any = false;
+    all = false;
+    memset(objects, 0, 8 * sizeof(uint32_t));
+    for (const auto &sub : live->subs) {
+        if (!sub.used || !sub.filter.matchesMac(mac))
+            continue;
+        any = true;
+        if (sub.filter.anyObject()) {
+            all = true;
+            continue;
+        }
+        const uint32_t *bits = sub.filter.objectBits();
+        for (int w = 0; w < 8; w++)
+            objects[w] |= bits[w];
+    }
+    return any;
+}
+
+// Hand every subscribed measurement to its subscribers.
+static void route(BLEScanner::Impl *impl, const BLEScanner::Impl::Live *live,
+                  const RawAdvert &adv, const DecodedAdvert &res) {
+    if (live->subCount == 0)
+        return;
+    BTHOME_TRACE_SCOPE(TRACE_ROUTE, adv.hdr.mac);
+
+    SubscribedValue sv;
+    sv.timeUs = adv.hdr.timeUs;
+    memcpy(sv.mac, adv.hdr.mac, 6);
+    sv.rssi = adv.hdr.rssi;
+    sv.protocol = res.protocol;
+
+    for (const auto &sub : live->subs) {
+        if (!sub.used || !sub.filter.matchesMac(adv.hdr.mac))
+            continue;
+        for (uint8_t i = 0; i < res.count; i++) {
+            if (!sub.filter.matchesObject(res.values[i].objectID))
+                continue;
+            sv.value = res.values[i];
+            impl->routed++;
+            if (sub.callback) {
+                sub.callback(sv, sub.ctx);
+            } else if (xQueueSend(sub.queue, &sv, 0) != pdTRUE) {
+                impl->subDropped++;
+            }
+        }
+    }
+}
+
+// Copy the advert's complete (or else short) local name into out.
+static bool localName(const RawAdvert &adv, char *out, size_t outLen) {
+    size_t adLen = 0;
+    const uint8_t *ad = findAd(adv.data, adv.hdr.len, AD_NAME_COMPLETE, adLen);
+    if (!ad)
+        ad = findAd(adv.data, adv.hdr.len, AD_NAME_SHORT, adLen);
+    if (!ad)
+        return false;
+    if (adLen >= outLen)
+        adLen = outLen - 1;
+    memcpy(out, ad, adLen);
+    out[adLen] = '\0';
+    return true;
+}
+
+// Local name and TX power of the advert, if it has them.
+static void advertExtras(const RawAdvert &adv, FrameExtras &extras, char *name, size_t nameLen) {
+    if (localName(adv, name, nameLen))
+        extras.name = name;
+    size_t adLen = 0;
+    const uint8_t *ad = findAd(adv.data, adv.hdr.len, AD_TX_POWER, adLen);
+    if (ad && adLen >= 1) {
+        extras.hasTxPower = true;
+        extras.txPower = (int8_t)ad[0];
+    }
+}
+
+// MAC without colons, truncated to outLen.
+static void copyMac(const uint8_t mac[6], char *out, size_t outLen) {
+    char macBare[13];
+    macToString(mac, macBare, false);
+    size_t copyLen = strlen(macBare);
+    if (copyLen >= outLen)
+        copyLen = outLen - 1;
+    memcpy(out, macBare, copyLen);
+    out[copyLen] = '\0';
+}
+
+static void toJson(const DecodedAdvert &res, JsonDocument &outDoc) {
+    JsonObject root = outDoc.to<JsonObject>();
+    if (strcmp(res.protocol, "bthome") == 0)
+        root["bthome_version"] = res.version;
+    else
+        root["protocol"] = res.protocol;
+    JsonArray measArr = root["measurements"].to<JsonArray>();
+
+    for (uint8_t i = 0; i < res.count; i++) {
+        const BTHomeValue &v = res.values[i];
+        JsonObject obj = measArr.add<JsonObject>();
+        obj["object_id"] = v.objectID;
+        obj["name"]      = v.name;
+        obj["value"]     = v.value;
+        obj["unit"]      = v.unit;
+    }
+}
+
+// The process() document: measurements plus the advert's metadata.
+static void toJson(const DecodedAdvert &res, const uint8_t mac[6], float timeS, int8_t rssi,
+                   const FrameExtras &extras, JsonDocument &outDoc) {
+    BTHOME_TRACE_SCOPE(TRACE_JSON, mac);
+    toJson(res, outDoc);
+    char macStr[18];
+    macToString(mac, macStr, true);
+    outDoc["mac"]  = (char *)macStr;
+    outDoc["time"] = timeS;
+    outDoc["rssi"] = rssi;
+    if (extras.name)
+        outDoc["name"] = (char *)extras.name;
+    if (extras.hasTxPower)
+        outDoc["txpwr"] = extras.txPower;
+}
+
+static void toJson(const WindowSummary &sum, bool variance, JsonDocument &outDoc) {
+    JsonObject root = outDoc.to<JsonObject>();
+    char macStr[18];
+    macToString(sum.mac, macStr, true);
+    root["mac"]    = (char *)macStr;
+    root["time"]   = (float)sum.startUs * 1.0e-6f;
+    root["window"] = (float)sum.windowMs * 1.0e-3f;
+    JsonArray measArr = root["measurements"].to<JsonArray>();
+
+    for (uint8_t i = 0; i < sum.count; i++) {
+        const WindowStats &w = sum.values[i];
+        JsonObject obj = measArr.add<JsonObject>();
+        obj["object_id"] = w.objectID;
+        obj["name"]      = w.name;
+        obj["unit"]      = w.unit;
+        obj["count"]     = w.count;
+        obj["min"]       = w.min;
+        obj["max"]       = w.max;
+        obj["mean"]      = w.mean;
+        obj["last"]      = w.last;
+        obj["sum"]       = w.sum;
+        if (variance)
+            obj["stddev"] = w.stddev;
+    }
+}
+
+// process() with window aggregation: hand out the closed window's summaries
+// first, otherwise fold the next advert into the active window.
+static bool processWindow(BLEScanner::Impl *impl, JsonDocument &doc, char *mac, size_t macLen) {
+    WindowAggregator *window = impl->window;
+    window->poll(esp_timer_get_time());
+    if (!window->ready()) {
+        uint8_t data[ADVERT_MAX_DATA];
+        RawAdvert adv;
+        if (!popAdvert(impl, adv, data))
+            return false;
+        DecodedAdvert res;
+        {
+            ReadSection rs(impl);
+            if (!decodeAdvert(impl, adv, res))
+                return false;
+            route(impl, rs.live, adv, res);
+        }
+
+        window->add(adv.hdr.mac, adv.hdr.timeUs, res);
+    }
+    if (!window->next(impl->summary))
+        return false;
+
+    toJson(impl->summary, window->config().variance, doc);
+    copyMac(impl->summary.mac, mac, macLen);
+    return true;
 }
 
 bool BLEScanner::process(JsonDocument &doc, char *mac, size_t macLen) {
     if (!_impl || !_impl->queue)
         return false;
+    BusyScope busy(_impl->busyUs[TASK_CONSUMER]);
+    _impl->consumerTask = xTaskGetCurrentTaskHandle();
+    if (_impl->window)
+        return processWindow(_impl, doc, mac, macLen);
+
+    // pop() copies the record out, so ring space is released before decoding
+    uint8_t data[ADVERT_MAX_DATA];
+    RawAdvert adv;
+    if (!popAdvert(_impl, adv, data))
+        return false;
+
+    // Decode
+    DecodedAdvert res;
+    {
+        ReadSection rs(_impl);
+        if (!decodeAdvert(_impl, adv, res))
+            return false;
+        route(_impl, rs.live, adv, res);
+    }
+
+    FrameExtras extras;
+    char name[32];
+    advertExtras(adv, extras, name, sizeof(name));
+    toJson(res, adv.hdr.mac, (float)adv.hdr.timeUs * 1.0e-6f, adv.hdr.rssi, extras, doc);
+    copyMac(adv.hdr.mac, mac, macLen);
+    return true;
+}
+
+bool BLEScanner::processFrame(Print &out) {
+    if (!_impl || !_impl->queue)
+        return false;
+    BusyScope busy(_impl->busyUs[TASK_CONSUMER]);
+    _impl->consumerTask = xTaskGetCurrentTaskHandle();
+
+    uint8_t data[ADVERT_MAX_DATA];
+    RawAdvert adv;
+    if (!popAdvert(_impl, adv, data))
+        return false;
+
+    DecodedAdvert res;
+    {
+        ReadSection rs(_impl);
+        if (!decodeAdvert(_impl, adv, res))
+            return false;
+        route(_impl, rs.live, adv, res);
+    }
+
+    // Same metadata as process() puts in the JSON
+    FrameExtras extras;
+    char name[FRAME_MAX_STRING + 1];
+    advertExtras(adv, extras, name, sizeof(name));
+
+    uint8_t frame[DECODED_FRAME_MAX_ENCODED];
+    size_t n;
+    {
+        BTHOME_TRACE_SCOPE(TRACE_FRAME, adv.hdr.mac);
+        n = encodeDecodedFrame(adv.hdr, res, extras, frame);
+    }
+    return out.write(frame, n) == n;
+}
+
+bool BLEScanner::dispatch() {
+    if (!_impl || !_impl->queue)
+        return false;
+    BusyScope busy(_impl->busyUs[TASK_CONSUMER]);
+    _impl->consumerTask = xTaskGetCurrentTaskHandle();
+
+    uint8_t data[ADVERT_MAX_DATA];
+    RawAdvert adv;
+    if (!popAdvert(_impl, adv, data))
+        return false;
+
+    // Adverts from devices nobody subscribed to are not even decoded, and
+    // the decoders skip objects none of their subscribers selected
+    ReadSection rs(_impl);
+    uint32_t objects[8];
+    bool all;
+    if (!subscribedObjects(rs.live, adv.hdr.mac, objects, all))
+        return false;
+
+    // History keeps every measurement of the devices that get decoded, and
+    // trackDevice() needs the packet id
+    objects[0] |= 1u;
+    DecodedAdvert res;
+    res.wanted = all || _impl->history ? nullptr : objects;
+    if (!decodeAdvert(_impl, adv, res))
+        return false;
+
+    uint32_t before = _impl->routed;
+    route(_impl, rs.live, adv, res);
+    return _impl->routed != before;
+}
+
+bool BLEScanner::forward(Print &out) {
+    if (!_impl || !_impl->queue)
+        return false;
+    BusyScope busy(_impl->busyUs[TASK_CONSUMER]);
+    _impl->consumerTask = xTaskGetCurrentTaskHandle();
+
+    uint8_t data[ADVERT_MAX_DATA];
+    RawAdvert adv;
+    if (!popAdvert(_impl, adv, data))
+        return false;
+
+    uint8_t frame[FRAME_MAX_ENCODED];
+    size_t n = encodeAdvertFrame(adv.hdr, adv.data, frame);
+    return out.write(frame, n) == n;
+}
+
+bool BLEScanner::waitForData(uint32_t timeoutMs) {
+    if (!_impl || !_impl->queue)
+        return false;
+    return _impl->queue->wait(msToTicks(timeoutMs), _impl->fastQueue);
+}
+
+// ---------------------------------------------------------------------------
+// Fan-out to consumers
+// ---------------------------------------------------------------------------
+
+// Append one frame payload to a consumer's ring without blocking.
+static void offer(BLEScanner::Impl::Consumer *c, const uint8_t *payload, size_t len) {
+    if (c->ring.send((void *)payload, len, 0) != pdTRUE) {
+        c->dropped++;
+        return;
+    }
+    c->delivered++;
+    c->maxLag.raise(c->delivered - c->taken);
+}
+
+// Sole reader of the advert queue once consumers are added: decode each
+// advert once and hand every consumer its own copy.
+static void fanoutTask(void *param) {
+    auto *impl = static_cast<BLEScanner::Impl *>(param);
+    uint8_t data[ADVERT_MAX_DATA];
+    uint8_t payload[DECODED_FRAME_MAX_PAYLOAD];
+    while (true) {
+        impl->queue->wait(portMAX_DELAY, impl->fastQueue);
+        BusyScope busy(impl->busyUs[BLEScanner::TASK_FANOUT]);
+        RawAdvert adv;
+        while (popAdvert(impl, adv, data)) {
+            DecodedAdvert res;
+            {
+                ReadSection rs(impl);
+                if (!decodeAdvert(impl, adv, res))
+                    continue;
+                route(impl, rs.live, adv, res);
+            }
+
+            FrameExtras extras;
+            char name[FRAME_MAX_STRING + 1];
+            advertExtras(adv, extras, name, sizeof(name));
+            size_t n;
+            {
+                BTHOME_TRACE_SCOPE(TRACE_FRAME, adv.hdr.mac);
+                n = encodeDecodedPayload(adv.hdr, res, extras, payload);
+            }
+            BTHOME_TRACE_SCOPE(TRACE_FANOUT, adv.hdr.mac);
+            for (uint8_t i = 0; i < impl->consumerCount; i++)
+                offer(impl->consumers[i], payload, n);
+        }
+    }
+}
+
+bool BLEScanner::consume(int id, JsonDocument &doc, char *mac, size_t macLen,
+                         uint32_t timeoutMs) {
+    if (!_impl || id < 0 || id >= _impl->consumerCount)
+        return false;
+    Impl::Consumer *c = _impl->consumers[id];
 
     size_t size = 0;
-    void *buffer = _impl->queue->receive(&size, 0);
-    if (buffer == nullptr)
+    void *item = c->ring.receive(&size, msToTicks(timeoutMs));
+    if (!item)
+        return false;
+    bool ok = decodeDecodedFrame((const uint8_t *)item, size, c->frame);
+    c->ring.return_item(item);
+    c->taken++;
+    if (!ok)
         return false;
 
-    JsonDocument rawDoc;
-    deserializeMsgPack(rawDoc, buffer, size);
-    _impl->queue->return_item(buffer);
-    _impl->received++;
+    const DecodedFrame &f = c->frame;
+    FrameExtras extras;
+    extras.name = f.localName;
+    extras.hasTxPower = f.hasTxPower;
+    extras.txPower = f.txPower;
+    toJson(f.adv, f.mac, (float)f.timeMs * 1.0e-3f, f.rssi, extras, doc);
+    copyMac(f.mac, mac, macLen);
+    return true;
+}
 
-    // Decode
-    JsonDocument decodedDoc;
-    bool decoded = deliver(rawDoc, decodedDoc);
-    if (decoded)
-        _impl->decoded++;
-
-    // Pick output document
-    JsonDocument &outDoc = decoded ? decodedDoc : rawDoc;
-
-    // Merge common metadata into decoded results
-    if (decoded) {
-        outDoc["mac"]  = rawDoc["mac"];
-        outDoc["time"] = rawDoc["time"];
-        outDoc["rssi"] = rawDoc["rssi"];
-        if (rawDoc["name"].is<const char*>())
-            outDoc["name"] = rawDoc["name"];
-        if (rawDoc["txpwr"].is<JsonVariant>())
-            outDoc["txpwr"] = rawDoc["txpwr"];
-
-        // Extract MAC (strip colons)
-        String macStr = rawDoc["mac"].as<String>();
-        macStr.replace(":", "");
-        size_t copyLen = macStr.length();
-        if (copyLen >= macLen)
-            copyLen = macLen - 1;
-        memcpy(mac, macStr.c_str(), copyLen);
-        mac[copyLen] = '\0';
-
-        // Move result into caller's doc
-        doc.set(outDoc);
-        return true;
+// Retry once() until it succeeds, sleeping on the queue whenever it is
+// empty, for up to timeoutMs. With window set, no sleep outlasts its active
+// window, so the summaries come out when it ends rather than with the next
+// advert or the timeout.
+template <typename Fn>
+static bool blockUntil(BLEScanner::Impl *impl, uint32_t timeoutMs, Fn once,
+                       const WindowAggregator *window = nullptr) {
+    TickType_t timeout = msToTicks(timeoutMs);
+    TickType_t start = xTaskGetTickCount();
+    while (true) {
+        if (once())
+            return true;
+        if (pending(impl) > 0)
+            continue;   // not decoded/wanted, try the next one
+
+        TickType_t left = portMAX_DELAY;
+        if (timeout != portMAX_DELAY) {
+            TickType_t elapsed = xTaskGetTickCount() - start;
+            if (elapsed >= timeout)
+                return false;
+            left = timeout - elapsed;
+        }
+        if (window && window->endUs() >= 0) {
+            int64_t untilEndUs = window->endUs() - esp_timer_get_time();
+            TickType_t untilEnd = untilEndUs > 0 ? pdMS_TO_TICKS((uint32_t)(untilEndUs / 1000)) + 1 : 0;
+            if (untilEnd < left)
+                left = untilEnd;
+        }
+        impl->queue->wait(left, impl->fastQueue);
+    }
+}
+
+bool BLEScanner::process(JsonDocument &doc, char *mac, size_t macLen, uint32_t timeoutMs) {
+    if (!_impl || !_impl->queue)
+        return false;
+    return blockUntil(_impl, timeoutMs,
+                      [&] { return process(doc, mac, macLen); }, _impl->window);
+}
+
+bool BLEScanner::processFrame(Print &out, uint32_t timeoutMs) {
+    if (!_impl || !_impl->queue)
+        return false;
+    return blockUntil(_impl, timeoutMs, [&] { return processFrame(out); });
+}
+
+bool BLEScanner::dispatch(uint32_t timeoutMs) {
+    if (!_impl || !_impl->queue)
+        return false;
+    return blockUntil(_impl, timeoutMs, [&] { return dispatch(); });
+}
+
+bool BLEScanner::forward(Print &out, uint32_t timeoutMs) {
+    if (!_impl || !_impl->queue)
+        return false;
+    return blockUntil(_impl, timeoutMs, [&] { return forward(out); });
+}
+
+// ---------------------------------------------------------------------------
+// Subscriptions
+// ---------------------------------------------------------------------------
+int BLEScanner::subscribe(const SubscriptionFilter &filter,
+                          SubscriptionCallback callback, void *ctx,
+                          QueueHandle_t queue) {
+    ensureImpl();
+    if (!callback && !queue)
+        return -1;
+    if (!filter.ok()) {
+        log_e("bad subscription filter (invalid MAC or more than %u)",
+              (unsigned)SubscriptionFilter::MAX_MACS);
+        return -1;
+    }
+
+    int id = -1;
+    xSemaphoreTake(_impl->configLock, portMAX_DELAY);
+    const Impl::Live *live = _impl->current.load();
+    for (int i = 0; i < MAX_SUBSCRIPTIONS && id < 0; i++)
+        if (!live->subs[i].used)
+            id = i;
+    if (id >= 0)
+        publish(_impl, [&](Impl::Live &l) {
+            auto &sub = l.subs[id];
+            sub.filter = filter;
+            sub.callback = callback;
+            sub.ctx = ctx;
+            sub.queue = queue;
+            sub.used = true;
+            l.subCount++;
+        });
+    xSemaphoreGive(_impl->configLock);
+    if (id < 0)
+        log_e("no free subscription slot (max %d)", MAX_SUBSCRIPTIONS);
+    return id;
+}
+
+int BLEScanner::subscribe(const SubscriptionFilter &filter,
+                          SubscriptionCallback callback, void *ctx) {
+    return subscribe(filter, callback, ctx, nullptr);
+}
+
+int BLEScanner::subscribe(const SubscriptionFilter &filter, QueueHandle_t queue) {
+    return subscribe(filter, nullptr, nullptr, queue);
+}
+
+void BLEScanner::unsubscribe(int id) {
+    if (!_impl || id < 0 || id >= MAX_SUBSCRIPTIONS)
+        return;
+    xSemaphoreTake(_impl->configLock, portMAX_DELAY);
+    if (_impl->current.load()->subs[id].used)
+        publish(_impl, [&](Impl::Live &l) {
+            l.subs[id].used = false;
+            l.subCount--;
+        });
+    xSemaphoreGive(_impl->configLock);
+}
+
+bool BLEScanner::resubscribe(int id, const SubscriptionFilter &filter) {
+    if (!_impl || id < 0 || id >= MAX_SUBSCRIPTIONS)
+        return false;
+    if (!filter.ok()) {
+        log_e("bad subscription filter (invalid MAC or more than %u)",
+              (unsigned)SubscriptionFilter::MAX_MACS);
+        return false;
     }
-    return false;
+    xSemaphoreTake(_impl->configLock, portMAX_DELAY);
+    bool used = _impl->current.load()->subs[id].used;
+    if (used)
+        publish(_impl, [&](Impl::Live &l) { l.subs[id].filter = filter; });
+    xSemaphoreGive(_impl->configLock);
+    return used;
 }
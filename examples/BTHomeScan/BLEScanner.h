@@ -1,17 +1,17 @@
 /// @file BLEScanner.h
 /// @brief Singleton BLE advertisement scanner with built-in device decoders.
 ///
-/// Scans for BLE advertisements in a dedicated FreeRTOS task and queues raw
-/// data via a ring buffer. The caller drains the queue from the main loop by
-/// calling process(), which deserializes, decodes (if a known device type is
-/// recognized), and returns a populated JsonDocument plus the device MAC.
+/// Scans for BLE advertisements in a dedicated FreeRTOS task and queues the
+/// raw advert bytes via a ring buffer. The radio backend is pluggable (see
+/// AdvertSource.h). The caller drains the queue from the main loop by calling
+/// process(), which decodes (if a known device type is recognized) and returns
+/// a populated JsonDocument plus the device MAC.
 ///
-/// Supported device decoders:
+/// Supported device decoders (see DeviceDecoders.h; more can be added with
+/// registerDecoder()):
 ///   - Ruuvi Tag (V5 format)
-///   - Mopeka tank level sensors
-///   - TPMS tire pressure sensors (0x0100 and 0x00AC variants)
-///   - Otodata tank monitors
-///   - Rotarex ELG level gauges
+///   - Mopeka Pro tank level sensors
+///   - TPMS tire pressure sensors (0x0100 variant)
 ///   - BTHome v2 (with optional AES decryption)
 ///
 /// Usage:
@@ -36,6 +36,18 @@
 #define ARDUINOJSON_USE_LONG_LONG 1
 #include "ArduinoJson.h"
 
+#include "AdvertQueue.h"
+#include "DecoderRegistry.h"
+#include "Subscription.h"
+#include "freertos/queue.h"
+
+class Arena;
+class AdvertRecorder;
+class AdvertSource;
+class HistoryStore;
+class Print;
+class StateStore;
+
 class BLEScanner {
 public:
     static BLEScanner &instance();
@@ -48,6 +60,12 @@ public:
 
     /// Initialize and start the BLE scanning RTOS task.
     /// Idempotent — second call is a no-op.
+    ///
+    /// scanTimeMs = 0 selects continuous mode: a single scan is started and
+    /// runs until the stack stops it, adverts are delivered through the
+    /// callback only (nothing is kept in BLEScanResults) and the scan is only
+    /// restarted if the controller ends it. Any other value runs periodic
+    /// scans of that length, rounded up to whole seconds.
     void begin(size_t ringBufSize = 2048,
                uint32_t scanTimeMs = 15000,
                uint16_t scanInterval = 100,
@@ -58,24 +76,329 @@ public:
 
     /// Drain one item from the ring buffer, decode and populate doc.
     /// mac is filled with the colon-stripped uppercase MAC (e.g. "AABBCCDDEEFF").
-    /// Returns true if an item was processed, false if queue was empty.
+    /// Returns true if an item was decoded, false if the queue was empty or
+    /// the item was not recognized.
     bool process(JsonDocument &doc, char *mac, size_t macLen);
 
+    /// Like process(), but block for up to timeoutMs (WAIT_FOREVER = no
+    /// limit) until an advert decodes. The calling task sleeps until the scan
+    /// task commits a record, so there is no need to poll with delay().
+    /// With setWindowAggregation() it also wakes when the active window
+    /// ends, so its summaries come out on time even if adverts stop.
+    bool process(JsonDocument &doc, char *mac, size_t macLen, uint32_t timeoutMs);
+
+    /// Block for up to timeoutMs until queued adverts are ready according to
+    /// setWakePolicy(). Returns true if any are queued. Uses the calling
+    /// task's notification value.
+    bool waitForData(uint32_t timeoutMs = WAIT_FOREVER);
+
+    /// Coalesce wake-ups for batch consumers: waitForData() and the blocking
+    /// process() return once minItems adverts are queued, or maxDelayMs after
+    /// the first of them arrived (0 = wait for minItems). The default (1, 0)
+    /// wakes on every advert.
+    void setWakePolicy(uint16_t minItems, uint32_t maxDelayMs = 0);
+
+    static constexpr uint32_t WAIT_FOREVER = UINT32_MAX;
+
+    /// Like process(), but write the result to out (e.g. Serial) as a
+    /// compact binary frame (see DecodedFrame.h) instead of building JSON,
+    /// 15-20 times fewer bytes than serializeJsonPretty(). Host tools turn
+    /// the frames back into JSON. Returns true if a frame was written.
+    bool processFrame(Print &out);
+
+    /// Like processFrame(), but block for up to timeoutMs until a frame is
+    /// written.
+    bool processFrame(Print &out, uint32_t timeoutMs);
+
+    /// Raw-forward mode for multi-gateway setups: drain one advert without
+    /// decoding it and write it to out (e.g. Serial) as an AdvertFrame (see
+    /// AdvertFrame.h) for a host aggregator. Returns true if a frame was
+    /// written. Forwarded adverts do not feed known-device admission or the
+    /// adaptive scheduler, which both learn from decoding.
+    bool forward(Print &out);
+
+    /// Like forward(), but block for up to timeoutMs until a frame is written.
+    bool forward(Print &out, uint32_t timeoutMs);
+
+    static constexpr int MAX_CONSUMERS = 4;
+
+    /// Give a task its own copy of the decoded advert stream. begin() then
+    /// starts a fan-out task that drains the queue, decodes each advert once
+    /// (routing it to subscribers too) and appends it as a compact frame
+    /// (see DecodedFrame.h) to every consumer's ring of bytes (allocated
+    /// with caps). A consumer that falls behind only fills its own ring and
+    /// loses its own adverts; the others are unaffected. The fan-out task
+    /// is then the queue's only reader: do not also call process(),
+    /// processFrame(), dispatch() or forward(). Returns the consumer id for
+    /// consume(), or -1 if out of slots or memory. Call before begin().
+    int addConsumer(size_t bytes = 4096, UBaseType_t caps = MALLOC_CAP_DEFAULT);
+
+    /// Like process(), for consumer id: take the next advert from its ring,
+    /// blocking for up to timeoutMs. Call from one task per consumer.
+    bool consume(int id, JsonDocument &doc, char *mac, size_t macLen,
+                 uint32_t timeoutMs = 0);
+
+    static constexpr int MAX_SUBSCRIPTIONS = 8;
+
+    /// Call callback with every measurement matching filter, from the task
+    /// that runs process() or dispatch(). Returns a subscription id, or -1
+    /// if all MAX_SUBSCRIPTIONS slots are taken or the filter is bad (see
+    /// SubscriptionFilter::ok()).
+    int subscribe(const SubscriptionFilter &filter,
+                  SubscriptionCallback callback, void *ctx = nullptr);
+
+    /// Like subscribe(filter, callback), but post each match as a
+    /// SubscribedValue to queue (created with item size
+    /// sizeof(SubscribedValue)) without blocking; a full queue drops it.
+    int subscribe(const SubscriptionFilter &filter, QueueHandle_t queue);
+
+    void unsubscribe(int id);
+
+    /// Replace the filter of subscription id while scanning. The decode
+    /// path never sees a half-written filter: it switches between two
+    /// adverts. Returns false if id is not subscribed or the filter is bad.
+    bool resubscribe(int id, const SubscriptionFilter &filter);
+
+    /// Drain one advert and route it to subscribers only, without building
+    /// JSON. Adverts from devices no subscriber selected are not decoded,
+    /// and objects none of their subscribers selected are skipped unscaled.
+    /// Returns true if a measurement was routed.
+    bool dispatch();
+
+    /// Like dispatch(), but block for up to timeoutMs until a measurement
+    /// has been routed.
+    bool dispatch(uint32_t timeoutMs);
+
+    /// Take all scanner memory from arena instead of the heap (see Arena.h):
+    /// the implementation state, device tables, advert queues, consumer
+    /// rings, window pools, mutexes and task stacks (task stacks then live
+    /// wherever the arena does; PSRAM stacks need
+    /// CONFIG_SPIRAM_ALLOW_STACK_EXTERNAL_MEMORY). Together with a JsonPool
+    /// for the documents, decoding adverts never calls malloc. Must be the
+    /// first call on the scanner; returns false otherwise, or if the arena
+    /// is too small for the state.
+    bool setArena(Arena *arena);
+
     /// Set BTHome decryption key (32-char hex string). Empty disables decryption.
+    /// The key is parsed immediately; the string need not outlive the call.
     void setBTHomeKey(const char *hexKey);
 
+    /// Decode service data with 16-bit UUID id (SERVICE_DATA_16) or
+    /// manufacturer data with company id (MANUFACTURER) using fn, replacing
+    /// any built-in decoder for it. Call before begin().
+    bool registerDecoder(DecoderRegistry::Kind kind, uint16_t id,
+                         AdvertDecoderFn fn, void *ctx = nullptr);
+
     /// Enable or disable active scanning. Call before begin().
     void setActiveScan(bool active);
 
+    /// Admission policy for the advert queue: capacity reserved for trigger
+    /// and known-device adverts, and which classes may evict older records
+    /// when full (see AdvertQueue.h). Call before begin().
+    void setQueuePolicy(const AdvertQueue::Policy &policy);
+
+    /// Back the advert queue with an overflow ring of bytes in memory with
+    /// caps (PSRAM by default; see AdvertQueue::Spill). The ring passed to
+    /// begin() then only has to absorb the BLE callback between two mover
+    /// runs and can stay small and internal: a mover task moves its oldest
+    /// adverts to the overflow ring once it is highPercent full, so a burst
+    /// queues in PSRAM instead of being dropped, and the consumer still
+    /// reads one queue in capture order. The admission policy covers both
+    /// rings. 0 disables it (the default). Call before begin().
+    void setQueueSpill(size_t bytes, uint8_t highPercent = 50,
+                       UBaseType_t caps = MALLOC_CAP_SPIRAM);
+
+    /// With active scanning, hold each scannable advert for up to windowMs
+    /// until its scan response arrives and queue the two as one record (see
+    /// ScanResponseMerger.h), so each device event is queued and decoded
+    /// once, with the name from the response alongside the sensor data.
+    /// Adverts whose response does not come in time are queued alone. Costs
+    /// up to windowMs of latency for scannable adverts; 20-50 ms covers the
+    /// response delay of common stacks. 0 disables it (the default). Call
+    /// before begin().
+    void setScanResponseMerge(uint32_t windowMs);
+
+    /// Size of the trigger fast lane: a small internal-RAM queue that only
+    /// carries trigger-based BTHome adverts (buttons, doors) and is always
+    /// drained before the main queue. 0 disables it. Default 512. Call
+    /// before begin().
+    void setFastLane(size_t bytes);
+
+    /// Use a specific radio backend (see AdvertSource.h), e.g. a
+    /// HostReplaySource on Linux. Defaults to the backend compiled in for the
+    /// target (Bluedroid, or NimBLE with -DBTHOME_USE_NIMBLE). Call before begin().
+    void setAdvertSource(AdvertSource *source);
+
+    /// Append every received advert to recorder (see AdvertRecorder.h),
+    /// before queue admission, so field captures include what the queue
+    /// dropped. nullptr detaches it. May be called while scanning.
+    void setRecorder(AdvertRecorder *recorder);
+
+    /// Append every decoded measurement to history (see HistoryStore.h),
+    /// timestamped in milliseconds on the capture clock (esp_timer), for
+    /// backfill after an uplink outage. The store is only touched from the
+    /// task calling process(), processFrame() or dispatch(); read it from
+    /// that task too. HistoryStore is not thread-safe and with addConsumer()
+    /// consumers the fan-out task would append to it, so this returns false
+    /// (and addConsumer() refuses while a store is attached). nullptr
+    /// detaches it.
+    bool setHistory(HistoryStore *history);
+
+    /// Learn the advertising period of every successfully decoded device and
+    /// only scan around their expected arrivals (plus a periodic discovery
+    /// scan) instead of continuously. Requires continuous mode
+    /// (scanTimeMs = 0). Call before begin().
+    void setAdaptiveScan(bool enable);
+
+    /// Make process() emit one summary per device every windowMs instead of
+    /// one document per advert: count, min, max, mean, last, sum and (with
+    /// variance) stddev of each measurement over the window, "time" being
+    /// the window start (see WindowAggregator.h). slots bounds the (device,
+    /// measurement) pairs tracked per window. Subscribers still get every
+    /// measurement. 0 disables it (the default). Call before begin().
+    void setWindowAggregation(uint32_t windowMs, uint16_t slots = 128,
+                              bool variance = true);
+
+    /// Persist the BTHome key and per-device state (last encryption counter
+    /// and packet id, learned advertising period) in store (see
+    /// StateStore.h). begin() restores it with one bulk read before the scan
+    /// starts, so a warm start admits known devices, checks counters and
+    /// schedules adaptive scans from the first advert. A key set with
+    /// setBTHomeKey() wins over the stored one. Call before begin().
+    void setStateStore(StateStore *store, uint32_t saveIntervalMs = 300000);
+
+    /// Write the state that changed since the last save, at most every
+    /// saveIntervalMs unless force. Call from the task calling process()
+    /// (e.g. in loop()), and with force before a planned restart. Returns
+    /// the bytes written. Safe alongside addConsumer(): the device table is
+    /// copied under a lock.
+    size_t saveState(bool force = false);
+
+    /// Drop BTHome adverts whose encryption counter is not above the last
+    /// one accepted from the device (replays, and the repeats a device
+    /// sends of one reading), and plaintext ones repeating the last packet
+    /// id. Counters are only learned from adverts that decrypted. Default
+    /// off.
+    void setReplayProtection(bool enable);
+
+    /// Settings reconfigure() can change while scanning. Fields left at their
+    /// defaults keep the current value.
+    struct RuntimeConfig {
+        uint16_t scanInterval = 0;  ///< ms, 0 = keep
+        uint16_t scanWindow = 0;    ///< ms, 0 = keep
+        int8_t activeScan = -1;     ///< 1 active, 0 passive, -1 = keep
+        size_t ringBufSize = 0;     ///< Advert queue bytes, 0 = keep
+        UBaseType_t ringBufCap = MALLOC_CAP_DEFAULT;    ///< Heap caps of the resized queue
+        int taskPriority = -1;      ///< Scan and fan-out task priority, -1 = keep
+        const char *bthomeKey = nullptr;    ///< 32 hex chars, "" = none, nullptr = keep
+    };
+
+    /// Apply config without restarting the scan task. The BTHome key (and
+    /// subscribe(), unsubscribe(), resubscribe()) are swapped between two
+    /// adverts; decoding never waits on a lock for them. Scan parameters are
+    /// taken up at the next scan boundary: at once in continuous mode (the
+    /// scan is stopped and restarted), otherwise when the current scan or
+    /// window ends. A new queue size takes effect at once; the queued
+    /// adverts are read from the old ring first, which is then freed, so
+    /// none is lost. Blocks until the scan task has the new parameters, for
+    /// up to timeoutMs, without holding up other configuration calls.
+    /// Returns false if the key is invalid (nothing is changed), the queue
+    /// cannot be reallocated or a previous resize is still draining (it is
+    /// kept) or the scan parameters are still pending at timeoutMs (they
+    /// apply later). Call after begin(), not from a subscription callback.
+    bool reconfigure(const RuntimeConfig &config, uint32_t timeoutMs = 1000);
+
+    /// The tasks the scanner's work runs on, indexing Stats::tasks.
+    enum TaskId : uint8_t {
+        TASK_RADIO,     ///< BLE stack callback: capture, merging, enqueueing
+        TASK_SCAN,      ///< ble_scan: scan parameters and merge windows
+        TASK_SPILL,     ///< ble_spill: the overflow ring mover (setQueueSpill())
+        TASK_FANOUT,    ///< ble_fanout: decoding for addConsumer() consumers
+        TASK_CONSUMER,  ///< Last task to call process(), processFrame(), dispatch() or forward()
+        TASK_COUNT
+    };
+
+    /// Load and stack headroom of one task. busyUs is the wall time
+    /// (esp_timer) spent inside each stage of the scanner's own work on the
+    /// task, not CPU time: it includes blocking on the scanner's mutexes and
+    /// preemption by higher-priority tasks, and leaves out waiting on the BLE
+    /// stack to start or stop a scan. cpuPercent is CPU time, from the
+    /// FreeRTOS run-time counters, for the whole task (the scanner's work or
+    /// not) since the previous stats() call; it needs
+    /// CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS.
+    struct TaskStats {
+        const char *name;     ///< Task name, nullptr if the task has not run
+        uint32_t stackBytes;  ///< Stack size, 0 for tasks the scanner did not create
+        uint32_t stackFreeMin; ///< Least free stack so far (high-water mark), bytes
+        uint64_t busyUs;      ///< Wall time spent in the scanner's work since begin()
+        uint8_t busyPercent;  ///< busyUs as a share of the time since begin()
+        uint8_t cpuPercent;   ///< Share of one core's time since the previous stats()
+        bool hasCpu;          ///< cpuPercent is valid (run-time stats, not the first call)
+    };
+
+    /// Per consumer (addConsumer()) statistics.
+    struct ConsumerStats {
+        uint32_t delivered;   ///< Adverts appended to the consumer's ring
+        uint32_t taken;       ///< Adverts consume() returned or discarded
+        uint32_t dropped;     ///< Adverts lost to a full ring
+        uint32_t lag;         ///< Adverts waiting in the ring
+        uint32_t maxLag;      ///< Most adverts ever waiting
+        size_t freeBytes;     ///< Ring space left
+    };
+
     /// Ring buffer and queue statistics.
     struct Stats {
         size_t hwmBytes;      ///< High water mark (peak bytes used)
         size_t totalBytes;    ///< Ring buffer total capacity
         uint8_t hwmPercent;   ///< High water mark as percentage of total
+        size_t usedBytes;     ///< Ring buffer bytes used now
+        size_t spillBytes;    ///< Overflow ring capacity (setQueueSpill(), 0 = none)
+        size_t spillHwmBytes; ///< Overflow ring high water mark
+        size_t spillUsedBytes; ///< Overflow ring bytes used now
+        uint32_t spilled;     ///< Adverts the mover task moved to the overflow ring
+        uint32_t spilledInline; ///< Adverts moved by the BLE callback, ring full before the mover ran
+        uint32_t spillFull;   ///< Moves refused with the overflow ring full
         uint32_t queueFull;   ///< Times send_complete failed (queue full)
-        uint32_t acquireFail; ///< Times send_acquire failed (no space)
+        uint32_t acquireFail; ///< Adverts the queue refused (all classes)
+        uint32_t lockBusy;    ///< Of those, adverts dropped because the queue was locked
+        uint32_t knownRotations; ///< Times the oldest generation of known devices was forgotten
         uint32_t received;    ///< Total messages dequeued
         uint32_t decoded;     ///< Messages matched by a decoder
+        uint32_t wakeups;     ///< Times a blocked consumer was woken by the scan task
+        uint32_t routed;      ///< Measurements handed to subscribers
+        uint32_t subDropped;  ///< Measurements lost to full subscriber queues
+        uint32_t mergeHeld;   ///< Scannable adverts held for their scan response
+        uint32_t merged;      ///< Adverts queued together with their scan response
+        uint32_t mergeAlone;  ///< Held adverts queued without one
+        uint32_t mergeOrphans; ///< Scan responses queued alone, their advert not held
+        uint32_t reconfigs;   ///< reconfigure() calls
+        uint32_t reconfigLastUs; ///< Time the last reconfigure() took to take effect
+        uint32_t reconfigMaxUs; ///< Longest reconfigure()
+        uint32_t scanRestarts; ///< Times the scan had to be (re)started
+        uint64_t scanGapUs;   ///< Total time spent not scanning between scans
+        uint32_t maxScanGapUs; ///< Longest single gap between two scans
+        uint32_t adaptivePredicted; ///< Arrivals predicted by the adaptive scheduler
+        uint32_t adaptiveHits; ///< Predicted arrivals that were observed
+        uint8_t dutyPercent;  ///< Adaptive scan duty cycle (100 when not adaptive)
+        AdvertQueue::ClassStats cls[ADV_CLASS_COUNT]; ///< Per admission class (AdvertClass order)
+        AdvertQueue::ClassStats fastLane; ///< Trigger fast lane (drops there fall back to the main queue)
+        uint32_t latencyAvgUs[ADV_CLASS_COUNT]; ///< Mean capture-to-dequeue time per class
+        uint32_t latencyMaxUs[ADV_CLASS_COUNT]; ///< Worst capture-to-dequeue time per class
+        uint32_t windowSummaries; ///< Window summaries emitted by process()
+        uint32_t windowOverflow; ///< Measurements not aggregated, window slots full
+        uint32_t windowDiscarded; ///< Window summaries lost, process() not called in time
+        uint32_t replayed;    ///< Adverts dropped by replay protection
+        uint16_t restoredDevices; ///< Devices restored from the state store by begin()
+        uint32_t restoreUs;   ///< Time begin() spent restoring state
+        uint32_t firstDecodeMs; ///< From begin() to the first decoded advert, 0 if none yet
+        uint8_t consumerCount;
+        ConsumerStats consumers[MAX_CONSUMERS]; ///< By consumer id
+        TaskStats tasks[TASK_COUNT]; ///< By TaskId
+        /// taskStackSize for begin() that fits the deepest stack use seen on
+        /// ble_scan and ble_fanout with a quarter spare (at least 512 bytes),
+        /// rounded up to 256. 0 until measured. Only as good as the traffic
+        /// seen: run it past encrypted adverts and every decoder in use.
+        uint32_t suggestedStackSize;
     };
 
     /// Return current ring buffer statistics.
@@ -84,8 +407,12 @@ public:
 private:
     BLEScanner() = default;
 
+    /// The state, created on first use (from arena if given, see setArena()).
+    Impl *ensureImpl(Arena *arena = nullptr);
+
     Impl *_impl = nullptr;
     bool _started = false;
 
-    bool deliver(JsonDocument &rawDoc, JsonDocument &outDoc);
+    int subscribe(const SubscriptionFilter &filter, SubscriptionCallback callback,
+                  void *ctx, QueueHandle_t queue);
 };
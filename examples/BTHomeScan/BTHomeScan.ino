@@ -3,41 +3,301 @@
  *
  * Scans for BLE advertisements on an ESP32, decodes any BTHome v2
  * payloads, and prints them as pretty-printed JSON on Serial.
+ *
+ * Define FORWARD_RAW to run as a gateway for the host aggregator
+ * (extras/host/aggregator) instead: every advert is written to Serial as a
+ * binary frame and decoded on the host.
+ *
+ * Define BINARY_OUTPUT to decode on the ESP32 but write compact binary
+ * frames instead of JSON, 15-20 times fewer bytes per advert; run
+ * extras/host/framecat on the other end of the serial port to get JSON or
+ * line protocol back.
+ *
+ * Define WINDOW_MS to print one summary per device every WINDOW_MS
+ * milliseconds (count, min, max, mean, last, sum, stddev per measurement)
+ * instead of every advert.
+ *
+ * Define KEEP_HISTORY to also keep every decoded measurement in a
+ * compressed history (PSRAM if the board has it) and send 'H' over serial
+ * to print it, one line per sample, e.g. to backfill after an outage.
+ *
+ * Define PERSIST_STATE to keep the key, known devices, encryption counters
+ * and learned advertising periods in NVS across reboots (saved every five
+ * minutes), with replay protection on, and print how long the first
+ * decoded advert took after begin().
+ *
+ * Define DISPLAY_TASK to consume the decoded stream from two tasks at once:
+ * loop() prints JSON while a second task prints one short line per advert,
+ * each from its own queue (BLEScanner::addConsumer()), so a slow reader
+ * never holds up the other.
+ *
+ * Define HEAP_FREE to take all scanner memory (state, queues, task stacks)
+ * from a static arena and build the JSON documents in a fixed pool, so that
+ * once begin() returns, decoding and printing adverts never calls malloc.
+ *
+ * Build with -DBTHOME_TRACE (the esp32dev_trace environment) to time every
+ * stage of the advert path and send 'T' over serial to dump the spans as
+ * Chrome trace JSON; save it to a file and open it in ui.perfetto.dev.
+ *
+ * Define RECORD_ADVERTS to also keep the latest raw adverts in a RAM ring
+ * (PSRAM if the board has it). Send 'D' over serial to export them as a
+ * capture file (extras/host/capture pulls and reads it) and 'C' to clear.
+ *
+ * Define BATCH_PUBLISH to publish every measurement to an MQTT broker over
+ * Wi-Fi instead of printing it: values of all devices are batched into one
+ * JSON message every five seconds, a newer value replacing an older one of
+ * the same sensor, and button presses go out at once. Set the Wi-Fi and
+ * broker settings below.
+ *
+ * Define TASK_LOAD to send 'L' over serial and print, per task the scanner
+ * runs on, the share of time it spent in the scanner's work (wall time),
+ * its CPU share since the last 'L' (with FreeRTOS run-time stats enabled)
+ * and its least free stack so far, with a task stack size for begin() that
+ * fits what was seen.
  */
 
+// #define FORWARD_RAW
+// #define BINARY_OUTPUT
+// #define WINDOW_MS 60000
+// #define KEEP_HISTORY
+// #define PERSIST_STATE
+// #define DISPLAY_TASK
+// #define HEAP_FREE
+// #define RECORD_ADVERTS
+// #define BATCH_PUBLISH
+// #define TASK_LOAD
+
+#if defined(DISPLAY_TASK) && defined(KEEP_HISTORY)
+#error "KEEP_HISTORY reads the history from loop(), DISPLAY_TASK appends to it on ble_fanout"
+#endif
+
 #include <Arduino.h>
 #include <ArduinoJson.h>
 #include <BLEScanner.h>
+#include <BTHomeTrace.h>
 
 #ifdef BOARD_HAS_PSRAM
     #define RBMEM MALLOC_CAP_SPIRAM
+    #define RECORDER_BYTES (1024 * 1024)
 #else
     #define RBMEM MALLOC_CAP_DEFAULT
+    #define RECORDER_BYTES (32 * 1024)
 #endif
 
 static auto &bleScanner = BLEScanner::instance();
 
+#ifdef KEEP_HISTORY
+#include <HistoryStore.h>
+static HistoryStore history;
+
+static void printHistory() {
+    HistoryStore::Cursor c = history.read();
+    HistorySample s;
+    while (c.next(s))
+        Serial.printf("%lld %02X:%02X:%02X:%02X:%02X:%02X %s=%g%s\n", (long long)s.timeMs,
+                      s.mac[0], s.mac[1], s.mac[2], s.mac[3], s.mac[4], s.mac[5],
+                      s.value.name, s.value.value, s.value.unit);
+}
+#endif
+
+#ifdef TASK_LOAD
+static void printTaskLoad() {
+    BLEScanner::Stats st = bleScanner.stats();
+    for (const BLEScanner::TaskStats &t : st.tasks) {
+        if (!t.name)
+            continue;
+        Serial.printf("%-12s %3u%% busy, ", t.name, t.busyPercent);
+        if (t.hasCpu)
+            Serial.printf("%3u%% cpu, ", t.cpuPercent);
+        Serial.printf("least stack free %u bytes", t.stackFreeMin);
+        if (t.stackBytes)
+            Serial.printf(" of %u", t.stackBytes);
+        Serial.println();
+    }
+    if (st.suggestedStackSize)
+        Serial.printf("suggested task stack size: %u\n", st.suggestedStackSize);
+}
+#endif
+
+#ifdef PERSIST_STATE
+#include <StateStore.h>
+static NvsStateBackend stateBackend;
+static StateStore state(stateBackend);
+#endif
+
+#ifdef DISPLAY_TASK
+static int mainConsumer = -1;
+
+static void displayTask(void *param) {
+    int id = (int)(intptr_t)param;
+    JsonDocument doc;
+    char mac[16];
+    while (true) {
+        if (bleScanner.consume(id, doc, mac, sizeof(mac), BLEScanner::WAIT_FOREVER))
+            Serial.printf("%s %d dBm, %u values\n", mac, doc["rssi"].as<int>(),
+                          (unsigned)doc["measurements"].size());
+    }
+}
+#endif
+
+#ifdef HEAP_FREE
+#include <Arena.h>
+#include <JsonPool.h>
+alignas(8) static uint8_t scannerMemory[48 * 1024];
+static Arena arena(scannerMemory, sizeof(scannerMemory));
+alignas(8) static uint8_t jsonMemory[8 * 1024];
+static JsonPool jsonPool(jsonMemory, sizeof(jsonMemory));
+#endif
+
+#ifdef RECORD_ADVERTS
+#include <AdvertRecorder.h>
+// For a capture that survives resets, add a data partition named "bthcap"
+// and use recorder.beginPartition("bthcap") instead of begin().
+static AdvertRecorder recorder;
+#endif
+
+#ifdef BATCH_PUBLISH
+#include <WiFi.h>
+#include <MqttTransport.h>
+#include <PublishSink.h>
+#include "esp_timer.h"
+#define WIFI_SSID "your-ssid"
+#define WIFI_PASSWORD "your-password"
+#define MQTT_HOST "192.168.1.10"
+static WiFiClient wifiClient;
+static MqttTransport mqtt(wifiClient);
+static PublishSink publisher(mqtt);
+#endif
+
 void setup() {
     Serial.begin(115200);
 
+#ifdef HEAP_FREE
+    bleScanner.setArena(&arena);    // before any other scanner call
+#endif
+
     // Optional: set a BTHome decryption key (32-char hex string)
     // bleScanner.setBTHomeKey("00112233445566778899aabbccddeeff");
 
+#ifdef WINDOW_MS
+    bleScanner.setWindowAggregation(WINDOW_MS);
+#endif
+
+#ifdef PERSIST_STATE
+    bleScanner.setStateStore(&state);
+    bleScanner.setReplayProtection(true);
+#endif
+
+#if defined(BOARD_HAS_PSRAM) && !defined(HEAP_FREE)
+    // The ring below stays in internal RAM for the BLE callback; bursts
+    // spill over into PSRAM instead of being dropped
+    bleScanner.setQueueSpill(64 * 1024);
+#endif
+
+#ifdef DISPLAY_TASK
+    mainConsumer = bleScanner.addConsumer();
+    int displayConsumer = bleScanner.addConsumer(2048);
+    xTaskCreate(displayTask, "display", 4096, (void *)(intptr_t)displayConsumer, 1, nullptr);
+#endif
+
     bleScanner.begin(4096,   // ring buffer size
-                     1000,   // scan time (ms)
+                     0,      // scan time (ms), 0 = continuous
                      100,    // scan interval
                      99,     // scan window
                      4096,   // task stack size
                      1,      // task priority
-                     RBMEM); // ring buffer memory capability
+                     MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT); // ring buffer memory capability
+
+#ifdef KEEP_HISTORY
+    HistoryStore::Config historyConfig;
+    historyConfig.caps = RBMEM;
+    history.begin(historyConfig);
+    bleScanner.setHistory(&history);
+#endif
+
+#ifdef RECORD_ADVERTS
+    recorder.begin(RECORDER_BYTES, RBMEM);
+    bleScanner.setRecorder(&recorder);
+#endif
+
+#ifdef BATCH_PUBLISH
+    WiFi.begin(WIFI_SSID, WIFI_PASSWORD);   // MqttTransport retries until it is up
+    MqttTransport::Config mqttConfig;
+    mqttConfig.host = MQTT_HOST;
+    mqttConfig.clientId = "bthome-gateway";
+    mqtt.begin(mqttConfig);
+    publisher.begin(PublishSink::Config());
+    bleScanner.subscribe(SubscriptionFilter(), PublishSink::onValue, &publisher);
+#endif
 }
 
 void loop() {
+#ifdef PERSIST_STATE
+    static bool firstDecodeShown = false;
+    BLEScanner::Stats st = bleScanner.stats();
+    if (!firstDecodeShown && st.firstDecodeMs) {
+        Serial.printf("first advert decoded %u ms after begin(), %u devices restored in %u us\n",
+                      st.firstDecodeMs, st.restoredDevices, st.restoreUs);
+        firstDecodeShown = true;
+    }
+    bleScanner.saveState();
+#endif
+
+#ifdef KEEP_HISTORY
+    if (Serial.peek() == 'H') {
+        Serial.read();
+        printHistory();
+    }
+#endif
+
+#ifdef TASK_LOAD
+    if (Serial.peek() == 'L') {
+        Serial.read();
+        printTaskLoad();
+    }
+#endif
+
+#ifdef BTHOME_TRACE
+    if (Serial.peek() == 'T') {
+        Serial.read();
+        BTHomeTrace::dump(Serial);
+    }
+#endif
+
+#ifdef RECORD_ADVERTS
+    int cmd = Serial.read();
+    if (cmd == 'D')
+        recorder.exportTo(Serial);
+    else if (cmd == 'C')
+        recorder.clear();
+    recorder.flush();
+#endif
+
+#if defined(DISPLAY_TASK)
     JsonDocument doc;
     char mac[16];
-    if (bleScanner.process(doc, mac, sizeof(mac))) {
+    if (bleScanner.consume(mainConsumer, doc, mac, sizeof(mac), 1000)) {
         serializeJsonPretty(doc, Serial);
         Serial.println();
     }
-    delay(10);
+#elif defined(BATCH_PUBLISH)
+    bleScanner.dispatch(100);
+    publisher.poll(esp_timer_get_time());
+#elif defined(FORWARD_RAW)
+    bleScanner.forward(Serial, 1000);
+#elif defined(BINARY_OUTPUT)
+    bleScanner.processFrame(Serial, 1000);
+#else
+#ifdef HEAP_FREE
+    JsonDocument doc(&jsonPool);
+#else
+    JsonDocument doc;
+#endif
+    char mac[16];
+    // Sleeps until the scan task queues an advert, no polling delay needed
+    if (bleScanner.process(doc, mac, sizeof(mac), 1000)) {
+        serializeJsonPretty(doc, Serial);
+        Serial.println();
+    }
+#endif
 }
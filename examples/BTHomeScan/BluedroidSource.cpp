@@ -0,0 +1,99 @@
+// AdvertSource on the Arduino-ESP32 Bluedroid stack.
+//
+// BLEDevice is only used to bring the controller up. Scanning goes straight
+// through esp_ble_gap_* with a custom GAP handler, so BLEScan never builds a
+// BLEAdvertisedDevice (and its String fields) per advert.
+
+#if defined(ESP_PLATFORM) && !defined(BTHOME_USE_NIMBLE)
+
+#include "AdvertSource.h"
+
+#include <Arduino.h>
+#include <BLEDevice.h>
+#include "esp_gap_ble_api.h"
+#include "esp_timer.h"
+
+class BluedroidSource : public AdvertSource {
+public:
+    bool init(const ScanParams &params, AdvertSink *sink) override {
+        _sink = sink;
+        BLEDevice::init("");
+        BLEDevice::setCustomGapHandler(gapHandler);
+        return setParams(params);
+    }
+
+    bool setParams(const ScanParams &params) override {
+        esp_ble_scan_params_t sp = {};
+        sp.scan_type          = params.active ? BLE_SCAN_TYPE_ACTIVE : BLE_SCAN_TYPE_PASSIVE;
+        sp.own_addr_type      = BLE_ADDR_TYPE_PUBLIC;
+        sp.scan_filter_policy = BLE_SCAN_FILTER_ALLOW_ALL;
+        sp.scan_interval      = (uint16_t)(params.intervalMs * 16 / 10); // 0.625 ms units
+        sp.scan_window        = (uint16_t)(params.windowMs * 16 / 10);
+        sp.scan_duplicate     = BLE_SCAN_DUPLICATE_DISABLE;
+        esp_err_t err = esp_ble_gap_set_scan_params(&sp);
+        if (err != ESP_OK) {
+            log_e("esp_ble_gap_set_scan_params: %d", err);
+            return false;
+        }
+        return true;
+    }
+
+    bool start(uint32_t durationMs, EndCallback onEnd, void *arg) override {
+        _onEnd = onEnd;
+        _onEndArg = arg;
+        // The GAP API takes whole seconds; round up so short scans are not 0 (forever)
+        uint32_t seconds = (durationMs + 999) / 1000;
+        return esp_ble_gap_start_scanning(seconds) == ESP_OK;
+    }
+
+    void stop() override {
+        esp_ble_gap_stop_scanning();
+    }
+
+    const char *name() const override {
+        return "bluedroid";
+    }
+
+private:
+    static void gapHandler(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t *param);
+
+    AdvertSink *_sink = nullptr;
+    EndCallback _onEnd = nullptr;
+    void *_onEndArg = nullptr;
+};
+
+static BluedroidSource s_source;
+
+void BluedroidSource::gapHandler(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t *param) {
+    if (event != ESP_GAP_BLE_SCAN_RESULT_EVT)
+        return;
+
+    const auto &r = param->scan_rst;
+    if (r.search_evt == ESP_GAP_SEARCH_INQ_CMPL_EVT) {
+        if (s_source._onEnd)
+            s_source._onEnd(s_source._onEndArg);
+        return;
+    }
+    if (r.search_evt != ESP_GAP_SEARCH_INQ_RES_EVT || !s_source._sink)
+        return;
+
+    RawAdvert adv;
+    adv.hdr.timeUs   = esp_timer_get_time();
+    memcpy(adv.hdr.mac, r.bda, 6);
+    adv.hdr.addrType = (uint8_t)r.ble_addr_type;
+    adv.hdr.rssi     = (int8_t)r.rssi;
+    adv.hdr.flags    = r.ble_evt_type == ESP_BLE_EVT_SCAN_RSP ? ADV_FLAG_SCAN_RSP
+                     : r.ble_evt_type == ESP_BLE_EVT_CONN_ADV ||
+                               r.ble_evt_type == ESP_BLE_EVT_DISC_ADV ? ADV_FLAG_SCANNABLE
+                     : 0;
+    size_t len = (size_t)r.adv_data_len + r.scan_rsp_len;
+    adv.hdr.len      = (uint8_t)(len > ADVERT_MAX_DATA ? ADVERT_MAX_DATA : len);
+    adv.data         = r.ble_adv;
+    s_source._sink->onAdvert(adv);
+}
+
+AdvertSource *defaultAdvertSource() {
+    return &s_source;
+}
+
+#endif
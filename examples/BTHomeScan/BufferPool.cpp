@@ -0,0 +1,78 @@
+#include "BufferPool.h"
+
+#include <cstring>
+
+void BufferPool::begin(void *buffer, size_t bytes) {
+    // Round the start up to 8 bytes, and the usable size down
+    uintptr_t start = ((uintptr_t)buffer + 7) & ~(uintptr_t)7;
+    size_t skip = start - (uintptr_t)buffer;
+    _base = buffer && bytes > skip ? (uint8_t *)start : nullptr;
+    _size = _base ? (bytes - skip) & ~(size_t)7 : 0;
+    _used = 0;
+    _live = 0;
+    _stats = {};
+}
+
+bool BufferPool::isLast(const Header *h) const {
+    return (const uint8_t *)h + sizeof(Header) + h->size == _base + _used;
+}
+
+void *BufferPool::allocate(size_t bytes) {
+    size_t need = sizeof(Header) + rounded(bytes);
+    if (need > _size - _used || bytes > UINT32_MAX) {
+        _stats.failures++;
+        return nullptr;
+    }
+    Header *h = (Header *)(_base + _used);
+    h->size = (uint32_t)rounded(bytes);
+    _used += need;
+    _live++;
+    _stats.allocations++;
+    if (_used > _stats.peakBytes)
+        _stats.peakBytes = _used;
+    return h + 1;
+}
+
+void BufferPool::deallocate(void *p) {
+    if (!p)
+        return;
+    Header *h = (Header *)p - 1;
+    // The last block gives its space back at once
+    if (isLast(h))
+        _used -= sizeof(Header) + h->size;
+    if (--_live == 0) {
+        _used = 0;
+        _stats.resets++;
+    }
+}
+
+void *BufferPool::reallocate(void *p, size_t bytes) {
+    if (!p)
+        return allocate(bytes);
+    Header *h = (Header *)p - 1;
+    size_t size = rounded(bytes);
+    if (size <= h->size) {
+        if (isLast(h))
+            _used -= h->size - size;
+        h->size = (uint32_t)size;
+        return p;
+    }
+    if (isLast(h)) {
+        if (size - h->size > _size - _used) {
+            _stats.failures++;
+            return nullptr;
+        }
+        _used += size - h->size;
+        h->size = (uint32_t)size;
+        _stats.allocations++;
+        if (_used > _stats.peakBytes)
+            _stats.peakBytes = _used;
+        return p;
+    }
+    void *q = allocate(bytes);
+    if (!q)
+        return nullptr;
+    memcpy(q, p, h->size);
+    deallocate(p);
+    return q;
+}
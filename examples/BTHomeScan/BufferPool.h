@@ -0,0 +1,62 @@
+/// @file BufferPool.h
+/// @brief malloc-like allocator over a fixed buffer for short-lived data.
+///
+/// Allocations are carved off the buffer in order, each behind an 8-byte
+/// header holding its size. Freed blocks are not reused one by one: once
+/// every allocation has been freed the whole buffer is available again.
+/// That fits data built and dropped per advert (a JsonDocument, see
+/// JsonPool.h) exactly, costs a few instructions per call, and cannot
+/// fragment. A block that is still the last one grows and shrinks in place.
+///
+/// When the buffer is full, allocate() returns nullptr and counts a
+/// failure; it never falls back to the heap. Not thread-safe: use one pool
+/// per task.
+
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+class BufferPool {
+public:
+    struct Stats {
+        uint32_t allocations;   ///< Successful allocate()/growing reallocate() calls
+        uint32_t failures;      ///< Requests that did not fit
+        uint32_t resets;        ///< Times every block was free and the buffer started over
+        size_t peakBytes;       ///< Most of the buffer ever in use, headers included
+    };
+
+    BufferPool() = default;
+    BufferPool(void *buffer, size_t bytes) { begin(buffer, bytes); }
+
+    BufferPool(const BufferPool &) = delete;
+    BufferPool &operator=(const BufferPool &) = delete;
+
+    /// Use buffer (8-byte aligned, owned by the caller).
+    void begin(void *buffer, size_t bytes);
+
+    void *allocate(size_t bytes);
+    void deallocate(void *p);
+    void *reallocate(void *p, size_t bytes);
+
+    size_t used() const { return _used; }
+    size_t capacity() const { return _size; }
+    uint32_t live() const { return _live; }     ///< Blocks not freed yet
+
+    Stats stats() const { return _stats; }
+
+private:
+    struct Header {
+        uint32_t size;
+        uint32_t reserved;
+    };
+    static_assert(sizeof(Header) == 8, "Header keeps blocks 8-byte aligned");
+
+    static size_t rounded(size_t bytes) { return (bytes + 7) & ~(size_t)7; }
+    bool isLast(const Header *h) const;
+
+    uint8_t *_base = nullptr;
+    size_t _size = 0;
+    size_t _used = 0;
+    uint32_t _live = 0;
+    Stats _stats = {};
+};
@@ -0,0 +1,65 @@
+#ifndef ESP_PLATFORM
+
+#include "CaptureFile.h"
+
+#include <cstdio>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+bool CaptureFile::open(const char *path) {
+    close();
+    int fd = ::open(path, O_RDONLY);
+    if (fd < 0)
+        return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(CaptureFileHeader)) {
+        ::close(fd);
+        return false;
+    }
+    void *map = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED)
+        return false;
+    _map = (const uint8_t *)map;
+    _mapLen = (size_t)st.st_size;
+
+    const CaptureFileHeader &h = header();
+    if (memcmp(h.magic, CAPTURE_MAGIC, sizeof(h.magic)) != 0 || h.version != CAPTURE_VERSION) {
+        fprintf(stderr, "CaptureFile: %s is not a version %u capture\n", path, CAPTURE_VERSION);
+        close();
+        return false;
+    }
+
+    // Walk the lengths once so iterators need no bounds checks
+    const uint8_t *p = _map + sizeof(CaptureFileHeader);
+    const uint8_t *limit = _map + _mapLen;
+    if (h.recordBytes < (uint64_t)(limit - p))
+        limit = p + h.recordBytes;
+    while (_records < h.records && (size_t)(limit - p) >= sizeof(CaptureRecord)) {
+        size_t size = captureRecordBytes(((const CaptureRecord *)p)->len);
+        if (size > (size_t)(limit - p))
+            break;
+        p += size;
+        _records++;
+    }
+    _end = p;
+    _truncated = _records < h.records;
+    if (_truncated)
+        fprintf(stderr, "CaptureFile: %s truncated after %zu of %u records\n",
+                path, _records, h.records);
+    return true;
+}
+
+void CaptureFile::close() {
+    if (_map)
+        munmap((void *)_map, _mapLen);
+    _map = nullptr;
+    _mapLen = 0;
+    _end = nullptr;
+    _records = 0;
+    _truncated = false;
+}
+
+#endif
@@ -0,0 +1,78 @@
+/// @file CaptureFile.h
+/// @brief Host-side reader for AdvertRecorder captures (CaptureFormat.h).
+///
+/// Memory-maps the file read-only and iterates the records in place: no
+/// copies, so a capture of millions of adverts can drive decoder benchmarks
+/// and regression runs at memory speed. open() checks the header and walks
+/// the record lengths once; a truncated or corrupt tail is cut off (see
+/// truncated()) so iteration never leaves the mapping.
+///
+/// @code
+///   CaptureFile cap;
+///   if (cap.open("field.bcap"))
+///       for (const CaptureRecord &r : cap)
+///           decode(r.header(), r.data());
+/// @endcode
+
+#pragma once
+#ifndef ESP_PLATFORM
+
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+
+#include "CaptureFormat.h"
+
+class CaptureFile {
+public:
+    class iterator {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = CaptureRecord;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const CaptureRecord *;
+        using reference = const CaptureRecord &;
+
+        explicit iterator(const uint8_t *p) : _p(p) {}
+        reference operator*() const { return *(pointer)_p; }
+        pointer operator->() const { return (pointer)_p; }
+        iterator &operator++() {
+            _p += captureRecordBytes(((pointer)_p)->len);
+            return *this;
+        }
+        bool operator==(const iterator &o) const { return _p == o._p; }
+        bool operator!=(const iterator &o) const { return _p != o._p; }
+
+    private:
+        const uint8_t *_p;
+    };
+
+    CaptureFile() = default;
+    ~CaptureFile() { close(); }
+
+    CaptureFile(const CaptureFile &) = delete;
+    CaptureFile &operator=(const CaptureFile &) = delete;
+
+    /// Map path and validate it. Returns false if it cannot be read or is
+    /// not a capture.
+    bool open(const char *path);
+    void close();
+
+    const CaptureFileHeader &header() const { return *(const CaptureFileHeader *)_map; }
+
+    /// Records that can be iterated (fewer than the header says if truncated).
+    size_t size() const { return _records; }
+    bool truncated() const { return _truncated; }
+
+    iterator begin() const { return iterator(_map + sizeof(CaptureFileHeader)); }
+    iterator end() const { return iterator(_end); }
+
+private:
+    const uint8_t *_map = nullptr;
+    size_t _mapLen = 0;
+    const uint8_t *_end = nullptr;
+    size_t _records = 0;
+    bool _truncated = false;
+};
+
+#endif
@@ -0,0 +1,74 @@
+/// @file CaptureFormat.h
+/// @brief Binary raw advert capture format written by AdvertRecorder.
+///
+/// A capture is a CaptureFileHeader followed by records. Every record is a
+/// fixed 24-byte CaptureRecord and its AD bytes, padded to a multiple of 8,
+/// so records are naturally aligned and a memory-mapped file can be walked
+/// in place (see CaptureFile.h). All fields are little-endian, as on the
+/// ESP32 and common hosts. Header-only and free of Arduino/FreeRTOS
+/// dependencies so firmware and host share it.
+
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include "AdvertSource.h"
+
+static constexpr char CAPTURE_MAGIC[8] = {'B', 'T', 'H', 'C', 'A', 'P', '0', '1'};
+static constexpr uint32_t CAPTURE_VERSION = 1;
+
+struct CaptureFileHeader {
+    char magic[8];          ///< CAPTURE_MAGIC
+    uint32_t version;       ///< CAPTURE_VERSION
+    uint32_t records;       ///< Records following the header
+    uint64_t recordBytes;   ///< Bytes of records following the header
+    uint32_t dropped;       ///< Adverts the recorder could not keep
+    uint32_t reserved;
+};
+
+struct CaptureRecord {
+    uint32_t seq;           ///< Advert number since recording began; gaps are drops
+    uint8_t len;            ///< AD bytes following the record header
+    uint8_t addrType;
+    int8_t rssi;
+    uint8_t flags;          ///< ADV_FLAG_* bits
+    int64_t timeUs;         ///< Capture time (gateway clock)
+    uint8_t mac[6];         ///< Most significant byte first
+    uint16_t reserved;
+
+    const uint8_t *data() const { return (const uint8_t *)(this + 1); }
+
+    AdvertHeader header() const {
+        AdvertHeader hdr;
+        hdr.timeUs = timeUs;
+        memcpy(hdr.mac, mac, 6);
+        hdr.addrType = addrType;
+        hdr.rssi = rssi;
+        hdr.flags = flags;
+        hdr.len = len;
+        return hdr;
+    }
+};
+
+static_assert(sizeof(CaptureFileHeader) == 32, "capture header layout");
+static_assert(sizeof(CaptureRecord) == 24, "capture record layout");
+
+/// seq of a ring wrap marker: the rest of the ring is unused, the next
+/// record is at offset 0. Only inside AdvertRecorder, never in a file.
+static constexpr uint32_t CAPTURE_SEQ_WRAP = 0xFFFFFFFF;
+
+/// Bytes a record with len AD bytes occupies, padding included.
+inline size_t captureRecordBytes(size_t len) {
+    return (sizeof(CaptureRecord) + len + 7) & ~(size_t)7;
+}
+
+inline void captureFileHeader(CaptureFileHeader &h, uint32_t records,
+                              uint64_t recordBytes, uint32_t dropped) {
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, CAPTURE_MAGIC, sizeof(h.magic));
+    h.version = CAPTURE_VERSION;
+    h.records = records;
+    h.recordBytes = recordBytes;
+    h.dropped = dropped;
+}
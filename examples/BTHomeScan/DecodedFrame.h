@@ -0,0 +1,343 @@
+/// @file DecodedFrame.h
+/// @brief Compact binary framing of decode results for serial links.
+///
+/// BLEScanner::processFrame() writes each decoded advert as one frame
+/// instead of JSON, and host tools (extras/host/framecat) turn the frames
+/// back into JSON or line protocol. A BTHome advert with six measurements
+/// is about 50 bytes on the wire instead of nearly 800 bytes of
+/// pretty-printed JSON. Same COBS framing and CRC as AdvertFrame.h, so both
+/// frame types can share a stream.
+///
+/// Frame payload, little-endian:
+/// @code
+///   u8  type (FRAME_DECODED)
+///   u32 timeMs  (gateway clock, wraps after ~49 days)
+///   u8  mac[6], i8 rssi
+///   u8  protocol (FrameProtocol); FRAME_PROTO_OTHER is followed by a string
+///   u8  info: version (bits 0-2), encrypted (3), trigger (4),
+///             local name follows (5), tx power follows (6)
+///   [string name] [i8 txPower]
+///   u8  count
+///   count x { u8 objectID, varint tagged, [string name], [string unit] }
+///   u16 CRC-16/CCITT-FALSE of everything above
+/// @endcode
+/// A string is a u8 length and that many bytes (no terminator), at most
+/// FRAME_MAX_STRING, or a single byte 0x80 + i for FRAME_STRINGS[i]. tagged is zigzag(raw) << 2 (so |raw| < 2^61), with
+/// bit 0 set if a name and bit 1 set if a unit follows; they are only sent
+/// where a decoder overrode the BTHome defaults for objectID. Values are raw
+/// integers: the reader applies the object's factor, as DecodedAdvert::add()
+/// does.
+
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include "AdvertFrame.h"
+#include "BTHomeDecoder.h"
+
+enum FrameProtocol : uint8_t {
+    FRAME_PROTO_OTHER  = 0,
+    FRAME_PROTO_BTHOME = 1,
+    FRAME_PROTO_RUUVI  = 2,
+    FRAME_PROTO_MOPEKA = 3,
+    FRAME_PROTO_TPMS   = 4,
+};
+
+static constexpr size_t FRAME_MAX_STRING = 31;
+static constexpr size_t DECODED_FRAME_MAX_PAYLOAD = 512;
+static constexpr size_t DECODED_FRAME_MAX_ENCODED =
+    DECODED_FRAME_MAX_PAYLOAD + DECODED_FRAME_MAX_PAYLOAD / 254 + 2;
+
+static const char *const FRAME_PROTOCOL_NAMES[] = {
+    nullptr, "bthome", "ruuvi", "mopeka", "tpms",
+};
+
+/// Names the built-in device decoders use instead of the BTHome defaults,
+/// sent as one byte. Append only: readers index this table.
+static const char *const FRAME_STRINGS[] = {
+    "acceleration_x", "acceleration_y", "acceleration_z", "movement_counter",
+    "measurement_sequence", "sync_button", "tank_level", "read_quality",
+    "wheel", "tire_pressure", "alarm",
+};
+static constexpr size_t FRAME_STRING_COUNT = sizeof(FRAME_STRINGS) / sizeof(FRAME_STRINGS[0]);
+
+// ------------------------------------------------------------
+//  Encoding
+// ------------------------------------------------------------
+
+/// Appends to a fixed payload buffer; sticks at full instead of overflowing.
+struct FrameWriter {
+    uint8_t *buf;
+    size_t cap;
+    size_t len = 0;
+    bool full = false;
+
+    FrameWriter(uint8_t *b, size_t c) : buf(b), cap(c) {}
+
+    void put(uint8_t b) {
+        if (len < cap)
+            buf[len++] = b;
+        else
+            full = true;
+    }
+    void putVarint(uint64_t v) {
+        while (v >= 0x80) {
+            put((uint8_t)(v | 0x80));
+            v >>= 7;
+        }
+        put((uint8_t)v);
+    }
+    void putString(const char *s) {
+        for (size_t i = 0; i < FRAME_STRING_COUNT; i++) {
+            if (strcmp(s, FRAME_STRINGS[i]) == 0) {
+                put((uint8_t)(0x80 + i));
+                return;
+            }
+        }
+        size_t n = strnlen(s, FRAME_MAX_STRING);
+        put((uint8_t)n);
+        for (size_t i = 0; i < n; i++)
+            put((uint8_t)s[i]);
+    }
+};
+
+/// Local name and TX power from the advert, if wanted in the frame.
+struct FrameExtras {
+    const char *name = nullptr;     ///< Local name, nullptr if none
+    bool hasTxPower = false;
+    int8_t txPower = 0;
+};
+
+/// Encode a decode result as a frame payload, CRC included but not COBS
+/// encoded, into payload, which must hold DECODED_FRAME_MAX_PAYLOAD bytes.
+/// Values that do not fit are left out. Returns the payload length.
+inline size_t encodeDecodedPayload(const AdvertHeader &hdr, const DecodedAdvert &res,
+                                   const FrameExtras &extras, uint8_t *payload) {
+    // Keep room for the CRC
+    FrameWriter w(payload, DECODED_FRAME_MAX_PAYLOAD - 2);
+
+    w.put(FRAME_DECODED);
+    uint32_t ms = (uint32_t)(hdr.timeUs / 1000);
+    for (int i = 0; i < 4; i++)
+        w.put((uint8_t)(ms >> (8 * i)));
+    for (int i = 0; i < 6; i++)
+        w.put(hdr.mac[i]);
+    w.put((uint8_t)hdr.rssi);
+
+    uint8_t proto = FRAME_PROTO_OTHER;
+    for (uint8_t p = 1; p < sizeof(FRAME_PROTOCOL_NAMES) / sizeof(FRAME_PROTOCOL_NAMES[0]); p++)
+        if (res.protocol && strcmp(res.protocol, FRAME_PROTOCOL_NAMES[p]) == 0)
+            proto = p;
+    w.put(proto);
+    if (proto == FRAME_PROTO_OTHER)
+        w.putString(res.protocol ? res.protocol : "");
+
+    uint8_t info = res.version & 0x07;
+    if (res.isEncrypted)
+        info |= 0x08;
+    if (res.isTriggerBased)
+        info |= 0x10;
+    if (extras.name)
+        info |= 0x20;
+    if (extras.hasTxPower)
+        info |= 0x40;
+    w.put(info);
+    if (extras.name)
+        w.putString(extras.name);
+    if (extras.hasTxPower)
+        w.put((uint8_t)extras.txPower);
+
+    size_t countAt = w.len;
+    uint8_t count = 0;
+    w.put(0);
+    for (uint8_t i = 0; i < res.count && !w.full; i++) {
+        const BTHomeValue &v = res.values[i];
+        bool ownName = strcmp(v.name, BTHomeDecoder::getObjectName(v.objectID)) != 0;
+        bool ownUnit = strcmp(v.unit, BTHomeDecoder::getObjectUnit(v.objectID)) != 0;
+        uint64_t zz = ((uint64_t)v.raw << 1) ^ (uint64_t)(v.raw >> 63);
+        size_t mark = w.len;
+        w.put(v.objectID);
+        w.putVarint(zz << 2 | (ownName ? 1 : 0) | (ownUnit ? 2 : 0));
+        if (ownName)
+            w.putString(v.name);
+        if (ownUnit)
+            w.putString(v.unit);
+        if (w.full) {
+            w.len = mark;   // drop the value that did not fit
+            break;
+        }
+        count++;
+    }
+    payload[countAt] = count;
+
+    size_t n = w.len;
+    uint16_t crc = frameCrc16(payload, n);
+    payload[n++] = (uint8_t)crc;
+    payload[n++] = (uint8_t)(crc >> 8);
+    return n;
+}
+
+/// Encode a decode result as a complete frame (delimiter included) into
+/// out, which must hold DECODED_FRAME_MAX_ENCODED bytes. Returns the frame
+/// length.
+inline size_t encodeDecodedFrame(const AdvertHeader &hdr, const DecodedAdvert &res,
+                                 const FrameExtras &extras, uint8_t *out) {
+    uint8_t payload[DECODED_FRAME_MAX_PAYLOAD];
+    size_t n = encodeDecodedPayload(hdr, res, extras, payload);
+    size_t e = cobsEncode(payload, n, out);
+    out[e++] = 0;
+    return e;
+}
+
+// ------------------------------------------------------------
+//  Decoding
+// ------------------------------------------------------------
+
+/// One decoded frame. The name/unit/protocol pointers in adv point at the
+/// BTHome tables or into strings, so the frame must outlive their use.
+struct DecodedFrame {
+    uint32_t timeMs;
+    uint8_t mac[6];
+    int8_t rssi;
+    const char *localName;  ///< nullptr if the frame carried none
+    bool hasTxPower;
+    int8_t txPower;
+    DecodedAdvert adv;
+    char strings[DECODED_FRAME_MAX_PAYLOAD];   ///< Storage for sent strings
+};
+
+/// Reads a frame payload; any read past the end sets bad.
+struct FrameCursor {
+    const uint8_t *p;
+    size_t len;
+    size_t pos = 0;
+    bool bad = false;
+
+    FrameCursor(const uint8_t *b, size_t n) : p(b), len(n) {}
+
+    uint8_t get() {
+        if (pos < len)
+            return p[pos++];
+        bad = true;
+        return 0;
+    }
+    uint64_t getVarint() {
+        uint64_t v = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            uint8_t b = get();
+            v |= (uint64_t)(b & 0x7F) << shift;
+            if (!(b & 0x80))
+                return v;
+        }
+        bad = true;
+        return v;
+    }
+    /// Copy a string into store (NUL-terminated) and return it.
+    const char *getString(char *&store, const char *storeEnd) {
+        size_t n = get();
+        if (n >= 0x80 && n - 0x80 < FRAME_STRING_COUNT)
+            return FRAME_STRINGS[n - 0x80];
+        if (n > FRAME_MAX_STRING || pos + n > len || store + n + 1 > storeEnd) {
+            bad = true;
+            return "";
+        }
+        char *s = store;
+        memcpy(s, p + pos, n);
+        s[n] = '\0';
+        pos += n;
+        store += n + 1;
+        return s;
+    }
+};
+
+/// Decode a frame payload (already COBS-decoded). Returns false on a bad
+/// type, CRC or length.
+inline bool decodeDecodedFrame(const uint8_t *payload, size_t len, DecodedFrame &f) {
+    if (len < 17 || payload[0] != FRAME_DECODED)
+        return false;
+    uint16_t crc = (uint16_t)(payload[len - 2] | (payload[len - 1] << 8));
+    if (frameCrc16(payload, len - 2) != crc)
+        return false;
+
+    FrameCursor c(payload, len - 2);
+    char *store = f.strings;
+    const char *storeEnd = f.strings + sizeof(f.strings);
+    c.get();
+    f.timeMs = 0;
+    for (int i = 0; i < 4; i++)
+        f.timeMs |= (uint32_t)c.get() << (8 * i);
+    for (int i = 0; i < 6; i++)
+        f.mac[i] = c.get();
+    f.rssi = (int8_t)c.get();
+
+    f.adv.clear();
+    uint8_t proto = c.get();
+    if (proto == FRAME_PROTO_OTHER)
+        f.adv.protocol = c.getString(store, storeEnd);
+    else if (proto < sizeof(FRAME_PROTOCOL_NAMES) / sizeof(FRAME_PROTOCOL_NAMES[0]))
+        f.adv.protocol = FRAME_PROTOCOL_NAMES[proto];
+    else
+        return false;
+
+    uint8_t info = c.get();
+    f.adv.version = info & 0x07;
+    f.adv.isEncrypted = (info & 0x08) != 0;
+    f.adv.isTriggerBased = (info & 0x10) != 0;
+    f.localName = (info & 0x20) ? c.getString(store, storeEnd) : nullptr;
+    f.hasTxPower = (info & 0x40) != 0;
+    f.txPower = f.hasTxPower ? (int8_t)c.get() : 0;
+
+    uint8_t count = c.get();
+    if (count > DecodedAdvert::MAX_VALUES)
+        return false;
+    for (uint8_t i = 0; i < count && !c.bad; i++) {
+        uint8_t objectID = c.get();
+        uint64_t tagged = c.getVarint();
+        uint64_t zz = tagged >> 2;
+        int64_t raw = (int64_t)(zz >> 1) ^ -(int64_t)(zz & 1);
+        const char *name = (tagged & 1) ? c.getString(store, storeEnd) : nullptr;
+        const char *unit = (tagged & 2) ? c.getString(store, storeEnd) : nullptr;
+        f.adv.add(objectID, raw, name, unit);
+    }
+    return !c.bad && c.pos == c.len;
+}
+
+/// Incremental decoded frame parser for byte streams. Feed it whatever was
+/// read; it calls fn(const DecodedFrame &) per valid frame. Valid raw advert
+/// frames in the same stream are passed to onRaw(hdr, data) if given, and
+/// counted as errors otherwise.
+class DecodedFrameReader : public FrameReader<DECODED_FRAME_MAX_PAYLOAD> {
+public:
+    template <typename Fn>
+    void feed(const uint8_t *bytes, size_t len, Fn fn) {
+        feed(bytes, len, fn, nullptr);
+    }
+
+    template <typename Fn, typename RawFn>
+    void feed(const uint8_t *bytes, size_t len, Fn fn, RawFn onRaw) {
+        FrameReader::feed(bytes, len, [&](const uint8_t *payload, size_t n) {
+            if (payload[0] == FRAME_RAW_ADVERT)
+                return raw(payload, n, onRaw);
+            if (!decodeDecodedFrame(payload, n, _frame))
+                return false;
+            fn((const DecodedFrame &)_frame);
+            return true;
+        });
+    }
+
+private:
+    static bool raw(const uint8_t *, size_t, std::nullptr_t) { return false; }
+
+    template <typename RawFn>
+    static bool raw(const uint8_t *payload, size_t n, RawFn onRaw) {
+        AdvertHeader hdr;
+        uint8_t data[ADVERT_MAX_DATA];
+        if (!decodeAdvertFrame(payload, n, hdr, data))
+            return false;
+        onRaw(hdr, (const uint8_t *)data);
+        return true;
+    }
+
+    DecodedFrame _frame;
+};
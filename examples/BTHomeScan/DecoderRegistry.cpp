@@ -0,0 +1,70 @@
+#include "DecoderRegistry.h"
+
+#include "AdParser.h"
+
+static_assert((DecoderRegistry::CAPACITY & (DecoderRegistry::CAPACITY - 1)) == 0,
+              "registry capacity must be a power of two");
+
+static inline uint32_t makeKey(uint8_t kind, uint16_t id) {
+    return ((uint32_t)kind << 16) | id;
+}
+
+// Fibonacci hashing onto the table
+size_t DecoderRegistry::slotFor(uint32_t key) {
+    return (size_t)((key * 2654435761u) >> 16) & (CAPACITY - 1);
+}
+
+const DecoderRegistry::Entry *DecoderRegistry::find(uint32_t key) const {
+    size_t slot = slotFor(key);
+    for (size_t i = 0; i < CAPACITY; i++) {
+        const Entry &e = _table[(slot + i) & (CAPACITY - 1)];
+        if (e.key == key)
+            return &e;
+        if (e.key == 0)
+            return nullptr;
+    }
+    return nullptr;
+}
+
+bool DecoderRegistry::add(Kind kind, uint16_t id, AdvertDecoderFn fn, void *ctx) {
+    if (!fn)
+        return false;
+    uint32_t key = makeKey(kind, id);
+    size_t slot = slotFor(key);
+    for (size_t i = 0; i < CAPACITY; i++) {
+        Entry &e = _table[(slot + i) & (CAPACITY - 1)];
+        if (e.key == key || e.key == 0) {
+            if (e.key == 0)
+                _count++;
+            e.key = key;
+            e.fn = fn;
+            e.ctx = ctx;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool DecoderRegistry::decode(const RawAdvert &adv, DecodedAdvert &out) const {
+    if (_count == 0)
+        return false;
+
+    bool decoded = false;
+    forEachAd(adv.data, adv.hdr.len, [&](uint8_t type, const uint8_t *p, size_t n) {
+        uint8_t kind;
+        if (type == AD_SERVICE_DATA16)
+            kind = SERVICE_DATA_16;
+        else if (type == AD_MANUFACTURER)
+            kind = MANUFACTURER;
+        else
+            return true;
+        if (n < 2)
+            return true;
+
+        const Entry *e = find(makeKey(kind, (uint16_t)(p[0] | (p[1] << 8))));
+        if (e && e->fn(p + 2, n - 2, adv.hdr, e->ctx, out))
+            decoded = true;
+        return true;
+    });
+    return decoded;
+}
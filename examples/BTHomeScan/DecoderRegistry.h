@@ -0,0 +1,57 @@
+/// @file DecoderRegistry.h
+/// @brief Dispatch of adverts to device decoders by binary service/company ID.
+///
+/// Decoders are keyed by (kind, 16-bit id): the UUID of a 16-bit service-data
+/// entry or the company ID of a manufacturer-data entry. The table is a small
+/// open-addressed hash, so dispatch is one walk over the AD structures with a
+/// constant-time lookup per entry and no string handling. Adding a protocol is
+/// one add() call.
+///
+/// Every decoder fills the same heap-free DecodedAdvert (BTHome object ids),
+/// whatever the source protocol.
+
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+#include "AdvertSource.h"
+#include "BTHomeDecoder.h"
+
+/// Decode one AD entry. data/len exclude the UUID or company ID. Return true
+/// if values were added to out.
+typedef bool (*AdvertDecoderFn)(const uint8_t *data, size_t len,
+                                const AdvertHeader &hdr, void *ctx,
+                                DecodedAdvert &out);
+
+class DecoderRegistry {
+public:
+    enum Kind : uint8_t {
+        SERVICE_DATA_16 = 1,    ///< id = 16-bit service UUID (AD type 0x16)
+        MANUFACTURER    = 2,    ///< id = company ID (AD type 0xFF)
+    };
+
+    static constexpr size_t CAPACITY = 32;
+
+    /// Register fn for (kind, id), replacing any previous decoder. Not
+    /// thread-safe against decode(); register before scanning starts.
+    bool add(Kind kind, uint16_t id, AdvertDecoderFn fn, void *ctx = nullptr);
+
+    /// Run the decoder of every service-data and manufacturer entry in adv
+    /// that has one. Returns true if any of them decoded.
+    bool decode(const RawAdvert &adv, DecodedAdvert &out) const;
+
+    size_t size() const { return _count; }
+
+private:
+    struct Entry {
+        uint32_t key;           ///< kind << 16 | id, 0 = empty
+        AdvertDecoderFn fn;
+        void *ctx;
+    };
+
+    static size_t slotFor(uint32_t key);
+    const Entry *find(uint32_t key) const;
+
+    Entry _table[CAPACITY] = {};
+    size_t _count = 0;
+};
@@ -0,0 +1,121 @@
+#include "DeviceDecoders.h"
+
+static inline int16_t be16s(const uint8_t *p) {
+    return (int16_t)((p[0] << 8) | p[1]);
+}
+
+static inline uint16_t be16(const uint8_t *p) {
+    return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+static inline uint32_t le32(const uint8_t *p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) |
+           ((uint32_t)p[3] << 24);
+}
+
+// ---------------------------------------------------------------------------
+// Ruuvi RAWv5: 24 bytes, big-endian, all-ones (or 0x8000 signed) = invalid
+// ---------------------------------------------------------------------------
+bool decodeRuuviV5(const uint8_t *d, size_t len, const AdvertHeader &,
+                   void *, DecodedAdvert &out) {
+    if (len < 24 || d[0] != 0x05)
+        return false;
+    if (!out.protocol) {
+        out.protocol = "ruuvi";
+        out.version = 5;
+    }
+
+    int16_t temp = be16s(d + 1);            // 0.005 degC
+    if (temp != INT16_MIN)
+        out.add(0x02, temp / 2);            // 0.01 degC
+    uint16_t hum = be16(d + 3);             // 0.0025 %
+    if (hum != 0xFFFF)
+        out.add(0x03, hum / 4);             // 0.01 %
+    uint16_t pres = be16(d + 5);            // Pa - 50000
+    if (pres != 0xFFFF)
+        out.add(0x04, (int64_t)pres + 50000);  // 0.01 hPa == Pa
+
+    static const char *const ACC_NAMES[3] = {
+        "acceleration_x", "acceleration_y", "acceleration_z"};
+    for (int i = 0; i < 3; i++) {
+        int16_t mg = be16s(d + 7 + 2 * i);
+        if (mg != INT16_MIN)                // mG -> 0.001 m/s2
+            out.add(0x51, (int64_t)mg * 980665 / 100000, ACC_NAMES[i]);
+    }
+
+    uint16_t power = be16(d + 13);          // 11 bits battery, 5 bits tx power
+    if ((power >> 5) != 0x7FF)
+        out.add(0x0C, (power >> 5) + 1600); // mV
+    if (d[15] != 0xFF)
+        out.add(0x09, d[15], "movement_counter");
+    uint16_t seq = be16(d + 16);
+    if (seq != 0xFFFF)
+        out.add(0x3D, seq, "measurement_sequence");
+    return out.count > 0;
+}
+
+// ---------------------------------------------------------------------------
+// Mopeka Pro family: 10 bytes after the Nordic company id
+// ---------------------------------------------------------------------------
+
+// Propane speed-of-sound correction, mm per raw unit as a function of the
+// raw temperature byte.
+static const float MOPEKA_PROPANE[3] = {0.573045f, -0.002822f, -0.00000535f};
+
+bool decodeMopekaPro(const uint8_t *d, size_t len, const AdvertHeader &,
+                     void *, DecodedAdvert &out) {
+    // 0x0059 is Nordic's id and shared by many devices; require the exact
+    // length and a known Mopeka hardware id.
+    if (len != 10)
+        return false;
+    uint8_t model = d[0];
+    if (!(model >= 0x03 && model <= 0x0C && model != 0x07))
+        return false;
+    if (!out.protocol) {
+        out.protocol = "mopeka";
+        out.version = model;
+    }
+
+    uint32_t mv = (uint32_t)(d[1] & 0x7F) * 1000 / 32;
+    out.add(0x0C, mv);
+    int32_t pct = ((int32_t)mv - 2200) * 100 / 650;
+    out.add(0x01, pct < 0 ? 0 : pct > 100 ? 100 : pct);
+
+    uint8_t rawTemp = d[2] & 0x7F;
+    out.add(0x02, ((int32_t)rawTemp - 40) * 100);
+    out.add(0x0F, (d[2] & 0x80) ? 1 : 0, "sync_button");
+
+    uint16_t level = (uint16_t)(((d[4] << 8) | d[3]) & 0x3FFF);
+    float t = rawTemp;
+    float mm = level * (MOPEKA_PROPANE[0] + MOPEKA_PROPANE[1] * t +
+                        MOPEKA_PROPANE[2] * t * t);
+    out.add(0x40, (int64_t)(mm + 0.5f), "tank_level");
+    out.add(VENDOR_ID_READ_QUALITY, d[4] >> 6, "read_quality");   // 0..3
+    return true;
+}
+
+// ---------------------------------------------------------------------------
+// TPMS, company id 0x0100: 16 bytes after it, little-endian
+// ---------------------------------------------------------------------------
+bool decodeTpms0100(const uint8_t *d, size_t len, const AdvertHeader &,
+                    void *, DecodedAdvert &out) {
+    if (len != 16)
+        return false;
+    if (!out.protocol) {
+        out.protocol = "tpms";
+        out.version = 1;
+    }
+
+    out.add(VENDOR_ID_WHEEL, (d[0] & 0x0F) + 1, "wheel");
+    out.add(0x04, le32(d + 6), "tire_pressure");    // Pa
+    out.add(0x02, (int32_t)le32(d + 10));           // 0.01 degC
+    out.add(0x01, d[14]);
+    out.add(0x0F, d[15] & 0x01, "alarm");
+    return true;
+}
+
+void registerDeviceDecoders(DecoderRegistry &registry) {
+    registry.add(DecoderRegistry::MANUFACTURER, 0x0499, decodeRuuviV5);
+    registry.add(DecoderRegistry::MANUFACTURER, 0x0059, decodeMopekaPro);
+    registry.add(DecoderRegistry::MANUFACTURER, 0x0100, decodeTpms0100);
+}
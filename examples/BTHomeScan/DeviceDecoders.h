@@ -0,0 +1,30 @@
+/// @file DeviceDecoders.h
+/// @brief Built-in non-BTHome device decoders for the DecoderRegistry.
+///
+/// Each decoder maps its protocol onto BTHome object ids (in BTHome raw
+/// units), so every device comes out of BLEScanner in the same shape.
+/// Values BTHome has no object for use the vendor ids below.
+///
+///   - Ruuvi Tag RAWv5         manufacturer 0x0499
+///   - Mopeka Pro family       manufacturer 0x0059
+///   - TPMS sensors            manufacturer 0x0100
+
+#pragma once
+#include "DecoderRegistry.h"
+
+/// Object ids for values with no BTHome equivalent. BTHome assigns nothing
+/// in 0xE0-0xEF, so these cannot collide with a real BTHome object.
+enum : uint8_t {
+    VENDOR_ID_READ_QUALITY = 0xE0,  ///< Mopeka read quality, 0..3
+    VENDOR_ID_WHEEL        = 0xE1,  ///< TPMS wheel position, 1-based
+};
+
+bool decodeRuuviV5(const uint8_t *data, size_t len, const AdvertHeader &hdr,
+                   void *ctx, DecodedAdvert &out);
+bool decodeMopekaPro(const uint8_t *data, size_t len, const AdvertHeader &hdr,
+                     void *ctx, DecodedAdvert &out);
+bool decodeTpms0100(const uint8_t *data, size_t len, const AdvertHeader &hdr,
+                    void *ctx, DecodedAdvert &out);
+
+/// Add all of the above to registry.
+void registerDeviceDecoders(DecoderRegistry &registry);
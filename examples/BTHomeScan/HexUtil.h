@@ -0,0 +1,12 @@
+/// @file HexUtil.h
+/// @brief Hex digit parsing shared by the key, MAC and capture parsers.
+
+#pragma once
+
+/// Value of one hex digit (either case), or -1 if c is not one.
+inline int hexNibble(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
@@ -0,0 +1,430 @@
+#include "HistoryStore.h"
+
+#include <Arduino.h>
+#include <cstdlib>
+#include <cstring>
+
+#ifdef ESP_PLATFORM
+#include "esp_heap_caps.h"
+#endif
+
+// ---------------------------------------------------------------------------
+// Sample encoding
+// ---------------------------------------------------------------------------
+//
+// 0ddd vvvv                       zigzag(dod) < 8 and zigzag(dv) < 16
+// 1000 0000, varint zigzag(dod), varint zigzag(dv)
+// 11nn nnnn                       n = 2..63 samples with dod = dv = 0
+//
+// dod is the change of the time step in ticks, dv the change of the raw value.
+// A sample with both 0 is a 0x00 byte, which the following ones turn into a
+// run.
+
+static constexpr size_t MAX_SAMPLE_BYTES = 1 + 10 + 10;
+
+static inline uint64_t zigzag(int64_t v) {
+    return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+static inline int64_t unzigzag(uint64_t v) {
+    return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+static size_t putVarint(uint64_t v, uint8_t *out) {
+    size_t n = 0;
+    while (v >= 0x80) {
+        out[n++] = (uint8_t)v | 0x80;
+        v >>= 7;
+    }
+    out[n++] = (uint8_t)v;
+    return n;
+}
+
+static size_t getVarint(const uint8_t *in, uint64_t &v) {
+    v = 0;
+    size_t n = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        uint8_t b = in[n++];
+        v |= (uint64_t)(b & 0x7F) << shift;
+        if (!(b & 0x80))
+            break;
+    }
+    return n;
+}
+
+static size_t encodeSample(int64_t dod, int64_t dv, uint8_t *out) {
+    uint64_t zt = zigzag(dod), zv = zigzag(dv);
+    if (zt < 8 && zv < 16) {
+        out[0] = (uint8_t)(zt << 4 | zv);
+        return 1;
+    }
+    out[0] = 0x80;
+    size_t n = 1;
+    n += putVarint(zt, out + n);
+    n += putVarint(zv, out + n);
+    return n;
+}
+
+static constexpr uint8_t RUN_TAG = 0xC0;
+static constexpr uint8_t RUN_MAX = 63;
+
+static size_t decodeSample(const uint8_t *in, int64_t &dod, int64_t &dv) {
+    if (!(in[0] & 0x80)) {
+        dod = unzigzag(in[0] >> 4);
+        dv = unzigzag(in[0] & 0x0F);
+        return 1;
+    }
+    uint64_t zt, zv;
+    size_t n = 1;
+    n += getVarint(in + n, zt);
+    n += getVarint(in + n, zv);
+    dod = unzigzag(zt);
+    dv = unzigzag(zv);
+    return n;
+}
+
+static inline int64_t toTick(int64_t timeMs, uint32_t resolutionMs) {
+    int64_t t = timeMs / resolutionMs;
+    return (timeMs % resolutionMs < 0) ? t - 1 : t;
+}
+
+// ---------------------------------------------------------------------------
+// Setup
+// ---------------------------------------------------------------------------
+HistoryStore::~HistoryStore() {
+    release();
+}
+
+void HistoryStore::release() {
+#ifdef ESP_PLATFORM
+    heap_caps_free(_blocks);
+    heap_caps_free(_series);
+#else
+    free(_blocks);
+    free(_series);
+#endif
+    _blocks = nullptr;
+    _series = nullptr;
+}
+
+bool HistoryStore::begin(const Config &config) {
+    if (_blocks || config.bytes < 2 * BLOCK_BYTES || config.maxSeries == 0 ||
+            config.resolutionMs == 0)
+        return false;
+
+    uint32_t cap = 8;
+    uint8_t bits = 3;
+    while (cap < (uint32_t)config.maxSeries * 4 / 3 + 1) {
+        cap <<= 1;
+        bits++;
+    }
+    if (cap > 0x8000)
+        return false;
+    uint32_t blocks = (uint32_t)(config.bytes / BLOCK_BYTES);
+
+#ifdef ESP_PLATFORM
+    _blocks = (Block *)heap_caps_malloc(blocks * sizeof(Block),
+                                        config.caps ? config.caps : MALLOC_CAP_SPIRAM);
+    // Looked up on every append: internal RAM
+    _series = (Series *)heap_caps_malloc(cap * sizeof(Series),
+                                         MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+#else
+    _blocks = (Block *)malloc(blocks * sizeof(Block));
+    _series = (Series *)malloc(cap * sizeof(Series));
+#endif
+    if (!_blocks || !_series) {
+        log_e("HistoryStore: cannot allocate %u blocks", (unsigned)blocks);
+        release();
+        return false;
+    }
+    _config = config;
+    _blockCount = blocks;
+    _seriesCap = cap;
+    _seriesShift = (uint8_t)(64 - bits);
+    clear();
+    return true;
+}
+
+void HistoryStore::clear() {
+    if (!_blocks)
+        return;
+    for (uint32_t i = 0; i < _blockCount; i++)
+        _blocks[i].seq = 0;
+    for (uint32_t i = 0; i < _seriesCap; i++)
+        _series[i].key = EMPTY_KEY;
+    _nextBlock = 0;
+    _seriesUsed = 0;
+    _samples = 0;
+    _blocksUsed = 0;
+    _bytesUsed = 0;
+}
+
+// ---------------------------------------------------------------------------
+// Appending
+// ---------------------------------------------------------------------------
+HistoryStore::Series *HistoryStore::findSeries(uint64_t key, bool create) {
+    uint32_t mask = _seriesCap - 1;
+    // Fibonacci hashing onto the table
+    uint32_t i = (uint32_t)((key * 0x9E3779B97F4A7C15ull) >> _seriesShift);
+    while (true) {
+        Series &s = _series[i];
+        if (s.key == key)
+            return &s;
+        if (s.key == EMPTY_KEY)
+            break;
+        i = (i + 1) & mask;
+    }
+    if (!create || _seriesUsed >= _config.maxSeries)
+        return nullptr;
+    Series &s = _series[i];
+    s.key = key;
+    s.head = s.tail = NO_BLOCK;
+    _seriesUsed++;
+    return &s;
+}
+
+// Take the next block in ring order. Blocks are handed out strictly in that
+// order, so once the pool has wrapped the next one is the oldest in use and
+// the head of its series.
+uint32_t HistoryStore::allocBlock() {
+    uint32_t b = _nextBlock;
+    _nextBlock = b + 1 == _blockCount ? 0 : b + 1;
+    Block &blk = _blocks[b];
+    if (blk.seq) {
+        Series &s = _series[blk.series];
+        s.head = blk.next;
+        if (s.tail == b)
+            s.tail = NO_BLOCK;
+        _evicted += blk.count;
+        _samples -= blk.count;
+        _blocksUsed--;
+        _bytesUsed -= BLOCK_BYTES - sizeof(blk.payload) + blk.used;
+    }
+    if (++_blockSeq == 0)
+        _blockSeq = 1;
+    blk.seq = _blockSeq;
+    return b;
+}
+
+void HistoryStore::startBlock(uint16_t seriesIdx, int64_t tick, int64_t raw) {
+    uint32_t b = allocBlock();
+    Block &blk = _blocks[b];
+    blk.next = NO_BLOCK;
+    blk.series = seriesIdx;
+    blk.count = 1;
+    blk.used = 0;
+    blk.reserved = 0;
+    blk.firstTick = tick;
+    blk.firstRaw = raw;
+
+    Series &s = _series[seriesIdx];
+    if (s.tail != NO_BLOCK)
+        _blocks[s.tail].next = b;
+    else
+        s.head = b;
+    s.tail = b;
+    s.lastTick = tick;
+    s.lastDelta = 0;
+    s.lastRaw = raw;
+    s.runAt = NO_RUN;
+    _samples++;
+    _blocksUsed++;
+    _bytesUsed += BLOCK_BYTES - sizeof(blk.payload);
+}
+
+bool HistoryStore::append(const uint8_t mac[6], uint8_t ordinal, int64_t timeMs,
+                          const BTHomeValue &v) {
+    if (!_blocks)
+        return false;
+    uint64_t key = 0;
+    for (int i = 0; i < 6; i++)
+        key = key << 8 | mac[i];
+    key = key << 16 | (uint64_t)v.objectID << 8 | ordinal;
+
+    Series *s = findSeries(key, true);
+    if (!s) {
+        _dropped++;
+        return false;
+    }
+    s->name = v.name;
+    s->unit = v.unit;
+    _appended++;
+
+    int64_t tick = toTick(timeMs, _config.resolutionMs);
+    if (s->tail == NO_BLOCK) {
+        startBlock((uint16_t)(s - _series), tick, v.raw);
+        return true;
+    }
+
+    int64_t delta = tick - s->lastTick;
+    int64_t dod = delta - s->lastDelta;
+    int64_t dv = v.raw - s->lastRaw;
+    Block &blk = _blocks[s->tail];
+    if (blk.count == UINT16_MAX) {
+        startBlock((uint16_t)(s - _series), tick, v.raw);
+        return true;
+    }
+
+    // Same step and value as before: extend the run, no new byte
+    if (dod == 0 && dv == 0 && s->runAt != NO_RUN) {
+        uint8_t &code = blk.payload[s->runAt];
+        if (code != (RUN_TAG | RUN_MAX)) {
+            code = code == 0 ? (RUN_TAG | 2) : code + 1;
+            blk.count++;
+            s->lastTick = tick;
+            _samples++;
+            return true;
+        }
+    }
+
+    uint8_t enc[MAX_SAMPLE_BYTES];
+    size_t n = encodeSample(dod, dv, enc);
+    if (blk.used + n > sizeof(blk.payload)) {
+        startBlock((uint16_t)(s - _series), tick, v.raw);
+        return true;
+    }
+    memcpy(blk.payload + blk.used, enc, n);
+    s->runAt = enc[0] == 0 ? blk.used : NO_RUN;
+    blk.used += n;
+    blk.count++;
+    s->lastTick = tick;
+    s->lastDelta = delta;
+    s->lastRaw = v.raw;
+    _samples++;
+    _bytesUsed += n;
+    return true;
+}
+
+void HistoryStore::add(const uint8_t mac[6], int64_t timeMs, const DecodedAdvert &res) {
+    for (uint8_t i = 0; i < res.count; i++) {
+        // Repeated object ids in one advert are told apart by their ordinal
+        uint8_t ordinal = 0;
+        for (uint8_t j = 0; j < i; j++)
+            if (res.values[j].objectID == res.values[i].objectID)
+                ordinal++;
+        append(mac, ordinal, timeMs, res.values[i]);
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Reading
+// ---------------------------------------------------------------------------
+HistoryStore::Cursor HistoryStore::read(int64_t sinceMs) const {
+    Cursor c;
+    if (!_blocks)
+        return c;
+    c._store = this;
+    c._fromTick = sinceMs == INT64_MIN ? INT64_MIN : toTick(sinceMs, _config.resolutionMs);
+    // A tick rounded down may still hold samples before sinceMs
+    if (c._fromTick != INT64_MIN && c._fromTick * (int64_t)_config.resolutionMs < sinceMs)
+        c._fromTick++;
+    return c;
+}
+
+bool HistoryStore::Cursor::next(HistorySample &out) {
+    if (!_store)
+        return false;
+    const HistoryStore &st = *_store;
+
+    while (_series < st._seriesCap) {
+        const Series &s = st._series[_series];
+        if (s.key == EMPTY_KEY) {
+            _series++;
+            continue;
+        }
+
+        // A block reused under us took everything older in the series with
+        // it, so carry on from the new head: nothing there was read yet.
+        if (_block == NO_BLOCK || st._blocks[_block].seq != _blockSeq) {
+            uint32_t b = s.head;
+            // Skip blocks that end before the start
+            while (b != NO_BLOCK && st._blocks[b].next != NO_BLOCK &&
+                   st._blocks[st._blocks[b].next].firstTick < _fromTick)
+                b = st._blocks[b].next;
+            if (b == NO_BLOCK) {
+                _series++;
+                continue;
+            }
+            _block = b;
+            _blockSeq = st._blocks[b].seq;
+            _index = 0;
+            _offset = 0;
+            _run = 0;
+        }
+
+        const Block &blk = st._blocks[_block];
+        if (_index >= blk.count) {
+            _block = blk.next;
+            if (_block == NO_BLOCK) {
+                _series++;
+            } else {
+                _blockSeq = st._blocks[_block].seq;
+                _index = 0;
+                _offset = 0;
+                _run = 0;
+            }
+            continue;
+        }
+
+        if (_index == 0) {
+            _tick = blk.firstTick;
+            _raw = blk.firstRaw;
+            _delta = 0;
+        } else if (_run > 0) {
+            _run--;
+            _tick += _delta;
+        } else if ((blk.payload[_offset] & RUN_TAG) == RUN_TAG) {
+            _run = (uint8_t)((blk.payload[_offset++] & RUN_MAX) - 1);
+            _tick += _delta;
+        } else {
+            int64_t dod, dv;
+            _offset += (uint16_t)decodeSample(blk.payload + _offset, dod, dv);
+            _delta += dod;
+            _tick += _delta;
+            _raw += dv;
+        }
+        _index++;
+        if (_tick < _fromTick)
+            continue;
+
+        out.timeMs = _tick * (int64_t)st._config.resolutionMs;
+        uint64_t mac = s.key >> 16;
+        for (int i = 5; i >= 0; i--) {
+            out.mac[i] = (uint8_t)mac;
+            mac >>= 8;
+        }
+        out.ordinal = (uint8_t)s.key;
+        out.value.objectID = (uint8_t)(s.key >> 8);
+        out.value.raw = _raw;
+        out.value.value = (float)_raw * BTHomeDecoder::getObjectFactor(out.value.objectID);
+        out.value.name = s.name;
+        out.value.unit = s.unit;
+        return true;
+    }
+    return false;
+}
+
+// ---------------------------------------------------------------------------
+// Stats
+// ---------------------------------------------------------------------------
+HistoryStore::Stats HistoryStore::stats() const {
+    Stats s = {};
+    s.samples = _samples;
+    s.appended = _appended;
+    s.evicted = _evicted;
+    s.dropped = _dropped;
+    s.series = _seriesUsed;
+    s.blocks = _blocksUsed;
+    s.totalBlocks = _blockCount;
+    s.bytes = _bytesUsed;
+    s.oldestMs = -1;
+    int64_t oldest = INT64_MAX;
+    for (uint32_t i = 0; i < _seriesCap && _blocks; i++) {
+        const Series &ser = _series[i];
+        if (ser.key != EMPTY_KEY && ser.head != NO_BLOCK && _blocks[ser.head].firstTick < oldest)
+            oldest = _blocks[ser.head].firstTick;
+    }
+    if (oldest != INT64_MAX)
+        s.oldestMs = oldest * (int64_t)_config.resolutionMs;
+    return s;
+}
@@ -0,0 +1,176 @@
+/// @file HistoryStore.h
+/// @brief Compressed time series of decoded measurements, for backfill.
+///
+/// Keeps every measurement appended to it, per series (MAC, object id,
+/// ordinal), in a preallocated block pool (PSRAM by default), so readings
+/// taken while the uplink is down can be sent later with a Cursor. When the
+/// pool is full the oldest block is reused.
+///
+/// Each series is a chain of 256-byte blocks. A block starts with the full
+/// time and raw value of its first sample; every further sample stores the
+/// delta-of-delta of its timestamp and the delta of its raw value, both
+/// zigzag-encoded. A sensor advertising at a steady rate with a slowly
+/// changing value costs one byte per sample, repeats of the same value
+/// share a byte between up to 63 samples, and larger steps fall back to two
+/// varints. Timestamps are kept at Config::resolutionMs. Blocks are
+/// self-contained, so dropping the oldest never breaks the rest of a chain.
+///
+/// Values are stored as BTHomeValue::raw and scaled back with the BTHome
+/// object factor (what DecodedAdvert::add() does), names and units are
+/// kept per series.
+///
+/// Not thread-safe: append and read from one task (e.g. the one calling
+/// BLEScanner::process()). A Cursor may be kept across appends; if blocks it
+/// was reading are reused meanwhile, it skips to what is left.
+///
+/// @code
+///   HistoryStore history;
+///   history.begin(HistoryStore::Config());
+///   BLEScanner::instance().setHistory(&history);
+///
+///   // uplink back: send everything since the last sample that got through
+///   HistoryStore::Cursor c = history.read(lastSentMs + 1);
+///   HistorySample s;
+///   while (c.next(s))
+///       publish(s);
+/// @endcode
+
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+#include "BTHomeDecoder.h"
+
+/// One stored measurement.
+struct HistorySample {
+    int64_t timeMs;         ///< Capture time passed to add(), at the store's resolution
+    uint8_t mac[6];
+    uint8_t ordinal;        ///< Tells repeated object ids of one device apart
+    BTHomeValue value;
+};
+
+class HistoryStore {
+public:
+    static constexpr size_t BLOCK_BYTES = 256;
+
+    struct Config {
+        size_t bytes = 256 * 1024;  ///< Block pool size
+        uint16_t maxSeries = 256;   ///< (device, measurement) pairs tracked
+        uint32_t resolutionMs = 1000; ///< Timestamps are rounded down to this
+        uint32_t caps = 0;          ///< Heap caps of the pool, 0 = MALLOC_CAP_SPIRAM
+    };
+
+    struct Stats {
+        uint32_t samples;       ///< Samples held
+        uint32_t appended;      ///< Samples appended since begin()
+        uint32_t evicted;       ///< Samples lost to block reuse
+        uint32_t dropped;       ///< Samples not stored, series table full
+        uint16_t series;        ///< Series in use
+        uint32_t blocks;        ///< Blocks in use
+        uint32_t totalBlocks;
+        size_t bytes;           ///< Encoded bytes held, block headers included
+        int64_t oldestMs;       ///< Oldest sample held, -1 if none
+    };
+
+    /// Reads samples in store order: series by series, each oldest first.
+    class Cursor {
+    public:
+        Cursor() = default;
+
+        /// Fill out with the next sample. Returns false at the end.
+        bool next(HistorySample &out);
+
+    private:
+        friend class HistoryStore;
+
+        const HistoryStore *_store = nullptr;
+        int64_t _fromTick = 0;
+        uint32_t _series = 0;       ///< Series table slot being read
+        uint32_t _block = UINT32_MAX;
+        uint32_t _blockSeq = 0;     ///< Detects the block being reused
+        uint16_t _index = 0;        ///< Sample index in the block
+        uint16_t _offset = 0;       ///< Byte offset of the next encoded sample
+        uint8_t _run = 0;           ///< Repeats left of the current run
+        int64_t _tick = 0;
+        int64_t _delta = 0;
+        int64_t _raw = 0;
+    };
+
+    HistoryStore() = default;
+    ~HistoryStore();
+
+    HistoryStore(const HistoryStore &) = delete;
+    HistoryStore &operator=(const HistoryStore &) = delete;
+
+    /// Allocate the block pool and series table. Returns false if out of
+    /// memory or already started.
+    bool begin(const Config &config);
+
+    /// Append every value of a decoded advert from mac captured at timeMs.
+    void add(const uint8_t mac[6], int64_t timeMs, const DecodedAdvert &res);
+
+    /// Append one value; ordinal tells repeated object ids of one device
+    /// apart. Returns false if it was dropped.
+    bool append(const uint8_t mac[6], uint8_t ordinal, int64_t timeMs, const BTHomeValue &v);
+
+    /// Cursor over every sample with timeMs >= sinceMs.
+    Cursor read(int64_t sinceMs = INT64_MIN) const;
+
+    /// Drop everything.
+    void clear();
+
+    const Config &config() const { return _config; }
+    Stats stats() const;
+
+private:
+    struct Block {
+        uint32_t seq;           ///< Allocation number, 0 = free
+        uint32_t next;          ///< Next block of the series, NO_BLOCK at the tail
+        uint16_t series;
+        uint16_t count;         ///< Samples, the first one in the header
+        uint16_t used;          ///< Payload bytes
+        uint16_t reserved;
+        int64_t firstTick;
+        int64_t firstRaw;
+        uint8_t payload[BLOCK_BYTES - 32];
+    };
+    static_assert(sizeof(Block) == BLOCK_BYTES, "Block must be BLOCK_BYTES");
+
+    struct Series {
+        uint64_t key;           ///< EMPTY_KEY or (MAC << 16 | object id << 8 | ordinal)
+        const char *name;
+        const char *unit;
+        uint32_t head;          ///< Oldest block, NO_BLOCK if none
+        uint32_t tail;          ///< Block being appended to
+        int64_t lastTick;       ///< Encoder state at the tail
+        int64_t lastDelta;
+        int64_t lastRaw;
+        uint16_t runAt;         ///< Payload offset of a trailing 0x00 or run code, NO_RUN if none
+    };
+
+    static constexpr uint64_t EMPTY_KEY = UINT64_MAX;
+    static constexpr uint32_t NO_BLOCK = UINT32_MAX;
+    static constexpr uint16_t NO_RUN = UINT16_MAX;
+
+    void release();
+    Series *findSeries(uint64_t key, bool create);
+    uint32_t allocBlock();
+    void startBlock(uint16_t seriesIdx, int64_t tick, int64_t raw);
+
+    Config _config;
+    Block *_blocks = nullptr;
+    uint32_t _blockCount = 0;
+    uint32_t _nextBlock = 0;    ///< Next to allocate: free, or the oldest in use
+    uint32_t _blockSeq = 0;
+    Series *_series = nullptr;
+    uint32_t _seriesCap = 0;    ///< Table size, a power of two
+    uint8_t _seriesShift = 0;   ///< 64 - log2(_seriesCap), for Fibonacci hashing
+    uint16_t _seriesUsed = 0;
+
+    uint32_t _samples = 0;
+    uint32_t _appended = 0;
+    uint32_t _evicted = 0;
+    uint32_t _dropped = 0;
+    uint32_t _blocksUsed = 0;
+    size_t _bytesUsed = 0;
+};
@@ -0,0 +1,188 @@
+#ifndef ESP_PLATFORM
+
+#include "HostReplaySource.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+
+#include "CaptureFile.h"
+#include "HexUtil.h"
+
+// Parse "AA:BB:CC:DD:EE:FF" (separators optional)
+static bool parseMac(const char *s, uint8_t mac[6]) {
+    int n = 0, hi = -1;
+    for (; *s && n < 6; s++) {
+        int v = hexNibble(*s);
+        if (v < 0)
+            continue;
+        if (hi < 0) {
+            hi = v;
+        } else {
+            mac[n++] = (uint8_t)((hi << 4) | v);
+            hi = -1;
+        }
+    }
+    return n == 6;
+}
+
+HostReplaySource::HostReplaySource(const char *path) {
+    if (!load(path))
+        fprintf(stderr, "HostReplaySource: cannot load %s\n", path);
+}
+
+HostReplaySource::HostReplaySource(Generator gen)
+    : _gen(std::move(gen)) {
+}
+
+HostReplaySource::~HostReplaySource() {
+    stop();
+}
+
+bool HostReplaySource::loadCapture(const char *path) {
+    CaptureFile cap;
+    if (!cap.open(path))
+        return false;
+    _records.reserve(cap.size());
+    for (const CaptureRecord &c : cap) {
+        Record r;
+        r.hdr = c.header();
+        memcpy(r.data, c.data(), c.len);
+        _records.push_back(r);
+    }
+    return true;
+}
+
+bool HostReplaySource::load(const char *path) {
+    FILE *f = fopen(path, "r");
+    if (!f)
+        return false;
+
+    char magic[sizeof(CAPTURE_MAGIC)];
+    if (fread(magic, 1, sizeof(magic), f) == sizeof(magic) &&
+            memcmp(magic, CAPTURE_MAGIC, sizeof(magic)) == 0) {
+        fclose(f);
+        return loadCapture(path);
+    }
+    rewind(f);
+
+    char line[1024];
+    while (fgets(line, sizeof(line), f)) {
+        char *hash = strchr(line, '#');
+        if (hash)
+            *hash = '\0';
+
+        long long timeUs;
+        char mac[32];
+        int rssi;
+        char hex[2 * ADVERT_MAX_DATA + 2];
+        hex[0] = '\0';
+        if (sscanf(line, "%lld %31s %d %511s", &timeUs, mac, &rssi, hex) < 3)
+            continue;
+
+        Record r = {};
+        r.hdr.timeUs = timeUs;
+        r.hdr.rssi = (int8_t)rssi;
+        if (!parseMac(mac, r.hdr.mac))
+            continue;
+
+        size_t len = 0;
+        for (const char *p = hex; p[0] && p[1] && len < ADVERT_MAX_DATA; p += 2) {
+            int hi = hexNibble(p[0]), lo = hexNibble(p[1]);
+            if (hi < 0 || lo < 0)
+                break;
+            r.data[len++] = (uint8_t)((hi << 4) | lo);
+        }
+        r.hdr.len = (uint8_t)len;
+        _records.push_back(r);
+    }
+    fclose(f);
+    return true;
+}
+
+bool HostReplaySource::init(const ScanParams &params, AdvertSink *sink) {
+    (void)params;
+    _sink = sink;
+    return _sink != nullptr;
+}
+
+bool HostReplaySource::start(uint32_t durationMs, EndCallback onEnd, void *arg) {
+    stop();
+    _onEnd = onEnd;
+    _onEndArg = arg;
+    _running = true;
+    _thread = std::thread(&HostReplaySource::run, this, durationMs);
+    return true;
+}
+
+void HostReplaySource::stop() {
+    _running = false;
+    if (_thread.joinable() && _thread.get_id() != std::this_thread::get_id())
+        _thread.join();
+}
+
+bool HostReplaySource::nextAdvert(RawAdvert &adv, uint8_t *buf) {
+    if (_gen)
+        return _gen(adv, buf);
+
+    if (_records.empty())
+        return false;
+    if (_pos == _records.size()) {
+        if (_loops != 0 && _loop + 1 >= _loops)
+            return false;
+        // Keep capture times increasing across loops
+        _loop++;
+        _loopOffsetUs += _records.back().hdr.timeUs - _records.front().hdr.timeUs + 1;
+        _pos = 0;
+    }
+    const Record &r = _records[_pos++];
+    adv.hdr = r.hdr;
+    adv.hdr.timeUs += _loopOffsetUs;
+    memcpy(buf, r.data, r.hdr.len);
+    return true;
+}
+
+void HostReplaySource::run(uint32_t durationMs) {
+    using clock = std::chrono::steady_clock;
+    const auto started = clock::now();
+    const auto deadline = started + std::chrono::milliseconds(durationMs);
+    int64_t firstUs = 0;
+    bool first = true;
+
+    uint8_t buf[ADVERT_MAX_DATA];
+    RawAdvert adv;
+    while (_running) {
+        if (durationMs != 0 && clock::now() >= deadline)
+            break;
+        if (!nextAdvert(adv, buf)) {
+            _finished = true;
+            break;
+        }
+        adv.data = buf;
+
+        if (_speed > 0) {
+            if (first) {
+                firstUs = adv.hdr.timeUs;
+                first = false;
+            }
+            auto due = started + std::chrono::microseconds(
+                           (int64_t)((adv.hdr.timeUs - firstUs) / _speed));
+            std::this_thread::sleep_until(due);
+        }
+
+        _sink->onAdvert(adv);
+        _delivered++;
+    }
+
+    bool ended = _running;
+    _running = false;
+    if (ended && _onEnd)
+        _onEnd(_onEndArg);
+}
+
+// No radio on the host: sources are always passed to setAdvertSource()
+AdvertSource *defaultAdvertSource() {
+    return nullptr;
+}
+
+#endif
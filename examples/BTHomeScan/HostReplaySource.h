@@ -0,0 +1,91 @@
+/// @file HostReplaySource.h
+/// @brief Host-side AdvertSource that replays a capture file or a generator.
+///
+/// Lets BLEScanner and the decoders run on Linux/macOS without a radio, for
+/// benchmarks and reproducing field captures. Adverts are delivered from a
+/// replay thread, like a BLE stack task would.
+///
+/// Capture files are text, one advert per line ('#' starts a comment):
+/// @code
+///   <timeUs> <AA:BB:CC:DD:EE:FF> <rssi> <AD bytes as hex>
+///   1000000 C3:DC:13:B3:B0:3C -40 0201060916D2FC4002C4092E32
+/// @endcode
+/// Binary captures exported by AdvertRecorder (CaptureFormat.h) are
+/// recognised by their header and replayed as well.
+
+#pragma once
+#ifndef ESP_PLATFORM
+
+#include <atomic>
+#include <functional>
+#include <thread>
+#include <vector>
+
+#include "AdvertSource.h"
+
+class HostReplaySource : public AdvertSource {
+public:
+    /// Fill adv.hdr and up to ADVERT_MAX_DATA bytes of buf (adv.data is set
+    /// by the caller). Return false when there is nothing more to replay.
+    typedef std::function<bool(RawAdvert &adv, uint8_t *buf)> Generator;
+
+    /// Replay a text or binary capture file (loaded completely up front).
+    explicit HostReplaySource(const char *path);
+
+    /// Replay adverts produced by gen.
+    explicit HostReplaySource(Generator gen);
+
+    ~HostReplaySource() override;
+
+    /// 1.0 paces adverts by their timestamps, 2.0 twice as fast, 0 replays
+    /// as fast as the sink accepts them (default).
+    void setSpeed(double speed) { _speed = speed; }
+
+    /// Times to replay a capture file; 0 loops forever. Default 1.
+    void setLoops(uint32_t loops) { _loops = loops; }
+
+    /// True once the file or generator is exhausted.
+    bool finished() const { return _finished; }
+
+    /// Adverts handed to the sink so far.
+    uint64_t delivered() const { return _delivered; }
+
+    /// Adverts loaded from the capture file (0 for a generator).
+    size_t size() const { return _records.size(); }
+
+    bool init(const ScanParams &params, AdvertSink *sink) override;
+    bool setParams(const ScanParams &) override { return true; }   // replays ignore them
+    bool start(uint32_t durationMs, EndCallback onEnd, void *arg) override;
+    void stop() override;
+    const char *name() const override { return "host-replay"; }
+
+private:
+    struct Record {
+        AdvertHeader hdr;
+        uint8_t data[ADVERT_MAX_DATA];
+    };
+
+    bool load(const char *path);
+    bool loadCapture(const char *path);
+    bool nextAdvert(RawAdvert &adv, uint8_t *buf);
+    void run(uint32_t durationMs);
+
+    std::vector<Record> _records;
+    Generator _gen;
+    size_t _pos = 0;
+    uint32_t _loop = 0;
+    int64_t _loopOffsetUs = 0;
+
+    AdvertSink *_sink = nullptr;
+    EndCallback _onEnd = nullptr;
+    void *_onEndArg = nullptr;
+    double _speed = 0;
+    uint32_t _loops = 1;
+
+    std::thread _thread;
+    std::atomic<bool> _running{false};
+    std::atomic<bool> _finished{false};
+    std::atomic<uint64_t> _delivered{0};
+};
+
+#endif
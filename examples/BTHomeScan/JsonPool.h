@@ -0,0 +1,40 @@
+/// @file JsonPool.h
+/// @brief ArduinoJson allocator over a fixed buffer (see BufferPool.h).
+///
+/// JsonDocuments normally allocate their variant pools and copied strings
+/// from the general heap, several times per advert. Give them a JsonPool
+/// instead and a gateway that builds one document per advert never calls
+/// malloc: the document's memory is carved from the buffer and the buffer
+/// starts over once the document is gone. A document that does not fit
+/// reports overflowed(), it never falls back to the heap.
+///
+/// @code
+///   static uint8_t jsonMemory[8192];
+///   static JsonPool jsonPool(jsonMemory, sizeof(jsonMemory));
+///
+///   // in loop():
+///   JsonDocument doc(&jsonPool);
+///   if (scanner.process(doc, mac, sizeof(mac), 1000)) ...
+/// @endcode
+///
+/// One pool per task; documents from it must not outlive the buffer.
+
+#pragma once
+#include "ArduinoJson.h"
+#include "BufferPool.h"
+
+class JsonPool : public ArduinoJson::Allocator {
+public:
+    JsonPool(void *buffer, size_t bytes) : _pool(buffer, bytes) {}
+
+    void *allocate(size_t size) override { return _pool.allocate(size); }
+    void deallocate(void *ptr) override { _pool.deallocate(ptr); }
+    void *reallocate(void *ptr, size_t newSize) override {
+        return _pool.reallocate(ptr, newSize);
+    }
+
+    const BufferPool &pool() const { return _pool; }
+
+private:
+    BufferPool _pool;
+};
@@ -0,0 +1,85 @@
+/// @file MacSet.h
+/// @brief Fixed-size lock-free set of device addresses.
+///
+/// Stores a 32-bit fingerprint per MAC in an open-addressed table, so lookups
+/// from the BLE callback never lock or allocate. One writer at a time; any
+/// number of concurrent readers. A fingerprint collision makes contains()
+/// report a false positive, which callers treat as harmless.
+
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+template <size_t N>
+class MacSet {
+    static_assert(N > 0 && (N & (N - 1)) == 0, "MacSet size must be a power of two");
+
+public:
+    MacSet() { clear(); }
+
+    /// Copies are not atomic as a whole; do not copy while another task inserts.
+    MacSet(const MacSet &other) { *this = other; }
+
+    MacSet &operator=(const MacSet &other) {
+        for (size_t i = 0; i < N; i++)
+            _slots[i].store(other._slots[i].load(std::memory_order_relaxed),
+                            std::memory_order_relaxed);
+        _size = other._size;
+        return *this;
+    }
+
+    /// FNV-1a over the six address bytes, never 0 (0 marks an empty slot).
+    static uint32_t hash(const uint8_t mac[6]) {
+        uint32_t h = 2166136261u;
+        for (int i = 0; i < 6; i++) {
+            h ^= mac[i];
+            h *= 16777619u;
+        }
+        return h ? h : 1;
+    }
+
+    bool contains(const uint8_t mac[6]) const {
+        return containsHash(hash(mac));
+    }
+
+    bool containsHash(uint32_t h) const {
+        for (size_t i = 0; i < N; i++) {
+            uint32_t v = _slots[(h + i) & (N - 1)].load(std::memory_order_relaxed);
+            if (v == h)
+                return true;
+            if (v == 0)
+                return false;
+        }
+        return false;
+    }
+
+    /// Returns false if the set is full.
+    bool insert(const uint8_t mac[6]) {
+        uint32_t h = hash(mac);
+        for (size_t i = 0; i < N; i++) {
+            std::atomic<uint32_t> &slot = _slots[(h + i) & (N - 1)];
+            uint32_t v = slot.load(std::memory_order_relaxed);
+            if (v == h)
+                return true;
+            if (v == 0) {
+                slot.store(h, std::memory_order_release);
+                _size++;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void clear() {
+        for (size_t i = 0; i < N; i++)
+            _slots[i].store(0, std::memory_order_relaxed);
+        _size = 0;
+    }
+
+    size_t size() const { return _size; }
+
+private:
+    std::atomic<uint32_t> _slots[N];
+    size_t _size = 0;
+};
@@ -0,0 +1,209 @@
+#include "MqttTransport.h"
+
+#include <Arduino.h>
+#include <cstring>
+
+#ifndef ESP_PLATFORM
+#include <chrono>
+#endif
+
+// MQTT 3.1.1 control packet types (high nibble of the first byte)
+static constexpr uint8_t MQTT_CONNECT = 0x10;
+static constexpr uint8_t MQTT_CONNACK = 0x20;
+static constexpr uint8_t MQTT_PUBLISH = 0x30;
+static constexpr uint8_t MQTT_PINGREQ = 0xC0;
+static constexpr uint8_t MQTT_DISCONNECT = 0xE0;
+
+static uint32_t nowMs() {
+#ifdef ESP_PLATFORM
+    return millis();
+#else
+    using namespace std::chrono;
+    return (uint32_t)duration_cast<milliseconds>(steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+// Longest client id, user name or password
+static constexpr size_t MAX_FIELD = 64;
+
+// Length-prefixed string, as in CONNECT and PUBLISH
+static size_t putString(uint8_t *out, const char *s) {
+    size_t len = strlen(s);
+    out[0] = (uint8_t)(len >> 8);
+    out[1] = (uint8_t)len;
+    memcpy(out + 2, s, len);
+    return len + 2;
+}
+
+bool MqttTransport::begin(const Config &config) {
+    if (!config.host || !config.clientId || strlen(config.clientId) > MAX_FIELD ||
+        (config.user && strlen(config.user) > MAX_FIELD) ||
+        (config.password && strlen(config.password) > MAX_FIELD))
+        return false;
+    _config = config;
+    return open();
+}
+
+bool MqttTransport::open() {
+    uint32_t now = nowMs();
+    if (_attempted && now - _lastAttemptMs < _config.retryMs)
+        return false;
+    _attempted = true;
+    _lastAttemptMs = now;
+    _state = IDLE;
+    _rxStage = 0;
+    _client.stop();
+    if (!_client.connect(_config.host, _config.port)) {
+        log_e("MqttTransport: cannot connect to %s:%u", _config.host, (unsigned)_config.port);
+        return false;
+    }
+
+    // Variable header, then client id, user and password
+    uint8_t var[10] = {0, 4, 'M', 'Q', 'T', 'T', 4, 0x02,   // level 4, clean session
+                       (uint8_t)(_config.keepAliveS >> 8), (uint8_t)_config.keepAliveS};
+    if (_config.user)
+        var[7] |= 0x80;
+    if (_config.password)
+        var[7] |= 0x40;
+    uint8_t payload[3 * (MAX_FIELD + 2)];
+    size_t n = putString(payload, _config.clientId);
+    if (_config.user)
+        n += putString(payload + n, _config.user);
+    if (_config.password)
+        n += putString(payload + n, _config.password);
+    if (!writePacket(MQTT_CONNECT, var, sizeof(var), payload, n))
+        return false;
+    _state = CONNECTING;
+    _stats.connects++;
+    return true;
+}
+
+// Header and small parts are gathered into one write, so that a packet is
+// usually a single segment; large parts are written straight through.
+bool MqttTransport::writePacket(uint8_t type, const uint8_t *a, size_t aLen, const uint8_t *b,
+                                size_t bLen, const uint8_t *c, size_t cLen) {
+    uint8_t buf[128];
+    size_t n = 0;
+    size_t remaining = aLen + bLen + cLen;
+    buf[n++] = type;
+    do {    // remaining length, 7 bits per byte
+        uint8_t digit = remaining & 0x7F;
+        remaining >>= 7;
+        buf[n++] = remaining ? digit | 0x80 : digit;
+    } while (remaining);
+
+    size_t total = n + aLen + bLen + cLen, written = 0;
+    const uint8_t *parts[3] = {a, b, c};
+    size_t lens[3] = {aLen, bLen, cLen};
+    for (int i = 0; i < 3; i++) {
+        if (!lens[i])
+            continue;
+        if (n + lens[i] <= sizeof(buf)) {
+            memcpy(buf + n, parts[i], lens[i]);
+            n += lens[i];
+            continue;
+        }
+        if (n)
+            written += _client.write(buf, n);
+        n = 0;
+        written += _client.write(parts[i], lens[i]);
+    }
+    if (n)
+        written += _client.write(buf, n);
+    _stats.bytes += written;
+    if (written != total) {
+        _client.stop();
+        _state = IDLE;
+        return false;
+    }
+    _lastSendMs = nowMs();
+    return true;
+}
+
+bool MqttTransport::publish(const char *topic, const uint8_t *payload, size_t len) {
+    if (!_config.host)
+        return false;
+    if (!_client.connected()) {
+        // The CONNACK of a new connection is read in poll()
+        open();
+        return false;
+    }
+    size_t topicLen = strlen(topic);
+    if (_state != ACCEPTED || topicLen > 0xFFFF)
+        return false;
+
+    uint8_t prefix[2] = {(uint8_t)(topicLen >> 8), (uint8_t)topicLen};
+    uint8_t type = MQTT_PUBLISH | (_config.retain ? 0x01 : 0x00);
+    if (!writePacket(type, prefix, 2, (const uint8_t *)topic, topicLen, payload, len))
+        return false;
+    _stats.published++;
+    return true;
+}
+
+void MqttTransport::poll() {
+    if (_state == IDLE)
+        return;
+    if (!_client.connected()) {
+        _state = IDLE;
+        return;
+    }
+    readPackets();
+    if (_state == ACCEPTED && _config.keepAliveS &&
+        nowMs() - _lastSendMs >= (uint32_t)_config.keepAliveS * 500) {
+        if (writePacket(MQTT_PINGREQ, nullptr, 0))
+            _stats.pings++;
+    }
+}
+
+void MqttTransport::end() {
+    if (_client.connected())
+        writePacket(MQTT_DISCONNECT, nullptr, 0);
+    _client.stop();
+    _state = IDLE;
+}
+
+// ---------------------------------------------------------------------------
+// Replies
+// ---------------------------------------------------------------------------
+
+// Only CONNACK matters; everything else (PINGRESP) is skipped by length
+void MqttTransport::readPackets() {
+    while (_state != IDLE && _client.available() > 0) {
+        int c = _client.read();
+        if (c < 0)
+            return;
+        if (_rxStage == 0) {
+            _rxType = (uint8_t)c & 0xF0;
+            _rxRemaining = 0;
+            _rxShift = 0;
+            _rxGot = 0;
+            _rxStage = 1;
+            continue;
+        }
+        if (_rxStage == 1) {
+            _rxRemaining |= (uint32_t)(c & 0x7F) << _rxShift;
+            _rxShift += 7;
+            if (c & 0x80)
+                continue;
+            _rxStage = 2;
+        } else {
+            if (_rxGot < sizeof(_rxBody))
+                _rxBody[_rxGot] = (uint8_t)c;
+            _rxGot++;
+        }
+        if (_rxGot < _rxRemaining)
+            continue;
+
+        _rxStage = 0;
+        if (_rxType != MQTT_CONNACK || _rxRemaining < 2)
+            continue;
+        if (_rxBody[1] == 0) {
+            _state = ACCEPTED;
+        } else {
+            log_e("MqttTransport: broker refused connection (%u)", _rxBody[1]);
+            _stats.refused++;
+            _client.stop();
+            _state = IDLE;
+        }
+    }
+}
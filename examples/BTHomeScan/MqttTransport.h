@@ -0,0 +1,93 @@
+/// @file MqttTransport.h
+/// @brief PublishTransport that publishes over MQTT 3.1.1 at QoS 0.
+///
+/// Just enough MQTT for a gateway that only publishes: CONNECT, PUBLISH
+/// (QoS 0), PINGREQ, DISCONNECT, over any Arduino Client (WiFiClient,
+/// EthernetClient, or PosixClient in host tools). Nothing blocks waiting for
+/// the broker: CONNACK and PINGRESP are read in poll(), and a dropped
+/// connection is reopened on the next publish(), at most every retryMs.
+/// Payloads published while disconnected are refused, so the PublishSink
+/// counts them as failed.
+/// @code
+///   static WiFiClient wifi;
+///   static MqttTransport mqtt(wifi);
+///   MqttTransport::Config mqttConfig;
+///   mqttConfig.host = "192.168.1.10";
+///   mqttConfig.clientId = "bthome-gw";
+///   mqtt.begin(mqttConfig);
+/// @endcode
+
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+#include <Client.h>
+
+#include "PublishSink.h"
+
+class MqttTransport : public PublishTransport {
+public:
+    struct Config {
+        const char *host = nullptr;         ///< Strings must outlive the transport
+        uint16_t port = 1883;
+        const char *clientId = "bthome";
+        const char *user = nullptr;
+        const char *password = nullptr;
+        uint16_t keepAliveS = 60;
+        uint32_t retryMs = 5000;            ///< Least time between connection attempts
+        bool retain = false;
+    };
+
+    struct Stats {
+        uint32_t connects;      ///< Connections opened
+        uint32_t refused;       ///< CONNACKs with an error code
+        uint32_t published;     ///< PUBLISH packets written
+        uint64_t bytes;         ///< Bytes written, all packets
+        uint32_t pings;         ///< PINGREQs sent
+    };
+
+    explicit MqttTransport(Client &client) : _client(client) {}
+
+    /// Remember the config and connect. Returns false without a host, with
+    /// a client id, user or password over 64 characters, or if the first
+    /// connection attempt fails (later publishes retry).
+    bool begin(const Config &config);
+
+    bool publish(const char *topic, const uint8_t *payload, size_t len) override;
+
+    /// Read CONNACK and PINGRESP, keep the connection alive.
+    void poll() override;
+
+    /// Send DISCONNECT and close.
+    void end();
+
+    /// Connected and accepted by the broker.
+    bool connected() { return _state == ACCEPTED && _client.connected(); }
+
+    Stats stats() const { return _stats; }
+
+private:
+    enum State : uint8_t { IDLE, CONNECTING, ACCEPTED };
+
+    bool open();
+    bool writePacket(uint8_t type, const uint8_t *a, size_t aLen, const uint8_t *b = nullptr,
+                     size_t bLen = 0, const uint8_t *c = nullptr, size_t cLen = 0);
+    void readPackets();
+
+    Client &_client;
+    Config _config;
+    State _state = IDLE;
+    uint32_t _lastAttemptMs = 0;
+    bool _attempted = false;
+    uint32_t _lastSendMs = 0;
+
+    // Packet being read: fixed header, remaining length, first body bytes
+    uint8_t _rxType = 0;
+    uint32_t _rxRemaining = 0;
+    uint8_t _rxShift = 0;
+    uint8_t _rxStage = 0;
+    uint8_t _rxBody[2];
+    uint32_t _rxGot = 0;
+
+    Stats _stats = {};
+};
@@ -0,0 +1,99 @@
+// AdvertSource on NimBLE-Arduino (build with -DBTHOME_USE_NIMBLE).
+//
+// NimBLEDevice brings the host stack up; discovery runs on ble_gap_disc()
+// with our own event handler, so adverts arrive as the raw HCI report
+// (address, RSSI, AD bytes) without NimBLEScan keeping a results vector.
+
+#if defined(ESP_PLATFORM) && defined(BTHOME_USE_NIMBLE)
+
+#include "AdvertSource.h"
+
+#include <Arduino.h>
+#include <NimBLEDevice.h>
+#include "esp_timer.h"
+
+class NimBLESource : public AdvertSource {
+public:
+    bool init(const ScanParams &params, AdvertSink *sink) override {
+        _sink = sink;
+        NimBLEDevice::init("");
+        return setParams(params);
+    }
+
+    bool setParams(const ScanParams &params) override {
+        memset(&_params, 0, sizeof(_params));
+        _params.itvl              = (uint16_t)(params.intervalMs * 16 / 10); // 0.625 ms units
+        _params.window            = (uint16_t)(params.windowMs * 16 / 10);
+        _params.filter_policy     = BLE_HCI_SCAN_FILT_NO_WL;
+        _params.limited           = 0;
+        _params.passive           = params.active ? 0 : 1;
+        _params.filter_duplicates = 0;
+        return true;
+    }
+
+    bool start(uint32_t durationMs, EndCallback onEnd, void *arg) override {
+        _onEnd = onEnd;
+        _onEndArg = arg;
+        int32_t duration = durationMs == 0 ? BLE_HS_FOREVER : (int32_t)durationMs;
+        int rc = ble_gap_disc(BLE_OWN_ADDR_PUBLIC, duration, &_params, gapEvent, this);
+        if (rc != 0) {
+            log_e("ble_gap_disc: %d", rc);
+            return false;
+        }
+        return true;
+    }
+
+    void stop() override {
+        if (ble_gap_disc_active())
+            ble_gap_disc_cancel();
+    }
+
+    const char *name() const override {
+        return "nimble";
+    }
+
+private:
+    static int gapEvent(struct ble_gap_event *event, void *arg);
+
+    AdvertSink *_sink = nullptr;
+    EndCallback _onEnd = nullptr;
+    void *_onEndArg = nullptr;
+    struct ble_gap_disc_params _params;
+};
+
+int NimBLESource::gapEvent(struct ble_gap_event *event, void *arg) {
+    auto *self = static_cast<NimBLESource *>(arg);
+
+    if (event->type == BLE_GAP_EVENT_DISC_COMPLETE) {
+        if (self->_onEnd)
+            self->_onEnd(self->_onEndArg);
+        return 0;
+    }
+    if (event->type != BLE_GAP_EVENT_DISC || !self->_sink)
+        return 0;
+
+    const auto &d = event->disc;
+    RawAdvert adv;
+    adv.hdr.timeUs = esp_timer_get_time();
+    // NimBLE stores addresses least significant byte first
+    for (int i = 0; i < 6; i++)
+        adv.hdr.mac[i] = d.addr.val[5 - i];
+    adv.hdr.addrType = d.addr.type;
+    adv.hdr.rssi     = d.rssi;
+    adv.hdr.flags    = d.event_type == BLE_HCI_ADV_RPT_EVTYPE_SCAN_RSP ? ADV_FLAG_SCAN_RSP
+                     : d.event_type == BLE_HCI_ADV_RPT_EVTYPE_ADV_IND ||
+                               d.event_type == BLE_HCI_ADV_RPT_EVTYPE_SCAN_IND ? ADV_FLAG_SCANNABLE
+                     : 0;
+    adv.hdr.len      = d.length_data > ADVERT_MAX_DATA ? ADVERT_MAX_DATA : d.length_data;
+    adv.data         = d.data;
+    self->_sink->onAdvert(adv);
+    return 0;
+}
+
+static NimBLESource s_source;
+
+AdvertSource *defaultAdvertSource() {
+    return &s_source;
+}
+
+#endif
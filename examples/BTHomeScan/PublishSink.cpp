@@ -0,0 +1,257 @@
+#include "PublishSink.h"
+
+#include <Arduino.h>
+#include <cinttypes>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+
+#ifdef ESP_PLATFORM
+#include "esp_heap_caps.h"
+#endif
+
+#include "Arena.h"
+
+// Payload size guesses used to close a batch before it outgrows maxBytes;
+// flush() splits exactly, these only keep splits rare.
+static constexpr size_t BATCH_BYTES = 32;   // {"t":...,"devices":[ ... ]}
+static constexpr size_t DEVICE_BYTES = 48;  // {"mac":"...","rssi":-61,"t":...}
+static constexpr size_t VALUE_BYTES = 14;   // ,"":-1234.567 around the name
+
+// Trigger-based objects: every one matters and is waited for
+static bool isEvent(uint8_t objectID) {
+    return objectID == 0x3A || objectID == 0x3C;   // button, dimmer
+}
+
+PublishSink::~PublishSink() {
+    if (!_ownsMem)
+        return;
+#ifdef ESP_PLATFORM
+    heap_caps_free(_mem);
+#else
+    free(_mem);
+#endif
+}
+
+bool PublishSink::begin(const Config &config, Arena *arena) {
+    if (_mem || !config.topic || config.maxBytes < 256 || config.slots == 0)
+        return false;
+
+    size_t entryBytes = (size_t)config.slots * sizeof(Entry);
+    size_t total = entryBytes + config.maxBytes + 1;
+    if (arena)
+        _mem = arena->allocate(total, alignof(Entry));
+    else
+#ifdef ESP_PLATFORM
+        _mem = heap_caps_malloc(total, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+#else
+        _mem = malloc(total);
+#endif
+    _ownsMem = _mem && !arena;
+    if (!_mem) {
+        log_e("PublishSink: cannot allocate %u bytes", (unsigned)total);
+        return false;
+    }
+    _entries = (Entry *)_mem;
+    _payload = (char *)_mem + entryBytes;
+    _config = config;
+    return true;
+}
+
+// ---------------------------------------------------------------------------
+// Batching
+// ---------------------------------------------------------------------------
+
+void PublishSink::add(const uint8_t mac[6], int64_t timeUs, int8_t rssi,
+                      const BTHomeValue &value) {
+    if (!_entries)
+        return;
+    _stats.values++;
+
+    bool newAdvert = timeUs != _advUs || memcmp(mac, _advMac, 6) != 0;
+    if (newAdvert) {
+        // The previous advert is complete: send it now if it carried an
+        // event, or if the batch has waited long enough
+        if (_count && (_eventPending ||
+                       timeUs - _oldestUs >= (int64_t)_config.maxDelayMs * 1000))
+            flush();
+        memcpy(_advMac, mac, 6);
+        _advUs = timeUs;
+        _advCount = 0;
+    }
+    uint8_t ordinal = 0;
+    for (uint8_t i = 0; i < _advCount; i++)
+        if (_advIds[i] == value.objectID)
+            ordinal++;
+    if (_advCount < DecodedAdvert::MAX_VALUES)
+        _advIds[_advCount++] = value.objectID;
+    if (isEvent(value.objectID))
+        _eventPending = true;
+
+    // A newer reading of something already batched takes its place
+    bool deviceBatched = false;
+    for (uint16_t i = 0; i < _count; i++) {
+        Entry &e = _entries[i];
+        if (memcmp(e.mac, mac, 6) != 0)
+            continue;
+        deviceBatched = true;
+        if (e.objectID == value.objectID && e.ordinal == ordinal && !isEvent(value.objectID)) {
+            e.value = value.value;
+            e.rssi = rssi;
+            e.timeUs = timeUs;
+            _newestUs = timeUs;
+            _stats.coalesced++;
+            return;
+        }
+    }
+
+    const char *name = value.name ? value.name : "unknown";
+    size_t bytes = strlen(name) + VALUE_BYTES + (deviceBatched ? 0 : DEVICE_BYTES);
+    if (_count == _config.slots || (_count && _estimate + bytes > _config.maxBytes)) {
+        _stats.early++;
+        flush();
+        bytes = strlen(name) + VALUE_BYTES + DEVICE_BYTES;
+    }
+    if (_count == 0) {
+        _oldestUs = timeUs;
+        _estimate = BATCH_BYTES;
+    }
+
+    Entry &e = _entries[_count++];
+    memcpy(e.mac, mac, 6);
+    e.objectID = value.objectID;
+    e.ordinal = ordinal;
+    e.rssi = rssi;
+    e.done = false;
+    e.value = value.value;
+    e.name = name;
+    e.timeUs = timeUs;
+    _newestUs = timeUs;
+    _estimate += bytes;
+}
+
+void PublishSink::add(const uint8_t mac[6], int64_t timeUs, int8_t rssi,
+                      const DecodedAdvert &res) {
+    for (uint8_t i = 0; i < res.count; i++)
+        add(mac, timeUs, rssi, res.values[i]);
+}
+
+size_t PublishSink::poll(int64_t nowUs) {
+    size_t sent = 0;
+    if (_count && (_eventPending || nowUs - _oldestUs >= (int64_t)_config.maxDelayMs * 1000))
+        sent = flush();
+    _transport.poll();
+    return sent;
+}
+
+// ---------------------------------------------------------------------------
+// Payloads
+// ---------------------------------------------------------------------------
+
+void PublishSink::beginPayload() {
+    _len = (size_t)snprintf(_payload, _config.maxBytes + 1, "{\"t\":%" PRId64 ",\"devices\":[",
+                            _newestUs / 1000);
+    _devicesInPayload = 0;
+}
+
+// True if len more bytes still leave room to close the device and the
+// payload
+bool PublishSink::fits(size_t len) const {
+    static const size_t CLOSE = 3;  // }]}
+    return _len + len + CLOSE <= _config.maxBytes;
+}
+
+void PublishSink::append(const char *text, size_t len) {
+    memcpy(_payload + _len, text, len);
+    _len += len;
+}
+
+void PublishSink::sendPayload() {
+    memcpy(_payload + _len, "]}", 2);
+    _len += 2;
+    _payload[_len] = '\0';
+    if (_transport.publish(_config.topic, (const uint8_t *)_payload, _len)) {
+        _stats.payloads++;
+        _stats.bytes += _len;
+    } else {
+        _stats.failed++;
+    }
+}
+
+static size_t valueText(char *out, size_t outLen, const char *name, uint8_t ordinal, float v) {
+    char suffix[6] = "";
+    if (ordinal)
+        snprintf(suffix, sizeof(suffix), "_%u", (unsigned)ordinal + 1);
+    int n = std::isfinite(v) ? snprintf(out, outLen, ",\"%s%s\":%.7g", name, suffix, (double)v)
+                             : snprintf(out, outLen, ",\"%s%s\":null", name, suffix);
+    return n < 0 ? 0 : (size_t)n < outLen ? (size_t)n : outLen - 1;
+}
+
+size_t PublishSink::flush() {
+    if (!_count)
+        return 0;
+    uint32_t before = _stats.payloads + _stats.failed;
+    _stats.batches++;
+    beginPayload();
+
+    char device[80], value[96];
+    for (uint16_t i = 0; i < _count; i++) {
+        if (_entries[i].done)
+            continue;
+
+        // The device's latest RSSI and capture time
+        const Entry &first = _entries[i];
+        const Entry *latest = &first;
+        for (uint16_t j = i + 1; j < _count; j++)
+            if (!memcmp(_entries[j].mac, first.mac, 6) && _entries[j].timeUs > latest->timeUs)
+                latest = &_entries[j];
+        const uint8_t *m = first.mac;
+        int deviceLen = snprintf(device, sizeof(device),
+                                 "{\"mac\":\"%02X%02X%02X%02X%02X%02X\",\"rssi\":%d,\"t\":%" PRId64,
+                                 m[0], m[1], m[2], m[3], m[4], m[5], latest->rssi,
+                                 latest->timeUs / 1000);
+
+        bool open = false;
+        for (uint16_t j = i; j < _count; j++) {
+            Entry &e = _entries[j];
+            if (e.done || memcmp(e.mac, first.mac, 6) != 0)
+                continue;
+            e.done = true;
+            size_t valueLen = valueText(value, sizeof(value), e.name, e.ordinal, e.value);
+            if (open && fits(valueLen)) {
+                append(value, valueLen);
+                continue;
+            }
+            if (open) {
+                // Close the device here and go on in the next payload
+                _payload[_len++] = '}';
+                open = false;
+                sendPayload();
+                beginPayload();
+            }
+            size_t comma = _devicesInPayload ? 1 : 0;
+            if (!fits(comma + (size_t)deviceLen + valueLen) && _devicesInPayload) {
+                sendPayload();
+                beginPayload();
+                comma = 0;
+            }
+            if (!fits(comma + (size_t)deviceLen + valueLen))
+                continue;   // cannot happen with maxBytes >= 256
+            if (comma)
+                append(",", 1);
+            append(device, (size_t)deviceLen);
+            append(value, valueLen);
+            _devicesInPayload++;
+            open = true;
+        }
+        if (open)
+            _payload[_len++] = '}';
+    }
+    if (_devicesInPayload)
+        sendPayload();
+
+    _count = 0;
+    _estimate = 0;
+    _eventPending = false;
+    return _stats.payloads + _stats.failed - before;
+}
@@ -0,0 +1,222 @@
+/// @file PublishSink.h
+/// @brief Batches decoded measurements into few, coalesced publish payloads.
+///
+/// Publishing every decoded advert as its own message spends most of the
+/// Wi-Fi airtime and CPU on per-message overhead. A PublishSink collects the
+/// measurements of all devices and publishes them together through a
+/// PublishTransport: one payload once the oldest value has waited
+/// maxDelayMs, or earlier when the batch would grow past maxBytes or its
+/// slots run out. Within a batch, a newer value of the same (MAC, object id,
+/// ordinal) replaces the older one, so a sensor advertising every second
+/// costs one value per batch however long the batch is. Events (button,
+/// dimmer) are never collapsed: the batch goes out as soon as the advert
+/// carrying one is complete.
+///
+/// Payloads are compact JSON, one object per device with its latest RSSI
+/// and capture time (ms, capture clock), repeated object ids in one advert
+/// (e.g. two temperatures) suffixed _2, _3, ...:
+/// @code
+///   {"t":61200,"devices":[{"mac":"A4C138001122","rssi":-61,"t":61050,
+///    "battery_percent":95,"temperature":21.5,"humidity":45.2},...]}
+/// @endcode
+/// A batch that does not fit in maxBytes is split over several payloads,
+/// between devices where possible.
+///
+/// Transports: MemoryTransport (below) keeps payloads in a buffer for tests
+/// and host tools; MqttTransport (MqttTransport.h) publishes over MQTT, and
+/// extras/host/broker is a local stand-in broker for host tests.
+///
+/// Feed it from a subscription, on the task that calls dispatch() or
+/// process():
+/// @code
+///   static PublishSink publisher(mqtt);
+///   publisher.begin(PublishSink::Config());
+///   bleScanner.subscribe(SubscriptionFilter(), PublishSink::onValue, &publisher);
+///
+///   // in loop():
+///   bleScanner.dispatch(100);
+///   publisher.poll(esp_timer_get_time());
+/// @endcode
+///
+/// Not thread-safe: call add(), poll() and flush() from one task.
+
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include "BTHomeDecoder.h"
+#include "Subscription.h"
+
+class Arena;
+
+/// Where a PublishSink's payloads go.
+class PublishTransport {
+public:
+    virtual ~PublishTransport() {}
+
+    /// Send one payload to topic. Return false if it was not sent; the sink
+    /// counts it in Stats::failed and does not retry.
+    virtual bool publish(const char *topic, const uint8_t *payload, size_t len) = 0;
+
+    /// Called from PublishSink::poll() for housekeeping (keepalives,
+    /// reading replies). Must not block.
+    virtual void poll() {}
+};
+
+/// Keeps payloads in a caller-provided buffer, for tests and host tools.
+/// publish() refuses payloads once the buffer is full; clear() empties it.
+class MemoryTransport : public PublishTransport {
+public:
+    struct Message {
+        const char *topic;      ///< Not NUL-terminated
+        size_t topicLen;
+        const uint8_t *payload;
+        size_t len;
+    };
+
+    MemoryTransport(uint8_t *buffer, size_t size) : _buf(buffer), _size(size) {}
+
+    bool publish(const char *topic, const uint8_t *payload, size_t len) override {
+        size_t topicLen = strlen(topic);
+        size_t need = HEADER + topicLen + len;
+        if (topicLen > 0xFFFF || len > 0xFFFF || need > _size - _used)
+            return false;
+        uint8_t *p = _buf + _used;
+        p[0] = (uint8_t)topicLen;
+        p[1] = (uint8_t)(topicLen >> 8);
+        p[2] = (uint8_t)len;
+        p[3] = (uint8_t)(len >> 8);
+        memcpy(p + HEADER, topic, topicLen);
+        memcpy(p + HEADER + topicLen, payload, len);
+        _used += need;
+        _count++;
+        return true;
+    }
+
+    /// Messages held.
+    size_t count() const { return _count; }
+
+    /// Walk the messages, oldest first: start with cursor = 0.
+    bool next(size_t &cursor, Message &m) const {
+        if (cursor >= _used)
+            return false;
+        const uint8_t *p = _buf + cursor;
+        m.topicLen = p[0] | (size_t)p[1] << 8;
+        m.len = p[2] | (size_t)p[3] << 8;
+        m.topic = (const char *)p + HEADER;
+        m.payload = p + HEADER + m.topicLen;
+        cursor += HEADER + m.topicLen + m.len;
+        return true;
+    }
+
+    void clear() {
+        _used = 0;
+        _count = 0;
+    }
+
+private:
+    static constexpr size_t HEADER = 4;     ///< Topic and payload length, 16 bits each
+
+    uint8_t *_buf;
+    size_t _size;
+    size_t _used = 0;
+    size_t _count = 0;
+};
+
+class PublishSink {
+public:
+    struct Config {
+        const char *topic = "bthome/batch";   ///< Must outlive the sink
+        size_t maxBytes = 1024;     ///< Largest payload, at least 256
+        uint32_t maxDelayMs = 5000; ///< Longest a value waits to be published
+        uint16_t slots = 64;        ///< (device, measurement) pairs per batch
+    };
+
+    struct Stats {
+        uint32_t values;        ///< Measurements added
+        uint32_t coalesced;     ///< Measurements that replaced an older value in the batch
+        uint32_t batches;       ///< Batches flushed
+        uint32_t payloads;      ///< Payloads published
+        uint64_t bytes;         ///< Payload bytes published
+        uint32_t failed;        ///< Payloads the transport refused (dropped)
+        uint32_t early;         ///< Batches sent before maxDelayMs: bytes or slots ran out
+    };
+
+    explicit PublishSink(PublishTransport &transport) : _transport(transport) {}
+    ~PublishSink();
+
+    PublishSink(const PublishSink &) = delete;
+    PublishSink &operator=(const PublishSink &) = delete;
+
+    /// Allocate the batch and payload buffer in internal RAM, or from arena
+    /// if given (see Arena.h). Returns false if out of memory, already
+    /// started, or the config is unusable.
+    bool begin(const Config &config, Arena *arena = nullptr);
+
+    /// Add one measurement, captured at timeUs (capture clock). Values of
+    /// one advert must be added one after the other.
+    void add(const uint8_t mac[6], int64_t timeUs, int8_t rssi, const BTHomeValue &value);
+
+    /// Add every measurement of a decoded advert.
+    void add(const uint8_t mac[6], int64_t timeUs, int8_t rssi, const DecodedAdvert &res);
+
+    /// SubscriptionCallback for BLEScanner::subscribe(); ctx is the sink.
+    static void onValue(const SubscribedValue &value, void *ctx) {
+        static_cast<PublishSink *>(ctx)->add(value.mac, value.timeUs, value.rssi, value.value);
+    }
+
+    /// Publish the batch if it is due at nowUs (capture clock, e.g.
+    /// esp_timer_get_time()) and let the transport do its housekeeping.
+    /// Call regularly, also when no adverts arrive. Returns payloads sent.
+    size_t poll(int64_t nowUs);
+
+    /// Publish whatever is batched now. Returns payloads sent.
+    size_t flush();
+
+    /// Values waiting in the batch.
+    uint16_t pending() const { return _count; }
+
+    Stats stats() const { return _stats; }
+
+private:
+    struct Entry {
+        uint8_t mac[6];
+        uint8_t objectID;
+        uint8_t ordinal;    ///< Repeats of objectID earlier in the same advert
+        int8_t rssi;
+        bool done;          ///< Written to the current payload
+        float value;
+        const char *name;   ///< Static string
+        int64_t timeUs;
+    };
+
+    void beginPayload();
+    bool fits(size_t len) const;
+    void append(const char *text, size_t len);
+    void sendPayload();
+
+    PublishTransport &_transport;
+    Config _config;
+    void *_mem = nullptr;
+    bool _ownsMem = false;
+
+    Entry *_entries = nullptr;
+    uint16_t _count = 0;
+    size_t _estimate = 0;           ///< Rough payload bytes of the batch
+    int64_t _oldestUs = 0;
+    int64_t _newestUs = 0;
+    bool _eventPending = false;     ///< Flush once the current advert is complete
+
+    // The advert whose values are being added, for ordinals
+    uint8_t _advMac[6] = {};
+    int64_t _advUs = -1;
+    uint8_t _advIds[DecodedAdvert::MAX_VALUES];
+    uint8_t _advCount = 0;
+
+    char *_payload = nullptr;       ///< maxBytes + 1
+    size_t _len = 0;
+    uint16_t _devicesInPayload = 0;
+
+    Stats _stats = {};
+};
@@ -0,0 +1,170 @@
+#include "ScanResponseMerger.h"
+
+#include <Arduino.h>
+#include <cstdlib>
+#include <cstring>
+
+#ifdef ESP_PLATFORM
+#include "esp_heap_caps.h"
+#endif
+
+#include "Arena.h"
+
+ScanResponseMerger::~ScanResponseMerger() {
+    if (_lock)
+        vSemaphoreDelete(_lock);
+    if (!_ownsSlots)
+        return;
+#ifdef ESP_PLATFORM
+    heap_caps_free(_slots);
+#else
+    free(_slots);
+#endif
+}
+
+bool ScanResponseMerger::begin(uint32_t windowMs, Arena *arena) {
+    if (_slots || windowMs == 0)
+        return false;
+
+    size_t total = SLOTS * sizeof(Slot);
+    if (arena) {
+        _slots = (Slot *)arena->allocate(total, alignof(Slot));
+        auto *lock = arena->create<StaticSemaphore_t>();
+        _lock = lock ? xSemaphoreCreateMutexStatic(lock) : nullptr;
+    } else {
+#ifdef ESP_PLATFORM
+        _slots = (Slot *)heap_caps_malloc(total, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+#else
+        _slots = (Slot *)malloc(total);
+#endif
+        _lock = xSemaphoreCreateMutex();
+    }
+    _ownsSlots = _slots && !arena;
+    if (!_slots || !_lock) {
+        log_e("ScanResponseMerger: cannot allocate %u bytes", (unsigned)total);
+        return false;
+    }
+    for (size_t i = 0; i < SLOTS; i++)
+        _slots[i].used = false;
+    _windowMs = windowMs;
+    return true;
+}
+
+ScanResponseMerger::Slot *ScanResponseMerger::find(const uint8_t mac[6]) {
+    for (size_t i = 0; i < SLOTS; i++)
+        if (_slots[i].used && memcmp(_slots[i].hdr.mac, mac, 6) == 0)
+            return &_slots[i];
+    return nullptr;
+}
+
+// Emit a held advert as it is and free its slot. Caller holds _lock.
+void ScanResponseMerger::release(Slot &slot) {
+    RawAdvert adv;
+    adv.hdr = slot.hdr;
+    adv.data = slot.data;
+    slot.used = false;
+    _emit(adv, _ctx);
+}
+
+// Caller holds _lock.
+void ScanResponseMerger::expire(int64_t nowUs) {
+    int64_t windowUs = (int64_t)_windowMs * 1000;
+    for (size_t i = 0; i < SLOTS; i++)
+        if (_slots[i].used && nowUs - _slots[i].hdr.timeUs >= windowUs) {
+            _stats.alone++;
+            release(_slots[i]);
+        }
+}
+
+void ScanResponseMerger::add(const RawAdvert &adv) {
+    if (!_slots) {
+        _emit(adv, _ctx);
+        return;
+    }
+    xSemaphoreTake(_lock, portMAX_DELAY);
+    expire(adv.hdr.timeUs);
+
+    if (adv.hdr.flags & ADV_FLAG_SCAN_RSP) {
+        Slot *s = find(adv.hdr.mac);
+        if (!s) {
+            _stats.orphans++;
+            _emit(adv, _ctx);
+            xSemaphoreGive(_lock);
+            return;
+        }
+        size_t len = s->hdr.len;
+        if (adv.hdr.len >= len && memcmp(adv.data, s->data, len) == 0) {
+            // The stack already put the advert data in front
+            memcpy(s->data, adv.data, adv.hdr.len);
+            len = adv.hdr.len;
+        } else {
+            size_t n = adv.hdr.len;
+            if (len + n > ADVERT_MAX_DATA)
+                n = ADVERT_MAX_DATA - len;
+            memcpy(s->data + len, adv.data, n);
+            len += n;
+        }
+        s->hdr.len = (uint8_t)len;
+        s->hdr.flags |= ADV_FLAG_MERGED;
+        if (adv.hdr.rssi > s->hdr.rssi)
+            s->hdr.rssi = adv.hdr.rssi;
+        _stats.merged++;
+        release(*s);
+    } else if (adv.hdr.flags & ADV_FLAG_SCANNABLE) {
+        // An advert still held from this device never got its response
+        Slot *s = find(adv.hdr.mac);
+        if (s) {
+            _stats.alone++;
+            release(*s);
+        } else {
+            for (size_t i = 0; i < SLOTS && !s; i++)
+                if (!_slots[i].used)
+                    s = &_slots[i];
+        }
+        if (!s) {
+            s = &_slots[0];
+            for (size_t i = 1; i < SLOTS; i++)
+                if (_slots[i].hdr.timeUs < s->hdr.timeUs)
+                    s = &_slots[i];
+            _stats.evicted++;
+            release(*s);
+        }
+        s->hdr = adv.hdr;
+        memcpy(s->data, adv.data, adv.hdr.len);
+        s->used = true;
+        _stats.held++;
+    } else {
+        _emit(adv, _ctx);
+    }
+    xSemaphoreGive(_lock);
+}
+
+void ScanResponseMerger::poll(int64_t nowUs) {
+    if (!_slots)
+        return;
+    xSemaphoreTake(_lock, portMAX_DELAY);
+    expire(nowUs);
+    xSemaphoreGive(_lock);
+}
+
+void ScanResponseMerger::flush() {
+    if (!_slots)
+        return;
+    xSemaphoreTake(_lock, portMAX_DELAY);
+    for (size_t i = 0; i < SLOTS; i++)
+        if (_slots[i].used) {
+            _stats.alone++;
+            release(_slots[i]);
+        }
+    xSemaphoreGive(_lock);
+}
+
+ScanResponseMerger::Stats ScanResponseMerger::stats() const {
+    Stats s = {};
+    if (!_lock)
+        return s;
+    xSemaphoreTake(_lock, portMAX_DELAY);
+    s = _stats;
+    xSemaphoreGive(_lock);
+    return s;
+}
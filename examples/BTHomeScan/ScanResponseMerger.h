@@ -0,0 +1,88 @@
+/// @file ScanResponseMerger.h
+/// @brief Joins an advert and its scan response into one queued record.
+///
+/// With active scanning a device's advert and its scan response arrive as
+/// two reports a few milliseconds apart, so each would be queued and
+/// decoded on its own, with the sensor data in one and the name often in
+/// the other. The merger holds a scannable advert (ADV_FLAG_SCANNABLE) per
+/// MAC for up to windowMs and emits it together with its scan response as
+/// one record: the advert's AD structures followed by the response's,
+/// flagged ADV_FLAG_MERGED, with the advert's capture time and the stronger
+/// RSSI. Stacks that report the response with the advert data already in
+/// front of it (Bluedroid) are recognised, so nothing is doubled. Nothing is
+/// dropped either: a held advert whose response does not come in time is
+/// emitted alone by poll(), as is the oldest one when every slot is taken,
+/// and a response with no advert held passes through like any other
+/// report.
+///
+/// add() runs on the radio task and poll() on another (the scan task), so
+/// both take a short lock; emit is called with it held and must not block.
+
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+#include "AdvertSource.h"
+
+class Arena;
+
+class ScanResponseMerger {
+public:
+    /// Receives every record, merged or not. data is only valid for the call.
+    typedef void (*EmitFn)(const RawAdvert &adv, void *ctx);
+
+    static constexpr size_t SLOTS = 16;     ///< Adverts held at once
+
+    struct Stats {
+        uint32_t held;      ///< Scannable adverts held for their scan response
+        uint32_t merged;    ///< Adverts emitted with their scan response
+        uint32_t alone;     ///< Held adverts emitted without one (window passed)
+        uint32_t evicted;   ///< Held adverts emitted early, every slot taken
+        uint32_t orphans;   ///< Scan responses emitted alone, no advert held
+    };
+
+    ScanResponseMerger(EmitFn emit, void *ctx) : _emit(emit), _ctx(ctx) {}
+    ~ScanResponseMerger();
+
+    ScanResponseMerger(const ScanResponseMerger &) = delete;
+    ScanResponseMerger &operator=(const ScanResponseMerger &) = delete;
+
+    /// Allocate the slots in internal RAM, or from arena if given (see
+    /// Arena.h). Returns false if out of memory or windowMs is 0.
+    bool begin(uint32_t windowMs, Arena *arena = nullptr);
+
+    /// Hand over one report from the radio.
+    void add(const RawAdvert &adv);
+
+    /// Emit held adverts whose window has passed at nowUs (capture clock).
+    void poll(int64_t nowUs);
+
+    /// Emit everything held, e.g. when the scan stops.
+    void flush();
+
+    uint32_t windowMs() const { return _windowMs; }
+
+    Stats stats() const;
+
+private:
+    struct Slot {
+        bool used;
+        AdvertHeader hdr;
+        uint8_t data[ADVERT_MAX_DATA];
+    };
+
+    Slot *find(const uint8_t mac[6]);
+    void release(Slot &slot);
+    void expire(int64_t nowUs);
+
+    EmitFn _emit;
+    void *_ctx;
+    uint32_t _windowMs = 0;
+    Slot *_slots = nullptr;
+    bool _ownsSlots = false;
+    SemaphoreHandle_t _lock = nullptr;
+    Stats _stats = {};
+};
@@ -0,0 +1,306 @@
+#include "StateStore.h"
+
+#include <Arduino.h>
+#include <cstdlib>
+#include <cstring>
+
+#include "AdvertFrame.h"
+
+#ifdef ESP_PLATFORM
+#include "nvs.h"
+#endif
+
+static const char STATE_MAGIC[4] = {'B', 'T', 'H', 'S'};
+
+// ---------------------------------------------------------------------------
+// File backend
+// ---------------------------------------------------------------------------
+FileStateBackend::~FileStateBackend() {
+    sync();
+}
+
+size_t FileStateBackend::read(uint8_t *buf, size_t cap) {
+    FILE *f = fopen(_path, "rb");
+    if (!f)
+        return 0;
+    size_t n = fread(buf, 1, cap, f);
+    fclose(f);
+    return n;
+}
+
+bool FileStateBackend::write(size_t offset, const uint8_t *data, size_t len) {
+    if (!_file) {
+        _file = fopen(_path, "r+b");
+        if (!_file)
+            _file = fopen(_path, "w+b");
+        if (!_file) {
+            log_e("StateStore: cannot open %s", _path);
+            return false;
+        }
+    }
+    return fseek(_file, (long)offset, SEEK_SET) == 0 &&
+           fwrite(data, 1, len, _file) == len;
+}
+
+bool FileStateBackend::sync() {
+    if (!_file)
+        return true;
+    bool ok = fflush(_file) == 0;
+    ok = fclose(_file) == 0 && ok;
+    _file = nullptr;
+    return ok;
+}
+
+// ---------------------------------------------------------------------------
+// NVS backend
+// ---------------------------------------------------------------------------
+#ifdef ESP_PLATFORM
+static void chunkKey(size_t chunk, char *key) {
+    snprintf(key, 8, "s%u", (unsigned)chunk);
+}
+
+NvsStateBackend::~NvsStateBackend() {
+    free(_image);
+}
+
+bool NvsStateBackend::ensure(size_t len) {
+    if (len <= _len)
+        return true;
+    size_t chunks = (len + NVS_CHUNK - 1) / NVS_CHUNK;
+    if (chunks > 32)
+        return false;
+    uint8_t *image = (uint8_t *)realloc(_image, chunks * NVS_CHUNK);
+    if (!image)
+        return false;
+    memset(image + _len, 0, chunks * NVS_CHUNK - _len);
+    _image = image;
+    _len = chunks * NVS_CHUNK;
+    return true;
+}
+
+size_t NvsStateBackend::read(uint8_t *buf, size_t cap) {
+    nvs_handle_t h;
+    if (nvs_open(_ns, NVS_READONLY, &h) != ESP_OK)
+        return 0;
+    size_t n = 0;
+    for (size_t chunk = 0; n < cap && ensure(n + NVS_CHUNK); chunk++) {
+        char key[8];
+        chunkKey(chunk, key);
+        size_t len = NVS_CHUNK;
+        if (nvs_get_blob(h, key, _image + n, &len) != ESP_OK)
+            break;
+        n += len;
+        if (len < NVS_CHUNK)
+            break;
+        _chunks = chunk + 1;
+    }
+    nvs_close(h);
+    size_t copy = n < cap ? n : cap;
+    memcpy(buf, _image, copy);
+    return copy;
+}
+
+bool NvsStateBackend::write(size_t offset, const uint8_t *data, size_t len) {
+    if (!ensure(offset + len))
+        return false;
+    memcpy(_image + offset, data, len);
+    for (size_t c = offset / NVS_CHUNK; c <= (offset + len - 1) / NVS_CHUNK; c++)
+        _dirty |= 1u << c;
+    return true;
+}
+
+bool NvsStateBackend::sync() {
+    if (!_dirty)
+        return true;
+    nvs_handle_t h;
+    if (nvs_open(_ns, NVS_READWRITE, &h) != ESP_OK) {
+        log_e("StateStore: cannot open NVS namespace %s", _ns);
+        return false;
+    }
+    // read() stops at the first missing chunk: fill any gap below the last
+    // one written
+    size_t last = 0;
+    for (size_t c = 0; c * NVS_CHUNK < _len; c++)
+        if (_dirty & (1u << c))
+            last = c;
+    for (size_t c = _chunks; c < last; c++)
+        _dirty |= 1u << c;
+
+    bool ok = true;
+    for (size_t c = 0; c * NVS_CHUNK < _len; c++) {
+        if (!(_dirty & (1u << c)))
+            continue;
+        char key[8];
+        chunkKey(c, key);
+        ok = nvs_set_blob(h, key, _image + c * NVS_CHUNK, NVS_CHUNK) == ESP_OK && ok;
+    }
+    ok = nvs_commit(h) == ESP_OK && ok;
+    nvs_close(h);
+    if (ok) {
+        _dirty = 0;
+        if (_chunks < last + 1)
+            _chunks = last + 1;
+    }
+    return ok;
+}
+#endif
+
+// ---------------------------------------------------------------------------
+// Store
+// ---------------------------------------------------------------------------
+bool StateStore::load() {
+    _hasKey = false;
+    memset(_devices, 0, sizeof(_devices));
+    memset(&_storedHeader, 0, sizeof(_storedHeader));
+    memset(_stored, 0, sizeof(_stored));
+    _headerStored = false;
+    _stats.restored = 0;
+    _stats.corrupt = 0;
+
+    uint8_t *image = (uint8_t *)malloc(IMAGE_BYTES);
+    if (!image)
+        return false;
+    size_t n = _backend.read(image, IMAGE_BYTES);
+
+    Header h;
+    bool ok = n >= sizeof(h);
+    if (ok) {
+        memcpy(&h, image, sizeof(h));
+        ok = memcmp(h.magic, STATE_MAGIC, 4) == 0 &&
+             h.crc == frameCrc16((const uint8_t *)&h, offsetof(Header, crc));
+    }
+    if (ok && h.version != VERSION) {
+        log_i("StateStore: ignoring version %u state", h.version);
+        ok = false;
+    }
+    if (!ok) {
+        // Slots of an unusable image may still pass their CRC: have the
+        // next flush() overwrite all of them
+        if (n > 0)
+            memset(_stored, 0xFF, sizeof(_stored));
+        free(image);
+        return false;
+    }
+
+    _storedHeader = h;
+    _headerStored = true;
+    _hasKey = h.flags & 1;
+    memcpy(_key, h.key, 16);
+
+    uint16_t slots = h.slots < MAX_DEVICES ? h.slots : MAX_DEVICES;
+    for (uint16_t i = 0; i < slots; i++) {
+        size_t off = sizeof(Header) + i * sizeof(Slot);
+        if (off + sizeof(Slot) > n)
+            break;
+        Slot s;
+        memcpy(&s, image + off, sizeof(s));
+        if (s.crc != frameCrc16((const uint8_t *)&s, offsetof(Slot, crc))) {
+            _stats.corrupt++;
+            continue;
+        }
+        _stored[i] = s;
+        if (s.state.flags) {
+            _devices[i] = s.state;
+            _stats.restored++;
+        }
+    }
+    free(image);
+    return true;
+}
+
+void StateStore::setKey(const uint8_t *key) {
+    _hasKey = key != nullptr;
+    if (key)
+        memcpy(_key, key, 16);
+    else
+        memset(_key, 0, 16);
+}
+
+const DeviceState *StateStore::device(uint16_t i) const {
+    return i < MAX_DEVICES && _devices[i].flags ? &_devices[i] : nullptr;
+}
+
+void StateStore::setDevice(uint16_t i, const DeviceState *state) {
+    if (i >= MAX_DEVICES)
+        return;
+    if (state)
+        _devices[i] = *state;
+    else
+        memset(&_devices[i], 0, sizeof(_devices[i]));
+}
+
+void StateStore::buildHeader(Header &h) const {
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, STATE_MAGIC, 4);
+    h.version = VERSION;
+    h.slots = MAX_DEVICES;
+    h.flags = _hasKey ? 1 : 0;
+    memcpy(h.key, _key, 16);
+    h.crc = frameCrc16((const uint8_t *)&h, offsetof(Header, crc));
+}
+
+void StateStore::buildSlot(uint16_t i, Slot &s) const {
+    memset(&s, 0, sizeof(s));
+    if (_devices[i].flags)
+        s.state = _devices[i];
+    s.crc = frameCrc16((const uint8_t *)&s, offsetof(Slot, crc));
+}
+
+size_t StateStore::flush() {
+    size_t written = 0;
+    bool ok = true;
+
+    Header h;
+    buildHeader(h);
+    if (!_headerStored || memcmp(&h, &_storedHeader, sizeof(h)) != 0) {
+        ok = _backend.write(0, (const uint8_t *)&h, sizeof(h));
+        if (ok) {
+            _storedHeader = h;
+            _headerStored = true;
+            written += sizeof(h);
+        }
+    }
+
+    // Changed slots, adjacent ones in one write. A slot that was never
+    // written reads back as invalid, i.e. empty, so empty slots only need
+    // writing when they held a device.
+    uint16_t i = 0;
+    while (ok && i < MAX_DEVICES) {
+        Slot s;
+        buildSlot(i, s);
+        bool emptyNow = !_devices[i].flags;
+        bool emptyStored = !_stored[i].state.flags;
+        if ((emptyNow && emptyStored) || memcmp(&s, &_stored[i], sizeof(s)) == 0) {
+            i++;
+            continue;
+        }
+
+        Slot run[8];
+        uint16_t first = i, count = 0;
+        while (i < MAX_DEVICES && count < 8) {
+            buildSlot(i, run[count]);
+            if (memcmp(&run[count], &_stored[i], sizeof(Slot)) == 0)
+                break;
+            if (!_devices[i].flags && !_stored[i].state.flags)
+                break;
+            count++;
+            i++;
+        }
+        ok = _backend.write(sizeof(Header) + first * sizeof(Slot), (const uint8_t *)run,
+                            count * sizeof(Slot));
+        if (ok) {
+            memcpy(&_stored[first], run, count * sizeof(Slot));
+            written += count * sizeof(Slot);
+            _stats.slotWrites += count;
+        }
+    }
+
+    if (written) {
+        ok = _backend.sync() && ok;
+        _stats.flushes++;
+        _stats.bytesWritten += written;
+    }
+    if (!ok)
+        log_e("StateStore: write failed");
+    return written;
+}
@@ -0,0 +1,177 @@
+/// @file StateStore.h
+/// @brief Versioned snapshot of gateway state that survives a reboot.
+///
+/// Holds the BTHome key and a table of MAX_DEVICES DeviceState slots (last
+/// encryption counter and packet id, learned advertising period). Attach a
+/// store with BLEScanner::setStateStore(): begin() restores it with a single
+/// bulk read before scanning starts, so keys, replay counters, known-device
+/// queue admission and adaptive scan timing are there from the first
+/// advert, and BLEScanner::saveState() writes it back.
+///
+/// Storage image (little-endian, fixed offsets):
+///   header  32 bytes: magic "BTHS", version, slot count, flags, key, CRC-16
+///   slot i  24 bytes at 32 + 24 * i: DeviceState, CRC-16
+///
+/// Writes are incremental: the store keeps the image it last read or wrote
+/// and flush() only rewrites the header or slots that differ from it, so
+/// counters ticking on one device cost 24 bytes, and unchanged state costs
+/// nothing. Each slot has its own CRC: a write cut off by a reset loses at
+/// most that slot. An image with another version is ignored (cold start).
+///
+/// Backends (StateBackend): FileStateBackend writes a file through stdio,
+/// which works on the host and on ESP32 LittleFS/SPIFFS mounts (e.g.
+/// "/littlefs/bthome.state"); NvsStateBackend keeps the image in NVS blobs
+/// of NVS_CHUNK bytes and rewrites only the chunks that changed.
+
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+
+/// Persisted state of one device.
+struct DeviceState {
+    static constexpr uint8_t USED = 0x01;
+    static constexpr uint8_t HAS_COUNTER = 0x02;
+    static constexpr uint8_t HAS_PACKET_ID = 0x04;
+    static constexpr uint8_t HAS_PERIOD = 0x08;
+
+    uint8_t mac[6];
+    uint8_t flags;          ///< USED and HAS_* bits, 0 = empty slot
+    uint8_t packetId;       ///< Last BTHome packet id (object 0x00)
+    uint32_t counter;       ///< Last accepted BTHome encryption counter
+    uint32_t periodUs;      ///< Learned advertising period (AdaptiveScan)
+    uint32_t jitterUs;      ///< Learned deviation from the period
+};
+static_assert(sizeof(DeviceState) == 20, "DeviceState is part of the storage format");
+
+/// Where a StateStore image lives.
+class StateBackend {
+public:
+    virtual ~StateBackend() {}
+
+    /// Read up to cap bytes of the stored image into buf. Returns the
+    /// number read, 0 if there is none.
+    virtual size_t read(uint8_t *buf, size_t cap) = 0;
+
+    /// Overwrite len bytes at offset, extending the image if needed.
+    virtual bool write(size_t offset, const uint8_t *data, size_t len) = 0;
+
+    /// Make the writes since the last sync durable.
+    virtual bool sync() { return true; }
+};
+
+/// Image in a file, through stdio (host, or an ESP32 VFS mount).
+class FileStateBackend : public StateBackend {
+public:
+    explicit FileStateBackend(const char *path) : _path(path) {}
+    ~FileStateBackend() override;
+
+    size_t read(uint8_t *buf, size_t cap) override;
+    bool write(size_t offset, const uint8_t *data, size_t len) override;
+    bool sync() override;
+
+private:
+    const char *_path;
+    FILE *_file = nullptr;      ///< Open between the writes of one flush
+};
+
+#ifdef ESP_PLATFORM
+/// Image in NVS blobs "s0", "s1", ... of NVS_CHUNK bytes in namespace ns.
+/// NVS must be initialized (the Arduino core does it).
+class NvsStateBackend : public StateBackend {
+public:
+    static constexpr size_t NVS_CHUNK = 256;
+
+    explicit NvsStateBackend(const char *ns = "bthome") : _ns(ns) {}
+    ~NvsStateBackend() override;
+
+    size_t read(uint8_t *buf, size_t cap) override;
+    bool write(size_t offset, const uint8_t *data, size_t len) override;
+    bool sync() override;
+
+private:
+    bool ensure(size_t len);
+
+    const char *_ns;
+    uint8_t *_image = nullptr;  ///< Cached copy of the blobs
+    size_t _len = 0;
+    uint32_t _dirty = 0;        ///< Chunks to rewrite, one bit each
+    size_t _chunks = 0;         ///< Chunks known to be in NVS
+};
+#endif
+
+class StateStore {
+public:
+    static constexpr uint16_t VERSION = 1;
+    static constexpr uint16_t MAX_DEVICES = 64;
+
+    struct Stats {
+        uint16_t restored;      ///< Valid device slots found by load()
+        uint16_t corrupt;       ///< Slots load() rejected (CRC)
+        uint32_t flushes;       ///< flush() calls that wrote something
+        uint32_t slotWrites;    ///< Device slots written
+        uint32_t bytesWritten;
+    };
+
+    explicit StateStore(StateBackend &backend) : _backend(backend) {}
+
+    StateStore(const StateStore &) = delete;
+    StateStore &operator=(const StateStore &) = delete;
+
+    /// Read the stored image in one go. Returns false if there is none or
+    /// it has another version; the store is then empty.
+    bool load();
+
+    /// Stored BTHome key, nullptr if none.
+    const uint8_t *key() const { return _hasKey ? _key : nullptr; }
+
+    /// Set (nullptr: clear) the key to store.
+    void setKey(const uint8_t *key);
+
+    /// Device slot i, nullptr if empty.
+    const DeviceState *device(uint16_t i) const;
+
+    /// Set (nullptr: clear) device slot i.
+    void setDevice(uint16_t i, const DeviceState *state);
+
+    /// Write what differs from the stored image. Returns bytes written.
+    size_t flush();
+
+    Stats stats() const { return _stats; }
+
+private:
+    struct Header {
+        char magic[4];
+        uint16_t version;
+        uint16_t slots;
+        uint8_t flags;          ///< Bit 0: key present
+        uint8_t reserved[3];
+        uint8_t key[16];
+        uint16_t reserved2;
+        uint16_t crc;
+    };
+    struct Slot {
+        DeviceState state;
+        uint16_t reserved;
+        uint16_t crc;
+    };
+    static_assert(sizeof(Header) == 32, "Header is part of the storage format");
+    static_assert(sizeof(Slot) == 24, "Slot is part of the storage format");
+
+    static constexpr size_t IMAGE_BYTES = sizeof(Header) + MAX_DEVICES * sizeof(Slot);
+
+    void buildHeader(Header &h) const;
+    void buildSlot(uint16_t i, Slot &s) const;
+
+    StateBackend &_backend;
+    bool _hasKey = false;
+    uint8_t _key[16] = {};
+    DeviceState _devices[MAX_DEVICES] = {};
+
+    // What the backend holds, to find what changed
+    Header _storedHeader = {};
+    Slot _stored[MAX_DEVICES] = {};
+    bool _headerStored = false;
+
+    Stats _stats = {};
+};
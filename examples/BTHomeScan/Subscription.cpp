@@ -0,0 +1,33 @@
+#include "Subscription.h"
+
+#include "HexUtil.h"
+
+SubscriptionFilter &SubscriptionFilter::mac(const char *macStr) {
+    // A device was asked for, so even a bad one narrows the filter
+    _anyMac = false;
+    if (!macStr) {
+        _error = true;
+        return *this;
+    }
+    uint8_t bytes[6];
+    int n = 0;
+    while (*macStr && n < 6) {
+        if (*macStr == ':' || *macStr == '-') {
+            macStr++;
+            continue;
+        }
+        int hi = hexNibble(macStr[0]);
+        int lo = macStr[1] ? hexNibble(macStr[1]) : -1;
+        if (hi < 0 || lo < 0) {
+            _error = true;
+            return *this;
+        }
+        bytes[n++] = (uint8_t)((hi << 4) | lo);
+        macStr += 2;
+    }
+    if (n == 6 && *macStr == '\0')
+        mac(bytes);
+    else
+        _error = true;
+    return *this;
+}
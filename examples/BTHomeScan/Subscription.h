@@ -0,0 +1,83 @@
+/// @file Subscription.h
+/// @brief Filters for routing decoded measurements to subscribers.
+///
+/// A SubscriptionFilter selects devices (by MAC) and/or BTHome object ids.
+/// Matching is a bit test in a 256-bit object bitmap plus a MacSet lookup,
+/// so BLEScanner can reject adverts before decoding them and measurements
+/// nobody subscribed to are never copied out or turned into JSON.
+///
+/// @code
+///   SubscriptionFilter buttons;
+///   buttons.object(0x3A);                    // all button events
+///
+///   SubscriptionFilter temps;
+///   temps.object(0x02).mac("A4:C1:38:00:11:22").mac("A4:C1:38:00:11:23");
+/// @endcode
+
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+#include "BTHomeDecoder.h"
+#include "MacSet.h"
+
+class SubscriptionFilter {
+public:
+    static constexpr size_t MAX_MACS = 16;
+
+    /// Add a BTHome object id. No ids = every measurement.
+    SubscriptionFilter &object(uint8_t objectID) {
+        _objects[objectID >> 5] |= 1u << (objectID & 31);
+        _anyObject = false;
+        return *this;
+    }
+
+    /// Add a device, most significant byte first. No devices = every device.
+    /// Past MAX_MACS devices the filter is marked bad (see ok()); it never
+    /// falls back to matching every device.
+    SubscriptionFilter &mac(const uint8_t mac[6]) {
+        if (!_macs.insert(mac))
+            _error = true;
+        _anyMac = false;
+        return *this;
+    }
+
+    /// Add a device as "AA:BB:CC:DD:EE:FF" or "AABBCCDDEEFF". An invalid
+    /// string marks the filter bad, like an overflow.
+    SubscriptionFilter &mac(const char *macStr);
+
+    /// False if a MAC was invalid or did not fit. BLEScanner::subscribe()
+    /// refuses such filters.
+    bool ok() const { return !_error; }
+
+    bool matchesMac(const uint8_t mac[6]) const {
+        return _anyMac || _macs.contains(mac);
+    }
+
+    bool matchesObject(uint8_t objectID) const {
+        return _anyObject || (_objects[objectID >> 5] >> (objectID & 31)) & 1u;
+    }
+
+    bool anyObject() const { return _anyObject; }
+    const uint32_t *objectBits() const { return _objects; }
+
+private:
+    uint32_t _objects[8] = {};
+    bool _anyObject = true;
+    bool _anyMac = true;
+    bool _error = false;
+    MacSet<MAX_MACS> _macs;
+};
+
+/// One measurement routed to a subscriber.
+struct SubscribedValue {
+    int64_t timeUs;         ///< Capture time (esp_timer)
+    uint8_t mac[6];         ///< Most significant byte first
+    int8_t rssi;
+    const char *protocol;   ///< "bthome", "ruuvi", ... (static string)
+    BTHomeValue value;
+};
+
+/// Called on the task that runs BLEScanner::process()/dispatch(). Must not
+/// block or (un)subscribe.
+typedef void (*SubscriptionCallback)(const SubscribedValue &value, void *ctx);
@@ -0,0 +1,230 @@
+#include "WindowAggregator.h"
+
+#include <Arduino.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+#ifdef ESP_PLATFORM
+#include "esp_heap_caps.h"
+#endif
+
+#include "Arena.h"
+
+WindowAggregator::~WindowAggregator() {
+    if (!_ownsMem)
+        return;
+#ifdef ESP_PLATFORM
+    heap_caps_free(_mem);
+#else
+    free(_mem);
+#endif
+}
+
+bool WindowAggregator::begin(const Config &config, Arena *arena) {
+    if (_mem || config.windowMs == 0 || config.slots == 0)
+        return false;
+
+    // Keep the table at most 3/4 full so probe runs stay short
+    size_t cap = 8;
+    uint8_t bits = 3;
+    while (cap < (size_t)config.slots * 4 / 3 + 1) {
+        cap <<= 1;
+        bits++;
+    }
+    if (cap > 0x8000)
+        return false;
+
+    size_t keyBytes = cap * sizeof(uint64_t);
+    size_t slotBytes = cap * sizeof(Slot);
+    size_t total = 2 * (keyBytes + slotBytes) + cap * sizeof(uint16_t);
+    // Hit on every decoded advert: internal RAM, not PSRAM
+    if (arena)
+        _mem = arena->allocate(total, alignof(uint64_t));
+    else
+#ifdef ESP_PLATFORM
+        _mem = heap_caps_malloc(total, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+#else
+        _mem = malloc(total);
+#endif
+    _ownsMem = _mem && !arena;
+    if (!_mem) {
+        log_e("WindowAggregator: cannot allocate %u bytes", (unsigned)total);
+        return false;
+    }
+
+    uint8_t *p = (uint8_t *)_mem;
+    for (Pool &pool : _pools) {
+        pool.keys = (uint64_t *)p;
+        p += keyBytes;
+        pool.slots = (Slot *)p;
+        p += slotBytes;
+    }
+    _order = (uint16_t *)p;
+
+    _config = config;
+    _windowUs = (int64_t)config.windowMs * 1000;
+    _capacity = cap;
+    _shift = (uint8_t)(64 - bits);
+    reset(_pools[0]);
+    reset(_pools[1]);
+    _active = &_pools[0];
+    return true;
+}
+
+void WindowAggregator::reset(Pool &pool) {
+    memset(pool.keys, 0xFF, _capacity * sizeof(uint64_t));
+    pool.used = 0;
+}
+
+// Slot for key in the active pool, claimed if new; nullptr when full.
+WindowAggregator::Slot *WindowAggregator::find(uint64_t key) {
+    Pool &pool = *_active;
+    size_t mask = _capacity - 1;
+    // Fibonacci hashing onto the table
+    size_t i = (size_t)((key * 0x9E3779B97F4A7C15ull) >> _shift);
+    while (true) {
+        uint64_t k = pool.keys[i];
+        if (k == key)
+            return &pool.slots[i];
+        if (k == EMPTY_KEY)
+            break;
+        i = (i + 1) & mask;
+    }
+    if (pool.used >= _config.slots)
+        return nullptr;
+    pool.keys[i] = key;
+    pool.used++;
+    Slot &s = pool.slots[i];
+    s.count = 0;
+    s.mean = 0;
+    s.m2 = 0;
+    return &s;
+}
+
+void WindowAggregator::add(const uint8_t mac[6], int64_t timeUs, const DecodedAdvert &res) {
+    if (!_mem)
+        return;
+    if (_startUs < 0)
+        _startUs = timeUs - timeUs % _windowUs;
+    else if (timeUs >= _startUs + _windowUs)
+        close(timeUs);
+
+    uint64_t macKey = 0;
+    for (int i = 0; i < 6; i++)
+        macKey = macKey << 8 | mac[i];
+    macKey <<= 16;
+
+    for (uint8_t i = 0; i < res.count; i++) {
+        const BTHomeValue &v = res.values[i];
+        // Repeated object ids in one advert are told apart by their ordinal
+        uint8_t ordinal = 0;
+        for (uint8_t j = 0; j < i; j++)
+            if (res.values[j].objectID == v.objectID)
+                ordinal++;
+
+        Slot *s = find(macKey | (uint64_t)v.objectID << 8 | ordinal);
+        if (!s) {
+            _stats.overflow++;
+            continue;
+        }
+        float x = v.value;
+        if (s->count == 0) {
+            s->min = s->max = x;
+        } else {
+            if (x < s->min)
+                s->min = x;
+            if (x > s->max)
+                s->max = x;
+        }
+        s->last = x;
+        s->name = v.name;
+        s->unit = v.unit;
+        s->count++;
+        float delta = x - s->mean;
+        s->mean += delta / (float)s->count;
+        if (_config.variance)
+            s->m2 += delta * (x - s->mean);
+        _stats.values++;
+    }
+}
+
+void WindowAggregator::poll(int64_t nowUs) {
+    if (_mem && _startUs >= 0 && nowUs >= _startUs + _windowUs)
+        close(nowUs);
+}
+
+// Swap pools: the active window becomes the closed one, sorted for next(),
+// and the window holding timeUs starts empty.
+void WindowAggregator::close(int64_t timeUs) {
+    Pool *done = _active;
+    _active = done == &_pools[0] ? &_pools[1] : &_pools[0];
+
+    if (_closed) {
+        // Count the devices of the previous window nobody drained
+        uint64_t lastMac = EMPTY_KEY;
+        for (uint16_t i = _cursor; i < _closed->used; i++) {
+            uint64_t mac = _closed->keys[_order[i]] >> 16;
+            if (mac != lastMac)
+                _stats.discarded++;
+            lastMac = mac;
+        }
+    }
+    reset(*_active);
+    _closed = nullptr;
+    _cursor = 0;
+
+    if (done->used > 0) {
+        uint16_t n = 0;
+        for (size_t i = 0; i < _capacity; i++)
+            if (done->keys[i] != EMPTY_KEY)
+                _order[n++] = (uint16_t)i;
+        const uint64_t *keys = done->keys;
+        std::sort(_order, _order + n,
+                  [keys](uint16_t a, uint16_t b) { return keys[a] < keys[b]; });
+        _closed = done;
+        _closedStartUs = _startUs;
+        _stats.windows++;
+    }
+    _startUs = timeUs - timeUs % _windowUs;
+}
+
+bool WindowAggregator::next(WindowSummary &out) {
+    if (!_closed || _cursor >= _closed->used)
+        return false;
+
+    uint64_t mac = _closed->keys[_order[_cursor]] >> 16;
+    for (int i = 5; i >= 0; i--) {
+        out.mac[i] = (uint8_t)mac;
+        mac >>= 8;
+    }
+    mac = _closed->keys[_order[_cursor]] >> 16;
+    out.startUs = _closedStartUs;
+    out.windowMs = _config.windowMs;
+    out.count = 0;
+
+    while (_cursor < _closed->used) {
+        uint16_t idx = _order[_cursor];
+        uint64_t key = _closed->keys[idx];
+        if (key >> 16 != mac)
+            break;
+        _cursor++;
+        if (out.count >= DecodedAdvert::MAX_VALUES)
+            continue;
+        const Slot &s = _closed->slots[idx];
+        WindowStats &w = out.values[out.count++];
+        w.objectID = (uint8_t)(key >> 8);
+        w.name = s.name;
+        w.unit = s.unit;
+        w.count = s.count;
+        w.sum = s.mean * (float)s.count;
+        w.min = s.min;
+        w.max = s.max;
+        w.mean = s.mean;
+        w.last = s.last;
+        w.stddev = s.count > 1 ? sqrtf(s.m2 / (float)(s.count - 1)) : 0.0f;
+    }
+    _stats.summaries++;
+    return true;
+}
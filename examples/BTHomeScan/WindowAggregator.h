@@ -0,0 +1,144 @@
+/// @file WindowAggregator.h
+/// @brief Per-device running statistics over tumbling time windows.
+///
+/// Feed every decoded advert to add() and, instead of one record per advert,
+/// get one summary per device and window: count, sum, min, max, mean, last
+/// and optionally the standard deviation of each measurement. Windows are
+/// aligned to multiples of the window length on the capture clock
+/// (AdvertHeader::timeUs).
+///
+/// State lives in a fixed pool allocated once by begin(): an open-addressed
+/// table keyed by (MAC, object id, ordinal), with the keys packed apart from
+/// the 32-byte statistics slots so lookups only walk the key array. Updates
+/// are O(1) (Welford's algorithm for the variance). Measurements that find
+/// the pool full are counted in Stats::overflow and left out.
+///
+/// There are two pools: when a window closes, the active pool becomes the
+/// closed one, sorted by key, and next() hands out its summaries one device
+/// at a time while the following window fills the other pool. Summaries not
+/// drained before that window closes too are discarded (Stats::discarded).
+///
+/// Not thread-safe: call add(), poll() and next() from one task.
+
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+#include "BTHomeDecoder.h"
+
+class Arena;
+
+/// Statistics of one measurement over a window, in the measurement's unit.
+struct WindowStats {
+    uint8_t objectID;
+    const char *name;       ///< Static string
+    const char *unit;       ///< Static string, "" if unitless
+    uint32_t count;
+    float sum;
+    float min;
+    float max;
+    float mean;
+    float last;
+    float stddev;           ///< Sample standard deviation, 0 below two values or without variance
+};
+
+/// One device's measurements over one window, in object id order (repeated
+/// object ids, e.g. Ruuvi acceleration x/y/z, in advert order).
+struct WindowSummary {
+    uint8_t mac[6];
+    int64_t startUs;        ///< Window start on the capture clock
+    uint32_t windowMs;
+    uint8_t count;
+    WindowStats values[DecodedAdvert::MAX_VALUES];
+};
+
+class WindowAggregator {
+public:
+    struct Config {
+        uint32_t windowMs = 60000;  ///< Tumbling window length
+        uint16_t slots = 128;       ///< (device, measurement) pairs per window
+        bool variance = true;       ///< Track the standard deviation as well
+    };
+
+    struct Stats {
+        uint32_t windows;       ///< Windows closed with at least one value
+        uint32_t summaries;     ///< Device summaries handed out by next()
+        uint32_t values;        ///< Measurements aggregated
+        uint32_t overflow;      ///< Measurements left out, pool full
+        uint32_t discarded;     ///< Device summaries lost, not drained in time
+    };
+
+    WindowAggregator() = default;
+    ~WindowAggregator();
+
+    WindowAggregator(const WindowAggregator &) = delete;
+    WindowAggregator &operator=(const WindowAggregator &) = delete;
+
+    /// Allocate both pools in internal RAM, or from arena if given (see
+    /// Arena.h). Returns false if out of memory or already started.
+    bool begin(const Config &config, Arena *arena = nullptr);
+
+    /// Add every value of a decoded advert captured at timeUs from mac.
+    /// Closes the active window first if timeUs lies past its end; adverts
+    /// older than the active window count towards it.
+    void add(const uint8_t mac[6], int64_t timeUs, const DecodedAdvert &res);
+
+    /// Close the active window if nowUs lies past its end, so summaries come
+    /// out even when adverts stop arriving.
+    void poll(int64_t nowUs);
+
+    /// Pop the next device summary of the last closed window. Returns false
+    /// when there is none.
+    bool next(WindowSummary &out);
+
+    /// True while the last closed window has summaries left for next().
+    bool ready() const { return _closed && _cursor < _closed->used; }
+
+    /// End of the active window on the capture clock, when poll() closes
+    /// it; -1 before the first advert.
+    int64_t endUs() const { return _startUs < 0 ? -1 : _startUs + _windowUs; }
+
+    const Config &config() const { return _config; }
+    Stats stats() const { return _stats; }
+
+private:
+    struct Slot {
+        float min;
+        float max;
+        float last;
+        float mean;
+        float m2;           ///< Sum of squared differences from the mean
+        uint32_t count;
+        const char *name;
+        const char *unit;
+    };
+
+    struct Pool {
+        uint64_t *keys;     ///< EMPTY_KEY or (MAC << 16 | object id << 8 | ordinal)
+        Slot *slots;
+        uint16_t used;
+    };
+
+    static constexpr uint64_t EMPTY_KEY = UINT64_MAX;
+
+    Slot *find(uint64_t key);
+    void close(int64_t timeUs);
+    void reset(Pool &pool);
+
+    Config _config;
+    int64_t _windowUs = 0;
+    int64_t _startUs = -1;  ///< Active window start, -1 before the first advert
+    int64_t _closedStartUs = 0;
+    size_t _capacity = 0;   ///< Table size per pool, a power of two
+    uint8_t _shift = 0;     ///< 64 - log2(_capacity), for Fibonacci hashing
+
+    void *_mem = nullptr;
+    bool _ownsMem = false;      ///< _mem is from the heap, not an arena
+    Pool _pools[2] = {};
+    Pool *_active = nullptr;
+    Pool *_closed = nullptr;
+    uint16_t *_order = nullptr;   ///< Closed pool slots sorted by key
+    uint16_t _cursor = 0;         ///< Next entry of _order to hand out
+
+    Stats _stats = {};
+};
@@ -1,5 +1,7 @@
+#pragma once
 
-#ifndef ESP_PLATFORM
+// BTHOME_HOST_RTOS: the host simulation's stand-in (extras/host/shim)
+#if !defined(ESP_PLATFORM) && !defined(BTHOME_HOST_RTOS)
     #error "ring buffer is part of esp-idf FreeRTOS supplemental feature"
 #else
     #include "freertos/ringbuf.h"
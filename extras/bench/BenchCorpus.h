@@ -0,0 +1,52 @@
+// BTHome service data (the bytes after the 0xFCD2 UUID) the decoder
+// benchmark (DecoderBench.cpp) runs over: typical sensors, a many-object
+// multisensor and a button, plaintext and encrypted with BENCH_KEY. Every
+// entry decodes to count values; the benchmark checks that before timing.
+
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+static const uint8_t BENCH_KEY[16] = {0x23, 0x1d, 0x39, 0xc1, 0xd7, 0xcc, 0x1a, 0xb1,
+                                      0xae, 0xe2, 0x24, 0xcd, 0x09, 0x6d, 0xb9, 0x32};
+static const char BENCH_KEY_HEX[] = "231d39c1d7cc1ab1aee224cd096db932";
+
+struct BenchAdvert {
+    const char *name;
+    uint8_t mac[6];
+    const uint8_t *data;
+    size_t len;
+    uint8_t count;      ///< Values it decodes to
+};
+
+// Packet id, battery, temperature, humidity
+static const uint8_t THERMOMETER[] = {0x40, 0x00, 0x2A, 0x01, 0x5D, 0x02, 0xCA, 0x08,
+                                      0x03, 0xBF, 0x13};
+static const uint8_t THERMOMETER_ENC[] = {0x41, 0xF5, 0x12, 0xF0, 0xCD, 0xB7, 0x55, 0x11,
+                                          0x61, 0x01, 0xC0, 0x33, 0x22, 0x11, 0x00, 0xB2,
+                                          0xAF, 0x86, 0xE8};
+
+// Thirteen objects of one to three bytes
+static const uint8_t MULTISENSOR[] = {
+    0x40, 0x00, 0x07, 0x01, 0x61, 0x02, 0x06, 0x09, 0x03, 0x3C, 0x11, 0x04, 0x13, 0x8A,
+    0x01, 0x05, 0x13, 0x8A, 0x14, 0x0C, 0x02, 0x0C, 0x12, 0xE2, 0x04, 0x13, 0x33, 0x01,
+    0x14, 0x02, 0x0C, 0x0B, 0x02, 0x1B, 0x00, 0x2E, 0x34, 0x0A, 0x13, 0x8A, 0x14};
+static const uint8_t MULTISENSOR_ENC[] = {
+    0x41, 0xEA, 0x9B, 0x1B, 0xA5, 0x80, 0xDC, 0x12, 0xA6, 0x00, 0x76, 0xCE, 0xCF, 0x20,
+    0x6D, 0xAC, 0x9F, 0x86, 0x1F, 0x10, 0x2C, 0x7B, 0xEC, 0x95, 0xF4, 0xB3, 0x13, 0x76,
+    0xB5, 0x40, 0xA6, 0x7D, 0x8A, 0xC8, 0xDD, 0xA7, 0xBF, 0x69, 0x9B, 0x26, 0x8C, 0x07,
+    0x01, 0x00, 0x00, 0x2F, 0x3C, 0x0D, 0xD4};
+
+// Trigger based: packet id, button press
+static const uint8_t BUTTON[] = {0x44, 0x00, 0x11, 0x3A, 0x01};
+
+static const BenchAdvert BENCH_CORPUS[] = {
+    {"thermometer", {0xA4, 0xC1, 0x38, 0x00, 0x11, 0x22}, THERMOMETER, sizeof(THERMOMETER), 4},
+    {"thermometer_enc", {0xA4, 0xC1, 0x38, 0x00, 0x11, 0x22}, THERMOMETER_ENC,
+     sizeof(THERMOMETER_ENC), 4},
+    {"multisensor", {0x54, 0x48, 0xE6, 0x8F, 0x80, 0xA5}, MULTISENSOR, sizeof(MULTISENSOR), 13},
+    {"multisensor_enc", {0x54, 0x48, 0xE6, 0x8F, 0x80, 0xA5}, MULTISENSOR_ENC,
+     sizeof(MULTISENSOR_ENC), 13},
+    {"button", {0xA4, 0xC1, 0x38, 0x00, 0x11, 0x22}, BUTTON, sizeof(BUTTON), 2},
+};
+static constexpr size_t BENCH_CORPUS_SIZE = sizeof(BENCH_CORPUS) / sizeof(BENCH_CORPUS[0]);
@@ -0,0 +1,180 @@
+// On-target cycle counts of the decode path, for the *_bench PlatformIO
+// environments. Runs every stage over the corpus in BenchCorpus.h and
+// prints the CPU cycles one call takes (esp_cpu_get_cycle_count(), fewest
+// of ROUNDS rounds of ITERATIONS calls), one line per case:
+//
+//   BENCH <stage>/<corpus entry> <cycles>
+//   ...
+//   BENCH done
+//
+// Stages:
+//   legacy   BTHomeDecoder::parseBTHomeV2(), strings in and out
+//   decode   BTHomeDecoder::decode(): decrypts (key schedule cached) and parses
+//   parse    BTHomeDecoder::decodePlaintext(): objects only, plaintext entries
+//   ccm      mbedtls_ccm_auth_decrypt() as decryptAESCCM() calls it,
+//            encrypted entries
+//   setkey   the AES-CCM key schedule decode() builds when the key changes
+//   frame    encodeDecodedFrame(), what processFrame() writes
+//   json     the JsonDocument process() fills, serialized
+//
+// Lines starting with # describe the chip. Every entry is decoded and
+// checked first; a mismatch prints "BENCH FAIL <entry>" and nothing is
+// timed. extras/bench/qemu_bench.sh runs it under QEMU and compares the
+// counts with a stored baseline. Under QEMU they follow the instructions
+// executed rather than real timing (no cache or flash wait states), so
+// compare them with the baseline of the same chip, not with hardware.
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <cinttypes>
+#include <string>
+
+#include "esp_cpu.h"
+#include "mbedtls/ccm.h"
+
+#include "BTHomeDecoder.h"
+#include "DecodedFrame.h"
+
+#include "BenchCorpus.h"
+
+static constexpr int ITERATIONS = 200;
+static constexpr int ROUNDS = 5;
+
+// Results land here so the calls cannot be optimised away
+static volatile uint32_t s_sink;
+
+template <typename Fn>
+static uint32_t cyclesPerCall(Fn fn) {
+    uint32_t best = UINT32_MAX;
+    for (int r = 0; r < ROUNDS; r++) {
+        uint32_t t0 = esp_cpu_get_cycle_count();
+        for (int i = 0; i < ITERATIONS; i++)
+            fn();
+        uint32_t cycles = (esp_cpu_get_cycle_count() - t0) / ITERATIONS;
+        if (cycles < best)
+            best = cycles;
+    }
+    return best;
+}
+
+static void report(const char *stage, const BenchAdvert &adv, uint32_t cycles) {
+    Serial.printf("BENCH %s/%s %" PRIu32 "\n", stage, adv.name, cycles);
+}
+
+static void macString(const uint8_t mac[6], char out[18]) {
+    snprintf(out, 18, "%02X:%02X:%02X:%02X:%02X:%02X", mac[0], mac[1], mac[2], mac[3], mac[4],
+             mac[5]);
+}
+
+// Same document as BLEScanner::process()
+static size_t toJson(const DecodedAdvert &res, const AdvertHeader &hdr, JsonDocument &doc,
+                     char *out, size_t outLen) {
+    JsonObject root = doc.to<JsonObject>();
+    root["bthome_version"] = res.version;
+    JsonArray measArr = root["measurements"].to<JsonArray>();
+    for (uint8_t i = 0; i < res.count; i++) {
+        const BTHomeValue &v = res.values[i];
+        JsonObject obj = measArr.add<JsonObject>();
+        obj["object_id"] = v.objectID;
+        obj["name"] = v.name;
+        obj["value"] = v.value;
+        obj["unit"] = v.unit;
+    }
+    char mac[18];
+    macString(hdr.mac, mac);
+    root["mac"] = (char *)mac;
+    root["time"] = (float)hdr.timeUs * 1.0e-6f;
+    root["rssi"] = hdr.rssi;
+    return serializeJson(doc, out, outLen);
+}
+
+static bool check(BTHomeDecoder &decoder, const BenchAdvert &adv) {
+    DecodedAdvert res;
+    res.clear();
+    if (!decoder.decode(adv.data, adv.len, adv.mac, BENCH_KEY, res) || res.count != adv.count) {
+        Serial.printf("BENCH FAIL %s\n", adv.name);
+        return false;
+    }
+    return true;
+}
+
+static void run(BTHomeDecoder &decoder, const BenchAdvert &adv) {
+    bool encrypted = adv.data[0] & 0x01;
+
+    char mac[18];
+    macString(adv.mac, mac);
+    std::string data((const char *)adv.data, adv.len), macStr(mac), keyHex(BENCH_KEY_HEX);
+    report("legacy", adv, cyclesPerCall([&] {
+        s_sink = decoder.parseBTHomeV2(data, macStr, keyHex).measurements.size();
+    }));
+
+    DecodedAdvert res;
+    report("decode", adv, cyclesPerCall([&] {
+        res.clear();
+        s_sink = decoder.decode(adv.data, adv.len, adv.mac, BENCH_KEY, res);
+    }));
+
+    if (encrypted) {
+        BTHomeCipher c;
+        BTHomeDecoder::cipherParams(adv.data, adv.len, adv.mac, c);
+        uint8_t plain[255];
+        mbedtls_ccm_context ccm;
+        mbedtls_ccm_init(&ccm);
+        mbedtls_ccm_setkey(&ccm, MBEDTLS_CIPHER_ID_AES, BENCH_KEY, 128);
+        report("ccm", adv, cyclesPerCall([&] {
+            s_sink = mbedtls_ccm_auth_decrypt(&ccm, c.cipherLen, c.nonce, sizeof(c.nonce),
+                                              nullptr, 0, c.cipher, plain, c.mic, 4);
+        }));
+        mbedtls_ccm_free(&ccm);
+
+        report("setkey", adv, cyclesPerCall([&] {
+            mbedtls_ccm_context k;
+            mbedtls_ccm_init(&k);
+            s_sink = mbedtls_ccm_setkey(&k, MBEDTLS_CIPHER_ID_AES, BENCH_KEY, 128);
+            mbedtls_ccm_free(&k);
+        }));
+    } else {
+        DecodedAdvert objects;
+        report("parse", adv, cyclesPerCall([&] {
+            objects.clear();
+            s_sink = BTHomeDecoder::decodePlaintext(adv.data[0], adv.data + 1, adv.len - 1,
+                                                    objects);
+        }));
+    }
+
+    AdvertHeader hdr = {};
+    hdr.timeUs = 61250000;
+    memcpy(hdr.mac, adv.mac, 6);
+    hdr.rssi = -67;
+    FrameExtras extras;
+    uint8_t frame[DECODED_FRAME_MAX_ENCODED];
+    report("frame", adv, cyclesPerCall([&] {
+        s_sink = encodeDecodedFrame(hdr, res, extras, frame);
+    }));
+
+    JsonDocument doc;
+    char json[1024];
+    report("json", adv, cyclesPerCall([&] {
+        s_sink = toJson(res, hdr, doc, json, sizeof(json));
+    }));
+}
+
+void setup() {
+    Serial.begin(115200);
+    delay(100);
+    Serial.printf("# %s rev %u, %" PRIu32 " MHz, %d iterations x %d rounds\n", ESP.getChipModel(),
+                  (unsigned)ESP.getChipRevision(), ESP.getCpuFreqMHz(), ITERATIONS, ROUNDS);
+
+    static BTHomeDecoder decoder;
+    bool ok = true;
+    for (const BenchAdvert &adv : BENCH_CORPUS)
+        ok = check(decoder, adv) && ok;
+    if (ok)
+        for (const BenchAdvert &adv : BENCH_CORPUS)
+            run(decoder, adv);
+    Serial.println("BENCH done");
+}
+
+void loop() {
+    delay(1000);
+}
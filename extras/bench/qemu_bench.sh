@@ -0,0 +1,119 @@
+#!/bin/sh
+# Build the decoder benchmark firmware (DecoderBench.cpp), run it headless
+# under Espressif's QEMU and compare its cycle counts with the stored
+# baseline, extras/bench/baseline/<chip>.txt.
+#
+#   extras/bench/qemu_bench.sh [esp32|esp32c3] [-u]
+#
+# The exit status is 1 if the firmware fails its corpus check, if there is
+# no baseline for the chip yet, or if any case takes more than TOLERANCE
+# percent (default 2) more cycles than in the baseline or is gone from the
+# results. -u writes the results as the new baseline instead; commit it
+# along with the change that moved them.
+# QEMU runs with -icount, so the counts are the same on every machine.
+#
+# Needs PlatformIO, esptool.py and Espressif's QEMU (qemu-system-xtensa
+# for the ESP32, qemu-system-riscv32 for the ESP32-C3, e.g. from
+# `idf_tools.py install qemu-xtensa qemu-riscv32`) on PATH. Run from the
+# repository root.
+set -e
+
+CHIP=${1:-esp32}
+UPDATE=0
+if [ "$2" = "-u" ]; then
+    UPDATE=1
+fi
+TOLERANCE=${TOLERANCE:-2}
+TIMEOUT=${TIMEOUT:-600}
+
+case "$CHIP" in
+esp32)
+    ENV=esp32dev_bench
+    QEMU=qemu-system-xtensa
+    BOOTLOADER_AT=0x1000
+    ;;
+esp32c3)
+    ENV=esp32c3_bench
+    QEMU=qemu-system-riscv32
+    BOOTLOADER_AT=0x0
+    ;;
+*)
+    echo "usage: $0 [esp32|esp32c3] [-u]" >&2
+    exit 2
+    ;;
+esac
+
+BUILD=.pio/build/$ENV
+BASELINE=extras/bench/baseline/$CHIP.txt
+OUT=${TMPDIR:-/tmp}/bthome-bench-$CHIP
+BOOT_APP0=${PLATFORMIO_CORE_DIR:-$HOME/.platformio}/packages/framework-arduinoespressif32/tools/partitions/boot_app0.bin
+mkdir -p "$OUT"
+
+pio run -e "$ENV"
+esptool.py --chip "$CHIP" merge_bin --fill-flash-size 4MB -o "$OUT/flash.bin" \
+    "$BOOTLOADER_AT" "$BUILD/bootloader.bin" 0x8000 "$BUILD/partitions.bin" \
+    0xe000 "$BOOT_APP0" 0x10000 "$BUILD/firmware.bin"
+
+# The firmware idles once it is done, so stop QEMU when the last line is in
+rm -f "$OUT/serial.txt"
+"$QEMU" -machine "$CHIP" -icount 3 -display none -monitor none \
+    -drive file="$OUT/flash.bin",if=mtd,format=raw -serial file:"$OUT/serial.txt" &
+PID=$!
+WAITED=0
+while ! grep -q '^BENCH done' "$OUT/serial.txt" 2>/dev/null; do
+    if ! kill -0 "$PID" 2>/dev/null || [ "$WAITED" -ge "$TIMEOUT" ]; then
+        kill "$PID" 2>/dev/null || true
+        echo "FAIL: no results from QEMU after $WAITED s, see $OUT/serial.txt"
+        exit 1
+    fi
+    sleep 1
+    WAITED=$((WAITED + 1))
+done
+kill "$PID" 2>/dev/null || true
+
+grep '^#' "$OUT/serial.txt" || true
+if grep '^BENCH FAIL' "$OUT/serial.txt"; then
+    exit 1
+fi
+grep '^BENCH ' "$OUT/serial.txt" | grep -v '^BENCH done' | awk '{ print $2, $3 }' \
+    > "$OUT/results.txt"
+
+if [ "$UPDATE" = 1 ]; then
+    mkdir -p "$(dirname "$BASELINE")"
+    cp "$OUT/results.txt" "$BASELINE"
+    echo "baseline written to $BASELINE"
+    exit 0
+fi
+if [ ! -f "$BASELINE" ]; then
+    cat "$OUT/results.txt"
+    echo "FAIL: no baseline for $CHIP yet, run $0 $CHIP -u to record one"
+    exit 1
+fi
+
+awk -v tolerance="$TOLERANCE" '
+    FNR == NR { base[$1] = $2; next }
+    {
+        seen[$1] = 1
+        if (!($1 in base)) {
+            printf "%-28s %10s %10d      new\n", $1, "-", $2
+            next
+        }
+        change = base[$1] ? 100.0 * ($2 - base[$1]) / base[$1] : 0
+        flag = change > tolerance ? "  REGRESSION" : ""
+        printf "%-28s %10d %10d %+7.1f%%%s\n", $1, base[$1], $2, change, flag
+        if (flag != "")
+            failed++
+    }
+    END {
+        for (name in base)
+            if (!(name in seen)) {
+                printf "%-28s %10d %10s  missing\n", name, base[name], "-"
+                failed++
+            }
+        if (failed) {
+            printf "FAIL: %d cases regressed by more than %s%% or are missing\n", failed, tolerance
+            exit 1
+        }
+        printf "OK: within %s%% of the baseline\n", tolerance
+    }
+' "$BASELINE" "$OUT/results.txt"
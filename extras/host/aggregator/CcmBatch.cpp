@@ -0,0 +1,307 @@
+#include "CcmBatch.h"
+
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define CCM_X86 1
+#include <immintrin.h>
+#endif
+
+// ---------------------------------------------------------------------------
+// Portable AES-128 (key schedule shared by all engines)
+// ---------------------------------------------------------------------------
+static const uint8_t SBOX[256] = {
+    0x63, 0x7c, 0x77, 0x7b, 0xf2, 0x6b, 0x6f, 0xc5, 0x30, 0x01, 0x67, 0x2b, 0xfe, 0xd7, 0xab, 0x76,
+    0xca, 0x82, 0xc9, 0x7d, 0xfa, 0x59, 0x47, 0xf0, 0xad, 0xd4, 0xa2, 0xaf, 0x9c, 0xa4, 0x72, 0xc0,
+    0xb7, 0xfd, 0x93, 0x26, 0x36, 0x3f, 0xf7, 0xcc, 0x34, 0xa5, 0xe5, 0xf1, 0x71, 0xd8, 0x31, 0x15,
+    0x04, 0xc7, 0x23, 0xc3, 0x18, 0x96, 0x05, 0x9a, 0x07, 0x12, 0x80, 0xe2, 0xeb, 0x27, 0xb2, 0x75,
+    0x09, 0x83, 0x2c, 0x1a, 0x1b, 0x6e, 0x5a, 0xa0, 0x52, 0x3b, 0xd6, 0xb3, 0x29, 0xe3, 0x2f, 0x84,
+    0x53, 0xd1, 0x00, 0xed, 0x20, 0xfc, 0xb1, 0x5b, 0x6a, 0xcb, 0xbe, 0x39, 0x4a, 0x4c, 0x58, 0xcf,
+    0xd0, 0xef, 0xaa, 0xfb, 0x43, 0x4d, 0x33, 0x85, 0x45, 0xf9, 0x02, 0x7f, 0x50, 0x3c, 0x9f, 0xa8,
+    0x51, 0xa3, 0x40, 0x8f, 0x92, 0x9d, 0x38, 0xf5, 0xbc, 0xb6, 0xda, 0x21, 0x10, 0xff, 0xf3, 0xd2,
+    0xcd, 0x0c, 0x13, 0xec, 0x5f, 0x97, 0x44, 0x17, 0xc4, 0xa7, 0x7e, 0x3d, 0x64, 0x5d, 0x19, 0x73,
+    0x60, 0x81, 0x4f, 0xdc, 0x22, 0x2a, 0x90, 0x88, 0x46, 0xee, 0xb8, 0x14, 0xde, 0x5e, 0x0b, 0xdb,
+    0xe0, 0x32, 0x3a, 0x0a, 0x49, 0x06, 0x24, 0x5c, 0xc2, 0xd3, 0xac, 0x62, 0x91, 0x95, 0xe4, 0x79,
+    0xe7, 0xc8, 0x37, 0x6d, 0x8d, 0xd5, 0x4e, 0xa9, 0x6c, 0x56, 0xf4, 0xea, 0x65, 0x7a, 0xae, 0x08,
+    0xba, 0x78, 0x25, 0x2e, 0x1c, 0xa6, 0xb4, 0xc6, 0xe8, 0xdd, 0x74, 0x1f, 0x4b, 0xbd, 0x8b, 0x8a,
+    0x70, 0x3e, 0xb5, 0x66, 0x48, 0x03, 0xf6, 0x0e, 0x61, 0x35, 0x57, 0xb9, 0x86, 0xc1, 0x1d, 0x9e,
+    0xe1, 0xf8, 0x98, 0x11, 0x69, 0xd9, 0x8e, 0x94, 0x9b, 0x1e, 0x87, 0xe9, 0xce, 0x55, 0x28, 0xdf,
+    0x8c, 0xa1, 0x89, 0x0d, 0xbf, 0xe6, 0x42, 0x68, 0x41, 0x99, 0x2d, 0x0f, 0xb0, 0x54, 0xbb, 0x16,
+};
+
+static constexpr int ROUND_KEY_BYTES = 176;    // 11 round keys
+
+static void expandKey(const uint8_t key[16], uint8_t rk[ROUND_KEY_BYTES]) {
+    memcpy(rk, key, 16);
+    uint8_t rcon = 1;
+    for (int i = 16; i < ROUND_KEY_BYTES; i += 4) {
+        uint8_t t[4] = {rk[i - 4], rk[i - 3], rk[i - 2], rk[i - 1]};
+        if (i % 16 == 0) {
+            uint8_t u = t[0];
+            t[0] = SBOX[t[1]] ^ rcon;
+            t[1] = SBOX[t[2]];
+            t[2] = SBOX[t[3]];
+            t[3] = SBOX[u];
+            rcon = (uint8_t)((rcon << 1) ^ ((rcon & 0x80) ? 0x1B : 0));
+        }
+        for (int j = 0; j < 4; j++)
+            rk[i + j] = rk[i + j - 16] ^ t[j];
+    }
+}
+
+static inline uint8_t xtime(uint8_t x) {
+    return (uint8_t)((x << 1) ^ ((x >> 7) * 0x1B));
+}
+
+static void aesEncryptBlock(const uint8_t rk[ROUND_KEY_BYTES], uint8_t b[16]) {
+    for (int i = 0; i < 16; i++)
+        b[i] ^= rk[i];
+    for (int round = 1; round <= 10; round++) {
+        // SubBytes + ShiftRows (state is column-major: b[row + 4 * col])
+        uint8_t t[16];
+        for (int c = 0; c < 4; c++)
+            for (int r = 0; r < 4; r++)
+                t[r + 4 * c] = SBOX[b[r + 4 * ((c + r) & 3)]];
+        if (round < 10) {
+            for (int c = 0; c < 4; c++) {
+                uint8_t *a = t + 4 * c;
+                uint8_t all = a[0] ^ a[1] ^ a[2] ^ a[3], a0 = a[0];
+                a[0] ^= all ^ xtime(a[0] ^ a[1]);
+                a[1] ^= all ^ xtime(a[1] ^ a[2]);
+                a[2] ^= all ^ xtime(a[2] ^ a[3]);
+                a[3] ^= all ^ xtime(a[3] ^ a0);
+            }
+        }
+        for (int i = 0; i < 16; i++)
+            b[i] = t[i] ^ rk[16 * round + i];
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Block engines: encrypt W independent blocks, lane i under key schedule
+// rk[i]. prepare() is called after rk changes.
+// ---------------------------------------------------------------------------
+struct ScalarEngine {
+    static constexpr int W = 4;
+    uint8_t rk[W][ROUND_KEY_BYTES];
+    uint8_t key[W][16];
+    bool valid[W] = {};
+
+    void prepare() {}
+
+    void encrypt(uint8_t (*blk)[16]) {
+        for (int i = 0; i < W; i++)
+            aesEncryptBlock(rk[i], blk[i]);
+    }
+};
+
+#ifdef CCM_X86
+// Eight lanes keep both AES units of recent cores busy despite the
+// multi-cycle aesenc latency.
+struct AesniEngine {
+    static constexpr int W = 8;
+    alignas(16) uint8_t rk[W][ROUND_KEY_BYTES];
+    uint8_t key[W][16];
+    bool valid[W] = {};
+
+    void prepare() {}
+
+    __attribute__((target("aes,sse4.1")))
+    void encrypt(uint8_t (*blk)[16]) {
+        __m128i s[W];
+        for (int i = 0; i < W; i++)
+            s[i] = _mm_xor_si128(_mm_loadu_si128((const __m128i *)blk[i]),
+                                 _mm_loadu_si128((const __m128i *)rk[i]));
+        for (int r = 1; r < 10; r++)
+            for (int i = 0; i < W; i++)
+                s[i] = _mm_aesenc_si128(s[i], _mm_loadu_si128((const __m128i *)(rk[i] + 16 * r)));
+        for (int i = 0; i < W; i++)
+            _mm_storeu_si128((__m128i *)blk[i],
+                             _mm_aesenclast_si128(s[i], _mm_loadu_si128((const __m128i *)(rk[i] + 160))));
+    }
+};
+
+// VAES runs AES on each 128-bit lane of a zmm register with that lane's
+// round key, so one instruction advances four different messages.
+struct VaesEngine {
+    static constexpr int W = 8;
+    uint8_t rk[W][ROUND_KEY_BYTES];
+    uint8_t key[W][16];
+    bool valid[W] = {};
+    alignas(64) uint8_t rkv[2][11][64];     ///< Round r of lanes 4z..4z+3
+
+    void prepare() {
+        for (int z = 0; z < 2; z++)
+            for (int r = 0; r < 11; r++)
+                for (int l = 0; l < 4; l++)
+                    memcpy(rkv[z][r] + 16 * l, rk[4 * z + l] + 16 * r, 16);
+    }
+
+    __attribute__((target("avx512f,vaes")))
+    void encrypt(uint8_t (*blk)[16]) {
+        __m512i a = _mm512_xor_si512(_mm512_loadu_si512(blk[0]), _mm512_load_si512(rkv[0][0]));
+        __m512i b = _mm512_xor_si512(_mm512_loadu_si512(blk[4]), _mm512_load_si512(rkv[1][0]));
+        for (int r = 1; r < 10; r++) {
+            a = _mm512_aesenc_epi128(a, _mm512_load_si512(rkv[0][r]));
+            b = _mm512_aesenc_epi128(b, _mm512_load_si512(rkv[1][r]));
+        }
+        _mm512_storeu_si512(blk[0], _mm512_aesenclast_epi128(a, _mm512_load_si512(rkv[0][10])));
+        _mm512_storeu_si512(blk[4], _mm512_aesenclast_epi128(b, _mm512_load_si512(rkv[1][10])));
+    }
+};
+#endif
+
+// ---------------------------------------------------------------------------
+// CCM over one group of up to W jobs
+// ---------------------------------------------------------------------------
+static constexpr int MAX_BLOCKS = 16;   // 255 bytes
+
+template <typename Engine>
+static void runGroup(CcmJob *jobs, int n, Engine &eng) {
+    constexpr int W = Engine::W;
+    auto &rk = eng.rk;
+    alignas(64) uint8_t blk[W][16];
+    uint8_t ks[W][MAX_BLOCKS + 1][16];
+    uint8_t tag[W][4];
+    int nb[W];
+    int maxBlocks = 0;
+
+    // Key schedules stay in the engine between groups, and jobs usually
+    // share keys, so expansion is rare. Idle lanes keep whatever key they
+    // have and their output is ignored.
+    bool changed = false;
+    for (int i = 0; i < W; i++) {
+        nb[i] = i < n ? (int)((jobs[i].len + 15) / 16) : 0;
+        if (nb[i] > maxBlocks)
+            maxBlocks = nb[i];
+        if (i >= n || (eng.valid[i] && memcmp(jobs[i].key, eng.key[i], 16) == 0))
+            continue;
+        if (i > 0 && memcmp(jobs[i].key, eng.key[i - 1], 16) == 0)
+            memcpy(rk[i], rk[i - 1], ROUND_KEY_BYTES);
+        else
+            expandKey(jobs[i].key, rk[i]);
+        memcpy(eng.key[i], jobs[i].key, 16);
+        eng.valid[i] = true;
+        changed = true;
+    }
+    for (int i = n; i < W; i++) {
+        if (!eng.valid[i]) {
+            memcpy(rk[i], rk[0], ROUND_KEY_BYTES);
+            memcpy(eng.key[i], eng.key[0], 16);
+            eng.valid[i] = true;
+            changed = true;
+        }
+    }
+    if (changed)
+        eng.prepare();
+
+    // CTR keystream S0..Sk: counter blocks [flags L'=1][nonce][counter]
+    for (int k = 0; k <= maxBlocks; k++) {
+        for (int i = 0; i < W; i++) {
+            const uint8_t *nonce = jobs[i < n ? i : 0].nonce;
+            blk[i][0] = 0x01;
+            memcpy(&blk[i][1], nonce, 13);
+            blk[i][14] = 0;
+            blk[i][15] = (uint8_t)k;
+        }
+        eng.encrypt(blk);
+        for (int i = 0; i < W; i++)
+            memcpy(ks[i][k], blk[i], 16);
+    }
+    for (int i = 0; i < n; i++)
+        for (size_t j = 0; j < jobs[i].len; j++)
+            jobs[i].plain[j] = jobs[i].cipher[j] ^ ks[i][1 + j / 16][j % 16];
+
+    // CBC-MAC over B0 [flags M'=1,L'=1][nonce][len], then the plaintext
+    for (int i = 0; i < W; i++) {
+        const CcmJob &j = jobs[i < n ? i : 0];
+        blk[i][0] = 0x09;
+        memcpy(&blk[i][1], j.nonce, 13);
+        blk[i][14] = 0;
+        blk[i][15] = (uint8_t)j.len;
+    }
+    eng.encrypt(blk);
+    for (int i = 0; i < n; i++)
+        if (nb[i] == 0)
+            memcpy(tag[i], blk[i], 4);
+    for (int k = 1; k <= maxBlocks; k++) {
+        for (int i = 0; i < n; i++) {
+            if (k > nb[i])
+                continue;
+            size_t off = 16 * (size_t)(k - 1);
+            size_t take = jobs[i].len - off < 16 ? jobs[i].len - off : 16;
+            for (size_t b = 0; b < take; b++)
+                blk[i][b] ^= jobs[i].plain[off + b];
+        }
+        eng.encrypt(blk);
+        for (int i = 0; i < n; i++)
+            if (k == nb[i])
+                memcpy(tag[i], blk[i], 4);
+    }
+
+    for (int i = 0; i < n; i++) {
+        uint8_t diff = 0;
+        for (int b = 0; b < 4; b++)
+            diff |= (uint8_t)(tag[i][b] ^ ks[i][0][b] ^ jobs[i].mic[b]);
+        jobs[i].ok = diff == 0;
+        if (!jobs[i].ok)
+            memset(jobs[i].plain, 0, jobs[i].len);
+    }
+}
+
+template <typename Engine>
+static void runAll(CcmJob *jobs, size_t n) {
+    Engine eng;
+    size_t i = 0;
+    while (i < n) {
+        // Oversized jobs cannot be CCM with L = 2 here; reject them alone
+        if (jobs[i].len > 255) {
+            jobs[i++].ok = false;
+            continue;
+        }
+        int take = 0;
+        while (take < Engine::W && i + take < n && jobs[i + take].len <= 255)
+            take++;
+        runGroup(jobs + i, take, eng);
+        i += take;
+    }
+}
+
+CcmEngine ccmBestEngine() {
+#ifdef CCM_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("vaes") && __builtin_cpu_supports("avx512f"))
+        return CCM_ENGINE_VAES;
+    if (__builtin_cpu_supports("aes"))
+        return CCM_ENGINE_AESNI;
+#endif
+    return CCM_ENGINE_SCALAR;
+}
+
+const char *ccmEngineName(CcmEngine engine) {
+    switch (engine) {
+    case CCM_ENGINE_SCALAR: return "scalar";
+    case CCM_ENGINE_AESNI: return "aes-ni";
+    case CCM_ENGINE_VAES: return "vaes";
+    default: return "auto";
+    }
+}
+
+void ccmDecryptBatch(CcmJob *jobs, size_t n, CcmEngine engine) {
+    static const CcmEngine best = ccmBestEngine();
+    if (engine == CCM_ENGINE_AUTO || engine > best)
+        engine = best;
+    switch (engine) {
+#ifdef CCM_X86
+    case CCM_ENGINE_VAES:
+        runAll<VaesEngine>(jobs, n);
+        break;
+    case CCM_ENGINE_AESNI:
+        runAll<AesniEngine>(jobs, n);
+        break;
+#endif
+    default:
+        runAll<ScalarEngine>(jobs, n);
+        break;
+    }
+}
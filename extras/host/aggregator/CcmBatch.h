@@ -0,0 +1,43 @@
+/// @file CcmBatch.h
+/// @brief Batched AES-128-CCM decryption of BTHome payloads on the host.
+///
+/// A BTHome message is one or two AES blocks, so decrypting one packet at a
+/// time (key setup, one CBC-MAC chain, a few CTR blocks) is dominated by
+/// call overhead and AES latency. ccmDecryptBatch() takes many messages at
+/// once and runs several of them side by side: the CTR keystream blocks of
+/// all lanes are independent, and the CBC-MAC chains of different messages
+/// are interleaved round by round, so the AES units stay busy.
+///
+/// Engines, picked at run time: VAES (AVX-512, 8 lanes in two zmm
+/// registers, one key schedule per 128-bit lane), AES-NI (8 lanes), and a
+/// portable scalar fallback. All handle the BTHome parameters only:
+/// 13-byte nonce (L = 2), 4-byte MIC, no associated data.
+
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+struct CcmJob {
+    const uint8_t *key;     ///< 16 bytes
+    const uint8_t *nonce;   ///< 13 bytes
+    const uint8_t *cipher;
+    size_t len;             ///< Ciphertext length, at most 255
+    const uint8_t *mic;     ///< 4 bytes
+    uint8_t *plain;         ///< len bytes of output
+    bool ok;                ///< Set: MIC verified (plain is zeroed otherwise)
+};
+
+enum CcmEngine {
+    CCM_ENGINE_AUTO,
+    CCM_ENGINE_SCALAR,
+    CCM_ENGINE_AESNI,
+    CCM_ENGINE_VAES,
+};
+
+/// Decrypt and authenticate jobs[0..n). Jobs may share or differ in keys.
+void ccmDecryptBatch(CcmJob *jobs, size_t n, CcmEngine engine = CCM_ENGINE_AUTO);
+
+/// Best engine this CPU supports.
+CcmEngine ccmBestEngine();
+
+const char *ccmEngineName(CcmEngine engine);
@@ -0,0 +1,138 @@
+#include "Deduper.h"
+
+#include "AdParser.h"
+
+static uint64_t fnv64(uint64_t h, const uint8_t *p, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        h ^= p[i];
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+size_t Deduper::KeyHash::operator()(const Key &k) const {
+    return (size_t)fnv64(k.event * 0x9E3779B97F4A7C15ull, k.mac, 6);
+}
+
+// Tags keep the id spaces apart.
+enum : uint64_t {
+    ID_COUNTER   = 1ull << 60,  ///< BTHome encryption counter
+    ID_PACKET    = 2ull << 60,  ///< BTHome packet id object (0x00)
+    ID_HASH_MASK = (1ull << 60) - 1,
+};
+
+uint64_t Deduper::eventId(const uint8_t *data, size_t len) {
+    size_t sdLen = 0;
+    const uint8_t *sd = findServiceData16(data, len, 0xFCD2, sdLen);
+    if (sd && sdLen >= 1) {
+        uint8_t advInfo = sd[0];
+        if ((advInfo & 0x01) && sdLen >= 1 + 8) {
+            const uint8_t *c = sd + sdLen - 8;  // counter precedes the 4-byte MIC
+            return ID_COUNTER | c[0] | (c[1] << 8) | ((uint64_t)c[2] << 16) | ((uint64_t)c[3] << 24);
+        }
+        size_t idx = (advInfo & 0x02) ? 7 : 1;
+        if (!(advInfo & 0x01) && sdLen >= idx + 2 && sd[idx] == 0x00)
+            return ID_PACKET | sd[idx + 1];
+    }
+
+    // Hash only what sensors put their readings in, so gateways that append
+    // a scan response (names, tx power) still agree.
+    uint64_t h = 14695981039346656037ull;
+    bool any = false;
+    forEachAd(data, len, [&](uint8_t type, const uint8_t *p, size_t n) {
+        if (type == AD_SERVICE_DATA16 || type == AD_MANUFACTURER) {
+            h = fnv64(h, &type, 1);
+            h = fnv64(h, p, n);
+            any = true;
+        }
+        return true;
+    });
+    if (!any)
+        h = fnv64(h, data, len);
+    return h & ID_HASH_MASK;
+}
+
+Deduper::Deduper(const Config &cfg, EmitFn emit) : _cfg(cfg), _emit(emit) {
+    if (_cfg.windowMs < _cfg.holdMs)
+        _cfg.windowMs = _cfg.holdMs;
+}
+
+void Deduper::add(int gateway, const AdvertHeader &hdr, const uint8_t *data, int64_t nowMs) {
+    _stats.received++;
+
+    Key key;
+    memcpy(key.mac, hdr.mac, 6);
+    key.event = eventId(data, hdr.len);
+
+    auto it = _events.find(key);
+    if (it != _events.end()) {
+        Entry &e = it->second;
+        _stats.duplicates++;
+        if (!e.emitted) {
+            e.best.copies++;
+            if (hdr.rssi > e.best.hdr.rssi) {
+                e.best.hdr = hdr;
+                memcpy(e.best.data, data, hdr.len);
+                e.best.gateway = gateway;
+                _stats.improved++;
+            }
+        }
+        return;
+    }
+
+    Entry &e = _events[key];
+    e.firstMs = nowMs;
+    e.emitted = false;
+    e.best.hdr = hdr;
+    memcpy(e.best.data, data, hdr.len);
+    e.best.gateway = gateway;
+    e.best.copies = 1;
+    _held.emplace_back(nowMs, key);
+    _expiry.emplace_back(nowMs, key);
+    if (_cfg.holdMs == 0)
+        poll(nowMs);
+}
+
+void Deduper::emit(Entry &e) {
+    if (e.emitted)
+        return;
+    e.emitted = true;
+    _stats.unique++;
+    _emit(e.best);
+}
+
+void Deduper::poll(int64_t nowMs) {
+    while (!_held.empty() && _held.front().first + _cfg.holdMs <= nowMs) {
+        auto it = _events.find(_held.front().second);
+        if (it != _events.end())
+            emit(it->second);
+        _held.pop_front();
+    }
+    while (!_expiry.empty() && _expiry.front().first + _cfg.windowMs <= nowMs) {
+        _events.erase(_expiry.front().second);
+        _expiry.pop_front();
+    }
+}
+
+void Deduper::flush() {
+    for (auto &h : _held) {
+        auto it = _events.find(h.second);
+        if (it != _events.end())
+            emit(it->second);
+    }
+    _held.clear();
+}
+
+int64_t Deduper::nextDeadlineMs() const {
+    if (!_held.empty())
+        return _held.front().first + _cfg.holdMs;
+    if (!_expiry.empty())
+        return _expiry.front().first + _cfg.windowMs;
+    return -1;
+}
+
+Deduper::Stats Deduper::stats() const {
+    Stats s = _stats;
+    s.tracked = _events.size();
+    return s;
+}
@@ -0,0 +1,90 @@
+/// @file Deduper.h
+/// @brief Cross-gateway duplicate suppression for the host aggregator.
+///
+/// With overlapping gateways the same transmission arrives several times.
+/// An event is identified by (MAC, event id): the BTHome packet id or
+/// encryption counter when present, otherwise a hash of the advert's
+/// service/manufacturer data. The first copy opens the event; copies arriving
+/// within holdMs may replace it if their RSSI is better; after holdMs the
+/// best copy is emitted exactly once. Later copies within windowMs of the
+/// first are dropped.
+
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <unordered_map>
+
+#include "AdvertSource.h"
+
+class Deduper {
+public:
+    struct Config {
+        uint32_t holdMs = 250;      ///< Wait for better copies this long
+        uint32_t windowMs = 3000;   ///< Treat copies this close as duplicates
+    };
+
+    /// The copy that won an event.
+    struct Event {
+        AdvertHeader hdr;
+        uint8_t data[ADVERT_MAX_DATA];
+        int gateway;                ///< Gateway the best copy came from
+        uint16_t copies;            ///< Copies received within the hold time
+    };
+
+    struct Stats {
+        uint64_t received;          ///< Copies offered
+        uint64_t unique;            ///< Events emitted
+        uint64_t duplicates;        ///< Copies folded into an existing event
+        uint64_t improved;          ///< Copies that replaced the held copy
+        size_t tracked;             ///< Events currently remembered
+    };
+
+    typedef std::function<void(const Event &)> EmitFn;
+
+    Deduper(const Config &cfg, EmitFn emit);
+
+    void add(int gateway, const AdvertHeader &hdr, const uint8_t *data, int64_t nowMs);
+
+    /// Emit events whose hold time has passed and forget expired ones.
+    void poll(int64_t nowMs);
+
+    /// Emit everything still held (at shutdown).
+    void flush();
+
+    /// Time poll() next has work to do, or -1 if nothing is held.
+    int64_t nextDeadlineMs() const;
+
+    Stats stats() const;
+
+    /// Event id of an advert (see file comment).
+    static uint64_t eventId(const uint8_t *data, size_t len);
+
+private:
+    struct Key {
+        uint8_t mac[6];
+        uint64_t event;
+        bool operator==(const Key &o) const {
+            return event == o.event && memcmp(mac, o.mac, 6) == 0;
+        }
+    };
+    struct KeyHash {
+        size_t operator()(const Key &k) const;
+    };
+    struct Entry {
+        int64_t firstMs;
+        bool emitted;
+        Event best;
+    };
+
+    void emit(Entry &e);
+
+    Config _cfg;
+    EmitFn _emit;
+    std::unordered_map<Key, Entry, KeyHash> _events;
+    std::deque<std::pair<int64_t, Key>> _held;      ///< Arrival order, for emission
+    std::deque<std::pair<int64_t, Key>> _expiry;    ///< Arrival order, for forgetting
+    Stats _stats = {};
+};
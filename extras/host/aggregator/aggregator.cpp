@@ -0,0 +1,534 @@
+// Multi-gateway advert aggregator for Linux.
+//
+// Reads AdvertFrame streams (see examples/BTHomeScan/AdvertFrame.h) from
+// several gateways running BLEScanner::forward(), removes the duplicates
+// that overlapping coverage produces (Deduper.h), decodes each unique advert
+// once with the library's decoders and prints one JSON object per line.
+// Encrypted BTHome adverts are decrypted in batches (CcmBatch.h).
+//
+// Inputs:
+//   serial:/dev/ttyUSB0[@baud]   gateway on a serial port (default 115200)
+//   tcp:host:port                gateway (or ser2net etc.) on a TCP socket
+//   udp:port                     gateways sending datagrams of whole frames;
+//                                each source address is its own gateway
+//   file:path                    recorded stream, read as fast as possible
+//
+// Build from the repository root (needs mbedtls for BTHome decryption):
+//   g++ -std=c++17 -O2 -Iextras/host/shim -Isrc -Iexamples/BTHomeScan
+//       -Iextras/host/aggregator -o bthome-aggregator
+//       extras/host/aggregator/aggregator.cpp extras/host/aggregator/Deduper.cpp
+//       extras/host/aggregator/CcmBatch.cpp src/BTHomeDecoder.cpp examples/BTHomeScan/DecoderRegistry.cpp
+//       examples/BTHomeScan/DeviceDecoders.cpp -lmbedcrypto
+//   ./bthome-aggregator [-k key] [-H holdMs] [-w windowMs] [-t] [-q] input...
+//
+// Dedupe windows run on the host clock. Recorded streams replay far faster
+// than real time, so for files from gateways sharing a clock (or from the
+// load generator) pass -t to run them on the frames' own timestamps.
+//
+// Ctrl-C (or the end of all non-UDP inputs) prints statistics to stderr.
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <map>
+#include <netdb.h>
+#include <string>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <termios.h>
+#include <unistd.h>
+#include <vector>
+
+#include "AdParser.h"
+#include "AdvertFrame.h"
+#include "BTHomeDecoder.h"
+#include "CcmBatch.h"
+#include "Deduper.h"
+#include "DecoderRegistry.h"
+#include "DeviceDecoders.h"
+
+// ---------------------------------------------------------------------------
+// Inputs
+// ---------------------------------------------------------------------------
+enum InputType { IN_SERIAL, IN_TCP, IN_UDP, IN_FILE };
+
+struct Input {
+    InputType type;
+    std::string spec;
+    int fd = -1;
+    int gateway = -1;           ///< Gateway index (UDP: per source address)
+    AdvertFrameReader reader;
+    bool open = false;
+};
+
+static std::vector<std::string> s_gateways;
+static std::vector<uint64_t> s_gatewayFrames;
+
+static int addGateway(const std::string &name) {
+    s_gateways.push_back(name);
+    s_gatewayFrames.push_back(0);
+    return (int)s_gateways.size() - 1;
+}
+
+static speed_t baudConstant(long baud) {
+    switch (baud) {
+    case 9600: return B9600;
+    case 57600: return B57600;
+    case 115200: return B115200;
+    case 230400: return B230400;
+    case 460800: return B460800;
+    case 921600: return B921600;
+    default: return 0;
+    }
+}
+
+static int openSerial(const std::string &arg) {
+    std::string path = arg;
+    long baud = 115200;
+    size_t at = arg.find('@');
+    if (at != std::string::npos) {
+        path = arg.substr(0, at);
+        baud = atol(arg.c_str() + at + 1);
+    }
+    speed_t speed = baudConstant(baud);
+    if (!speed) {
+        fprintf(stderr, "unsupported baud rate %ld\n", baud);
+        return -1;
+    }
+    int fd = open(path.c_str(), O_RDONLY | O_NOCTTY | O_NONBLOCK);
+    if (fd < 0) {
+        perror(path.c_str());
+        return -1;
+    }
+    struct termios tio;
+    if (tcgetattr(fd, &tio) == 0) {
+        cfmakeraw(&tio);
+        cfsetispeed(&tio, speed);
+        cfsetospeed(&tio, speed);
+        tcsetattr(fd, TCSANOW, &tio);
+    }
+    return fd;
+}
+
+static int openTcp(const std::string &arg) {
+    size_t colon = arg.rfind(':');
+    if (colon == std::string::npos) {
+        fprintf(stderr, "tcp input needs host:port\n");
+        return -1;
+    }
+    std::string host = arg.substr(0, colon), port = arg.substr(colon + 1);
+    struct addrinfo hints = {}, *res = nullptr;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host.c_str(), port.c_str(), &hints, &res) != 0) {
+        fprintf(stderr, "cannot resolve %s\n", arg.c_str());
+        return -1;
+    }
+    int fd = -1;
+    for (auto *ai = res; ai; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd >= 0 && connect(fd, ai->ai_addr, ai->ai_addrlen) == 0)
+            break;
+        if (fd >= 0)
+            close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(res);
+    if (fd < 0) {
+        fprintf(stderr, "cannot connect to %s\n", arg.c_str());
+        return -1;
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    return fd;
+}
+
+static int openUdp(const std::string &arg) {
+    int fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+    if (fd < 0)
+        return -1;
+    int rcvbuf = 4 << 20;   // ride out bursts from many gateways
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons((uint16_t)atoi(arg.c_str()));
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        perror("udp bind");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static bool openInput(Input &in) {
+    size_t colon = in.spec.find(':');
+    if (colon == std::string::npos) {
+        fprintf(stderr, "input must be type:arg, got %s\n", in.spec.c_str());
+        return false;
+    }
+    std::string type = in.spec.substr(0, colon), arg = in.spec.substr(colon + 1);
+    if (type == "serial") {
+        in.type = IN_SERIAL;
+        in.fd = openSerial(arg);
+    } else if (type == "tcp") {
+        in.type = IN_TCP;
+        in.fd = openTcp(arg);
+    } else if (type == "udp") {
+        in.type = IN_UDP;
+        in.fd = openUdp(arg);
+    } else if (type == "file") {
+        in.type = IN_FILE;
+        in.fd = open(arg.c_str(), O_RDONLY);
+        if (in.fd < 0)
+            perror(arg.c_str());
+    } else {
+        fprintf(stderr, "unknown input type %s\n", type.c_str());
+        return false;
+    }
+    if (in.fd < 0)
+        return false;
+    in.open = true;
+    if (in.type != IN_UDP)
+        in.gateway = addGateway(in.spec);
+    return true;
+}
+
+// ---------------------------------------------------------------------------
+// Decoding and output
+// ---------------------------------------------------------------------------
+struct BTHomeCtx {
+    BTHomeDecoder decoder;
+    uint8_t key[16];
+    bool hasKey = false;
+
+    // Set while decoding an advert whose payload was already decrypted by
+    // the batch: service data at preSd decodes from prePlain instead.
+    const uint8_t *preSd = nullptr;
+    const uint8_t *prePlain = nullptr;
+    size_t prePlainLen = 0;
+    bool preOk = false;
+};
+
+static bool decodeBTHome(const uint8_t *sd, size_t len, const AdvertHeader &hdr,
+                         void *ctx, DecodedAdvert &out) {
+    auto *c = static_cast<BTHomeCtx *>(ctx);
+    if (sd == c->preSd) {
+        if (c->preOk)
+            return BTHomeDecoder::decodePlaintext(sd[0], c->prePlain, c->prePlainLen, out);
+        // Failed MIC: report the header like BTHomeDecoder::decode() does
+        BTHomeDecoder::decodePlaintext(sd[0], nullptr, 0, out);
+        return false;
+    }
+    return c->decoder.decode(sd, len, hdr.mac, c->hasKey ? c->key : nullptr, out);
+}
+
+static void printEvent(const Deduper::Event &ev, const DecodedAdvert &res) {
+    const uint8_t *m = ev.hdr.mac;
+    printf("{\"mac\":\"%02X:%02X:%02X:%02X:%02X:%02X\",\"gateway\":\"%s\",\"rssi\":%d,\"copies\":%u,",
+           m[0], m[1], m[2], m[3], m[4], m[5], s_gateways[ev.gateway].c_str(),
+           ev.hdr.rssi, ev.copies);
+    if (strcmp(res.protocol, "bthome") == 0)
+        printf("\"bthome_version\":%u,", res.version);
+    else
+        printf("\"protocol\":\"%s\",", res.protocol);
+    printf("\"measurements\":[");
+    for (uint8_t i = 0; i < res.count; i++) {
+        const BTHomeValue &v = res.values[i];
+        printf("%s{\"object_id\":%u,\"name\":\"%s\",\"value\":%g,\"unit\":\"%s\"}",
+               i ? "," : "", v.objectID, v.name, v.value, v.unit);
+    }
+    printf("]}\n");
+}
+
+// Unique events are decoded in batches so the encrypted ones among them can
+// go through ccmDecryptBatch() together instead of one mbedtls call each.
+class EventBatch {
+public:
+    static constexpr size_t CAPACITY = 64;
+
+    EventBatch(DecoderRegistry &registry, BTHomeCtx &bthome, bool quiet)
+        : _registry(registry), _bthome(bthome), _quiet(quiet) {}
+
+    void add(const Deduper::Event &ev) {
+        Slot &s = _slots[_count++];
+        s.ev = ev;
+        s.sd = nullptr;
+        if (_count == CAPACITY)
+            flush();
+    }
+
+    void flush();
+
+    uint64_t decoded = 0, undecoded = 0, decrypted = 0, authFailed = 0;
+
+private:
+    struct Slot {
+        Deduper::Event ev;
+        const uint8_t *sd;      ///< Encrypted BTHome service data, else nullptr
+        uint8_t plain[ADVERT_MAX_DATA];
+        size_t plainLen;
+        bool ok;
+    };
+
+    DecoderRegistry &_registry;
+    BTHomeCtx &_bthome;
+    bool _quiet;
+    Slot _slots[CAPACITY];
+    size_t _count = 0;
+};
+
+void EventBatch::flush() {
+    CcmJob jobs[CAPACITY];
+    BTHomeCipher params[CAPACITY];
+    size_t nJobs = 0;
+    size_t jobSlot[CAPACITY];
+
+    for (size_t i = 0; i < _count && _bthome.hasKey; i++) {
+        Slot &s = _slots[i];
+        size_t sdLen = 0;
+        const uint8_t *sd = findServiceData16(s.ev.data, s.ev.hdr.len, 0xFCD2, sdLen);
+        if (!sd || !BTHomeDecoder::cipherParams(sd, sdLen, s.ev.hdr.mac, params[nJobs]))
+            continue;
+        const BTHomeCipher &p = params[nJobs];
+        s.sd = sd;
+        s.plainLen = p.cipherLen;
+        jobs[nJobs] = {_bthome.key, p.nonce, p.cipher, p.cipherLen, p.mic, s.plain, false};
+        jobSlot[nJobs++] = i;
+    }
+    if (nJobs)
+        ccmDecryptBatch(jobs, nJobs);
+    for (size_t j = 0; j < nJobs; j++) {
+        _slots[jobSlot[j]].ok = jobs[j].ok;
+        jobs[j].ok ? decrypted++ : authFailed++;
+    }
+
+    for (size_t i = 0; i < _count; i++) {
+        Slot &s = _slots[i];
+        RawAdvert adv;
+        adv.hdr = s.ev.hdr;
+        adv.data = s.ev.data;
+        _bthome.preSd = s.sd;
+        _bthome.prePlain = s.plain;
+        _bthome.prePlainLen = s.plainLen;
+        _bthome.preOk = s.sd && s.ok;
+
+        DecodedAdvert res;
+        res.clear();
+        if (!_registry.decode(adv, res) || res.count == 0) {
+            undecoded++;
+            continue;
+        }
+        decoded++;
+        if (!_quiet)
+            printEvent(s.ev, res);
+    }
+    _bthome.preSd = nullptr;
+    _count = 0;
+}
+
+static bool parseKey(const char *hex, uint8_t key[16]) {
+    if (strlen(hex) != 32)
+        return false;
+    for (int i = 0; i < 16; i++) {
+        unsigned v;
+        if (sscanf(hex + 2 * i, "%2x", &v) != 1)
+            return false;
+        key[i] = (uint8_t)v;
+    }
+    return true;
+}
+
+// ---------------------------------------------------------------------------
+// Main loop
+// ---------------------------------------------------------------------------
+static volatile sig_atomic_t s_stop = 0;
+
+static void onSignal(int) {
+    s_stop = 1;
+}
+
+static int64_t nowMs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "usage: %s [-k key] [-H holdMs] [-w windowMs] [-t] [-q] input...\n"
+            "  inputs: serial:/dev/ttyUSB0[@baud] tcp:host:port udp:port file:path\n",
+            prog);
+}
+
+int main(int argc, char **argv) {
+    Deduper::Config cfg;
+    BTHomeCtx bthome;
+    bool quiet = false;
+    bool frameClock = false;
+    std::vector<Input> inputs;
+
+    for (int i = 1; i < argc; i++) {
+        std::string a = argv[i];
+        if (a == "-k" && i + 1 < argc) {
+            if (!parseKey(argv[++i], bthome.key)) {
+                fprintf(stderr, "key must be 32 hex characters\n");
+                return 2;
+            }
+            bthome.hasKey = true;
+        } else if (a == "-H" && i + 1 < argc) {
+            cfg.holdMs = (uint32_t)atoi(argv[++i]);
+        } else if (a == "-w" && i + 1 < argc) {
+            cfg.windowMs = (uint32_t)atoi(argv[++i]);
+        } else if (a == "-t") {
+            frameClock = true;
+        } else if (a == "-q") {
+            quiet = true;
+        } else if (a[0] == '-') {
+            usage(argv[0]);
+            return 2;
+        } else {
+            inputs.emplace_back();
+            inputs.back().spec = a;
+        }
+    }
+    if (inputs.empty()) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    DecoderRegistry registry;
+    registry.add(DecoderRegistry::SERVICE_DATA_16, 0xFCD2, decodeBTHome, &bthome);
+    registerDeviceDecoders(registry);
+
+    static EventBatch batch(registry, bthome, quiet);
+    Deduper dedupe(cfg, [&](const Deduper::Event &ev) { batch.add(ev); });
+
+    int ep = epoll_create1(0);
+    size_t live = 0;    // inputs that can still deliver data (UDP never ends)
+    for (size_t i = 0; i < inputs.size(); i++) {
+        if (!openInput(inputs[i]))
+            return 1;
+        if (inputs[i].type != IN_FILE) {
+            // Regular files cannot be polled; they are read between waits
+            struct epoll_event ev = {};
+            ev.events = EPOLLIN;
+            ev.data.u64 = i;
+            epoll_ctl(ep, EPOLL_CTL_ADD, inputs[i].fd, &ev);
+        }
+        live++;
+    }
+
+    signal(SIGINT, onSignal);
+    signal(SIGTERM, onSignal);
+
+    std::map<std::string, int> udpPeers;
+    static uint8_t buf[65536];
+    int64_t startMs = nowMs();
+    int64_t frameMs = 0;    // latest frame timestamp seen (-t)
+    auto clockMs = [&] { return frameClock ? frameMs : nowMs(); };
+
+    auto feed = [&](Input &in, int gateway, const uint8_t *bytes, size_t n) {
+        in.reader.feed(bytes, n, [&](const AdvertHeader &hdr, const uint8_t *data) {
+            s_gatewayFrames[gateway]++;
+            if (hdr.timeUs / 1000 > frameMs)
+                frameMs = hdr.timeUs / 1000;
+            dedupe.add(gateway, hdr, data, clockMs());
+        });
+    };
+    auto closeInput = [&](Input &in) {
+        if (in.type != IN_FILE)
+            epoll_ctl(ep, EPOLL_CTL_DEL, in.fd, nullptr);
+        close(in.fd);
+        in.open = false;
+        live--;
+    };
+
+    while (!s_stop && live > 0) {
+        bool filesPending = false;
+        for (auto &in : inputs)
+            filesPending |= in.open && in.type == IN_FILE;
+
+        int timeout = 100;
+        int64_t deadline = dedupe.nextDeadlineMs();
+        if (filesPending)
+            timeout = 0;
+        else if (deadline >= 0)
+            timeout = (int)std::max<int64_t>(0, std::min<int64_t>(100, deadline - clockMs()));
+
+        struct epoll_event events[16];
+        int n = epoll_wait(ep, events, 16, timeout);
+        for (int e = 0; e < n; e++) {
+            Input &in = inputs[events[e].data.u64];
+            if (in.type == IN_UDP) {
+                struct sockaddr_in from;
+                socklen_t fromLen = sizeof(from);
+                ssize_t r;
+                while ((r = recvfrom(in.fd, buf, sizeof(buf), 0,
+                                     (struct sockaddr *)&from, &fromLen)) > 0) {
+                    char name[64];
+                    snprintf(name, sizeof(name), "udp:%s:%u", inet_ntoa(from.sin_addr),
+                             ntohs(from.sin_port));
+                    auto it = udpPeers.find(name);
+                    int gw = it != udpPeers.end() ? it->second : (udpPeers[name] = addGateway(name));
+                    in.reader.reset();  // datagrams carry whole frames
+                    feed(in, gw, buf, (size_t)r);
+                    fromLen = sizeof(from);
+                }
+                continue;
+            }
+            ssize_t r = read(in.fd, buf, sizeof(buf));
+            if (r > 0)
+                feed(in, in.gateway, buf, (size_t)r);
+            else if (r == 0 || (errno != EAGAIN && errno != EINTR))
+                closeInput(in);
+        }
+
+        // Round-robin chunks from recorded streams so gateways interleave
+        for (auto &in : inputs) {
+            if (!in.open || in.type != IN_FILE)
+                continue;
+            ssize_t r = read(in.fd, buf, 16384);
+            if (r > 0)
+                feed(in, in.gateway, buf, (size_t)r);
+            else
+                closeInput(in);
+        }
+
+        dedupe.poll(clockMs());
+        batch.flush();
+    }
+    dedupe.flush();
+    batch.flush();
+    fflush(stdout);
+
+    double secs = (nowMs() - startMs) / 1000.0;
+    Deduper::Stats ds = dedupe.stats();
+    uint64_t frames = 0, errors = 0;
+    for (auto &in : inputs) {
+        frames += in.reader.frames();
+        errors += in.reader.errors();
+    }
+    fprintf(stderr, "gateways:\n");
+    for (size_t g = 0; g < s_gateways.size(); g++)
+        fprintf(stderr, "  %-32s %llu frames\n", s_gateways[g].c_str(),
+                (unsigned long long)s_gatewayFrames[g]);
+    fprintf(stderr,
+            "frames %llu (bad %llu), unique %llu, duplicates %llu (better rssi %llu), "
+            "decoded %llu, undecoded %llu\n",
+            (unsigned long long)frames, (unsigned long long)errors,
+            (unsigned long long)ds.unique, (unsigned long long)ds.duplicates,
+            (unsigned long long)ds.improved, (unsigned long long)batch.decoded,
+            (unsigned long long)batch.undecoded);
+    if (bthome.hasKey)
+        fprintf(stderr, "bthome decrypted %llu, failed %llu (%s)\n",
+                (unsigned long long)batch.decrypted, (unsigned long long)batch.authFailed,
+                ccmEngineName(ccmBestEngine()));
+    if (secs > 0)
+        fprintf(stderr, "%.2f s, %.0f frames/s\n", secs, frames / secs);
+    return 0;
+}
@@ -0,0 +1,228 @@
+// Simulated gateway streams for load-testing the aggregator.
+//
+// Generates BTHome sensors (packet id, temperature, humidity, battery) that
+// each advertise once per period, and a set of gateways with overlapping
+// coverage: every gateway hears a given advert with probability coverage%
+// at its own RSSI, so each event arrives 1..gateways times. Streams are
+// AdvertFrames, written either to one file per gateway or sent as UDP
+// datagrams from one socket per gateway. With -k the sensors encrypt their
+// payloads (BTHome v2 AES-CCM) with that key, to load the aggregator's
+// batch decryption.
+//
+// Build from the repository root:
+//   g++ -std=c++17 -O2 -Iexamples/BTHomeScan -o bthome-loadgen
+//       extras/host/aggregator/loadgen.cpp -lmbedcrypto
+//   ./bthome-loadgen -o /tmp/gw -g 3 -d 500 -s 600       (files /tmp/gw0.bin ...)
+//   ./bthome-loadgen -u 127.0.0.1:7000 -g 3 -d 500 -s 60 (UDP, real time)
+//   ./bthome-loadgen -o /tmp/gw -k 231d39c1d7cc1ab1aee224cd096db932 ...
+//
+// Prints the number of distinct events it generated, which the aggregator's
+// "unique" count should match (events no gateway heard are not counted).
+
+#include <arpa/inet.h>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "mbedtls/ccm.h"
+
+#include "AdvertFrame.h"
+
+struct Sensor {
+    uint8_t mac[6];
+    uint8_t packetId;
+    uint32_t counter;       ///< Encryption counter
+    int64_t nextUs;
+    int64_t periodUs;
+};
+
+struct Gateway {
+    FILE *file = nullptr;
+    int sock = -1;
+    std::vector<uint8_t> pending;   ///< UDP datagram being filled
+    uint64_t frames = 0;
+};
+
+static size_t buildAdvert(Sensor &s, std::mt19937 &rng, mbedtls_ccm_context *ccm,
+                          uint8_t *out) {
+    std::uniform_int_distribution<int> temp(1500, 2800), hum(3000, 7000);
+    int t = temp(rng), h = hum(rng);
+    uint8_t sd[32] = {
+        0xD2, 0xFC, 0x40,                   // UUID, BTHome v2 plaintext
+        0x00, s.packetId,                   // packet id
+        0x01, 87,                           // battery %
+        0x02, (uint8_t)t, (uint8_t)(t >> 8),// temperature 0.01 C
+        0x03, (uint8_t)h, (uint8_t)(h >> 8),// humidity 0.01 %
+    };
+    size_t sdLen = 13;
+    if (ccm) {
+        // Encrypted: objects, then counter(4) and MIC(4). The nonce is
+        // mac(6) + UUID + advInfo + counter.
+        sd[2] = 0x41;
+        uint8_t nonce[13];
+        memcpy(nonce, s.mac, 6);
+        memcpy(nonce + 6, sd, 3);
+        memcpy(nonce + 9, &s.counter, 4);
+        uint8_t plain[10];
+        memcpy(plain, sd + 3, sizeof(plain));
+        mbedtls_ccm_encrypt_and_tag(ccm, sizeof(plain), nonce, 13, nullptr, 0,
+                                    plain, sd + 3, sd + 17, 4);
+        memcpy(sd + 13, &s.counter, 4);
+        sdLen = 21;
+        s.counter++;
+    }
+    size_t n = 0;
+    out[n++] = 2; out[n++] = 0x01; out[n++] = 0x06;     // flags
+    out[n++] = (uint8_t)(sdLen + 1);
+    out[n++] = 0x16;
+    memcpy(out + n, sd, sdLen);
+    n += sdLen;
+    s.packetId++;
+    return n;
+}
+
+static bool parseKey(const char *hex, uint8_t key[16]) {
+    if (strlen(hex) != 32)
+        return false;
+    for (int i = 0; i < 16; i++) {
+        unsigned v;
+        if (sscanf(hex + 2 * i, "%2x", &v) != 1)
+            return false;
+        key[i] = (uint8_t)v;
+    }
+    return true;
+}
+
+static void flushUdp(Gateway &g, const sockaddr_in &dst) {
+    if (g.pending.empty())
+        return;
+    sendto(g.sock, g.pending.data(), g.pending.size(), 0, (const sockaddr *)&dst, sizeof(dst));
+    g.pending.clear();
+}
+
+int main(int argc, char **argv) {
+    int gateways = 3, devices = 200, coverage = 80;
+    double seconds = 60;
+    std::string outPrefix, udpTarget;
+    unsigned seed = 1;
+    uint8_t key[16];
+    bool encrypt = false;
+    for (int i = 1; i < argc; i++) {
+        std::string a = argv[i];
+        if (a == "-g" && i + 1 < argc) gateways = atoi(argv[++i]);
+        else if (a == "-d" && i + 1 < argc) devices = atoi(argv[++i]);
+        else if (a == "-c" && i + 1 < argc) coverage = atoi(argv[++i]);
+        else if (a == "-s" && i + 1 < argc) seconds = atof(argv[++i]);
+        else if (a == "-o" && i + 1 < argc) outPrefix = argv[++i];
+        else if (a == "-u" && i + 1 < argc) udpTarget = argv[++i];
+        else if (a == "-r" && i + 1 < argc) seed = (unsigned)atoi(argv[++i]);
+        else if (a == "-k" && i + 1 < argc && parseKey(argv[i + 1], key)) encrypt = true, i++;
+        else {
+            fprintf(stderr,
+                    "usage: %s (-o prefix | -u host:port) [-g gateways] [-d devices]\n"
+                    "          [-c coverage%%] [-s seconds] [-r seed] [-k key]\n", argv[0]);
+            return 2;
+        }
+    }
+    if (outPrefix.empty() == udpTarget.empty()) {
+        fprintf(stderr, "give exactly one of -o and -u\n");
+        return 2;
+    }
+
+    std::mt19937 rng(seed);
+    mbedtls_ccm_context ccm;
+    mbedtls_ccm_init(&ccm);
+    if (encrypt)
+        mbedtls_ccm_setkey(&ccm, MBEDTLS_CIPHER_ID_AES, key, 128);
+    std::vector<Gateway> gws(gateways);
+    sockaddr_in dst = {};
+    if (!udpTarget.empty()) {
+        size_t colon = udpTarget.rfind(':');
+        dst.sin_family = AF_INET;
+        dst.sin_port = htons((uint16_t)atoi(udpTarget.c_str() + colon + 1));
+        inet_pton(AF_INET, udpTarget.substr(0, colon).c_str(), &dst.sin_addr);
+        for (auto &g : gws)
+            g.sock = socket(AF_INET, SOCK_DGRAM, 0);
+    } else {
+        for (int i = 0; i < gateways; i++) {
+            std::string path = outPrefix + std::to_string(i) + ".bin";
+            gws[i].file = fopen(path.c_str(), "wb");
+            if (!gws[i].file) {
+                perror(path.c_str());
+                return 1;
+            }
+        }
+    }
+
+    std::uniform_int_distribution<int> periodMs(1000, 10000), pct(0, 99), rssi(-95, -40);
+    std::vector<Sensor> sensors(devices);
+    for (int i = 0; i < devices; i++) {
+        Sensor &s = sensors[i];
+        s.mac[0] = 0xA4; s.mac[1] = 0xC1; s.mac[2] = 0x38;
+        s.mac[3] = (uint8_t)(i >> 16); s.mac[4] = (uint8_t)(i >> 8); s.mac[5] = (uint8_t)i;
+        s.packetId = (uint8_t)rng();
+        s.counter = rng();
+        s.periodUs = (int64_t)periodMs(rng) * 1000;
+        s.nextUs = rng() % s.periodUs;
+    }
+
+    // Walk simulated time in 10 ms steps; in UDP mode pace to real time
+    uint64_t events = 0, frames = 0;
+    const int64_t stepUs = 10000, endUs = (int64_t)(seconds * 1e6);
+    auto wallStart = std::chrono::steady_clock::now();
+    for (int64_t now = 0; now < endUs; now += stepUs) {
+        for (auto &s : sensors) {
+            while (s.nextUs <= now) {
+                uint8_t data[ADVERT_MAX_DATA];
+                AdvertHeader hdr = {};
+                memcpy(hdr.mac, s.mac, 6);
+                hdr.len = (uint8_t)buildAdvert(s, rng, encrypt ? &ccm : nullptr, data);
+                s.nextUs += s.periodUs + rng() % 10000;     // advDelay
+
+                bool heard = false;
+                for (auto &g : gws) {
+                    if (pct(rng) >= coverage)
+                        continue;
+                    heard = true;
+                    hdr.timeUs = s.nextUs;
+                    hdr.rssi = (int8_t)rssi(rng);
+                    uint8_t frame[FRAME_MAX_ENCODED];
+                    size_t n = encodeAdvertFrame(hdr, data, frame);
+                    if (g.file) {
+                        fwrite(frame, 1, n, g.file);
+                    } else {
+                        if (g.pending.size() + n > 1400)
+                            flushUdp(g, dst);
+                        g.pending.insert(g.pending.end(), frame, frame + n);
+                    }
+                    g.frames++;
+                    frames++;
+                }
+                events += heard;
+            }
+        }
+        if (!udpTarget.empty()) {
+            for (auto &g : gws)
+                flushUdp(g, dst);
+            std::this_thread::sleep_until(wallStart + std::chrono::microseconds(now + stepUs));
+        }
+    }
+    mbedtls_ccm_free(&ccm);
+    for (auto &g : gws) {
+        if (g.file)
+            fclose(g.file);
+        if (g.sock >= 0)
+            close(g.sock);
+    }
+    printf("events %llu, frames %llu (%.2f copies per event)\n",
+           (unsigned long long)events, (unsigned long long)frames,
+           events ? (double)frames / events : 0.0);
+    return 0;
+}
@@ -0,0 +1,51 @@
+#!/bin/sh
+# Build the aggregator and load generator, replay simulated multi-gateway
+# streams through the aggregator and check every event is emitted once.
+#
+#   extras/host/aggregator/loadtest.sh [gateways] [devices] [seconds]
+#
+# Set KEY to a 32-character hex key to run it with encrypted sensors.
+#
+# Needs g++ and mbedtls (libmbedtls-dev). Run from the repository root.
+set -e
+
+GATEWAYS=${1:-4}
+DEVICES=${2:-2000}
+SECONDS_SIM=${3:-600}
+OUT=${TMPDIR:-/tmp}/bthome-loadtest
+mkdir -p "$OUT"
+
+g++ -std=c++17 -O2 -Iextras/host/shim -Isrc -Iexamples/BTHomeScan \
+    -Iextras/host/aggregator -o "$OUT/bthome-aggregator" \
+    extras/host/aggregator/aggregator.cpp extras/host/aggregator/Deduper.cpp \
+    extras/host/aggregator/CcmBatch.cpp src/BTHomeDecoder.cpp examples/BTHomeScan/DecoderRegistry.cpp \
+    examples/BTHomeScan/DeviceDecoders.cpp -lmbedcrypto
+g++ -std=c++17 -O2 -Iexamples/BTHomeScan -o "$OUT/bthome-loadgen" \
+    extras/host/aggregator/loadgen.cpp -lmbedcrypto
+
+KEYARG=""
+if [ -n "$KEY" ]; then
+    KEYARG="-k $KEY"
+fi
+
+# shellcheck disable=SC2086
+GEN=$("$OUT/bthome-loadgen" -o "$OUT/gw" -g "$GATEWAYS" -d "$DEVICES" -s "$SECONDS_SIM" $KEYARG)
+echo "$GEN"
+
+INPUTS=""
+i=0
+while [ "$i" -lt "$GATEWAYS" ]; do
+    INPUTS="$INPUTS file:$OUT/gw$i.bin"
+    i=$((i + 1))
+done
+# shellcheck disable=SC2086
+"$OUT/bthome-aggregator" -t -q $KEYARG $INPUTS 2>"$OUT/stats.txt"
+cat "$OUT/stats.txt"
+
+EXPECTED=$(echo "$GEN" | sed -n 's/^events \([0-9]*\),.*/\1/p')
+UNIQUE=$(sed -n 's/.*unique \([0-9]*\),.*/\1/p' "$OUT/stats.txt")
+if [ "$EXPECTED" != "$UNIQUE" ]; then
+    echo "FAIL: generated $EXPECTED events, aggregator emitted $UNIQUE"
+    exit 1
+fi
+echo "OK: $UNIQUE unique events from $GATEWAYS gateways"
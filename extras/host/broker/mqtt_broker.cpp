@@ -0,0 +1,359 @@
+// Minimal MQTT 3.1.1 broker for host tests of MqttTransport and anything
+// else that publishes, without installing a real broker.
+//
+// Accepts CONNECT, PUBLISH at QoS 0 and 1, SUBSCRIBE (with + and #
+// wildcards, delivered at QoS 0), UNSUBSCRIBE, PINGREQ and DISCONNECT.
+// No sessions, retained messages, wills, QoS 2 or authentication: a
+// user name and password are accepted and ignored. Every publish is
+// printed as "topic payload" on stdout.
+//
+// Build from the repository root:
+//   g++ -std=c++17 -O2 -o mqtt_broker extras/host/broker/mqtt_broker.cpp
+//   ./mqtt_broker [-p port] [-n publishes] [-o file] [-q]
+//
+//   -p  listen port (default 1883)
+//   -n  exit after this many publishes, e.g. at the end of a test
+//   -o  also append each publish to this file, one per line
+//   -q  do not print publishes
+//
+// Ctrl-C (or -n) prints statistics to stderr.
+
+#include <arpa/inet.h>
+#include <cerrno>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <netinet/in.h>
+#include <poll.h>
+#include <string>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <vector>
+
+static volatile sig_atomic_t stopRequested = 0;
+
+static void onSignal(int) { stopRequested = 1; }
+
+struct Session {
+    int fd;
+    bool connected = false;
+    std::string id;
+    std::vector<uint8_t> rx;
+    std::vector<std::string> filters;
+};
+
+struct BrokerStats {
+    uint64_t connects = 0;
+    uint64_t publishes = 0;
+    uint64_t publishBytes = 0;  // payload bytes
+    uint64_t delivered = 0;     // to subscribers
+    uint64_t pings = 0;
+    uint64_t protocolErrors = 0;
+};
+
+static BrokerStats stats;
+
+// ---------------------------------------------------------------------------
+// Packets
+// ---------------------------------------------------------------------------
+
+static void sendAll(Session &s, const std::vector<uint8_t> &pkt) {
+    size_t done = 0;
+    while (s.fd >= 0 && done < pkt.size()) {
+        ssize_t n = send(s.fd, pkt.data() + done, pkt.size() - done, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0) {
+            close(s.fd);
+            s.fd = -1;
+            return;
+        }
+        done += (size_t)n;
+    }
+}
+
+static std::vector<uint8_t> packet(uint8_t type, const std::vector<uint8_t> &body) {
+    std::vector<uint8_t> pkt;
+    pkt.push_back(type);
+    size_t len = body.size();
+    do {
+        uint8_t digit = len & 0x7F;
+        len >>= 7;
+        pkt.push_back(len ? digit | 0x80 : digit);
+    } while (len);
+    pkt.insert(pkt.end(), body.begin(), body.end());
+    return pkt;
+}
+
+// Topic filter match with + (one level) and # (the rest)
+static bool topicMatches(const std::string &filter, const std::string &topic) {
+    size_t f = 0, t = 0;
+    while (f < filter.size()) {
+        if (filter[f] == '#')
+            return true;
+        size_t fEnd = filter.find('/', f);
+        size_t tEnd = topic.find('/', t);
+        if (fEnd == std::string::npos)
+            fEnd = filter.size();
+        if (tEnd == std::string::npos)
+            tEnd = topic.size();
+        if (t > topic.size())
+            return false;
+        if (filter.compare(f, fEnd - f, "+") != 0 &&
+            filter.compare(f, fEnd - f, topic, t, tEnd - t) != 0)
+            return false;
+        f = fEnd + 1;
+        t = tEnd + 1;
+    }
+    return t > topic.size();
+}
+
+static bool readString(const uint8_t *&p, const uint8_t *end, std::string &out) {
+    if (end - p < 2)
+        return false;
+    size_t len = (size_t)p[0] << 8 | p[1];
+    if ((size_t)(end - p - 2) < len)
+        return false;
+    out.assign((const char *)p + 2, len);
+    p += 2 + len;
+    return true;
+}
+
+struct Output {
+    FILE *file = nullptr;
+    bool quiet = false;
+};
+
+// Handle one complete packet. Returns false to drop the client.
+static bool handle(Session &s, std::vector<Session> &all, uint8_t type, const uint8_t *body,
+                   size_t len, const Output &out) {
+    const uint8_t *p = body, *end = body + len;
+    uint8_t kind = type & 0xF0;
+    if (!s.connected && kind != 0x10)
+        return false;
+
+    switch (kind) {
+    case 0x10: {    // CONNECT
+        std::string proto;
+        if (!readString(p, end, proto) || end - p < 4)
+            return false;
+        uint8_t level = p[0];
+        p += 4;     // level, flags, keep alive
+        readString(p, end, s.id);
+        bool ok = proto == "MQTT" && level == 4;
+        sendAll(s, packet(0x20, {0, (uint8_t)(ok ? 0 : 1)}));
+        if (!ok)
+            return false;
+        s.connected = true;
+        stats.connects++;
+        return true;
+    }
+    case 0x30: {    // PUBLISH
+        std::string topic;
+        if (!readString(p, end, topic))
+            return false;
+        uint8_t qos = (type >> 1) & 3;
+        uint16_t packetId = 0;
+        if (qos) {
+            if (end - p < 2)
+                return false;
+            packetId = (uint16_t)(p[0] << 8 | p[1]);
+            p += 2;
+        }
+        if (qos > 1)
+            return false;
+        stats.publishes++;
+        stats.publishBytes += (size_t)(end - p);
+        if (!out.quiet)
+            printf("%s %.*s\n", topic.c_str(), (int)(end - p), (const char *)p);
+        if (out.file)
+            fprintf(out.file, "%s %.*s\n", topic.c_str(), (int)(end - p), (const char *)p);
+        if (qos == 1)
+            sendAll(s, packet(0x40, {(uint8_t)(packetId >> 8), (uint8_t)packetId}));
+
+        std::vector<uint8_t> fwd;
+        for (Session &other : all) {
+            if (other.fd < 0 || !other.connected)
+                continue;
+            for (const std::string &f : other.filters) {
+                if (!topicMatches(f, topic))
+                    continue;
+                if (fwd.empty()) {
+                    std::vector<uint8_t> b = {(uint8_t)(topic.size() >> 8), (uint8_t)topic.size()};
+                    b.insert(b.end(), topic.begin(), topic.end());
+                    b.insert(b.end(), p, end);
+                    fwd = packet(0x30, b);
+                }
+                sendAll(other, fwd);
+                stats.delivered++;
+                break;
+            }
+        }
+        return true;
+    }
+    case 0x80: {    // SUBSCRIBE
+        if ((type & 0x0F) != 0x02 || end - p < 2)
+            return false;
+        std::vector<uint8_t> ack = {p[0], p[1]};
+        p += 2;
+        std::string filter;
+        while (p < end && readString(p, end, filter) && p < end) {
+            p++;    // requested QoS, granted 0
+            s.filters.push_back(filter);
+            ack.push_back(0);
+        }
+        sendAll(s, packet(0x90, ack));
+        return true;
+    }
+    case 0xA0: {    // UNSUBSCRIBE
+        if (end - p < 2)
+            return false;
+        std::vector<uint8_t> ack = {p[0], p[1]};
+        p += 2;
+        std::string filter;
+        while (p < end && readString(p, end, filter))
+            for (size_t i = 0; i < s.filters.size(); i++)
+                if (s.filters[i] == filter)
+                    s.filters.erase(s.filters.begin() + (long)i--);
+        sendAll(s, packet(0xB0, ack));
+        return true;
+    }
+    case 0xC0:      // PINGREQ
+        stats.pings++;
+        sendAll(s, packet(0xD0, {}));
+        return true;
+    case 0xE0:      // DISCONNECT
+        return false;
+    default:
+        return false;
+    }
+}
+
+// Parse every complete packet in the session's buffer
+static bool drain(Session &s, std::vector<Session> &all, const Output &out) {
+    size_t pos = 0;
+    while (s.rx.size() - pos >= 2) {
+        size_t len = 0, shift = 0, i = pos + 1;
+        bool complete = false;
+        while (i < s.rx.size() && i < pos + 5) {
+            uint8_t b = s.rx[i++];
+            len |= (size_t)(b & 0x7F) << shift;
+            shift += 7;
+            if (!(b & 0x80)) {
+                complete = true;
+                break;
+            }
+        }
+        if (!complete) {
+            if (i == pos + 5)
+                return false;   // malformed length
+            break;
+        }
+        if (s.rx.size() - i < len)
+            break;
+        if (!handle(s, all, s.rx[pos], s.rx.data() + i, len, out)) {
+            if ((s.rx[pos] & 0xF0) != 0xE0)
+                stats.protocolErrors++;
+            return false;
+        }
+        pos = i + len;
+    }
+    s.rx.erase(s.rx.begin(), s.rx.begin() + (long)pos);
+    return true;
+}
+
+int main(int argc, char **argv) {
+    uint16_t port = 1883;
+    uint64_t limit = 0;
+    Output out;
+    for (int i = 1; i < argc; i++) {
+        std::string a = argv[i];
+        if (a == "-p" && i + 1 < argc) {
+            port = (uint16_t)atoi(argv[++i]);
+        } else if (a == "-n" && i + 1 < argc) {
+            limit = strtoull(argv[++i], nullptr, 10);
+        } else if (a == "-o" && i + 1 < argc) {
+            out.file = fopen(argv[++i], "a");
+            if (!out.file) {
+                fprintf(stderr, "cannot open %s\n", argv[i]);
+                return 2;
+            }
+        } else if (a == "-q") {
+            out.quiet = true;
+        } else {
+            fprintf(stderr, "usage: %s [-p port] [-n publishes] [-o file] [-q]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+    if (bind(listener, (sockaddr *)&addr, sizeof(addr)) != 0 || listen(listener, 16) != 0) {
+        fprintf(stderr, "cannot listen on port %u: %s\n", (unsigned)port, strerror(errno));
+        return 1;
+    }
+    signal(SIGINT, onSignal);
+    signal(SIGTERM, onSignal);
+    fprintf(stderr, "listening on port %u\n", (unsigned)port);
+
+    std::vector<Session> sessions;
+    uint8_t buf[4096];
+    while (!stopRequested && (!limit || stats.publishes < limit)) {
+        std::vector<pollfd> fds = {{listener, POLLIN, 0}};
+        for (const Session &s : sessions)
+            fds.push_back({s.fd, POLLIN, 0});
+        if (poll(fds.data(), fds.size(), 500) < 0 && errno != EINTR)
+            break;
+
+        if (fds[0].revents & POLLIN) {
+            int fd = accept(listener, nullptr, nullptr);
+            if (fd >= 0) {
+                Session s;
+                s.fd = fd;
+                sessions.push_back(s);
+            }
+        }
+        for (size_t i = 1; i < fds.size(); i++) {
+            if (!(fds[i].revents & (POLLIN | POLLHUP | POLLERR)))
+                continue;
+            Session &s = sessions[i - 1];
+            ssize_t n = recv(s.fd, buf, sizeof(buf), 0);
+            if (n > 0) {
+                s.rx.insert(s.rx.end(), buf, buf + n);
+                if (drain(s, sessions, out))
+                    continue;
+            } else if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (s.fd >= 0)
+                close(s.fd);
+            s.fd = -1;
+        }
+        for (size_t i = 0; i < sessions.size(); i++)
+            if (sessions[i].fd < 0)
+                sessions.erase(sessions.begin() + (long)i--);
+        fflush(stdout);
+        if (out.file)
+            fflush(out.file);
+    }
+
+    for (Session &s : sessions)
+        if (s.fd >= 0)
+            close(s.fd);
+    close(listener);
+    if (out.file)
+        fclose(out.file);
+    fprintf(stderr, "%llu connects, %llu publishes (%llu payload bytes), %llu delivered, "
+                    "%llu pings, %llu protocol errors\n",
+            (unsigned long long)stats.connects, (unsigned long long)stats.publishes,
+            (unsigned long long)stats.publishBytes, (unsigned long long)stats.delivered,
+            (unsigned long long)stats.pings, (unsigned long long)stats.protocolErrors);
+    return 0;
+}
@@ -0,0 +1,332 @@
+// Pull, inspect and replay raw advert captures (AdvertRecorder, see
+// examples/BTHomeScan/CaptureFormat.h) on Linux/macOS.
+//
+//   capture pull /dev/ttyUSB0[@baud] out.bcap   ask a RECORD_ADVERTS gateway
+//                                               for its capture ('D') and save it
+//   capture info file.bcap                      counts, time span, devices, gaps
+//   capture text file.bcap                      HostReplaySource text format
+//   capture decode [-k key] file.bcap           one JSON line per decoded advert,
+//                                               stable output to diff in regressions
+//   capture bench [-k key] [-n loops] file.bcap decoder throughput over the capture
+//
+// Files are memory-mapped and walked in place (CaptureFile.h).
+//
+// Build from the repository root:
+//   g++ -std=c++17 -O2 -Iextras/host/shim -Isrc -Iexamples/BTHomeScan
+//       -o capture extras/host/capture/capture.cpp
+//       examples/BTHomeScan/CaptureFile.cpp src/BTHomeDecoder.cpp
+//       examples/BTHomeScan/DecoderRegistry.cpp
+//       examples/BTHomeScan/DeviceDecoders.cpp -lmbedcrypto
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
+#include <set>
+#include <string>
+#include <termios.h>
+#include <unistd.h>
+
+#include "BTHomeDecoder.h"
+#include "CaptureFile.h"
+#include "DecoderRegistry.h"
+#include "DeviceDecoders.h"
+
+// ---------------------------------------------------------------------------
+// Decoding
+// ---------------------------------------------------------------------------
+struct BTHomeCtx {
+    BTHomeDecoder decoder;
+    uint8_t key[16];
+    bool hasKey = false;
+};
+
+static bool decodeBTHome(const uint8_t *sd, size_t len, const AdvertHeader &hdr,
+                         void *ctx, DecodedAdvert &out) {
+    auto *c = static_cast<BTHomeCtx *>(ctx);
+    return c->decoder.decode(sd, len, hdr.mac, c->hasKey ? c->key : nullptr, out);
+}
+
+static bool parseKey(const char *hex, uint8_t key[16]) {
+    if (strlen(hex) != 32)
+        return false;
+    for (int i = 0; i < 16; i++) {
+        unsigned v;
+        if (sscanf(hex + 2 * i, "%2x", &v) != 1)
+            return false;
+        key[i] = (uint8_t)v;
+    }
+    return true;
+}
+
+// ---------------------------------------------------------------------------
+// Commands
+// ---------------------------------------------------------------------------
+static speed_t baudConstant(long baud) {
+    switch (baud) {
+    case 115200: return B115200;
+    case 230400: return B230400;
+    case 460800: return B460800;
+    case 921600: return B921600;
+    default: return 0;
+    }
+}
+
+// Read exactly len bytes, giving up after timeoutMs of silence.
+static bool readFully(int fd, uint8_t *buf, size_t len, int timeoutMs) {
+    size_t got = 0;
+    while (got < len) {
+        struct pollfd p = {fd, POLLIN, 0};
+        if (poll(&p, 1, timeoutMs) <= 0)
+            return false;
+        ssize_t r = read(fd, buf + got, len - got);
+        if (r <= 0)
+            return false;
+        got += (size_t)r;
+    }
+    return true;
+}
+
+static int cmdPull(const char *port, const char *outPath) {
+    std::string path = port;
+    long baud = 115200;
+    size_t at = path.find('@');
+    if (at != std::string::npos) {
+        baud = atol(path.c_str() + at + 1);
+        path.resize(at);
+    }
+    speed_t speed = baudConstant(baud);
+    if (!speed) {
+        fprintf(stderr, "unsupported baud rate %ld\n", baud);
+        return 1;
+    }
+    int fd = open(path.c_str(), O_RDWR | O_NOCTTY);
+    if (fd < 0) {
+        perror(path.c_str());
+        return 1;
+    }
+    struct termios tio;
+    if (tcgetattr(fd, &tio) == 0) {
+        cfmakeraw(&tio);
+        cfsetispeed(&tio, speed);
+        cfsetospeed(&tio, speed);
+        tcsetattr(fd, TCSANOW, &tio);
+    }
+    tcflush(fd, TCIFLUSH);
+    if (write(fd, "D", 1) != 1) {
+        perror("write");
+        return 1;
+    }
+
+    // Skip whatever the sketch printed until the capture magic shows up
+    CaptureFileHeader h;
+    uint8_t *hb = (uint8_t *)&h;
+    size_t matched = 0;
+    while (matched < sizeof(CAPTURE_MAGIC)) {
+        uint8_t b;
+        if (!readFully(fd, &b, 1, 5000)) {
+            fprintf(stderr, "no capture received (is RECORD_ADVERTS defined?)\n");
+            return 1;
+        }
+        if (b == (uint8_t)CAPTURE_MAGIC[matched])
+            hb[matched++] = b;
+        else
+            matched = b == (uint8_t)CAPTURE_MAGIC[0] ? 1 : 0;
+    }
+    if (!readFully(fd, hb + matched, sizeof(h) - matched, 2000)) {
+        fprintf(stderr, "capture header cut off\n");
+        return 1;
+    }
+
+    FILE *out = fopen(outPath, "wb");
+    if (!out) {
+        perror(outPath);
+        return 1;
+    }
+    fwrite(&h, 1, sizeof(h), out);
+    uint8_t buf[4096];
+    uint64_t left = h.recordBytes;
+    while (left > 0) {
+        size_t n = left < sizeof(buf) ? (size_t)left : sizeof(buf);
+        if (!readFully(fd, buf, n, 2000)) {
+            fprintf(stderr, "capture cut off with %llu bytes to go\n", (unsigned long long)left);
+            fclose(out);
+            return 1;
+        }
+        fwrite(buf, 1, n, out);
+        left -= n;
+    }
+    fclose(out);
+    close(fd);
+    fprintf(stderr, "%u records (%llu bytes), %u dropped on the gateway\n", h.records,
+            (unsigned long long)h.recordBytes, h.dropped);
+    return 0;
+}
+
+static int cmdInfo(const CaptureFile &cap) {
+    const CaptureFileHeader &h = cap.header();
+    std::set<uint64_t> macs;
+    uint64_t gaps = 0, missing = 0, adBytes = 0;
+    int64_t first = 0, last = 0;
+    bool have = false;
+    uint32_t prevSeq = 0;
+    for (const CaptureRecord &r : cap) {
+        uint64_t m = 0;
+        for (int i = 0; i < 6; i++)
+            m = m << 8 | r.mac[i];
+        macs.insert(m);
+        adBytes += r.len;
+        if (have && r.seq != prevSeq + 1) {
+            gaps++;
+            missing += r.seq - prevSeq - 1;
+        }
+        if (!have || r.timeUs < first)
+            first = r.timeUs;
+        if (!have || r.timeUs > last)
+            last = r.timeUs;
+        prevSeq = r.seq;
+        have = true;
+    }
+    printf("records     %zu%s\n", cap.size(), cap.truncated() ? " (truncated)" : "");
+    printf("dropped     %u on the gateway, %llu missing in %llu seq gaps\n", h.dropped,
+           (unsigned long long)missing, (unsigned long long)gaps);
+    printf("devices     %zu\n", macs.size());
+    printf("span        %.3f s\n", (last - first) / 1e6);
+    printf("bytes       %llu (%.1f AD bytes per advert)\n", (unsigned long long)h.recordBytes,
+           cap.size() ? (double)adBytes / cap.size() : 0.0);
+    return 0;
+}
+
+static int cmdText(const CaptureFile &cap) {
+    for (const CaptureRecord &r : cap) {
+        printf("%lld %02X:%02X:%02X:%02X:%02X:%02X %d ", (long long)r.timeUs,
+               r.mac[0], r.mac[1], r.mac[2], r.mac[3], r.mac[4], r.mac[5], r.rssi);
+        for (uint8_t i = 0; i < r.len; i++)
+            printf("%02X", r.data()[i]);
+        printf("\n");
+    }
+    return 0;
+}
+
+static int cmdDecode(const CaptureFile &cap, DecoderRegistry &registry) {
+    DecodedAdvert res;
+    for (const CaptureRecord &r : cap) {
+        RawAdvert adv;
+        adv.hdr = r.header();
+        adv.data = r.data();
+        res.clear();
+        if (!registry.decode(adv, res) || res.count == 0)
+            continue;
+        printf("{\"seq\":%u,\"time_us\":%lld,\"mac\":\"%02X:%02X:%02X:%02X:%02X:%02X\",\"rssi\":%d,",
+               r.seq, (long long)r.timeUs, r.mac[0], r.mac[1], r.mac[2], r.mac[3], r.mac[4],
+               r.mac[5], r.rssi);
+        if (strcmp(res.protocol, "bthome") == 0)
+            printf("\"bthome_version\":%u,", res.version);
+        else
+            printf("\"protocol\":\"%s\",", res.protocol);
+        printf("\"measurements\":[");
+        for (uint8_t i = 0; i < res.count; i++) {
+            const BTHomeValue &v = res.values[i];
+            printf("%s{\"object_id\":%u,\"name\":\"%s\",\"raw\":%lld,\"unit\":\"%s\"}",
+                   i ? "," : "", v.objectID, v.name, (long long)v.raw, v.unit);
+        }
+        printf("]}\n");
+    }
+    return 0;
+}
+
+static int cmdBench(const CaptureFile &cap, DecoderRegistry &registry, int loops) {
+    if (cap.size() == 0) {
+        fprintf(stderr, "empty capture\n");
+        return 1;
+    }
+    uint64_t decoded = 0, values = 0;
+    DecodedAdvert res;
+    auto t0 = std::chrono::steady_clock::now();
+    for (int l = 0; l < loops; l++) {
+        for (const CaptureRecord &r : cap) {
+            RawAdvert adv;
+            adv.hdr = r.header();
+            adv.data = r.data();
+            res.clear();
+            if (registry.decode(adv, res)) {
+                decoded++;
+                values += res.count;
+            }
+        }
+    }
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    uint64_t total = (uint64_t)cap.size() * loops;
+    printf("%llu adverts in %.3f s: %.1f ns/advert, %.2f M adverts/s\n",
+           (unsigned long long)total, secs, secs * 1e9 / total, total / secs / 1e6);
+    printf("decoded %.1f%%, %.2f values per decoded advert\n", 100.0 * decoded / total,
+           decoded ? (double)values / decoded : 0.0);
+    return 0;
+}
+
+static void usage() {
+    fprintf(stderr,
+            "usage: capture pull port[@baud] out.bcap\n"
+            "       capture info|text file.bcap\n"
+            "       capture decode [-k key] file.bcap\n"
+            "       capture bench [-k key] [-n loops] file.bcap\n");
+}
+
+int main(int argc, char **argv) {
+    if (argc < 3) {
+        usage();
+        return 2;
+    }
+    std::string cmd = argv[1];
+    if (cmd == "pull") {
+        if (argc != 4) {
+            usage();
+            return 2;
+        }
+        return cmdPull(argv[2], argv[3]);
+    }
+
+    BTHomeCtx bthome;
+    int loops = 10;
+    const char *path = nullptr;
+    for (int i = 2; i < argc; i++) {
+        std::string a = argv[i];
+        if (a == "-k" && i + 1 < argc) {
+            if (!parseKey(argv[++i], bthome.key)) {
+                fprintf(stderr, "key must be 32 hex characters\n");
+                return 2;
+            }
+            bthome.hasKey = true;
+        } else if (a == "-n" && i + 1 < argc) {
+            loops = atoi(argv[++i]);
+        } else {
+            path = argv[i];
+        }
+    }
+    if (!path || loops <= 0) {
+        usage();
+        return 2;
+    }
+
+    CaptureFile cap;
+    if (!cap.open(path)) {
+        fprintf(stderr, "cannot read capture %s\n", path);
+        return 1;
+    }
+    DecoderRegistry registry;
+    registry.add(DecoderRegistry::SERVICE_DATA_16, 0xFCD2, decodeBTHome, &bthome);
+    registerDeviceDecoders(registry);
+
+    if (cmd == "info")
+        return cmdInfo(cap);
+    if (cmd == "text")
+        return cmdText(cap);
+    if (cmd == "decode")
+        return cmdDecode(cap, registry);
+    if (cmd == "bench")
+        return cmdBench(cap, registry, loops);
+    usage();
+    return 2;
+}
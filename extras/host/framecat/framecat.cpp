@@ -0,0 +1,232 @@
+// Turn a gateway's binary output (BLEScanner::processFrame(), see
+// examples/BTHomeScan/DecodedFrame.h) back into text on Linux/macOS.
+//
+// Reads a serial port, a recorded file or stdin, reassembles the frames,
+// drops corrupt ones and prints one line per advert, either as JSON (the
+// same fields as BLEScanner::process(), one object per line) or as InfluxDB
+// line protocol. Raw advert frames (FORWARD_RAW) are skipped; use the
+// aggregator for those.
+//
+// Build from the repository root (BTHomeDecoder.cpp only supplies the
+// object tables; decryption happened on the gateway):
+//   g++ -std=c++17 -O2 -Iextras/host/shim -Isrc -Iexamples/BTHomeScan
+//       -o framecat extras/host/framecat/framecat.cpp src/BTHomeDecoder.cpp
+//       -lmbedcrypto
+//   ./framecat [-f json|line] [-m measurement] [-b baud] [-s] [input]
+//
+// input is a serial device, a file or - (stdin, the default). -s prints
+// byte and frame counts to stderr at the end.
+
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <string>
+#include <termios.h>
+#include <unistd.h>
+
+#include "DecodedFrame.h"
+
+enum Format { FMT_JSON, FMT_LINE };
+
+static volatile sig_atomic_t s_stop = 0;
+
+static void onSignal(int) {
+    s_stop = 1;
+}
+
+static speed_t baudConstant(long baud) {
+    switch (baud) {
+    case 9600: return B9600;
+    case 57600: return B57600;
+    case 115200: return B115200;
+    case 230400: return B230400;
+    case 460800: return B460800;
+    case 921600: return B921600;
+    default: return 0;
+    }
+}
+
+static int openInput(const char *path, long baud) {
+    if (strcmp(path, "-") == 0)
+        return STDIN_FILENO;
+    int fd = open(path, O_RDONLY | O_NOCTTY);
+    if (fd < 0) {
+        perror(path);
+        return -1;
+    }
+    struct termios tio;
+    if (isatty(fd) && tcgetattr(fd, &tio) == 0) {
+        speed_t speed = baudConstant(baud);
+        if (!speed) {
+            fprintf(stderr, "unsupported baud rate %ld\n", baud);
+            close(fd);
+            return -1;
+        }
+        cfmakeraw(&tio);
+        cfsetispeed(&tio, speed);
+        cfsetospeed(&tio, speed);
+        tcsetattr(fd, TCSANOW, &tio);
+    }
+    return fd;
+}
+
+static void printJsonString(const char *s) {
+    putchar('"');
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\')
+            printf("\\%c", *s);
+        else if ((unsigned char)*s < 0x20)
+            printf("\\u%04x", *s);
+        else
+            putchar(*s);
+    }
+    putchar('"');
+}
+
+static void printJson(const DecodedFrame &f) {
+    const DecodedAdvert &res = f.adv;
+    if (strcmp(res.protocol, "bthome") == 0)
+        printf("{\"bthome_version\":%u,", res.version);
+    else
+        printf("{\"protocol\":\"%s\",", res.protocol);
+    printf("\"measurements\":[");
+    for (uint8_t i = 0; i < res.count; i++) {
+        const BTHomeValue &v = res.values[i];
+        printf("%s{\"object_id\":%u,\"name\":", i ? "," : "", v.objectID);
+        printJsonString(v.name);
+        printf(",\"value\":%g,\"unit\":", v.value);
+        printJsonString(v.unit);
+        putchar('}');
+    }
+    const uint8_t *m = f.mac;
+    printf("],\"mac\":\"%02X:%02X:%02X:%02X:%02X:%02X\",\"time\":%.3f,\"rssi\":%d",
+           m[0], m[1], m[2], m[3], m[4], m[5], f.timeMs / 1000.0, f.rssi);
+    if (f.localName) {
+        printf(",\"name\":");
+        printJsonString(f.localName);
+    }
+    if (f.hasTxPower)
+        printf(",\"txpwr\":%d", f.txPower);
+    printf("}\n");
+}
+
+// Line protocol keys: escape commas, spaces and equals signs.
+static void printLineKey(const char *s) {
+    for (; *s; s++) {
+        if (*s == ',' || *s == ' ' || *s == '=')
+            putchar('\\');
+        putchar(*s);
+    }
+}
+
+static void printLine(const DecodedFrame &f, const char *measurement) {
+    const uint8_t *m = f.mac;
+    printLineKey(measurement);
+    printf(",mac=%02X%02X%02X%02X%02X%02X,protocol=", m[0], m[1], m[2], m[3], m[4], m[5]);
+    printLineKey(f.adv.protocol);
+    if (f.localName && *f.localName) {
+        printf(",name=");
+        printLineKey(f.localName);
+    }
+    printf(" rssi=%di", f.rssi);
+
+    // A name may repeat within an advert (e.g. a device with two
+    // temperature probes): number the repeats so fields stay distinct.
+    for (uint8_t i = 0; i < f.adv.count; i++) {
+        const BTHomeValue &v = f.adv.values[i];
+        int seen = 0;
+        for (uint8_t j = 0; j < i; j++)
+            seen += strcmp(f.adv.values[j].name, v.name) == 0;
+        putchar(',');
+        printLineKey(v.name);
+        if (seen)
+            printf("_%d", seen + 1);
+        if (BTHomeDecoder::getObjectFactor(v.objectID) == 1.0f)
+            printf("=%lldi", (long long)v.raw);
+        else
+            printf("=%g", v.value);
+    }
+
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    printf(" %lld%09ld\n", (long long)ts.tv_sec, ts.tv_nsec);
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "usage: %s [-f json|line] [-m measurement] [-b baud] [-s] [input]\n", prog);
+}
+
+int main(int argc, char **argv) {
+    Format format = FMT_JSON;
+    const char *measurement = "bthome";
+    const char *path = "-";
+    long baud = 115200;
+    bool stats = false;
+
+    for (int i = 1; i < argc; i++) {
+        std::string a = argv[i];
+        if (a == "-f" && i + 1 < argc) {
+            std::string f = argv[++i];
+            if (f == "json") {
+                format = FMT_JSON;
+            } else if (f == "line") {
+                format = FMT_LINE;
+            } else {
+                usage(argv[0]);
+                return 2;
+            }
+        } else if (a == "-m" && i + 1 < argc) {
+            measurement = argv[++i];
+        } else if (a == "-b" && i + 1 < argc) {
+            baud = atol(argv[++i]);
+        } else if (a == "-s") {
+            stats = true;
+        } else if (a[0] == '-' && a != "-") {
+            usage(argv[0]);
+            return 2;
+        } else {
+            path = argv[i];
+        }
+    }
+
+    int fd = openInput(path, baud);
+    if (fd < 0)
+        return 1;
+    signal(SIGINT, onSignal);
+    signal(SIGTERM, onSignal);
+
+    static DecodedFrameReader reader;
+    uint64_t bytes = 0, raw = 0;
+    uint8_t buf[4096];
+    while (!s_stop) {
+        ssize_t r = read(fd, buf, sizeof(buf));
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r <= 0)
+            break;
+        bytes += (uint64_t)r;
+        reader.feed(buf, (size_t)r, [&](const DecodedFrame &f) {
+            if (format == FMT_JSON)
+                printJson(f);
+            else
+                printLine(f, measurement);
+        }, [&](const AdvertHeader &, const uint8_t *) { raw++; });
+        // Interactive use: show each batch of adverts as it arrives
+        fflush(stdout);
+    }
+
+    if (stats) {
+        uint64_t frames = reader.frames() - raw;
+        fprintf(stderr, "%llu bytes, %llu frames (%.1f bytes each), %llu bad, %llu raw skipped\n",
+                (unsigned long long)bytes, (unsigned long long)frames,
+                frames ? (double)bytes / frames : 0.0,
+                (unsigned long long)reader.errors(), (unsigned long long)raw);
+    }
+    if (fd != STDIN_FILENO)
+        close(fd);
+    return 0;
+}
@@ -0,0 +1,365 @@
+// Checks that the per-advert path of a heap-free gateway (see
+// examples/BTHomeScan/Arena.h) never calls malloc once it is running.
+//
+//   heap_check [-n adverts] [-d devices] [-k key] [capture.bcap]
+//
+// Replaces malloc and friends with counting wrappers, builds everything a
+// heap-free BLEScanner builds at startup (WindowAggregator and AdaptiveScan
+// from an Arena over a static buffer, the decoder registry with BTHome and
+// the device decoders, a HistoryStore), warms up, then runs n adverts
+// through decode, AdaptiveScan::observe(), WindowAggregator add/poll/next,
+// HistoryStore::add(), the decoded frame encoding the consumers and
+// forward() use, MacSet lookups and a JsonDocument's allocation pattern on a
+// BufferPool (JsonPool.h). Without a capture the adverts are synthetic BTHome
+// adverts from the given number of devices, every other one encrypted.
+// Prints the allocations seen while counting; the exit status is 1 if there
+// were any.
+//
+// BLEScanner itself needs FreeRTOS and is not built here: this covers the
+// code its tasks run per advert.
+//
+// Build from the repository root:
+//   g++ -std=c++17 -O2 -Iextras/host/shim -Isrc -Iexamples/BTHomeScan
+//       -o heap_check extras/host/heapcheck/heap_check.cpp
+//       examples/BTHomeScan/Arena.cpp examples/BTHomeScan/BufferPool.cpp
+//       examples/BTHomeScan/AdaptiveScan.cpp examples/BTHomeScan/WindowAggregator.cpp
+//       examples/BTHomeScan/HistoryStore.cpp examples/BTHomeScan/CaptureFile.cpp
+//       src/BTHomeDecoder.cpp examples/BTHomeScan/DecoderRegistry.cpp
+//       examples/BTHomeScan/DeviceDecoders.cpp -lmbedcrypto
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include "mbedtls/ccm.h"
+
+#include "AdaptiveScan.h"
+#include "Arena.h"
+#include "BTHomeDecoder.h"
+#include "BufferPool.h"
+#include "CaptureFile.h"
+#include "DecodedFrame.h"
+#include "DecoderRegistry.h"
+#include "DeviceDecoders.h"
+#include "HistoryStore.h"
+#include "MacSet.h"
+#include "WindowAggregator.h"
+
+// ---------------------------------------------------------------------------
+// Counting allocator
+// ---------------------------------------------------------------------------
+extern "C" {
+void *__libc_malloc(size_t);
+void *__libc_calloc(size_t, size_t);
+void *__libc_realloc(void *, size_t);
+void *__libc_memalign(size_t, size_t);
+void __libc_free(void *);
+}
+
+static bool g_counting = false;
+static size_t g_allocs = 0;
+static size_t g_frees = 0;
+
+static void counted() {
+    if (g_counting)
+        g_allocs++;
+}
+
+extern "C" {
+void *malloc(size_t n) {
+    counted();
+    return __libc_malloc(n);
+}
+
+void *calloc(size_t n, size_t size) {
+    counted();
+    return __libc_calloc(n, size);
+}
+
+void *realloc(void *p, size_t n) {
+    counted();
+    return __libc_realloc(p, n);
+}
+
+void *memalign(size_t align, size_t n) {
+    counted();
+    return __libc_memalign(align, n);
+}
+
+void *aligned_alloc(size_t align, size_t n) {
+    counted();
+    return __libc_memalign(align, n);
+}
+
+int posix_memalign(void **out, size_t align, size_t n) {
+    counted();
+    *out = __libc_memalign(align, n);
+    return *out ? 0 : 12;   // ENOMEM
+}
+
+void free(void *p) {
+    if (g_counting && p)
+        g_frees++;
+    __libc_free(p);
+}
+}
+
+// ---------------------------------------------------------------------------
+// Pipeline
+// ---------------------------------------------------------------------------
+struct BTHomeCtx {
+    BTHomeDecoder decoder;
+    uint8_t key[16];
+    bool hasKey = false;
+};
+
+static bool decodeBTHome(const uint8_t *sd, size_t len, const AdvertHeader &hdr,
+                         void *ctx, DecodedAdvert &out) {
+    auto *c = static_cast<BTHomeCtx *>(ctx);
+    return c->decoder.decode(sd, len, hdr.mac, c->hasKey ? c->key : nullptr, out);
+}
+
+static bool parseKey(const char *hex, uint8_t key[16]) {
+    if (strlen(hex) != 32)
+        return false;
+    for (int i = 0; i < 16; i++) {
+        unsigned v;
+        if (sscanf(hex + 2 * i, "%2x", &v) != 1)
+            return false;
+        key[i] = (uint8_t)v;
+    }
+    return true;
+}
+
+// Everything the scanner creates at startup, from one arena
+struct Pipeline {
+    DecoderRegistry registry;
+    BTHomeCtx bthome;
+    AdaptiveScan *adaptive = nullptr;
+    WindowAggregator windows;
+    HistoryStore history;
+    MacSet<128> seen;
+    BufferPool json;
+    uint32_t decoded = 0;
+    uint32_t summaries = 0;
+    uint32_t frames = 0;
+    uint32_t jsonFailures = 0;
+
+    bool begin(Arena &arena, void *jsonBuffer, size_t jsonBytes) {
+        registry.add(DecoderRegistry::SERVICE_DATA_16, 0xFCD2, decodeBTHome, &bthome);
+        registerDeviceDecoders(registry);
+        adaptive = arena.create<AdaptiveScan>(AdaptiveScan::Config(), &arena);
+        WindowAggregator::Config wc;
+        wc.windowMs = 10000;
+        HistoryStore::Config hc;
+        hc.bytes = 1u << 20;
+        json.begin(jsonBuffer, jsonBytes);
+        return adaptive && windows.begin(wc, &arena) && history.begin(hc);
+    }
+
+    // Builds a document the way ArduinoJson v7 does: a slot pool grown as
+    // members are added, copied strings, then a shrink and everything freed
+    void jsonDocument(const DecodedAdvert &res) {
+        void *slots = json.allocate(256);
+        void *name = res.protocol ? json.allocate(strlen(res.protocol) + 1) : nullptr;
+        for (uint8_t i = 0; slots && i < res.count; i += 8)
+            slots = json.reallocate(slots, 256 + 32 * (size_t)(i + 8));
+        if (slots)
+            slots = json.reallocate(slots, 64 + 32 * (size_t)res.count);
+        if (!slots)
+            jsonFailures++;
+        json.deallocate(name);
+        json.deallocate(slots);
+    }
+
+    void advert(const AdvertHeader &hdr, const uint8_t *data) {
+        RawAdvert adv;
+        adv.hdr = hdr;
+        adv.data = data;
+        seen.insert(hdr.mac);
+        adaptive->observe(hdr.mac, hdr.timeUs);
+
+        DecodedAdvert res;
+        res.clear();
+        if (registry.decode(adv, res) && res.count) {
+            decoded++;
+            windows.add(hdr.mac, hdr.timeUs, res);
+            history.add(hdr.mac, hdr.timeUs / 1000, res);
+
+            uint8_t payload[DECODED_FRAME_MAX_PAYLOAD];
+            size_t len = encodeDecodedPayload(hdr, res, FrameExtras(), payload);
+            static DecodedFrame frame;
+            if (decodeDecodedFrame(payload, len, frame))
+                frames++;
+            jsonDocument(res);
+        }
+
+        windows.poll(hdr.timeUs);
+        WindowSummary summary;
+        while (windows.next(summary))
+            summaries++;
+        AdaptiveScan::Window w = adaptive->next(hdr.timeUs);
+        if (w.endUs > w.startUs)
+            adaptive->scanned(w.startUs, w.endUs);
+    }
+};
+
+// ---------------------------------------------------------------------------
+// Synthetic adverts
+// ---------------------------------------------------------------------------
+struct Synthetic {
+    static constexpr int MAX_DEVICES = 256;
+    int devices = 40;
+    mbedtls_ccm_context ccm;
+    uint32_t counter = 0;
+    uint64_t n = 0;
+
+    // AD structures of the next advert, returns their length
+    size_t make(AdvertHeader &hdr, uint8_t *ad) {
+        int dev = (int)(n % (uint64_t)devices);
+        bool encrypted = dev % 2;
+        hdr.timeUs = (int64_t)(n / devices) * 5000000 + dev * 1000 + (int64_t)(n % 7) * 300;
+        uint8_t mac[6] = {0xA4, 0xC1, 0x38, 0x00, 0x00, (uint8_t)dev};
+        memcpy(hdr.mac, mac, 6);
+        hdr.addrType = 0;
+        hdr.rssi = -60 - dev % 30;
+        hdr.flags = 0;
+
+        int16_t temp = (int16_t)(2000 + (n % 50));
+        uint16_t hum = (uint16_t)(4500 + (n % 30));
+        uint8_t obj[] = {0x01, (uint8_t)(90 + dev % 10),
+                         0x02, (uint8_t)temp, (uint8_t)(temp >> 8),
+                         0x03, (uint8_t)hum, (uint8_t)(hum >> 8)};
+        uint8_t advInfo = encrypted ? 0x41 : 0x40;
+
+        size_t i = 0;
+        ad[i++] = 0x02;
+        ad[i++] = 0x01;
+        ad[i++] = 0x06;
+        uint8_t *lenByte = &ad[i++];
+        ad[i++] = 0x16;
+        ad[i++] = 0xD2;
+        ad[i++] = 0xFC;
+        ad[i++] = advInfo;
+        if (encrypted) {
+            uint8_t nonce[13];
+            memcpy(nonce, hdr.mac, 6);
+            nonce[6] = 0xD2;
+            nonce[7] = 0xFC;
+            nonce[8] = advInfo;
+            counter++;
+            memcpy(&nonce[9], &counter, 4);
+            uint8_t *cipher = &ad[i];
+            i += sizeof(obj);
+            memcpy(&ad[i], &counter, 4);
+            i += 4;
+            mbedtls_ccm_encrypt_and_tag(&ccm, sizeof(obj), nonce, sizeof(nonce), nullptr, 0,
+                                        obj, cipher, &ad[i], 4);
+            i += 4;
+        } else {
+            memcpy(&ad[i], obj, sizeof(obj));
+            i += sizeof(obj);
+        }
+        *lenByte = (uint8_t)(&ad[i] - lenByte - 1);
+        hdr.len = (uint8_t)i;
+        n++;
+        return i;
+    }
+};
+
+// ---------------------------------------------------------------------------
+// Check
+// ---------------------------------------------------------------------------
+alignas(16) static uint8_t g_arenaMemory[64 * 1024];
+alignas(8) static uint8_t g_jsonMemory[8 * 1024];
+
+int main(int argc, char **argv) {
+    uint64_t adverts = 200000;
+    int devices = 40;
+    const char *capturePath = nullptr;
+    uint8_t key[16] = {0x23, 0x1d, 0x39, 0xc1, 0xd7, 0xcc, 0x1a, 0xb1,
+                       0xae, 0xe2, 0x24, 0xcd, 0x09, 0x6d, 0xb9, 0x32};
+    for (int i = 1; i < argc; i++) {
+        std::string a = argv[i];
+        if (a == "-n" && i + 1 < argc) {
+            adverts = strtoull(argv[++i], nullptr, 10);
+        } else if (a == "-d" && i + 1 < argc) {
+            devices = atoi(argv[++i]);
+        } else if (a == "-k" && i + 1 < argc) {
+            if (!parseKey(argv[++i], key)) {
+                fprintf(stderr, "bad key\n");
+                return 2;
+            }
+        } else if (a[0] != '-') {
+            capturePath = argv[i];
+        } else {
+            fprintf(stderr, "usage: %s [-n adverts] [-d devices] [-k key] [capture.bcap]\n",
+                    argv[0]);
+            return 2;
+        }
+    }
+    if (devices < 1 || devices > Synthetic::MAX_DEVICES) {
+        fprintf(stderr, "devices must be 1..%d\n", Synthetic::MAX_DEVICES);
+        return 2;
+    }
+
+    // Startup: allocating is fine here
+    Arena arena(g_arenaMemory, sizeof(g_arenaMemory));
+    static Pipeline pipe;
+    if (!pipe.begin(arena, g_jsonMemory, sizeof(g_jsonMemory))) {
+        fprintf(stderr, "setup failed\n");
+        return 2;
+    }
+    memcpy(pipe.bthome.key, key, 16);
+    pipe.bthome.hasKey = true;
+
+    CaptureFile cap;
+    static Synthetic synth;
+    if (capturePath) {
+        if (!cap.open(capturePath)) {
+            fprintf(stderr, "cannot open %s\n", capturePath);
+            return 2;
+        }
+    } else {
+        synth.devices = devices;
+        mbedtls_ccm_init(&synth.ccm);
+        mbedtls_ccm_setkey(&synth.ccm, MBEDTLS_CIPHER_ID_AES, key, 128);
+    }
+
+    uint8_t ad[ADVERT_MAX_DATA];
+    AdvertHeader hdr;
+    auto feed = [&](uint64_t count) {
+        if (capturePath) {
+            for (const CaptureRecord &r : cap)
+                pipe.advert(r.header(), r.data());
+            return;
+        }
+        for (uint64_t i = 0; i < count; i++) {
+            synth.make(hdr, ad);
+            pipe.advert(hdr, ad);
+        }
+    };
+
+    // Warm up: first sighting of every device, first key schedule, first
+    // window and history block
+    feed((uint64_t)devices * 4);
+
+    g_counting = true;
+    feed(adverts);
+    g_counting = false;
+
+    printf("arena: %zu of %zu bytes, %u failed\n", arena.used(), arena.capacity(),
+           (unsigned)arena.failed());
+    BufferPool::Stats js = pipe.json.stats();
+    printf("json pool: %u allocations, %u resets, peak %zu bytes, %u failed\n",
+           (unsigned)js.allocations, (unsigned)js.resets, js.peakBytes,
+           (unsigned)pipe.jsonFailures);
+    printf("adverts: %u decoded, %u frames, %u window summaries\n",
+           (unsigned)pipe.decoded, (unsigned)pipe.frames, (unsigned)pipe.summaries);
+    printf("steady state: %zu allocations, %zu frees\n", g_allocs, g_frees);
+
+    bool ok = g_allocs == 0 && g_frees == 0 && pipe.jsonFailures == 0 && pipe.decoded > 0;
+    printf("%s\n", ok ? "OK" : "FAIL");
+    return ok ? 0 : 1;
+}
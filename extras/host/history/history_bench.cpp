@@ -0,0 +1,296 @@
+// Compression ratio and append/scan throughput of HistoryStore
+// (examples/BTHomeScan/HistoryStore.h), with a round-trip check.
+//
+//   history_bench [-s sensors] [-p periodSec] [-d days] [-b poolBytes] [-r resolutionMs]
+//   history_bench [-b poolBytes] [-r resolutionMs] [-k key] capture.bcap
+//
+// Without a capture, simulates BTHome sensors reporting temperature,
+// humidity, pressure and battery every periodSec (with capture jitter) for
+// the given number of days. With a capture (extras/host/capture), appends
+// every decoded measurement in it. Everything read back is compared with
+// what was appended; the exit status is 1 on a mismatch.
+//
+// Build from the repository root:
+//   g++ -std=c++17 -O2 -Iextras/host/shim -Isrc -Iexamples/BTHomeScan
+//       -o history_bench extras/host/history/history_bench.cpp
+//       examples/BTHomeScan/HistoryStore.cpp examples/BTHomeScan/CaptureFile.cpp
+//       src/BTHomeDecoder.cpp examples/BTHomeScan/DecoderRegistry.cpp
+//       examples/BTHomeScan/DeviceDecoders.cpp -lmbedcrypto
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <queue>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "BTHomeDecoder.h"
+#include "CaptureFile.h"
+#include "DecoderRegistry.h"
+#include "DeviceDecoders.h"
+#include "HistoryStore.h"
+
+struct Point {
+    int64_t timeMs;
+    int64_t raw;
+};
+
+// Everything appended, per series, to check the read-back against
+struct Reference {
+    std::map<uint64_t, std::vector<Point>> series;
+    size_t count = 0;
+
+    static uint64_t key(const uint8_t mac[6], const BTHomeValue &v, uint8_t ordinal) {
+        uint64_t k = 0;
+        for (int i = 0; i < 6; i++)
+            k = k << 8 | mac[i];
+        return k << 16 | (uint64_t)v.objectID << 8 | ordinal;
+    }
+
+    void add(const uint8_t mac[6], int64_t timeMs, const DecodedAdvert &res, uint32_t resMs) {
+        for (uint8_t i = 0; i < res.count; i++) {
+            uint8_t ordinal = 0;
+            for (uint8_t j = 0; j < i; j++)
+                if (res.values[j].objectID == res.values[i].objectID)
+                    ordinal++;
+            int64_t t = timeMs / resMs * resMs;
+            series[key(mac, res.values[i], ordinal)].push_back({t, res.values[i].raw});
+            count++;
+        }
+    }
+};
+
+struct BTHomeCtx {
+    BTHomeDecoder decoder;
+    uint8_t key[16];
+    bool hasKey = false;
+};
+
+static bool decodeBTHome(const uint8_t *sd, size_t len, const AdvertHeader &hdr,
+                         void *ctx, DecodedAdvert &out) {
+    auto *c = static_cast<BTHomeCtx *>(ctx);
+    return c->decoder.decode(sd, len, hdr.mac, c->hasKey ? c->key : nullptr, out);
+}
+
+static bool parseKey(const char *hex, uint8_t key[16]) {
+    if (strlen(hex) != 32)
+        return false;
+    for (int i = 0; i < 16; i++) {
+        unsigned v;
+        if (sscanf(hex + 2 * i, "%2x", &v) != 1)
+            return false;
+        key[i] = (uint8_t)v;
+    }
+    return true;
+}
+
+// ---------------------------------------------------------------------------
+// Inputs
+// ---------------------------------------------------------------------------
+struct Advert {
+    int64_t timeMs;
+    uint8_t mac[6];
+    DecodedAdvert res;
+};
+
+struct Sensor {
+    uint8_t mac[6];
+    int64_t nextMs;
+    int64_t temp, hum, press, batt;
+};
+
+static std::vector<Advert> simulate(int sensors, int periodSec, double days) {
+    std::mt19937 rng(42);
+    std::vector<Sensor> s(sensors);
+    for (int i = 0; i < sensors; i++) {
+        uint8_t mac[6] = {0xA4, 0xC1, 0x38, 0x00, (uint8_t)(i >> 8), (uint8_t)i};
+        memcpy(s[i].mac, mac, 6);
+        s[i].nextMs = rng() % (periodSec * 1000);
+        s[i].temp = 1800 + rng() % 600;     // 0.01 °C
+        s[i].hum = 4000 + rng() % 2000;     // 0.01 %
+        s[i].press = 101300 + rng() % 500;  // 0.01 hPa
+        s[i].batt = 90 + rng() % 10;        // %
+    }
+    auto later = [&](int a, int b) { return s[a].nextMs > s[b].nextMs; };
+    std::priority_queue<int, std::vector<int>, decltype(later)> due(later);
+    for (int i = 0; i < sensors; i++)
+        due.push(i);
+
+    int64_t endMs = (int64_t)(days * 86400e3);
+    std::vector<Advert> out;
+    while (!due.empty()) {
+        int i = due.top();
+        due.pop();
+        Sensor &x = s[i];
+        if (x.nextMs >= endMs)
+            continue;
+        Advert a;
+        a.timeMs = x.nextMs;
+        memcpy(a.mac, x.mac, 6);
+        a.res.clear();
+        a.res.protocol = "bthome";
+        // Readings drift and often repeat between adverts
+        if (rng() % 4 == 0)
+            x.temp += (int)(rng() % 7) - 3;
+        if (rng() % 3 == 0)
+            x.hum += (int)(rng() % 21) - 10;
+        if (rng() % 4 == 0)
+            x.press += (int)(rng() % 5) - 2;
+        if (rng() % 20000 == 0 && x.batt > 0)
+            x.batt--;
+        a.res.add(0x01, x.batt);
+        a.res.add(0x02, x.temp);
+        a.res.add(0x03, x.hum);
+        a.res.add(0x04, x.press);
+        out.push_back(a);
+        // Advertising interval plus the random advDelay and scan latency
+        x.nextMs += periodSec * 1000 + rng() % 40;
+        due.push(i);
+    }
+    return out;
+}
+
+static std::vector<Advert> fromCapture(const char *path, const uint8_t *key) {
+    std::vector<Advert> out;
+    CaptureFile cap;
+    if (!cap.open(path))
+        return out;
+    BTHomeCtx bthome;
+    if (key) {
+        memcpy(bthome.key, key, 16);
+        bthome.hasKey = true;
+    }
+    DecoderRegistry registry;
+    registry.add(DecoderRegistry::SERVICE_DATA_16, 0xFCD2, decodeBTHome, &bthome);
+    registerDeviceDecoders(registry);
+    for (const CaptureRecord &r : cap) {
+        RawAdvert adv;
+        adv.hdr = r.header();
+        adv.data = r.data();
+        Advert a;
+        a.res.clear();
+        if (!registry.decode(adv, a.res) || a.res.count == 0)
+            continue;
+        a.timeMs = r.timeUs / 1000;
+        memcpy(a.mac, r.mac, 6);
+        out.push_back(a);
+    }
+    return out;
+}
+
+// ---------------------------------------------------------------------------
+// Benchmark
+// ---------------------------------------------------------------------------
+int main(int argc, char **argv) {
+    int sensors = 40, periodSec = 10;
+    double days = 2;
+    size_t poolBytes = 64u << 20;
+    uint32_t resolutionMs = 1000;
+    const char *capturePath = nullptr;
+    uint8_t key[16];
+    bool hasKey = false;
+    for (int i = 1; i < argc; i++) {
+        std::string a = argv[i];
+        if (a == "-s" && i + 1 < argc) {
+            sensors = atoi(argv[++i]);
+        } else if (a == "-p" && i + 1 < argc) {
+            periodSec = atoi(argv[++i]);
+        } else if (a == "-d" && i + 1 < argc) {
+            days = atof(argv[++i]);
+        } else if (a == "-b" && i + 1 < argc) {
+            poolBytes = (size_t)atoll(argv[++i]);
+        } else if (a == "-r" && i + 1 < argc) {
+            resolutionMs = (uint32_t)atol(argv[++i]);
+        } else if (a == "-k" && i + 1 < argc) {
+            if (!parseKey(argv[++i], key)) {
+                fprintf(stderr, "key must be 32 hex characters\n");
+                return 2;
+            }
+            hasKey = true;
+        } else if (a[0] != '-') {
+            capturePath = argv[i];
+        } else {
+            fprintf(stderr,
+                    "usage: history_bench [-s sensors] [-p periodSec] [-d days] [-b poolBytes]"
+                    " [-r resolutionMs] [-k key] [capture.bcap]\n");
+            return 2;
+        }
+    }
+    if (sensors <= 0 || periodSec <= 0 || days <= 0 || resolutionMs == 0) {
+        fprintf(stderr, "bad arguments\n");
+        return 2;
+    }
+
+    std::vector<Advert> adverts = capturePath ? fromCapture(capturePath, hasKey ? key : nullptr)
+                                              : simulate(sensors, periodSec, days);
+    if (adverts.empty()) {
+        fprintf(stderr, "nothing to store\n");
+        return 1;
+    }
+
+    HistoryStore::Config cfg;
+    cfg.bytes = poolBytes;
+    cfg.maxSeries = 4096;
+    cfg.resolutionMs = resolutionMs;
+    HistoryStore store;
+    if (!store.begin(cfg)) {
+        fprintf(stderr, "cannot allocate the store\n");
+        return 1;
+    }
+
+    auto t0 = std::chrono::steady_clock::now();
+    for (const Advert &a : adverts)
+        store.add(a.mac, a.timeMs, a.res);
+    double appendSecs = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+    Reference ref;
+    for (const Advert &a : adverts)
+        ref.add(a.mac, a.timeMs, a.res, resolutionMs);
+
+    // Read back: every series must be the tail of what was appended to it
+    t0 = std::chrono::steady_clock::now();
+    HistoryStore::Cursor c = store.read();
+    HistorySample smp;
+    std::map<uint64_t, std::vector<Point>> got;
+    size_t read = 0;
+    while (c.next(smp)) {
+        got[Reference::key(smp.mac, smp.value, smp.ordinal)].push_back(
+            {smp.timeMs, smp.value.raw});
+        read++;
+    }
+    double scanSecs = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+    HistoryStore::Stats st = store.stats();
+    bool ok = read == st.samples && st.samples + st.evicted + st.dropped == ref.count;
+    for (const auto &g : got) {
+        auto it = ref.series.find(g.first);
+        if (it == ref.series.end() || g.second.size() > it->second.size() ||
+                memcmp(g.second.data(), it->second.data() + it->second.size() - g.second.size(),
+                       g.second.size() * sizeof(Point)) != 0) {
+            ok = false;
+            break;
+        }
+    }
+
+    int64_t spanMs = adverts.back().timeMs - adverts.front().timeMs;
+    for (const Advert &a : adverts)
+        if (a.timeMs - adverts.front().timeMs > spanMs)
+            spanMs = a.timeMs - adverts.front().timeMs;
+    printf("adverts     %zu (%s), %u series\n", adverts.size(),
+           capturePath ? capturePath : "simulated", st.series);
+    printf("samples     %u held, %u evicted, %u dropped\n", st.samples, st.evicted, st.dropped);
+    printf("stored      %zu bytes in %u of %u blocks, %.2f bytes/sample\n", st.bytes, st.blocks,
+           st.totalBlocks, st.samples ? (double)st.bytes / st.samples : 0.0);
+    printf("ratio       %.1fx against 16-byte (time, raw) pairs\n",
+           st.bytes ? 16.0 * st.samples / st.bytes : 0.0);
+    if (spanMs > 0 && st.evicted == 0)
+        printf("256 KB      holds %.1f days of this load\n",
+               256.0 * 1024 / (st.blocks * (double)HistoryStore::BLOCK_BYTES) * spanMs / 86400e3);
+    printf("append      %.1f ns/sample\n", appendSecs * 1e9 / ref.count);
+    printf("scan        %.1f ns/sample\n", read ? scanSecs * 1e9 / read : 0.0);
+    printf("round trip  %s\n", ok ? "ok" : "MISMATCH");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,278 @@
+// Compares publishing every advert on its own with PublishSink batching
+// (examples/BTHomeScan/PublishSink.h) for a synthetic set of devices:
+// messages, payload bytes and an estimate of the bytes on the wire.
+//
+//   publish_bench [-d devices] [-b buttons] [-s seconds] [-w batchMs]
+//                 [-m maxBytes] [-t host:port] [-v]
+//
+// Sensors advertise battery, temperature and humidity about once a second,
+// buttons press every few seconds. Both sinks publish into a
+// MemoryTransport; every payload is checked (size, balanced JSON) and every
+// button press must come out of the batched sink. With -t the batched
+// payloads are also published over MQTT (MqttTransport on a TCP socket),
+// e.g. to extras/host/broker, in simulated time, i.e. as fast as possible.
+// -v prints the first batched payloads.
+//
+// Build from the repository root:
+//   g++ -std=c++17 -O2 -Iextras/host/shim -Isrc -Iexamples/BTHomeScan
+//       -o publish_bench extras/host/publish/publish_bench.cpp
+//       examples/BTHomeScan/PublishSink.cpp examples/BTHomeScan/MqttTransport.cpp
+//       examples/BTHomeScan/Arena.cpp
+//
+// The wire estimate adds the MQTT PUBLISH header and 40 bytes of TCP/IP
+// headers per message; Wi-Fi framing and TCP ACKs come on top of that.
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "MqttTransport.h"
+#include "PosixClient.h"
+#include "PublishSink.h"
+
+static constexpr size_t TCPIP_BYTES = 40;
+
+struct Device {
+    uint8_t mac[6];
+    bool button;
+    int64_t nextUs;
+    int64_t periodUs;
+};
+
+// Both a MemoryTransport and, with -t, MQTT
+struct TeeTransport : PublishTransport {
+    PublishTransport *a = nullptr;
+    PublishTransport *b = nullptr;
+    bool publish(const char *topic, const uint8_t *payload, size_t len) override {
+        bool ok = a->publish(topic, payload, len);
+        if (b)
+            b->publish(topic, payload, len);
+        return ok;
+    }
+    void poll() override {
+        if (b)
+            b->poll();
+    }
+};
+
+struct Checked {
+    size_t messages = 0;
+    size_t bytes = 0;
+    size_t wire = 0;
+    size_t largest = 0;
+    size_t bad = 0;
+    size_t presses = 0;     // "button" keys seen
+};
+
+// Braces and brackets balance outside strings, and the payload is one object
+static bool balanced(const uint8_t *p, size_t len) {
+    int depth = 0;
+    bool inString = false;
+    for (size_t i = 0; i < len; i++) {
+        char c = (char)p[i];
+        if (inString) {
+            inString = c != '"';
+            continue;
+        }
+        if (c == '"')
+            inString = true;
+        else if (c == '{' || c == '[')
+            depth++;
+        else if (c == '}' || c == ']')
+            depth--;
+        if (depth < 0 || (depth == 0 && i + 1 < len))
+            return false;
+    }
+    return depth == 0 && !inString;
+}
+
+static size_t count(const uint8_t *p, size_t len, const char *needle) {
+    size_t n = 0, k = strlen(needle);
+    for (size_t i = 0; i + k <= len; i++)
+        if (!memcmp(p + i, needle, k))
+            n++;
+    return n;
+}
+
+static void drain(MemoryTransport &mem, size_t maxBytes, Checked &c, int verbose) {
+    size_t cursor = 0;
+    MemoryTransport::Message m;
+    while (mem.next(cursor, m)) {
+        c.messages++;
+        c.bytes += m.len;
+        // Fixed header, remaining length, topic length and topic
+        size_t remaining = 2 + m.topicLen + m.len;
+        size_t lenBytes = remaining < 128 ? 1 : remaining < 16384 ? 2 : 3;
+        c.wire += 1 + lenBytes + 2 + m.topicLen + m.len + TCPIP_BYTES;
+        if (m.len > c.largest)
+            c.largest = m.len;
+        if (m.len > maxBytes || !balanced(m.payload, m.len))
+            c.bad++;
+        c.presses += count(m.payload, m.len, "\"button");
+        if (verbose > 0 && c.messages <= (size_t)verbose)
+            printf("  %.*s %.*s\n", (int)m.topicLen, m.topic, (int)m.len, (const char *)m.payload);
+    }
+    mem.clear();
+}
+
+static void report(const char *name, const Checked &c, const PublishSink::Stats &st) {
+    printf("%-10s %8zu msgs %10zu payload B %10zu wire B  largest %5zu  coalesced %7u  "
+           "early %5u  failed %u  bad %zu\n",
+           name, c.messages, c.bytes, c.wire, c.largest, (unsigned)st.coalesced,
+           (unsigned)st.early, (unsigned)st.failed, c.bad);
+}
+
+int main(int argc, char **argv) {
+    int devices = 20, buttons = 4, seconds = 600, verbose = 0;
+    uint32_t batchMs = 5000;
+    size_t maxBytes = 4096;
+    std::string target;
+    for (int i = 1; i < argc; i++) {
+        std::string a = argv[i];
+        if (a == "-d" && i + 1 < argc) {
+            devices = atoi(argv[++i]);
+        } else if (a == "-b" && i + 1 < argc) {
+            buttons = atoi(argv[++i]);
+        } else if (a == "-s" && i + 1 < argc) {
+            seconds = atoi(argv[++i]);
+        } else if (a == "-w" && i + 1 < argc) {
+            batchMs = (uint32_t)atoi(argv[++i]);
+        } else if (a == "-m" && i + 1 < argc) {
+            maxBytes = strtoul(argv[++i], nullptr, 10);
+        } else if (a == "-t" && i + 1 < argc) {
+            target = argv[++i];
+        } else if (a == "-v") {
+            verbose = 3;
+        } else {
+            fprintf(stderr, "usage: %s [-d devices] [-b buttons] [-s seconds] [-w batchMs] "
+                            "[-m maxBytes] [-t host:port] [-v]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    std::mt19937 rng(1);
+    std::vector<Device> devs;
+    for (int i = 0; i < devices + buttons; i++) {
+        Device d = {{0xA4, 0xC1, 0x38, 0x00, (uint8_t)(i >> 8), (uint8_t)i}, i >= devices, 0, 0};
+        d.periodUs = d.button ? 0 : 900000 + (int64_t)(rng() % 200000);
+        d.nextUs = (int64_t)(rng() % 1000000);
+        devs.push_back(d);
+    }
+
+    static std::vector<uint8_t> singleMem(1 << 24), batchMem(1 << 24);
+    MemoryTransport single(singleMem.data(), singleMem.size());
+    MemoryTransport batchedMem(batchMem.data(), batchMem.size());
+
+    PosixClient client;
+    MqttTransport mqtt(client);
+    TeeTransport batchedOut;
+    batchedOut.a = &batchedMem;
+    if (!target.empty()) {
+        size_t colon = target.rfind(':');
+        static std::string host = target.substr(0, colon);
+        MqttTransport::Config mc;
+        mc.host = host.c_str();
+        mc.port = colon == std::string::npos ? 1883 : (uint16_t)atoi(target.c_str() + colon + 1);
+        mc.clientId = "publish_bench";
+        if (!mqtt.begin(mc)) {
+            fprintf(stderr, "cannot connect to %s\n", target.c_str());
+            return 1;
+        }
+        for (int i = 0; i < 200 && !mqtt.connected(); i++) {
+            mqtt.poll();
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        if (!mqtt.connected()) {
+            fprintf(stderr, "no CONNACK from %s\n", target.c_str());
+            return 1;
+        }
+        batchedOut.b = &mqtt;
+    }
+
+    PublishSink perAdvert(single), batched(batchedOut);
+    PublishSink::Config cfg;
+    cfg.maxBytes = maxBytes;
+    cfg.maxDelayMs = 0;     // every advert on its own
+    cfg.topic = "bthome/advert";
+    PublishSink::Config batchCfg;
+    batchCfg.maxBytes = maxBytes;
+    batchCfg.maxDelayMs = batchMs;
+    if (!perAdvert.begin(cfg) || !batched.begin(batchCfg)) {
+        fprintf(stderr, "bad config\n");
+        return 2;
+    }
+
+    // Simulated time in 10 ms steps
+    Checked singleCheck, batchCheck;
+    size_t adverts = 0, presses = 0;
+    int64_t lastUs = 0;
+    const int64_t endUs = (int64_t)seconds * 1000000;
+    for (int64_t now = 0; now < endUs; now += 10000) {
+        for (Device &d : devs) {
+            if (d.button) {
+                if (rng() % 400 != 0)   // about every 4 s
+                    continue;
+            } else if (d.nextUs > now) {
+                continue;
+            } else {
+                d.nextUs += d.periodUs;
+            }
+            // Capture times only go forward
+            int64_t t = std::max(lastUs + 1, now + (int64_t)(rng() % 10000));
+            lastUs = t;
+            int8_t rssi = (int8_t)(-50 - (int)(rng() % 40));
+            BTHomeValue v[3];
+            uint8_t n = 0;
+            if (d.button) {
+                v[n++] = {0x3A, 1, 1.0f, "button", ""};
+                presses++;
+            } else {
+                float temp = 20.0f + (float)(rng() % 100) / 10.0f;
+                float hum = 40.0f + (float)(rng() % 200) / 10.0f;
+                v[n++] = {0x01, 95, 95.0f, "battery", "%"};
+                v[n++] = {0x02, (int64_t)(temp * 100), temp, "temperature", "°C"};
+                v[n++] = {0x03, (int64_t)(hum * 100), hum, "humidity", "%"};
+            }
+            for (uint8_t k = 0; k < n; k++) {
+                perAdvert.add(d.mac, t, rssi, v[k]);
+                batched.add(d.mac, t, rssi, v[k]);
+            }
+            adverts++;
+        }
+        perAdvert.poll(now);
+        batched.poll(now);
+        drain(single, maxBytes, singleCheck, 0);
+        drain(batchedMem, maxBytes, batchCheck, verbose);
+    }
+    perAdvert.flush();
+    batched.flush();
+    drain(single, maxBytes, singleCheck, 0);
+    drain(batchedMem, maxBytes, batchCheck, verbose);
+
+    printf("%d sensors, %d buttons, %d s: %zu adverts, %zu button presses\n", devices, buttons,
+           seconds, adverts, presses);
+    report("per-advert", singleCheck, perAdvert.stats());
+    report("batched", batchCheck, batched.stats());
+    if (batchCheck.messages)
+        printf("batching: %.1fx fewer messages, %.1fx fewer wire bytes\n",
+               (double)singleCheck.messages / batchCheck.messages,
+               (double)singleCheck.wire / batchCheck.wire);
+    if (!target.empty()) {
+        MqttTransport::Stats ms = mqtt.stats();
+        mqtt.end();
+        printf("mqtt: %u published, %llu bytes, %u connects\n", (unsigned)ms.published,
+               (unsigned long long)ms.bytes, (unsigned)ms.connects);
+    }
+
+    bool ok = !singleCheck.bad && !batchCheck.bad && batchCheck.presses == presses &&
+              singleCheck.presses == presses;
+    if (!ok)
+        printf("FAILED: %zu/%zu bad payloads, %zu/%zu presses published (of %zu)\n",
+               singleCheck.bad, batchCheck.bad, singleCheck.presses, batchCheck.presses, presses);
+    return ok ? 0 : 1;
+}
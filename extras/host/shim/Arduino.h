@@ -0,0 +1,42 @@
+// Minimal Arduino.h stand-in for building the library sources on Linux/macOS.
+//
+// Only what src/ and the portable parts of examples/BTHomeScan use: String
+// (legacy decode results), Print and the ESP32 log_* macros, which go to
+// stderr when BTHOME_HOST_LOG is defined and compile away otherwise.
+// delay(), millis() and micros() run on the host simulation's virtual clock
+// (HostRtos.cpp); tools that do not link it must not call them.
+
+#pragma once
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include "Print.h"
+
+class String : public std::string {
+public:
+    String() = default;
+    String(const char *s) : std::string(s ? s : "") {}
+    String(const std::string &s) : std::string(s) {}
+    unsigned int length() const { return (unsigned int)size(); }
+};
+
+void delay(uint32_t ms);
+unsigned long millis();
+unsigned long micros();
+
+#ifdef BTHOME_HOST_LOG
+#define log_e(fmt, ...) fprintf(stderr, "[E] " fmt "\n", ##__VA_ARGS__)
+#define log_w(fmt, ...) fprintf(stderr, "[W] " fmt "\n", ##__VA_ARGS__)
+#define log_i(fmt, ...) fprintf(stderr, "[I] " fmt "\n", ##__VA_ARGS__)
+#define log_d(fmt, ...) fprintf(stderr, "[D] " fmt "\n", ##__VA_ARGS__)
+#else
+#define log_e(fmt, ...) do {} while (0)
+#define log_w(fmt, ...) do {} while (0)
+#define log_i(fmt, ...) do {} while (0)
+#define log_d(fmt, ...) do {} while (0)
+#endif
+#define log_v(fmt, ...) do {} while (0)
+#define log_buf_v(buf, len) do {} while (0)
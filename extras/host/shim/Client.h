@@ -0,0 +1,20 @@
+// Client.h stand-in: the Arduino byte-stream client MqttTransport talks
+// through. PosixClient.h implements it over a TCP socket.
+
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+#include "Print.h"
+
+class Client : public Print {
+public:
+    virtual int connect(const char *host, uint16_t port) = 0;
+    using Print::write;
+    virtual int available() = 0;
+    virtual int read() = 0;
+    virtual int read(uint8_t *buf, size_t size) = 0;
+    virtual void flush() {}
+    virtual void stop() = 0;
+    virtual uint8_t connected() = 0;
+};
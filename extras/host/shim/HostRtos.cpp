@@ -0,0 +1,813 @@
+// Single-core, virtual-time FreeRTOS / ESP-IDF stand-in (see HostRtos.h).
+
+#include "HostRtos.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <Arduino.h>
+
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/ringbuf.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+
+// ---------------------------------------------------------------------------
+// Scheduler
+// ---------------------------------------------------------------------------
+
+static constexpr int64_t NEVER = INT64_MAX;
+
+struct WaitList {
+    std::vector<HostTask *> tasks;   ///< In the order they started waiting
+};
+
+struct HostTask {
+    enum State { READY, RUNNING, BLOCKED, DONE };
+
+    std::string name;
+    UBaseType_t priority;
+    uint32_t stackBytes;
+    TaskFunction_t fn;
+    void *arg;
+    std::thread thread;
+    std::condition_variable cv;   ///< Signalled when the task may run
+
+    State state = READY;
+    uint64_t readySeq = 0;        ///< Order among ready tasks of one priority
+    int64_t wakeUs = NEVER;       ///< Timeout while BLOCKED
+    bool timedOut = false;
+    bool killed = false;
+    WaitList *waitingOn = nullptr;
+
+    uint32_t notifyValue = 0;
+    WaitList notifyWait;
+};
+
+// Thrown into a task to unwind it: vTaskDelete() and the end of a run
+struct TaskExit {};
+
+namespace {
+struct Kernel {
+    std::mutex lock;
+    std::condition_variable stopped;
+    std::vector<HostTask *> tasks;
+    HostTask *current = nullptr;
+    HostTask *main = nullptr;
+    int64_t nowUs = 0;
+    uint64_t seq = 0;
+    uint64_t switches = 0;
+    bool stopping = false;
+    bool deadlock = false;
+};
+}  // namespace
+
+static Kernel k;
+static thread_local HostTask *t_self = nullptr;
+
+typedef std::unique_lock<std::mutex> Lock;
+
+static void unwait(HostTask *t) {
+    if (!t->waitingOn)
+        return;
+    std::vector<HostTask *> &v = t->waitingOn->tasks;
+    v.erase(std::find(v.begin(), v.end(), t));
+    t->waitingOn = nullptr;
+}
+
+static void makeReady(HostTask *t) {
+    unwait(t);
+    t->state = HostTask::READY;
+    t->readySeq = k.seq++;
+    t->wakeUs = NEVER;
+}
+
+static void stopAll() {
+    k.stopping = true;
+    for (HostTask *t : k.tasks)
+        t->cv.notify_all();
+    k.stopped.notify_all();
+}
+
+// Highest priority ready task. With none ready, advance the clock to the
+// earliest timeout and time those tasks out. nullptr if nothing can run.
+static HostTask *pickNext() {
+    for (;;) {
+        HostTask *best = nullptr;
+        for (HostTask *t : k.tasks)
+            if (t->state == HostTask::READY &&
+                (!best || t->priority > best->priority ||
+                 (t->priority == best->priority && t->readySeq < best->readySeq)))
+                best = t;
+        if (best)
+            return best;
+
+        int64_t next = NEVER;
+        for (HostTask *t : k.tasks)
+            if (t->state == HostTask::BLOCKED && t->wakeUs < next)
+                next = t->wakeUs;
+        if (next == NEVER)
+            return nullptr;
+        k.nowUs = std::max(k.nowUs, next);
+        for (HostTask *t : k.tasks)
+            if (t->state == HostTask::BLOCKED && t->wakeUs <= k.nowUs) {
+                t->timedOut = true;
+                makeReady(t);
+            }
+    }
+}
+
+// Hand the core to the next task. self has already left RUNNING; unless it
+// is DONE, wait until it is scheduled again.
+static void switchFrom(Lock &lk, HostTask *self) {
+    HostTask *next = pickNext();
+    if (!next) {
+        k.deadlock = true;
+        stopAll();
+    } else {
+        next->state = HostTask::RUNNING;
+        if (next != k.current)
+            k.switches++;
+        k.current = next;
+        next->cv.notify_one();
+    }
+    if (next == self || self->state == HostTask::DONE)
+        return;
+    self->cv.wait(lk, [&] { return k.current == self || k.stopping || self->killed; });
+    if (k.stopping || self->killed)
+        throw TaskExit();
+}
+
+static HostTask *requireTask(const char *what) {
+    if (!t_self) {
+        fprintf(stderr, "HostRtos: %s would block outside a task\n", what);
+        abort();
+    }
+    return t_self;
+}
+
+// Block the calling task on wl (may be nullptr) until woken or deadlineUs.
+// Returns false on timeout.
+static bool block(Lock &lk, WaitList *wl, int64_t deadlineUs, const char *what) {
+    HostTask *self = requireTask(what);
+    self->state = HostTask::BLOCKED;
+    self->wakeUs = deadlineUs;
+    self->timedOut = false;
+    self->waitingOn = wl;
+    if (wl)
+        wl->tasks.push_back(self);
+    switchFrom(lk, self);
+    return !self->timedOut;
+}
+
+// Wake the highest priority waiter, the longest waiting among equals
+static HostTask *wakeOne(WaitList &wl) {
+    if (wl.tasks.empty())
+        return nullptr;
+    HostTask *best = wl.tasks.front();
+    for (HostTask *t : wl.tasks)
+        if (t->priority > best->priority)
+            best = t;
+    makeReady(best);
+    return best;
+}
+
+static HostTask *wakeAll(WaitList &wl) {
+    HostTask *best = nullptr;
+    while (HostTask *t = wakeOne(wl))
+        if (!best)
+            best = t;
+    return best;
+}
+
+// Switch to woken if it outranks the calling task. From an ISR only report
+// that a switch is due.
+static void preemptFor(Lock &lk, HostTask *woken, BaseType_t *isrWoken = nullptr) {
+    HostTask *self = t_self;
+    if (!woken || !self || woken->priority <= self->priority)
+        return;
+    if (isrWoken) {
+        *isrWoken = pdTRUE;
+        return;
+    }
+    self->state = HostTask::READY;
+    self->readySeq = k.seq++;
+    switchFrom(lk, self);
+}
+
+// Like FreeRTOS, a timeout of n ticks ends on the nth tick boundary
+static int64_t tickDeadline(TickType_t ticks) {
+    if (ticks == portMAX_DELAY)
+        return NEVER;
+    return (k.nowUs / 1000 + (int64_t)ticks) * 1000;
+}
+
+static void taskMain(HostTask *t) {
+    t_self = t;
+    {
+        Lock lk(k.lock);
+        t->cv.wait(lk, [&] { return k.current == t || k.stopping || t->killed; });
+        if (k.stopping || t->killed) {
+            t->state = HostTask::DONE;
+            return;
+        }
+    }
+    try {
+        t->fn(t->arg);
+    } catch (TaskExit &) {
+    }
+    Lock lk(k.lock);
+    unwait(t);
+    t->state = HostTask::DONE;
+    if (t == k.main)
+        stopAll();
+    else if (k.current == t && !k.stopping)
+        switchFrom(lk, t);
+}
+
+bool HostRtos::run(const std::function<void()> &fn) {
+    static std::function<void()> s_main;
+    s_main = fn;
+    TaskHandle_t main;
+    xTaskCreate([](void *) { s_main(); }, "loopTask", 8192, nullptr, 1, &main);
+
+    Lock lk(k.lock);
+    k.main = main;
+    k.stopping = false;
+    k.deadlock = false;
+    HostTask *first = pickNext();
+    first->state = HostTask::RUNNING;
+    k.current = first;
+    first->cv.notify_one();
+    k.stopped.wait(lk, [] { return k.stopping; });
+    std::vector<HostTask *> tasks;
+    tasks.swap(k.tasks);
+    lk.unlock();
+
+    for (HostTask *t : tasks)
+        t->thread.join();
+    lk.lock();
+    for (HostTask *t : tasks) {
+        unwait(t);
+        delete t;
+    }
+    k.current = nullptr;
+    k.main = nullptr;
+    return !k.deadlock;
+}
+
+int64_t HostRtos::nowUs() {
+    Lock lk(k.lock);
+    return k.nowUs;
+}
+
+void HostRtos::sleepUntil(int64_t timeUs) {
+    Lock lk(k.lock);
+    if (timeUs > k.nowUs)
+        block(lk, nullptr, timeUs, "sleepUntil()");
+}
+
+void HostRtos::spend(uint32_t us) {
+    Lock lk(k.lock);
+    if (us)
+        block(lk, nullptr, k.nowUs + us, "spend()");
+}
+
+uint64_t HostRtos::switches() {
+    Lock lk(k.lock);
+    return k.switches;
+}
+
+// ---------------------------------------------------------------------------
+// Tasks and time
+// ---------------------------------------------------------------------------
+
+BaseType_t xTaskCreate(TaskFunction_t fn, const char *name, uint32_t stackBytes, void *arg,
+                       UBaseType_t priority, TaskHandle_t *handle) {
+    auto *t = new HostTask;
+    t->name = name ? name : "";
+    t->priority = priority;
+    t->stackBytes = stackBytes;
+    t->fn = fn;
+    t->arg = arg;
+    Lock lk(k.lock);
+    k.tasks.push_back(t);
+    makeReady(t);
+    t->thread = std::thread(taskMain, t);
+    if (handle)
+        *handle = t;
+    preemptFor(lk, t);
+    return pdPASS;
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char *name, uint32_t stackBytes,
+                                   void *arg, UBaseType_t priority, TaskHandle_t *handle,
+                                   BaseType_t) {
+    return xTaskCreate(fn, name, stackBytes, arg, priority, handle);
+}
+
+// The caller's stack and TCB go unused; the task runs on its thread's stack
+TaskHandle_t xTaskCreateStatic(TaskFunction_t fn, const char *name, uint32_t stackBytes,
+                               void *arg, UBaseType_t priority, StackType_t *,
+                               StaticTask_t *) {
+    TaskHandle_t handle = nullptr;
+    xTaskCreate(fn, name, stackBytes, arg, priority, &handle);
+    return handle;
+}
+
+void vTaskDelete(TaskHandle_t task) {
+    if (!task || task == t_self) {
+        requireTask("vTaskDelete(nullptr)");
+        throw TaskExit();
+    }
+    Lock lk(k.lock);
+    unwait(task);
+    task->killed = true;
+    task->state = HostTask::DONE;
+    task->cv.notify_all();
+}
+
+void vTaskDelay(TickType_t ticks) {
+    Lock lk(k.lock);
+    if (ticks == 0) {
+        HostTask *self = requireTask("vTaskDelay()");
+        self->state = HostTask::READY;
+        self->readySeq = k.seq++;
+        switchFrom(lk, self);
+        return;
+    }
+    block(lk, nullptr, tickDeadline(ticks), "vTaskDelay()");
+}
+
+TickType_t xTaskGetTickCount() {
+    return (TickType_t)(HostRtos::nowUs() / 1000);
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle() {
+    return t_self;
+}
+
+TaskHandle_t xTaskGetHandle(const char *name) {
+    Lock lk(k.lock);
+    for (HostTask *t : k.tasks)
+        if (t->state != HostTask::DONE && t->name == name)
+            return t;
+    return nullptr;
+}
+
+char *pcTaskGetName(TaskHandle_t task) {
+    if (!task)
+        task = t_self;
+    return task ? &task->name[0] : nullptr;
+}
+
+UBaseType_t uxTaskPriorityGet(TaskHandle_t task) {
+    if (!task)
+        task = t_self;
+    return task ? task->priority : 0;
+}
+
+// Tasks run on their threads' stacks, so no use of the FreeRTOS-sized
+// stack is seen: it is reported all free.
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task) {
+    if (!task)
+        task = t_self;
+    return task ? task->stackBytes : 0;
+}
+
+void vTaskPrioritySet(TaskHandle_t task, UBaseType_t priority) {
+    Lock lk(k.lock);
+    HostTask *self = t_self;
+    if (!task)
+        task = self;
+    if (!task)
+        return;
+    task->priority = priority;
+    if (task != self) {
+        if (task->state == HostTask::READY)
+            preemptFor(lk, task);
+        return;
+    }
+    // Lowered below a ready task: let it run
+    for (HostTask *t : k.tasks)
+        if (t->state == HostTask::READY && t->priority > priority) {
+            self->state = HostTask::READY;
+            self->readySeq = k.seq++;
+            switchFrom(lk, self);
+            return;
+        }
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task) {
+    Lock lk(k.lock);
+    task->notifyValue++;
+    if (task->waitingOn == &task->notifyWait) {
+        makeReady(task);
+        preemptFor(lk, task);
+    }
+    return pdPASS;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clearOnExit, TickType_t ticks) {
+    Lock lk(k.lock);
+    HostTask *self = requireTask("ulTaskNotifyTake()");
+    if (self->notifyValue == 0 && ticks != 0)
+        block(lk, &self->notifyWait, tickDeadline(ticks), "ulTaskNotifyTake()");
+    uint32_t v = self->notifyValue;
+    if (v)
+        self->notifyValue = clearOnExit ? 0 : v - 1;
+    return v;
+}
+
+int64_t esp_timer_get_time() {
+    return HostRtos::nowUs();
+}
+
+void delay(uint32_t ms) {
+    vTaskDelay(pdMS_TO_TICKS(ms));
+}
+
+unsigned long millis() {
+    return (unsigned long)(HostRtos::nowUs() / 1000);
+}
+
+unsigned long micros() {
+    return (unsigned long)HostRtos::nowUs();
+}
+
+// ---------------------------------------------------------------------------
+// Semaphores
+// ---------------------------------------------------------------------------
+
+struct HostSemaphore {
+    UBaseType_t count;
+    UBaseType_t max;
+    bool mutex;
+    bool isStatic = false;
+    HostTask *holder = nullptr;
+    WaitList waiters;
+
+    HostSemaphore(UBaseType_t count, UBaseType_t max, bool mutex)
+        : count(count), max(max), mutex(mutex) {}
+};
+
+static_assert(sizeof(HostSemaphore) <= sizeof(StaticSemaphore_t),
+              "StaticSemaphore_t too small");
+
+SemaphoreHandle_t xSemaphoreCreateMutex() {
+    return new HostSemaphore(1, 1, true);
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutexStatic(StaticSemaphore_t *buffer) {
+    auto *sem = new (buffer) HostSemaphore(1, 1, true);
+    sem->isStatic = true;
+    return sem;
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary() {
+    return new HostSemaphore(0, 1, false);
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinaryStatic(StaticSemaphore_t *buffer) {
+    auto *sem = new (buffer) HostSemaphore(0, 1, false);
+    sem->isStatic = true;
+    return sem;
+}
+
+SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t max, UBaseType_t initial) {
+    return new HostSemaphore(initial, max, false);
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t sem, TickType_t ticks) {
+    Lock lk(k.lock);
+    if (sem->count > 0) {
+        sem->count--;
+        sem->holder = t_self;
+        return pdTRUE;
+    }
+    if (ticks == 0)
+        return pdFALSE;
+    // A give hands the semaphore straight to the woken waiter
+    if (!block(lk, &sem->waiters, tickDeadline(ticks), "xSemaphoreTake()"))
+        return pdFALSE;
+    sem->holder = t_self;
+    return pdTRUE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t sem) {
+    Lock lk(k.lock);
+    if (sem->mutex && sem->holder != t_self)
+        return pdFALSE;
+    if (HostTask *woken = wakeOne(sem->waiters)) {
+        sem->holder = woken;
+        preemptFor(lk, woken);
+        return pdTRUE;
+    }
+    if (sem->count >= sem->max)
+        return pdFALSE;
+    sem->count++;
+    sem->holder = nullptr;
+    return pdTRUE;
+}
+
+void vSemaphoreDelete(SemaphoreHandle_t sem) {
+    if (!sem)
+        return;
+    if (sem->isStatic)
+        sem->~HostSemaphore();
+    else
+        delete sem;
+}
+
+// ---------------------------------------------------------------------------
+// Queues
+// ---------------------------------------------------------------------------
+
+struct HostQueue {
+    size_t itemSize;
+    size_t length;
+    std::deque<std::vector<uint8_t>> items;
+    WaitList senders;
+    WaitList receivers;
+};
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t itemSize) {
+    auto *q = new HostQueue;
+    q->itemSize = itemSize;
+    q->length = length;
+    return q;
+}
+
+BaseType_t xQueueSend(QueueHandle_t q, const void *item, TickType_t ticks) {
+    Lock lk(k.lock);
+    int64_t deadline = tickDeadline(ticks);
+    while (q->items.size() >= q->length)
+        if (ticks == 0 || !block(lk, &q->senders, deadline, "xQueueSend()"))
+            return pdFALSE;
+    const auto *p = static_cast<const uint8_t *>(item);
+    q->items.emplace_back(p, p + q->itemSize);
+    preemptFor(lk, wakeOne(q->receivers));
+    return pdTRUE;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t q, void *item, TickType_t ticks) {
+    Lock lk(k.lock);
+    int64_t deadline = tickDeadline(ticks);
+    while (q->items.empty())
+        if (ticks == 0 || !block(lk, &q->receivers, deadline, "xQueueReceive()"))
+            return pdFALSE;
+    memcpy(item, q->items.front().data(), q->itemSize);
+    q->items.pop_front();
+    preemptFor(lk, wakeOne(q->senders));
+    return pdTRUE;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t q) {
+    Lock lk(k.lock);
+    return (UBaseType_t)q->items.size();
+}
+
+void vQueueDelete(QueueHandle_t q) {
+    delete q;
+}
+
+// ---------------------------------------------------------------------------
+// No-split ring buffers
+// ---------------------------------------------------------------------------
+
+static constexpr size_t RING_HEADER = 8;
+
+static size_t align4(size_t n) {
+    return (n + 3) & ~(size_t)3;
+}
+
+struct RingItem {
+    size_t start;       ///< Where its space begins (before a wasted tail)
+    size_t offset;      ///< Header position
+    size_t len;
+    bool complete;      ///< Sent, or acquired and completed
+    bool received;
+    bool returned;
+};
+
+struct HostRingbuffer {
+    uint8_t *buf;
+    size_t size;
+    size_t maxItem;
+    bool isStatic = false;
+    size_t writeOffset = 0;
+    std::deque<RingItem> items;   ///< Oldest first
+    WaitList senders;
+    WaitList receivers;
+};
+
+static_assert(sizeof(HostRingbuffer) <= sizeof(StaticRingbuffer_t),
+              "StaticRingbuffer_t too small");
+
+static const size_t NO_SPACE = SIZE_MAX;
+
+// Start of the space in use; with nothing in use, where the next item goes
+static size_t ringTail(const HostRingbuffer *r) {
+    return r->items.empty() ? r->writeOffset : r->items.front().start;
+}
+
+// Header offset an item taking need bytes would be written at
+static size_t placeItem(const HostRingbuffer *r, size_t need) {
+    size_t tail = ringTail(r);
+    if (r->items.empty() || r->writeOffset > tail) {
+        if (r->size - r->writeOffset >= need)
+            return r->writeOffset;
+        return need <= tail ? 0 : NO_SPACE;   // wrap, wasting the end
+    }
+    if (r->writeOffset < tail && tail - r->writeOffset >= need)
+        return r->writeOffset;
+    return NO_SPACE;                          // writeOffset == tail: full
+}
+
+static RingItem *findItem(HostRingbuffer *r, const void *item) {
+    size_t offset = (size_t)((const uint8_t *)item - r->buf) - RING_HEADER;
+    for (RingItem &it : r->items)
+        if (it.offset == offset)
+            return &it;
+    fprintf(stderr, "HostRtos: %p is not an item of ring %p\n", item, (void *)r);
+    abort();
+}
+
+static HostRingbuffer *createRing(size_t size, RingbufferType_t type, HostRingbuffer *r,
+                                  uint8_t *storage) {
+    if (type != RINGBUF_TYPE_NOSPLIT) {
+        fprintf(stderr, "HostRtos: only RINGBUF_TYPE_NOSPLIT is simulated\n");
+        return nullptr;
+    }
+    size = size & ~(size_t)3;
+    r->buf = storage;
+    r->size = size;
+    r->maxItem = align4(size / 2) - RING_HEADER;
+    return r;
+}
+
+RingbufHandle_t xRingbufferCreate(size_t size, RingbufferType_t type) {
+    auto *storage = (uint8_t *)malloc(size);
+    HostRingbuffer *r = createRing(size, type, new HostRingbuffer, storage);
+    if (!r)
+        free(storage);
+    return r;
+}
+
+RingbufHandle_t xRingbufferCreateWithCaps(size_t size, RingbufferType_t type, UBaseType_t) {
+    return xRingbufferCreate(size, type);
+}
+
+RingbufHandle_t xRingbufferCreateStatic(size_t size, RingbufferType_t type, uint8_t *storage,
+                                        StaticRingbuffer_t *buffer) {
+    HostRingbuffer *r = createRing(size, type, new (buffer) HostRingbuffer, storage);
+    if (r)
+        r->isStatic = true;
+    return r;
+}
+
+void vRingbufferDelete(RingbufHandle_t r) {
+    if (!r)
+        return;
+    if (r->isStatic) {
+        r->~HostRingbuffer();
+    } else {
+        free(r->buf);
+        delete r;
+    }
+}
+
+static BaseType_t ringAcquire(Lock &lk, RingbufHandle_t r, void **item, size_t size,
+                              TickType_t ticks) {
+    if (size > r->maxItem)
+        return pdFALSE;
+    size_t need = RING_HEADER + align4(size);
+    int64_t deadline = tickDeadline(ticks);
+    for (;;) {
+        size_t offset = placeItem(r, need);
+        if (offset != NO_SPACE) {
+            r->items.push_back({r->writeOffset, offset, size, false, false, false});
+            r->writeOffset = offset + need == r->size ? 0 : offset + need;
+            *item = r->buf + offset + RING_HEADER;
+            return pdTRUE;
+        }
+        if (ticks == 0 || !block(lk, &r->senders, deadline, "ring buffer send"))
+            return pdFALSE;
+    }
+}
+
+static void ringComplete(Lock &lk, RingbufHandle_t r, void *item, BaseType_t *isrWoken) {
+    findItem(r, item)->complete = true;
+    preemptFor(lk, wakeOne(r->receivers), isrWoken);
+}
+
+BaseType_t xRingbufferSendAcquire(RingbufHandle_t r, void **item, size_t size,
+                                  TickType_t ticks) {
+    Lock lk(k.lock);
+    return ringAcquire(lk, r, item, size, ticks);
+}
+
+BaseType_t xRingbufferSendComplete(RingbufHandle_t r, void *item) {
+    Lock lk(k.lock);
+    ringComplete(lk, r, item, nullptr);
+    return pdTRUE;
+}
+
+BaseType_t xRingbufferSend(RingbufHandle_t r, const void *data, size_t size, TickType_t ticks) {
+    Lock lk(k.lock);
+    void *item;
+    if (!ringAcquire(lk, r, &item, size, ticks))
+        return pdFALSE;
+    memcpy(item, data, size);
+    ringComplete(lk, r, item, nullptr);
+    return pdTRUE;
+}
+
+BaseType_t xRingbufferSendFromISR(RingbufHandle_t r, const void *data, size_t size,
+                                  BaseType_t *woken) {
+    Lock lk(k.lock);
+    void *item;
+    if (!ringAcquire(lk, r, &item, size, 0))
+        return pdFALSE;
+    memcpy(item, data, size);
+    BaseType_t dummy = pdFALSE;
+    ringComplete(lk, r, item, woken ? woken : &dummy);
+    return pdTRUE;
+}
+
+// Items are handed out strictly in order: an incomplete one holds back the
+// rest
+static void *ringReceive(Lock &lk, RingbufHandle_t r, size_t *size, TickType_t ticks) {
+    int64_t deadline = tickDeadline(ticks);
+    for (;;) {
+        for (RingItem &it : r->items) {
+            if (it.received)
+                continue;
+            if (it.complete) {
+                it.received = true;
+                *size = it.len;
+                return r->buf + it.offset + RING_HEADER;
+            }
+            break;
+        }
+        if (ticks == 0 || !block(lk, &r->receivers, deadline, "ring buffer receive"))
+            return nullptr;
+    }
+}
+
+void *xRingbufferReceive(RingbufHandle_t r, size_t *size, TickType_t ticks) {
+    Lock lk(k.lock);
+    return ringReceive(lk, r, size, ticks);
+}
+
+void *xRingbufferReceiveFromISR(RingbufHandle_t r, size_t *size) {
+    Lock lk(k.lock);
+    return ringReceive(lk, r, size, 0);
+}
+
+static void ringReturn(Lock &lk, RingbufHandle_t r, void *item, BaseType_t *isrWoken) {
+    findItem(r, item)->returned = true;
+    while (!r->items.empty() && r->items.front().returned)
+        r->items.pop_front();
+    preemptFor(lk, wakeAll(r->senders), isrWoken);
+}
+
+void vRingbufferReturnItem(RingbufHandle_t r, void *item) {
+    Lock lk(k.lock);
+    ringReturn(lk, r, item, nullptr);
+}
+
+void vRingbufferReturnItemFromISR(RingbufHandle_t r, void *item, BaseType_t *woken) {
+    Lock lk(k.lock);
+    BaseType_t dummy = pdFALSE;
+    ringReturn(lk, r, item, woken ? woken : &dummy);
+}
+
+size_t xRingbufferGetMaxItemSize(RingbufHandle_t r) {
+    return r->maxItem;
+}
+
+// Largest item that could be sent right now, as IDF computes it for no-split
+// buffers
+size_t xRingbufferGetCurFreeSize(RingbufHandle_t r) {
+    Lock lk(k.lock);
+    size_t tail = ringTail(r);
+    size_t free;
+    if (r->items.empty() || r->writeOffset > tail)
+        free = std::max(r->size - r->writeOffset, tail);
+    else
+        free = tail - r->writeOffset;
+    free = free > RING_HEADER ? (free - RING_HEADER) & ~(size_t)3 : 0;
+    return std::min(free, r->maxItem);
+}
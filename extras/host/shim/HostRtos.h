@@ -0,0 +1,62 @@
+// Deterministic FreeRTOS stand-in for running BLEScanner on the host.
+//
+// The shim headers next to this file (freertos/*.h, esp_timer.h, ...)
+// declare the FreeRTOS and ESP-IDF calls the library makes; HostRtos.cpp
+// implements them on a single simulated core:
+//
+//   - every task is a thread, but exactly one of them runs at a time: the
+//     highest priority ready task, first come first served within a
+//     priority. Waking a higher priority task (semaphore give, queue or
+//     ring buffer send, task notification) switches to it at once.
+//   - time is virtual. It stands still while a task runs and jumps to the
+//     next timeout when every task is blocked, so a run takes as long as
+//     the work in it, not as long as the simulated period, and the same
+//     inputs always give the same schedule and the same results.
+//     esp_timer_get_time(), xTaskGetTickCount(), millis() and delay() all
+//     use it; a tick is 1 ms.
+//   - ring buffers keep the IDF no-split layout (see freertos/ringbuf.h),
+//     so queue sizing behaves as it does on the ESP32.
+//
+// Work that takes time on the target is modelled with spend(). A task
+// blocked forever with nothing left to wake it ends the run.
+//
+// @code
+//   HostRtos::run([] {              // becomes "loopTask", priority 1
+//       BLEScanner::instance().begin();
+//       while (millis() < 60000) {
+//           ...
+//       }
+//   });
+// @endcode
+
+#pragma once
+#include <cstdint>
+#include <functional>
+
+namespace HostRtos {
+
+/// Run fn as a task named "loopTask" at priority 1, the way Arduino runs
+/// setup() and loop(), together with every task it creates, until fn
+/// returns. The other tasks are then stopped wherever they are blocked
+/// (their stacks unwind) and run() returns true. Returns false if the run
+/// ended early because every task was blocked without a timeout. One run
+/// at a time; objects created during it stay valid afterwards but their
+/// tasks are gone.
+bool run(const std::function<void()> &fn);
+
+/// Virtual time in microseconds since the first run() started.
+int64_t nowUs();
+
+/// Let us microseconds pass on the calling task, as if it were busy that
+/// long. Other tasks run meanwhile, as they would on the ESP32's other
+/// core or at a higher priority.
+void spend(uint32_t us);
+
+/// Block the calling task until virtual time timeUs (returns at once if
+/// that has passed).
+void sleepUntil(int64_t timeUs);
+
+/// Context switches so far.
+uint64_t switches();
+
+}  // namespace HostRtos
@@ -0,0 +1,109 @@
+// Client over a POSIX TCP socket, for host tools that publish to a broker
+// (extras/host/broker). Non-blocking once connected, like WiFiClient.
+
+#pragma once
+#include <cerrno>
+#include <cstdio>
+
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "Client.h"
+
+class PosixClient : public Client {
+public:
+    ~PosixClient() override { stop(); }
+
+    int connect(const char *host, uint16_t port) override {
+        stop();
+        char service[8];
+        snprintf(service, sizeof(service), "%u", (unsigned)port);
+        addrinfo hints = {}, *res = nullptr;
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        if (getaddrinfo(host, service, &hints, &res) != 0)
+            return 0;
+        for (addrinfo *a = res; a && _fd < 0; a = a->ai_next) {
+            _fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+            if (_fd >= 0 && ::connect(_fd, a->ai_addr, a->ai_addrlen) != 0) {
+                close(_fd);
+                _fd = -1;
+            }
+        }
+        freeaddrinfo(res);
+        if (_fd < 0)
+            return 0;
+        int one = 1;
+        setsockopt(_fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        fcntl(_fd, F_SETFL, fcntl(_fd, F_GETFL) | O_NONBLOCK);
+        return 1;
+    }
+
+    size_t write(uint8_t c) override { return write(&c, 1); }
+
+    size_t write(const uint8_t *buffer, size_t size) override {
+        size_t done = 0;
+        while (_fd >= 0 && done < size) {
+            ssize_t n = send(_fd, buffer + done, size - done, MSG_NOSIGNAL);
+            if (n > 0) {
+                done += (size_t)n;
+            } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                usleep(100);
+            } else {
+                stop();
+            }
+        }
+        return done;
+    }
+
+    int available() override {
+        fill();
+        return (int)(_end - _pos);
+    }
+
+    int read() override {
+        uint8_t c;
+        return read(&c, 1) == 1 ? c : -1;
+    }
+
+    int read(uint8_t *buf, size_t size) override {
+        fill();
+        size_t n = _end - _pos < size ? _end - _pos : size;
+        for (size_t i = 0; i < n; i++)
+            buf[i] = _buf[_pos++];
+        return n ? (int)n : -1;
+    }
+
+    void stop() override {
+        if (_fd >= 0)
+            close(_fd);
+        _fd = -1;
+        _pos = _end = 0;
+    }
+
+    uint8_t connected() override {
+        fill();
+        return _fd >= 0 || _pos < _end;
+    }
+
+private:
+    void fill() {
+        if (_pos < _end || _fd < 0)
+            return;
+        ssize_t n = recv(_fd, _buf, sizeof(_buf), 0);
+        if (n > 0) {
+            _pos = 0;
+            _end = (size_t)n;
+        } else if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+            stop();
+        }
+    }
+
+    int _fd = -1;
+    uint8_t _buf[512];
+    size_t _pos = 0, _end = 0;
+};
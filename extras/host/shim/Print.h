@@ -0,0 +1,22 @@
+// Print.h stand-in: the byte sink processFrame(), forward() and
+// BTHomeTrace::dump() write to.
+
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+class Print {
+public:
+    virtual ~Print() {}
+    virtual size_t write(uint8_t c) = 0;
+    virtual size_t write(const uint8_t *buffer, size_t size) {
+        size_t n = 0;
+        while (size-- && write(*buffer++))
+            n++;
+        return n;
+    }
+    size_t write(const char *s) { return write((const uint8_t *)s, strlen(s)); }
+    size_t print(const char *s) { return write(s); }
+    size_t println(const char *s = "") { return write(s) + write((const uint8_t *)"\r\n", 2); }
+};
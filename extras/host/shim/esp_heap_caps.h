@@ -0,0 +1,22 @@
+// esp_heap_caps.h stand-in: every capability is the host heap.
+
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+
+#define MALLOC_CAP_EXEC (1 << 0)
+#define MALLOC_CAP_32BIT (1 << 1)
+#define MALLOC_CAP_8BIT (1 << 2)
+#define MALLOC_CAP_DMA (1 << 3)
+#define MALLOC_CAP_SPIRAM (1 << 10)
+#define MALLOC_CAP_INTERNAL (1 << 11)
+#define MALLOC_CAP_DEFAULT (1 << 12)
+
+static inline void *heap_caps_malloc(size_t size, uint32_t) { return malloc(size); }
+static inline void *heap_caps_calloc(size_t n, size_t size, uint32_t) { return calloc(n, size); }
+static inline void heap_caps_free(void *p) { free(p); }
+static inline void *heap_caps_aligned_alloc(size_t align, size_t size, uint32_t) {
+    return aligned_alloc(align, (size + align - 1) / align * align);
+}
+static inline size_t heap_caps_get_free_size(uint32_t) { return 4u << 20; }
@@ -0,0 +1,44 @@
+// esp_partition.h stand-in: the host has no flash, so no partition is ever
+// found and AdvertRecorder keeps to its RAM ring.
+
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+typedef int esp_err_t;
+#define ESP_OK 0
+#define ESP_FAIL -1
+
+typedef enum {
+    ESP_PARTITION_TYPE_APP = 0x00,
+    ESP_PARTITION_TYPE_DATA = 0x01,
+} esp_partition_type_t;
+
+typedef enum {
+    ESP_PARTITION_SUBTYPE_ANY = 0xff,
+} esp_partition_subtype_t;
+
+typedef struct {
+    esp_partition_type_t type;
+    esp_partition_subtype_t subtype;
+    uint32_t address;
+    uint32_t size;
+    uint32_t erase_size;
+    char label[17];
+} esp_partition_t;
+
+static inline const esp_partition_t *esp_partition_find_first(esp_partition_type_t,
+                                                              esp_partition_subtype_t,
+                                                              const char *) {
+    return nullptr;
+}
+static inline esp_err_t esp_partition_read(const esp_partition_t *, size_t, void *, size_t) {
+    return ESP_FAIL;
+}
+static inline esp_err_t esp_partition_write(const esp_partition_t *, size_t, const void *,
+                                            size_t) {
+    return ESP_FAIL;
+}
+static inline esp_err_t esp_partition_erase_range(const esp_partition_t *, size_t, size_t) {
+    return ESP_FAIL;
+}
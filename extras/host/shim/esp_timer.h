@@ -0,0 +1,7 @@
+// esp_timer.h stand-in: microseconds on the host simulation's virtual clock
+// (see HostRtos.h), 0 at the start of HostRtos::run().
+
+#pragma once
+#include <cstdint>
+
+int64_t esp_timer_get_time();
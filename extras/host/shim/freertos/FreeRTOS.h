@@ -0,0 +1,51 @@
+// FreeRTOS.h stand-in for the host simulation (see HostRtos.h).
+//
+// Types and macros of the ESP-IDF FreeRTOS port as the library uses them.
+// One tick is one millisecond of virtual time (CONFIG_FREERTOS_HZ=1000).
+
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+#include "esp_idf_version.h"
+
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef uint32_t TickType_t;
+typedef uint8_t StackType_t;
+typedef void (*TaskFunction_t)(void *);
+
+#define pdTRUE 1
+#define pdFALSE 0
+#define pdPASS 1
+#define pdFAIL 0
+#define portMAX_DELAY ((TickType_t)0xffffffffUL)
+#define portTICK_PERIOD_MS 1
+#define configTICK_RATE_HZ 1000
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms))
+#define portNUM_PROCESSORS 1
+
+// One task runs at a time, so critical sections have nothing to exclude
+typedef struct {
+    uint32_t owner;
+} portMUX_TYPE;
+#define portMUX_INITIALIZER_UNLOCKED {0}
+#define portENTER_CRITICAL(mux) ((void)(mux))
+#define portEXIT_CRITICAL(mux) ((void)(mux))
+#define portENTER_CRITICAL_ISR(mux) ((void)(mux))
+#define portEXIT_CRITICAL_ISR(mux) ((void)(mux))
+#define portYIELD_FROM_ISR(woken) ((void)(woken))
+
+// Static control blocks: opaque storage the shim keeps its objects in
+typedef struct {
+    alignas(16) uint8_t storage[256];
+} StaticTask_t;
+typedef struct {
+    alignas(16) uint8_t storage[192];
+} StaticSemaphore_t;
+typedef StaticSemaphore_t StaticQueue_t;
+typedef struct {
+    alignas(16) uint8_t storage[256];
+} StaticRingbuffer_t;
+
+static inline BaseType_t xPortGetCoreID() { return 0; }
@@ -0,0 +1,44 @@
+// ESP-IDF ring buffer API stand-in for the host simulation (see HostRtos.h).
+//
+// Only RINGBUF_TYPE_NOSPLIT, the type the library uses, with the IDF layout:
+// every item takes an 8 byte header plus its length rounded up to 4 bytes,
+// an item that does not fit before the end of the buffer wraps and wastes
+// the tail, items are received strictly in order (an acquired but not yet
+// completed item blocks the ones behind it) and space is only reclaimed
+// once the oldest items have been returned.
+
+#pragma once
+#include "esp_heap_caps.h"
+#include "freertos/FreeRTOS.h"
+
+typedef enum {
+    RINGBUF_TYPE_NOSPLIT = 0,
+    RINGBUF_TYPE_ALLOWSPLIT,
+    RINGBUF_TYPE_BYTEBUF,
+    RINGBUF_TYPE_MAX,
+} RingbufferType_t;
+
+struct HostRingbuffer;
+typedef HostRingbuffer *RingbufHandle_t;
+
+RingbufHandle_t xRingbufferCreate(size_t size, RingbufferType_t type);
+RingbufHandle_t xRingbufferCreateWithCaps(size_t size, RingbufferType_t type, UBaseType_t caps);
+RingbufHandle_t xRingbufferCreateStatic(size_t size, RingbufferType_t type, uint8_t *storage,
+                                        StaticRingbuffer_t *buffer);
+void vRingbufferDelete(RingbufHandle_t ring);
+
+BaseType_t xRingbufferSend(RingbufHandle_t ring, const void *item, size_t size,
+                           TickType_t ticks);
+BaseType_t xRingbufferSendFromISR(RingbufHandle_t ring, const void *item, size_t size,
+                                  BaseType_t *woken);
+BaseType_t xRingbufferSendAcquire(RingbufHandle_t ring, void **item, size_t size,
+                                  TickType_t ticks);
+BaseType_t xRingbufferSendComplete(RingbufHandle_t ring, void *item);
+
+void *xRingbufferReceive(RingbufHandle_t ring, size_t *size, TickType_t ticks);
+void *xRingbufferReceiveFromISR(RingbufHandle_t ring, size_t *size);
+void vRingbufferReturnItem(RingbufHandle_t ring, void *item);
+void vRingbufferReturnItemFromISR(RingbufHandle_t ring, void *item, BaseType_t *woken);
+
+size_t xRingbufferGetMaxItemSize(RingbufHandle_t ring);
+size_t xRingbufferGetCurFreeSize(RingbufHandle_t ring);
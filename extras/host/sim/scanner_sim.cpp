@@ -0,0 +1,707 @@
+// Runs the real BLEScanner (queues, scan task, wake-ups, decoders) on the
+// host's simulated FreeRTOS (extras/host/shim/HostRtos.h) against a
+// synthetic radio, and reports throughput, drops and latency. Time is
+// virtual and the radio is seeded, so a scenario gives the same numbers
+// on every run and every machine: queue sizes, wake policies and consumer
+// cadence can be tried and checked in CI without hardware.
+//
+//   scanner_sim [-d seconds] [-s seed] [-n sensors] [-b buttons] [-a rate]
+//               [-B rate:ms:every] [-q bytes] [-S bytes[:percent]] [-f bytes]
+//               [-w items:ms] [-R ms:bytes[:interval:window]] [-M ms]
+//               [-t scanMs] [-m frame|process|poll] [-c us] [-r baud]
+//               [-p ms] [-x lossPercent] [-l latencyMs]
+//
+// The radio ("btController", priority 23, above everything the scanner
+// creates) hands adverts to BLEScanner's sink like the BLE stack does:
+//   -n  BTHome sensors advertising every 2-10 s, every other one encrypted
+//       (default 40)
+//   -b  BTHome buttons, trigger-based, a press every 5-60 s sent three
+//       times 20 ms apart (default 4)
+//   -a  background adverts per second from 200 phones and beacons that
+//       never decode (default 200)
+//   -B  background storms: rate adverts/s for ms milliseconds every every
+//       seconds (default 3000:500:10; 0:0:0 disables)
+//
+// loop() is the consumer, the way BTHomeScan.ino runs it:
+//   frame    processFrame() to a simulated UART at -r baud (default 115200),
+//            blocking up to 100 ms for data (default)
+//   process  blocking process() with a JsonDocument
+//   poll     non-blocking process(), delay(-p ms) when nothing decoded
+//            (default 10)
+// and spends -c microseconds on every advert it takes off the queue
+// (default 200), standing in for decoding and publishing.
+//
+// The scanner is set up with begin(-q bytes, -t ms) (defaults 2048 and 0,
+// continuous), setFastLane(-f bytes) (default 512), setWakePolicy(-w)
+// (default 1:0) and, with -S, setQueueSpill(bytes, percent) (default 50):
+// the report then adds the overflow ring's peak and moves, and checks that
+// sensor adverts still come out in capture order. -R has loop() call
+// reconfigure() ms into the run to resize the queue to bytes (and, if
+// given, change the scan interval and window, in ms); the report then adds
+// how long that took. -M scans actively:
+// sensors and half the background devices become scannable and answer each
+// advert with a scan response carrying their name 1-3 ms later, and ms > 0
+// merges the two with setScanResponseMerge(ms); the report then adds what
+// was merged. The report covers every admission class (AdvertQueue.h):
+// adverts offered, queued, refused and evicted, capture-to-dequeue latency,
+// the time each task spent in the scanner's work (Stats::tasks; stack
+// headroom is not visible on the host, and since the virtual clock only
+// moves while a task sleeps, work that never blocks, such as the radio
+// callback and the scan task, shows as 0.0 ms), and a digest of everything the
+// consumer produced to compare runs. With -x the exit status is 1 if more
+// than that percentage of trigger and known-device adverts was lost; with
+// -l, if their worst latency exceeded that many milliseconds.
+//
+// Build from the repository root, with ArduinoJson 7 (e.g. from
+// .pio/libdeps/esp32dev/ArduinoJson after a PlatformIO build):
+//   g++ -std=c++17 -O2 -DBTHOME_HOST_RTOS -Iextras/host/shim -Isrc
+//       -Iexamples/BTHomeScan -I<ArduinoJson>/src
+//       -o scanner_sim extras/host/sim/scanner_sim.cpp extras/host/shim/HostRtos.cpp
+//       examples/BTHomeScan/BLEScanner.cpp examples/BTHomeScan/AdvertQueue.cpp
+//       examples/BTHomeScan/AdvertRecorder.cpp examples/BTHomeScan/AdaptiveScan.cpp
+//       examples/BTHomeScan/Arena.cpp examples/BTHomeScan/HistoryStore.cpp
+//       examples/BTHomeScan/StateStore.cpp examples/BTHomeScan/WindowAggregator.cpp
+//       examples/BTHomeScan/Subscription.cpp examples/BTHomeScan/DecoderRegistry.cpp
+//       examples/BTHomeScan/DeviceDecoders.cpp examples/BTHomeScan/HostReplaySource.cpp
+//       examples/BTHomeScan/CaptureFile.cpp examples/BTHomeScan/ScanResponseMerger.cpp
+//       src/BTHomeDecoder.cpp
+//       -lmbedcrypto -lpthread
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <Arduino.h>
+
+#include "mbedtls/ccm.h"
+
+#include "HostRtos.h"
+#include "freertos/task.h"
+
+#include "AdvertSource.h"
+#include "BLEScanner.h"
+
+#ifndef BTHOME_HOST_RTOS
+#error "build with -DBTHOME_HOST_RTOS"
+#endif
+
+static const uint8_t KEY[16] = {0x23, 0x1d, 0x39, 0xc1, 0xd7, 0xcc, 0x1a, 0xb1,
+                                0xae, 0xe2, 0x24, 0xcd, 0x09, 0x6d, 0xb9, 0x32};
+
+struct Options {
+    uint32_t seconds = 60;
+    uint64_t seed = 1;
+    uint32_t sensors = 40;
+    uint32_t buttons = 4;
+    uint32_t background = 200;
+    uint32_t stormRate = 3000, stormMs = 500, stormEvery = 10;
+    size_t queueBytes = 2048;
+    size_t spillBytes = 0;
+    uint32_t spillPercent = 50;
+    size_t fastLane = 512;
+    uint16_t wakeItems = 1;
+    uint32_t wakeMs = 0;
+    uint32_t scanMs = 0;
+    uint32_t reconfigMs = 0;
+    size_t reconfigBytes = 0;
+    uint32_t reconfigInterval = 0, reconfigWindow = 0;
+    int32_t mergeMs = -1;     ///< -1: passive scan
+    std::string mode = "frame";
+    uint32_t costUs = 200;
+    uint32_t baud = 115200;
+    uint32_t pollMs = 10;
+    double maxLoss = -1;
+    double maxLatencyMs = -1;
+};
+
+// splitmix64: small, seedable and the same everywhere
+class Rng {
+public:
+    explicit Rng(uint64_t seed) : _s(seed) {}
+    uint64_t next() {
+        uint64_t z = (_s += 0x9E3779B97F4A7C15ull);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+        return z ^ (z >> 31);
+    }
+    uint32_t below(uint32_t n) { return n ? (uint32_t)(next() % n) : 0; }
+
+private:
+    uint64_t _s;
+};
+
+static uint64_t fnv(uint64_t h, const void *data, size_t len) {
+    const auto *p = static_cast<const uint8_t *>(data);
+    for (size_t i = 0; i < len; i++) {
+        h ^= p[i];
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+// ---------------------------------------------------------------------------
+// Radio
+// ---------------------------------------------------------------------------
+enum DeviceKind : uint8_t { SENSOR, BUTTON, BACKGROUND, KINDS };
+static const char *const KIND_NAMES[KINDS] = {"sensor", "button", "background"};
+
+struct Device {
+    uint8_t mac[6];
+    DeviceKind kind;
+    bool encrypted;
+    bool scannable;
+    uint32_t counter;
+    uint8_t packetId;
+};
+
+struct Emission {
+    int64_t timeUs;
+    uint32_t device;
+    bool response;      ///< The scan response to the device's advert
+};
+
+class SimRadio : public AdvertSource {
+public:
+    SimRadio(const Options &opt);
+
+    bool init(const ScanParams &params, AdvertSink *sink) override;
+    bool setParams(const ScanParams &) override {
+        paramChanges++;
+        return true;
+    }
+    bool start(uint32_t durationMs, EndCallback onEnd, void *arg) override;
+    void stop() override { _scanning = false; }
+    const char *name() const override { return "sim-radio"; }
+
+    uint32_t offered[KINDS] = {};   ///< Handed to the sink
+    uint32_t responses = 0;         ///< Scan responses handed to the sink
+    uint32_t missed = 0;            ///< Sent while not scanning
+    uint32_t paramChanges = 0;      ///< setParams() calls
+
+private:
+    static void task(void *arg);
+    void run();
+    void build(Device &d, RawAdvert &adv);
+    void buildResponse(const Device &d, RawAdvert &adv);
+
+    std::vector<Device> _devices;
+    std::vector<Emission> _schedule;
+    mbedtls_ccm_context _ccm;
+    uint8_t _buf[ADVERT_MAX_DATA];
+
+    AdvertSink *_sink = nullptr;
+    TaskHandle_t _task = nullptr;
+    bool _scanning = false;
+    int64_t _endUs = 0;
+    EndCallback _onEnd = nullptr;
+    void *_onEndArg = nullptr;
+};
+
+SimRadio::SimRadio(const Options &opt) {
+    Rng rng(opt.seed);
+    int64_t endUs = (int64_t)opt.seconds * 1000000;
+    auto add = [&](DeviceKind kind, uint32_t index) {
+        Device d = {};
+        d.kind = kind;
+        d.mac[0] = kind == BACKGROUND ? (uint8_t)(0xC0 | rng.below(64)) : 0xA4;
+        d.mac[1] = kind == BACKGROUND ? (uint8_t)rng.below(256) : 0xC1;
+        d.mac[2] = kind == BACKGROUND ? (uint8_t)rng.below(256) : 0x38;
+        d.mac[3] = (uint8_t)kind;
+        d.mac[4] = (uint8_t)(index >> 8);
+        d.mac[5] = (uint8_t)index;
+        d.encrypted = kind == SENSOR && index % 2;
+        d.scannable = opt.mergeMs >= 0 && (kind == SENSOR || (kind == BACKGROUND && index % 2));
+        _devices.push_back(d);
+        return (uint32_t)_devices.size() - 1;
+    };
+
+    for (uint32_t i = 0; i < opt.sensors; i++) {
+        uint32_t dev = add(SENSOR, i);
+        int64_t period = 2000000 + rng.below(8000001);
+        for (int64_t t = rng.below((uint32_t)period); t < endUs; t += period)
+            _schedule.push_back({t, dev, false});
+    }
+    for (uint32_t i = 0; i < opt.buttons; i++) {
+        uint32_t dev = add(BUTTON, i);
+        for (int64_t t = rng.below(5000000); t < endUs; t += 5000000 + rng.below(55000001))
+            for (int rep = 0; rep < 3; rep++)
+                _schedule.push_back({t + rep * 20000, dev, false});
+    }
+    const uint32_t PHONES = 200;
+    uint32_t first = (uint32_t)_devices.size();
+    for (uint32_t i = 0; i < PHONES; i++)
+        add(BACKGROUND, i);
+    auto noise = [&](int64_t from, int64_t to, uint32_t rate) {
+        if (!rate)
+            return;
+        uint32_t gap = 1000000 / rate;
+        for (int64_t t = from + rng.below(gap + 1); t < to; t += 1 + rng.below(2 * gap))
+            _schedule.push_back({t, first + rng.below(PHONES), false});
+    };
+    noise(0, endUs, opt.background);
+    if (opt.stormEvery)
+        for (int64_t t = (int64_t)opt.stormEvery * 1000000; t < endUs;
+             t += (int64_t)opt.stormEvery * 1000000)
+            noise(t, std::min(endUs, t + (int64_t)opt.stormMs * 1000), opt.stormRate);
+
+    // Scan responses follow their advert after 1-3 ms, fixed per device so
+    // the other draws stay the same with and without -M
+    size_t adverts = _schedule.size();
+    for (size_t i = 0; i < adverts; i++) {
+        const Device &d = _devices[_schedule[i].device];
+        if (d.scannable && _schedule[i].timeUs + 3000 < endUs)
+            _schedule.push_back({_schedule[i].timeUs + 1000 + d.mac[5] % 3 * 1000,
+                                 _schedule[i].device, true});
+    }
+
+    std::stable_sort(_schedule.begin(), _schedule.end(),
+                     [](const Emission &a, const Emission &b) { return a.timeUs < b.timeUs; });
+
+    mbedtls_ccm_init(&_ccm);
+    mbedtls_ccm_setkey(&_ccm, MBEDTLS_CIPHER_ID_AES, KEY, 128);
+}
+
+bool SimRadio::init(const ScanParams &, AdvertSink *sink) {
+    _sink = sink;
+    return xTaskCreate(task, "btController", 4096, this, 23, &_task) == pdPASS;
+}
+
+bool SimRadio::start(uint32_t durationMs, EndCallback onEnd, void *arg) {
+    _onEnd = onEnd;
+    _onEndArg = arg;
+    _endUs = durationMs ? HostRtos::nowUs() + (int64_t)durationMs * 1000 : 0;
+    _scanning = true;
+    return true;
+}
+
+void SimRadio::task(void *arg) {
+    static_cast<SimRadio *>(arg)->run();
+    vTaskDelete(nullptr);
+}
+
+void SimRadio::run() {
+    size_t i = 0;
+    while (i < _schedule.size()) {
+        const Emission &e = _schedule[i];
+        if (_scanning && _endUs && _endUs <= e.timeUs) {
+            // A timed scan ends before the next advert
+            HostRtos::sleepUntil(_endUs);
+            if (_scanning && _endUs && _endUs <= HostRtos::nowUs()) {
+                _scanning = false;
+                _endUs = 0;
+                if (_onEnd)
+                    _onEnd(_onEndArg);
+            }
+            continue;
+        }
+        HostRtos::sleepUntil(e.timeUs);
+        i++;
+        Device &d = _devices[e.device];
+        if (!_scanning) {
+            if (!e.response)
+                missed++;
+            continue;
+        }
+        RawAdvert adv;
+        if (e.response) {
+            buildResponse(d, adv);
+            responses++;
+        } else {
+            build(d, adv);
+            offered[d.kind]++;
+        }
+        _sink->onAdvert(adv);
+    }
+}
+
+void SimRadio::build(Device &d, RawAdvert &adv) {
+    memcpy(adv.hdr.mac, d.mac, 6);
+    adv.hdr.timeUs = HostRtos::nowUs();
+    adv.hdr.addrType = d.kind == BACKGROUND ? 1 : 0;
+    adv.hdr.rssi = (int8_t)(-50 - d.mac[5] % 40);
+    adv.hdr.flags = d.scannable ? ADV_FLAG_SCANNABLE : 0;
+    adv.data = _buf;
+
+    uint8_t *ad = _buf;
+    size_t i = 0;
+    ad[i++] = 2;    // flags
+    ad[i++] = 0x01;
+    ad[i++] = 0x06;
+    if (d.kind == BACKGROUND) {
+        // Apple-style manufacturer data, as phones and trackers send
+        ad[i++] = 26;
+        ad[i++] = 0xFF;
+        ad[i++] = 0x4C;
+        ad[i++] = 0x00;
+        for (int k = 0; k < 23; k++)
+            ad[i++] = (uint8_t)(d.mac[5] * 31 + k);
+        adv.hdr.len = (uint8_t)i;
+        return;
+    }
+
+    uint8_t obj[16];
+    size_t n = 0;
+    uint8_t advInfo = 0x40;
+    if (d.kind == BUTTON) {
+        advInfo |= 0x04;   // trigger based
+        obj[n++] = 0x00;   // packet id
+        obj[n++] = ++d.packetId;
+        obj[n++] = 0x3A;   // button: press
+        obj[n++] = 0x01;
+    } else {
+        d.packetId++;
+        int16_t temp = (int16_t)(1800 + (d.mac[5] * 37 + d.packetId) % 700);
+        uint16_t hum = (uint16_t)(3500 + (d.mac[5] * 53 + d.packetId) % 3000);
+        obj[n++] = 0x01;
+        obj[n++] = (uint8_t)(60 + d.mac[5] % 40);
+        obj[n++] = 0x02;
+        obj[n++] = (uint8_t)temp;
+        obj[n++] = (uint8_t)(temp >> 8);
+        obj[n++] = 0x03;
+        obj[n++] = (uint8_t)hum;
+        obj[n++] = (uint8_t)(hum >> 8);
+    }
+    if (d.encrypted)
+        advInfo |= 0x01;
+
+    size_t lenAt = i;
+    ad[i++] = 0;    // length, set below
+    ad[i++] = 0x16;
+    ad[i++] = 0xD2;
+    ad[i++] = 0xFC;
+    ad[i++] = advInfo;
+    if (d.encrypted) {
+        uint8_t nonce[13];
+        memcpy(nonce, d.mac, 6);
+        nonce[6] = 0xD2;
+        nonce[7] = 0xFC;
+        nonce[8] = advInfo;
+        d.counter++;
+        memcpy(&nonce[9], &d.counter, 4);
+        mbedtls_ccm_encrypt_and_tag(&_ccm, n, nonce, sizeof(nonce), nullptr, 0, obj, &ad[i],
+                                    &ad[i + n + 4], 4);
+        i += n;
+        memcpy(&ad[i], &d.counter, 4);
+        i += 8;
+    } else {
+        memcpy(&ad[i], obj, n);
+        i += n;
+    }
+    ad[lenAt] = (uint8_t)(i - lenAt - 1);
+    adv.hdr.len = (uint8_t)i;
+}
+
+// A complete local name, as scan responses usually carry
+void SimRadio::buildResponse(const Device &d, RawAdvert &adv) {
+    memcpy(adv.hdr.mac, d.mac, 6);
+    adv.hdr.timeUs = HostRtos::nowUs();
+    adv.hdr.addrType = d.kind == BACKGROUND ? 1 : 0;
+    adv.hdr.rssi = (int8_t)(-50 - d.mac[5] % 40);
+    adv.hdr.flags = ADV_FLAG_SCAN_RSP;
+    adv.data = _buf;
+    int n = snprintf((char *)_buf + 2, sizeof(_buf) - 2, "%s-%02X%02X",
+                     d.kind == SENSOR ? "SBHT" : "Phone", d.mac[4], d.mac[5]);
+    _buf[0] = (uint8_t)(n + 1);
+    _buf[1] = 0x09;
+    adv.hdr.len = (uint8_t)(n + 2);
+}
+
+// ---------------------------------------------------------------------------
+// Consumer
+// ---------------------------------------------------------------------------
+
+// A UART: writing blocks for the time the bytes take on the wire
+class SimSerial : public Print {
+public:
+    explicit SimSerial(uint32_t baud) : _baud(baud) {}
+
+    size_t write(uint8_t c) override { return write(&c, 1); }
+    size_t write(const uint8_t *data, size_t len) override {
+        digest = fnv(digest, data, len);
+        bytes += len;
+        HostRtos::spend((uint32_t)((uint64_t)len * 10 * 1000000 / _baud));
+        return len;
+    }
+
+    uint64_t digest = 14695981039346656037ull;
+    uint64_t bytes = 0;
+
+private:
+    uint32_t _baud;
+};
+
+struct Result {
+    BLEScanner::Stats stats;
+    uint32_t outputs = 0;
+    uint64_t digest = 14695981039346656037ull;
+    uint64_t serialBytes = 0;
+    int64_t endUs = 0;
+    int64_t lastSensorUs = 0;
+    uint32_t reordered = 0;     // sensor adverts taken before an older one
+    bool reconfigured = false;
+};
+
+// Sensor temperatures arrive through the main queue only, in capture order
+static void onTemperature(const SubscribedValue &v, void *ctx) {
+    auto *res = static_cast<Result *>(ctx);
+    if (v.timeUs < res->lastSensorUs)
+        res->reordered++;
+    else
+        res->lastSensorUs = v.timeUs;
+}
+
+static void consume(const Options &opt, SimRadio &radio, Result &res) {
+    BLEScanner &scanner = BLEScanner::instance();
+    scanner.setAdvertSource(&radio);
+    scanner.setBTHomeKey("231d39c1d7cc1ab1aee224cd096db932");
+    scanner.setFastLane(opt.fastLane);
+    scanner.setWakePolicy(opt.wakeItems, opt.wakeMs);
+    if (opt.spillBytes)
+        scanner.setQueueSpill(opt.spillBytes, (uint8_t)opt.spillPercent);
+    if (opt.mergeMs >= 0) {
+        scanner.setActiveScan(true);
+        scanner.setScanResponseMerge((uint32_t)opt.mergeMs);
+    }
+    SubscriptionFilter temperatures;
+    scanner.subscribe(temperatures.object(0x02), onTemperature, &res);
+    scanner.begin(opt.queueBytes, opt.scanMs);
+
+    SimSerial serial(opt.baud);
+    JsonDocument doc;
+    char mac[16];
+    uint32_t taken = 0;
+    // One second past the last advert to drain the queue
+    int64_t endUs = ((int64_t)opt.seconds + 1) * 1000000;
+    while (HostRtos::nowUs() < endUs) {
+        if (opt.reconfigMs && !res.reconfigured &&
+                HostRtos::nowUs() >= (int64_t)opt.reconfigMs * 1000) {
+            BLEScanner::RuntimeConfig config;
+            config.ringBufSize = opt.reconfigBytes;
+            config.scanInterval = (uint16_t)opt.reconfigInterval;
+            config.scanWindow = (uint16_t)opt.reconfigWindow;
+            res.reconfigured = scanner.reconfigure(config);
+        }
+        bool out;
+        if (opt.mode == "frame") {
+            out = scanner.processFrame(serial, 100);
+        } else if (opt.mode == "process") {
+            out = scanner.process(doc, mac, sizeof(mac), 100);
+        } else {
+            out = scanner.process(doc, mac, sizeof(mac));
+        }
+        if (out) {
+            res.outputs++;
+            if (opt.mode != "frame")
+                res.digest = fnv(res.digest, mac, strlen(mac));
+        }
+        uint32_t received = scanner.stats().received;
+        HostRtos::spend((received - taken) * opt.costUs);
+        taken = received;
+        if (!out && opt.mode == "poll")
+            delay(opt.pollMs);
+    }
+    res.stats = scanner.stats();
+    res.endUs = HostRtos::nowUs();
+    if (opt.mode == "frame") {
+        res.digest = serial.digest;
+        res.serialBytes = serial.bytes;
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Report
+// ---------------------------------------------------------------------------
+static bool parsePair(const char *s, uint32_t &a, uint32_t &b) {
+    return sscanf(s, "%u:%u", &a, &b) == 2;
+}
+
+static void usage(const char *argv0) {
+    fprintf(stderr,
+            "usage: %s [-d seconds] [-s seed] [-n sensors] [-b buttons] [-a rate]\n"
+            "          [-B rate:ms:every] [-q bytes] [-S bytes[:percent]] [-f bytes]\n"
+            "          [-w items:ms] [-R ms:bytes[:interval:window]] [-M ms]\n"
+            "          [-t scanMs] [-m frame|process|poll] [-c us] [-r baud] [-p ms]\n"
+            "          [-x lossPercent] [-l latencyMs]\n",
+            argv0);
+}
+
+int main(int argc, char **argv) {
+    Options opt;
+    for (int i = 1; i < argc; i++) {
+        std::string a = argv[i];
+        const char *v = i + 1 < argc ? argv[i + 1] : nullptr;
+        bool ok = v != nullptr;
+        if (!ok) {
+        } else if (a == "-d") {
+            opt.seconds = (uint32_t)strtoul(v, nullptr, 10);
+        } else if (a == "-s") {
+            opt.seed = strtoull(v, nullptr, 10);
+        } else if (a == "-n") {
+            opt.sensors = (uint32_t)strtoul(v, nullptr, 10);
+        } else if (a == "-b") {
+            opt.buttons = (uint32_t)strtoul(v, nullptr, 10);
+        } else if (a == "-a") {
+            opt.background = (uint32_t)strtoul(v, nullptr, 10);
+        } else if (a == "-B") {
+            ok = sscanf(v, "%u:%u:%u", &opt.stormRate, &opt.stormMs, &opt.stormEvery) == 3;
+        } else if (a == "-q") {
+            opt.queueBytes = strtoul(v, nullptr, 10);
+        } else if (a == "-S") {
+            int n = sscanf(v, "%zu:%u", &opt.spillBytes, &opt.spillPercent);
+            ok = n >= 1 && opt.spillPercent > 0 && opt.spillPercent <= 100;
+        } else if (a == "-f") {
+            opt.fastLane = strtoul(v, nullptr, 10);
+        } else if (a == "-w") {
+            uint32_t items;
+            ok = parsePair(v, items, opt.wakeMs);
+            opt.wakeItems = (uint16_t)items;
+        } else if (a == "-R") {
+            int n = sscanf(v, "%u:%zu:%u:%u", &opt.reconfigMs, &opt.reconfigBytes,
+                           &opt.reconfigInterval, &opt.reconfigWindow);
+            ok = (n == 2 || n == 4) && opt.reconfigMs > 0;
+        } else if (a == "-M") {
+            opt.mergeMs = atoi(v);
+            ok = opt.mergeMs >= 0;
+        } else if (a == "-t") {
+            opt.scanMs = (uint32_t)strtoul(v, nullptr, 10);
+        } else if (a == "-m") {
+            opt.mode = v;
+            ok = opt.mode == "frame" || opt.mode == "process" || opt.mode == "poll";
+        } else if (a == "-c") {
+            opt.costUs = (uint32_t)strtoul(v, nullptr, 10);
+        } else if (a == "-r") {
+            opt.baud = (uint32_t)strtoul(v, nullptr, 10);
+            ok = opt.baud > 0;
+        } else if (a == "-p") {
+            opt.pollMs = (uint32_t)strtoul(v, nullptr, 10);
+        } else if (a == "-x") {
+            opt.maxLoss = atof(v);
+        } else if (a == "-l") {
+            opt.maxLatencyMs = atof(v);
+        } else {
+            ok = false;
+        }
+        if (!ok) {
+            usage(argv[0]);
+            return 2;
+        }
+        i++;
+    }
+
+    SimRadio radio(opt);
+    Result res;
+    bool finished = HostRtos::run([&] { consume(opt, radio, res); });
+    if (!finished) {
+        fprintf(stderr, "simulation stalled: every task blocked for good at %.3f s\n",
+                HostRtos::nowUs() / 1e6);
+        return 1;
+    }
+
+    const BLEScanner::Stats &s = res.stats;
+    double secs = opt.seconds ? opt.seconds : 1;
+    uint32_t offered = 0;
+    for (uint32_t n : radio.offered)
+        offered += n;
+
+    std::string spill;
+    if (opt.spillBytes)
+        spill = " + " + std::to_string(opt.spillBytes) + " B spill at " +
+                std::to_string(opt.spillPercent) + "%";
+    printf("scenario: %u s, seed %" PRIu64 ", %u sensors, %u buttons, %u/s background, "
+           "storms %u/s for %u ms every %u s\n",
+           opt.seconds, opt.seed, opt.sensors, opt.buttons, opt.background, opt.stormRate,
+           opt.stormMs, opt.stormEvery);
+    printf("scanner:  queue %zu B%s, fast lane %zu B, wake %u/%u ms, scan %s, consumer %s, "
+           "%u us/advert", opt.queueBytes, spill.c_str(), opt.fastLane, (unsigned)opt.wakeItems, opt.wakeMs,
+           opt.scanMs ? "periodic" : "continuous", opt.mode.c_str(), opt.costUs);
+    if (opt.mode == "frame")
+        printf(", %u baud", opt.baud);
+    else if (opt.mode == "poll")
+        printf(", %u ms poll", opt.pollMs);
+    printf("\n\n");
+
+    printf("offered:  %u adverts (%.1f/s):", offered, offered / secs);
+    for (int k = 0; k < KINDS; k++)
+        printf(" %u %s", radio.offered[k], KIND_NAMES[k]);
+    printf(", %u missed between scans\n", radio.missed);
+    if (opt.mergeMs >= 0)
+        printf("active:   %u scan responses, merge window %d ms\n", radio.responses,
+               opt.mergeMs);
+    printf("taken:    %u adverts (%.1f/s), %u decoded, %u %s", s.received, s.received / secs,
+           s.decoded, res.outputs, opt.mode == "frame" ? "frames" : "documents");
+    if (opt.mode == "frame")
+        printf(" (%" PRIu64 " bytes)", res.serialBytes);
+    printf("\n");
+    printf("dropped:  %u adverts (%.2f%%), queue peak %zu of %zu B (%u%%), %u wake-ups\n",
+           s.acquireFail, offered ? 100.0 * s.acquireFail / offered : 0.0, s.hwmBytes,
+           s.totalBytes, (unsigned)s.hwmPercent, s.wakeups);
+    if (s.spillBytes)
+        printf("spill:    peak %zu of %zu B, %u moved by the mover, %u inline, %u refused full, "
+               "%u sensor adverts out of order\n",
+               s.spillHwmBytes, s.spillBytes, s.spilled, s.spilledInline, s.spillFull,
+               res.reordered);
+    if (opt.mergeMs > 0)
+        printf("merge:    %u adverts held, %u merged with their response, %u queued alone, "
+               "%u responses without a held advert\n",
+               s.mergeHeld, s.merged, s.mergeAlone, s.mergeOrphans);
+    if (opt.reconfigMs)
+        printf("reconfig: at %.3f s%s, took %u us, %u scan parameter changes\n",
+               opt.reconfigMs / 1000.0, res.reconfigured ? "" : " (failed)", s.reconfigLastUs,
+               radio.paramChanges);
+    // Stack use is not visible on the host, only where the virtual time went:
+    // work that never sleeps (radio callback, scan task) takes none
+    printf("busy:    ");
+    for (const BLEScanner::TaskStats &t : s.tasks)
+        if (t.name)
+            printf(" %s %.1f ms (%u%%)", t.name, t.busyUs / 1000.0, (unsigned)t.busyPercent);
+    printf(" (virtual time, 0.0 ms = never blocked)\n");
+    if (s.scanRestarts > 1)
+        printf("scans:    %u started, %.1f ms between them at most\n", s.scanRestarts,
+               s.maxScanGapUs / 1000.0);
+    printf("\n%-10s %8s %8s %8s %8s %10s %10s\n", "class", "offered", "queued", "refused",
+           "evicted", "avg ms", "max ms");
+
+    static const char *const CLASS_NAMES[ADV_CLASS_COUNT] = {"trigger", "known", "unknown"};
+    uint32_t important = 0, lost = 0;
+    double worstMs = 0;
+    for (int c = 0; c < ADV_CLASS_COUNT; c++) {
+        const AdvertQueue::ClassStats &cs = s.cls[c];
+        uint32_t queued = cs.queued;
+        // Trigger adverts that fit the fast lane never reach the main queue
+        if (c == ADV_CLASS_TRIGGER)
+            queued += s.fastLane.queued;
+        uint32_t classOffered = queued + cs.dropped;
+        printf("%-10s %8u %8u %8u %8u %10.2f %10.2f\n", CLASS_NAMES[c], classOffered, queued,
+               cs.dropped, cs.evicted, s.latencyAvgUs[c] / 1000.0, s.latencyMaxUs[c] / 1000.0);
+        if (c != ADV_CLASS_UNKNOWN) {
+            important += classOffered;
+            lost += cs.dropped + cs.evicted;
+            worstMs = std::max(worstMs, s.latencyMaxUs[c] / 1000.0);
+        }
+    }
+
+    uint64_t digest = res.digest;
+    digest = fnv(digest, &s.received, sizeof(s.received));
+    digest = fnv(digest, &s.acquireFail, sizeof(s.acquireFail));
+    digest = fnv(digest, s.latencyMaxUs, sizeof(s.latencyMaxUs));
+    printf("\n%" PRIu64 " context switches, ended at %.3f s, digest %016" PRIx64 "\n",
+           HostRtos::switches(), res.endUs / 1e6, digest);
+
+    int status = 0;
+    double lossPercent = important ? 100.0 * lost / important : 0.0;
+    if (opt.maxLoss >= 0 && lossPercent > opt.maxLoss) {
+        printf("FAIL: %.2f%% of trigger and known-device adverts lost (limit %.2f%%)\n",
+               lossPercent, opt.maxLoss);
+        status = 1;
+    }
+    if (opt.maxLatencyMs >= 0 && worstMs > opt.maxLatencyMs) {
+        printf("FAIL: trigger and known-device latency reached %.2f ms (limit %.2f ms)\n",
+               worstMs, opt.maxLatencyMs);
+        status = 1;
+    }
+    return status;
+}
@@ -0,0 +1,271 @@
+// Runs the library's trace points (src/BTHomeTrace.h) on the host: decodes
+// adverts with the same decoders and probes as the gateway, on one or more
+// threads, then writes the spans as Chrome trace JSON and prints a summary
+// per stage.
+//
+//   trace_replay [-t threads] [-n adverts] [-k key] [-o trace.json] [capture.bcap]
+//
+// Without a capture each thread decodes n synthetic BTHome adverts, every
+// other one encrypted with the key. With a capture (extras/host/capture)
+// each thread decodes every advert in it. Open the output (default
+// trace.json) in chrome://tracing or ui.perfetto.dev. Also prints the cost
+// of one probe, measured around an empty scope.
+//
+// Build from the repository root:
+//   g++ -std=c++17 -O2 -DBTHOME_TRACE -DBTHOME_TRACE_EVENTS=65536
+//       -Iextras/host/shim -Isrc -Iexamples/BTHomeScan
+//       -o trace_replay extras/host/trace/trace_replay.cpp src/BTHomeTrace.cpp
+//       src/BTHomeDecoder.cpp examples/BTHomeScan/DecoderRegistry.cpp
+//       examples/BTHomeScan/DeviceDecoders.cpp examples/BTHomeScan/CaptureFile.cpp
+//       -lmbedcrypto -lpthread
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "mbedtls/ccm.h"
+
+#include "BTHomeDecoder.h"
+#include "BTHomeTrace.h"
+#include "CaptureFile.h"
+#include "DecodedFrame.h"
+#include "DecoderRegistry.h"
+#include "DeviceDecoders.h"
+
+#ifndef BTHOME_TRACE
+#error "build with -DBTHOME_TRACE"
+#endif
+
+struct BTHomeCtx {
+    BTHomeDecoder decoder;
+    uint8_t key[16];
+};
+
+static bool decodeBTHome(const uint8_t *sd, size_t len, const AdvertHeader &hdr,
+                         void *ctx, DecodedAdvert &out) {
+    auto *c = static_cast<BTHomeCtx *>(ctx);
+    return c->decoder.decode(sd, len, hdr.mac, c->key, out);
+}
+
+static bool parseKey(const char *hex, uint8_t key[16]) {
+    if (strlen(hex) != 32)
+        return false;
+    for (int i = 0; i < 16; i++) {
+        unsigned v;
+        if (sscanf(hex + 2 * i, "%2x", &v) != 1)
+            return false;
+        key[i] = (uint8_t)v;
+    }
+    return true;
+}
+
+// ---------------------------------------------------------------------------
+// Adverts
+// ---------------------------------------------------------------------------
+struct Advert {
+    AdvertHeader hdr;
+    uint8_t data[ADVERT_MAX_DATA];
+};
+
+// n BTHome adverts from 32 devices: battery, temperature and humidity,
+// odd devices encrypted
+static std::vector<Advert> synthesize(size_t n, const uint8_t key[16]) {
+    mbedtls_ccm_context ccm;
+    mbedtls_ccm_init(&ccm);
+    mbedtls_ccm_setkey(&ccm, MBEDTLS_CIPHER_ID_AES, key, 128);
+    std::vector<Advert> out(n);
+    uint32_t counter = 0;
+    for (size_t k = 0; k < n; k++) {
+        Advert &a = out[k];
+        int dev = (int)(k % 32);
+        bool encrypted = dev % 2;
+        uint8_t mac[6] = {0xA4, 0xC1, 0x38, 0x00, 0x00, (uint8_t)dev};
+        memcpy(a.hdr.mac, mac, 6);
+        a.hdr.timeUs = (int64_t)k * 1000;
+        a.hdr.addrType = 0;
+        a.hdr.rssi = -70;
+        a.hdr.flags = 0;
+
+        int16_t temp = (int16_t)(2000 + k % 50);
+        uint16_t hum = (uint16_t)(4500 + k % 30);
+        uint8_t obj[] = {0x01, 95, 0x02, (uint8_t)temp, (uint8_t)(temp >> 8),
+                         0x03, (uint8_t)hum, (uint8_t)(hum >> 8)};
+        uint8_t advInfo = encrypted ? 0x41 : 0x40;
+
+        uint8_t *ad = a.data;
+        size_t i = 0;
+        ad[i++] = 0;    // length, set below
+        ad[i++] = 0x16;
+        ad[i++] = 0xD2;
+        ad[i++] = 0xFC;
+        ad[i++] = advInfo;
+        if (encrypted) {
+            uint8_t nonce[13];
+            memcpy(nonce, mac, 6);
+            nonce[6] = 0xD2;
+            nonce[7] = 0xFC;
+            nonce[8] = advInfo;
+            counter++;
+            memcpy(&nonce[9], &counter, 4);
+            mbedtls_ccm_encrypt_and_tag(&ccm, sizeof(obj), nonce, sizeof(nonce), nullptr, 0,
+                                        obj, &ad[i], &ad[i + sizeof(obj) + 4], 4);
+            i += sizeof(obj);
+            memcpy(&ad[i], &counter, 4);
+            i += 8;
+        } else {
+            memcpy(&ad[i], obj, sizeof(obj));
+            i += sizeof(obj);
+        }
+        ad[0] = (uint8_t)(i - 1);
+        a.hdr.len = (uint8_t)i;
+    }
+    mbedtls_ccm_free(&ccm);
+    return out;
+}
+
+static std::vector<Advert> fromCapture(const char *path) {
+    std::vector<Advert> out;
+    CaptureFile cap;
+    if (!cap.open(path))
+        return out;
+    for (const CaptureRecord &r : cap) {
+        Advert a;
+        a.hdr = r.header();
+        memcpy(a.data, r.data(), a.hdr.len);
+        out.push_back(a);
+    }
+    return out;
+}
+
+// ---------------------------------------------------------------------------
+// Decoding threads
+// ---------------------------------------------------------------------------
+static void decodeAll(const std::vector<Advert> &adverts, const uint8_t key[16]) {
+    BTHomeCtx bthome;
+    memcpy(bthome.key, key, 16);
+    DecoderRegistry registry;
+    registry.add(DecoderRegistry::SERVICE_DATA_16, 0xFCD2, decodeBTHome, &bthome);
+    registerDeviceDecoders(registry);
+
+    uint8_t payload[DECODED_FRAME_MAX_PAYLOAD];
+    for (const Advert &a : adverts) {
+        RawAdvert adv;
+        adv.hdr = a.hdr;
+        adv.data = a.data;
+        DecodedAdvert res;
+        bool ok;
+        {
+            BTHOME_TRACE_SCOPE(TRACE_DECODE, adv.hdr.mac);
+            res.clear();
+            ok = registry.decode(adv, res) && res.count;
+        }
+        if (!ok)
+            continue;
+        BTHOME_TRACE_SCOPE(TRACE_FRAME, adv.hdr.mac);
+        encodeDecodedPayload(adv.hdr, res, FrameExtras(), payload);
+    }
+}
+
+struct StageSummary {
+    std::vector<uint32_t> durNs;
+};
+
+static void writeFile(const char *data, size_t len, void *ctx) {
+    fwrite(data, 1, len, static_cast<FILE *>(ctx));
+}
+
+int main(int argc, char **argv) {
+    int threads = 2;
+    size_t adverts = 20000;
+    const char *outPath = "trace.json";
+    const char *capturePath = nullptr;
+    uint8_t key[16] = {0x23, 0x1d, 0x39, 0xc1, 0xd7, 0xcc, 0x1a, 0xb1,
+                       0xae, 0xe2, 0x24, 0xcd, 0x09, 0x6d, 0xb9, 0x32};
+    for (int i = 1; i < argc; i++) {
+        std::string a = argv[i];
+        if (a == "-t" && i + 1 < argc) {
+            threads = atoi(argv[++i]);
+        } else if (a == "-n" && i + 1 < argc) {
+            adverts = strtoul(argv[++i], nullptr, 10);
+        } else if (a == "-k" && i + 1 < argc) {
+            if (!parseKey(argv[++i], key)) {
+                fprintf(stderr, "bad key\n");
+                return 2;
+            }
+        } else if (a == "-o" && i + 1 < argc) {
+            outPath = argv[++i];
+        } else if (a[0] != '-') {
+            capturePath = argv[i];
+        } else {
+            fprintf(stderr, "usage: %s [-t threads] [-n adverts] [-k key] [-o trace.json] "
+                            "[capture.bcap]\n", argv[0]);
+            return 2;
+        }
+    }
+    if (threads < 1)
+        threads = 1;
+
+    std::vector<Advert> input = capturePath ? fromCapture(capturePath) : synthesize(adverts, key);
+    if (input.empty()) {
+        fprintf(stderr, "no adverts\n");
+        return 2;
+    }
+
+    // Cost of a probe: an empty scope records one span. The first pass
+    // touches the ring's pages.
+    const int PROBES = 100000;
+    for (int i = 0; i < PROBES; i++) {
+        BTHOME_TRACE_SCOPE(TRACE_SINK, nullptr);
+    }
+    int64_t t0 = BTHomeTrace::nowNs();
+    for (int i = 0; i < PROBES; i++) {
+        BTHOME_TRACE_SCOPE(TRACE_SINK, nullptr);
+    }
+    double probeNs = (double)(BTHomeTrace::nowNs() - t0) / PROBES;
+    BTHomeTrace::clear();
+
+    std::vector<std::thread> pool;
+    for (int i = 0; i < threads; i++)
+        pool.emplace_back(decodeAll, std::cref(input), key);
+    for (std::thread &t : pool)
+        t.join();
+
+    uint32_t recorded = BTHomeTrace::recorded();
+    std::vector<TraceEvent> events(recorded);
+    events.resize(BTHomeTrace::collect(events.data(), events.size()));
+
+    StageSummary stages[TRACE_STAGES];
+    for (const TraceEvent &ev : events)
+        if (ev.stage < TRACE_STAGES)
+            stages[ev.stage].durNs.push_back(ev.durNs);
+
+    printf("%u spans recorded, %zu held (%d threads x %zu adverts)\n", (unsigned)recorded,
+           events.size(), threads, input.size());
+    printf("probe cost: %.1f ns\n", probeNs);
+    printf("%-14s %8s %10s %10s %10s\n", "stage", "count", "mean ns", "p99 ns", "max ns");
+    for (uint8_t s = 0; s < TRACE_STAGES; s++) {
+        std::vector<uint32_t> &d = stages[s].durNs;
+        if (d.empty())
+            continue;
+        std::sort(d.begin(), d.end());
+        double sum = 0;
+        for (uint32_t v : d)
+            sum += v;
+        printf("%-14s %8zu %10.0f %10u %10u\n", BTHomeTrace::stageName(s), d.size(),
+               sum / d.size(), (unsigned)d[d.size() * 99 / 100], (unsigned)d.back());
+    }
+
+    FILE *f = fopen(outPath, "w");
+    if (!f) {
+        fprintf(stderr, "cannot write %s\n", outPath);
+        return 1;
+    }
+    size_t n = BTHomeTrace::dump(writeFile, f);
+    fclose(f);
+    printf("wrote %zu spans to %s\n", n, outPath);
+    return 0;
+}
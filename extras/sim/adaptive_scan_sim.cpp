@@ -0,0 +1,115 @@
+// Host simulation of the AdaptiveScan scheduling policy.
+//
+// Simulates a set of periodic advertisers (BLE advInterval plus the 0-10 ms
+// random advDelay, optional packet loss and clock drift) against a radio that
+// only hears adverts inside the windows AdaptiveScan::next() hands out. Prints
+// the resulting duty cycle, the share of all transmitted adverts received, and
+// the predicted-versus-observed hit rate.
+//
+// Build and run from the repository root (Arena.cpp for the optional arena
+// path, built against the host shim of extras/host):
+//   g++ -std=c++17 -O2 -Iextras/host/shim -Iexamples/BTHomeScan -o adaptive_scan_sim
+//       extras/sim/adaptive_scan_sim.cpp examples/BTHomeScan/AdaptiveScan.cpp
+//       examples/BTHomeScan/Arena.cpp
+//   ./adaptive_scan_sim [devices] [hours] [lossPercent] [seed]
+
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+#include "AdaptiveScan.h"
+
+struct SimDevice {
+    uint8_t mac[6];
+    int64_t periodUs;
+    int64_t nextTxUs;
+    double drift;   ///< Clock error, e.g. 1.0002 = 200 ppm slow
+    uint32_t sent = 0;
+    uint32_t heard = 0;
+};
+
+int main(int argc, char **argv) {
+    int devices = argc > 1 ? atoi(argv[1]) : 12;
+    double hours = argc > 2 ? atof(argv[2]) : 2.0;
+    int lossPercent = argc > 3 ? atoi(argv[3]) : 2;
+    unsigned seed = argc > 4 ? (unsigned)atoi(argv[4]) : 1;
+
+    std::mt19937 rng(seed);
+    std::uniform_int_distribution<int> advDelay(0, 10000);
+    std::uniform_int_distribution<int> percent(0, 99);
+    // Typical sensor intervals: 1 s beacons up to 60 s low-power sensors.
+    const int64_t periods[] = {1000000, 2000000, 5000000, 10000000, 30000000, 60000000};
+    std::uniform_int_distribution<int> pick(0, sizeof(periods) / sizeof(periods[0]) - 1);
+    std::uniform_real_distribution<double> driftDist(0.9998, 1.0002);
+
+    std::vector<SimDevice> sim(devices);
+    for (int i = 0; i < devices; i++) {
+        SimDevice &d = sim[i];
+        for (int b = 0; b < 6; b++)
+            d.mac[b] = (uint8_t)(i * 37 + b);
+        d.periodUs = periods[pick(rng)];
+        d.nextTxUs = 1 + rng() % d.periodUs;
+        d.drift = driftDist(rng);
+    }
+
+    AdaptiveScan scan;
+    const int64_t endUs = (int64_t)(hours * 3600e6);
+    int64_t nowUs = 1;
+    int64_t scannedUs = 0;
+    uint32_t windows = 0;
+
+    while (nowUs < endUs) {
+        AdaptiveScan::Window w = scan.next(nowUs);
+        if (w.startUs > nowUs)
+            nowUs = w.startUs; // radio idle
+        int64_t stopUs = w.endUs < endUs ? w.endUs : endUs;
+        if (stopUs <= nowUs)
+            stopUs = nowUs + 1000;
+
+        // Deliver every advert transmitted inside [nowUs, stopUs) in time order.
+        while (true) {
+            SimDevice *first = nullptr;
+            for (SimDevice &d : sim)
+                if (!first || d.nextTxUs < first->nextTxUs)
+                    first = &d;
+            if (first->nextTxUs >= stopUs)
+                break;
+            SimDevice &d = *first;
+            if (d.nextTxUs >= nowUs) {
+                d.sent++;
+                if (percent(rng) >= lossPercent) {
+                    d.heard++;
+                    scan.observe(d.mac, d.nextTxUs);
+                }
+            } else {
+                d.sent++; // transmitted while the radio was off
+            }
+            d.nextTxUs += (int64_t)(d.periodUs * d.drift) + advDelay(rng);
+        }
+
+        scan.scanned(nowUs, stopUs);
+        scannedUs += stopUs - nowUs;
+        windows++;
+        nowUs = stopUs;
+    }
+
+    uint64_t sent = 0, heard = 0;
+    for (const SimDevice &d : sim) {
+        sent += d.sent;
+        heard += d.heard;
+    }
+    AdaptiveScan::Stats st = scan.stats();
+
+    printf("devices=%d hours=%.2f loss=%d%% seed=%u\n", devices, hours, lossPercent, seed);
+    printf("duty cycle       : %.1f%% (%u windows)\n", 100.0 * scannedUs / endUs, windows);
+    printf("adverts received : %llu / %llu (%.1f%%)\n",
+           (unsigned long long)heard, (unsigned long long)sent,
+           sent ? 100.0 * heard / sent : 0.0);
+    printf("predicted        : %u  hits %u  misses %u  hit rate %.1f%%\n",
+           st.predicted, st.hits, st.misses,
+           st.predicted ? 100.0 * st.hits / st.predicted : 0.0);
+    printf("tracked/locked   : %u / %u  guard x%.2f\n",
+           st.tracked, st.locked, st.guardScale / 256.0);
+    return 0;
+}
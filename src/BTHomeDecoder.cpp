@@ -1,128 +1,121 @@
 #include "BTHomeDecoder.h"
-
-// Declaration for stringToHexString from blescan.cpp
-bool stringToHexString(const String &str, String &hexStr);
+#include "BTHomeTrace.h"
 
 // ----------------------------
-//  parseBTHomeV2
+//  DecodedAdvert
 // ----------------------------
-BTHomeDecodeResult BTHomeDecoder::parseBTHomeV2(
-    // const std::vector<uint8_t> &serviceData,
-    const std::string &serviceData,
-    const std::string &macString,
-    const std::string &keyHex) {
-    BTHomeDecodeResult result;
-    result.isBTHome = false;
-    result.isBTHomeV2 = false;
-    result.bthomeVersion = 0;
-    result.isEncrypted = false;
-    result.decryptionSucceeded = false;
-    result.isTriggerBased = false;
-
-    // Must have at least 1 byte to read the adv_info
-    if (serviceData.size() < 1) {
-        return result;
-    }
-
-    uint8_t advInfo = serviceData[0];
-    bool encryptionFlag = (advInfo & 0x01) != 0;
-    bool hasMac = (advInfo & 0x02) != 0;
-    bool triggerBased = (advInfo & 0x04) != 0;
-    uint8_t version = (advInfo >> 5) & 0x07;
+void DecodedAdvert::clear() {
+    protocol = nullptr;
+    version = 0;
+    isEncrypted = false;
+    isTriggerBased = false;
+    count = 0;
+    skipped = 0;
+}
 
-    result.isBTHome = true; // because presumably the 0xFCD2 service UUID was matched externally
-    result.bthomeVersion = version;
-    result.isEncrypted = encryptionFlag;
-    result.isTriggerBased = triggerBased;
-    if (version == 2) {
-        result.isBTHomeV2 = true;
+bool DecodedAdvert::add(uint8_t objectID, int64_t raw,
+                        const char *name, const char *unit) {
+    if (!wants(objectID)) {
+        skipped++;
+        return true;
     }
+    if (count >= MAX_VALUES)
+        return false;
+    BTHomeValue &v = values[count++];
+    v.objectID = objectID;
+    v.raw = raw;
+    v.value = (float)raw * BTHomeDecoder::getObjectFactor(objectID);
+    v.name = name ? name : BTHomeDecoder::getObjectName(objectID);
+    v.unit = unit ? unit : BTHomeDecoder::getObjectUnit(objectID);
+    return true;
+}
 
-    // Skip over advInfo + MAC if present
-    size_t index = 1;
-    // size_t index = 0;
-    if (hasMac) {
-        if (serviceData.size() < 7) {
-            return result; // not enough data
-        }
-        index += 6; // skip the "reversed MAC"
-    }
+// ----------------------------
+//  decode
+// ----------------------------
+bool BTHomeDecoder::decode(const uint8_t *serviceData, size_t len,
+                           const uint8_t mac[6], const uint8_t *key,
+                           DecodedAdvert &out) {
+    BTHOME_TRACE_SCOPE(TRACE_BTHOME, mac);
+    // Must have at least 1 byte to read the adv_info
+    if (len < 1)
+        return false;
 
-    if (index >= serviceData.size()) {
-        return result;
+    uint8_t advInfo = serviceData[0];
+    setHeader(advInfo, out);
+    if (!(advInfo & 0x01)) {
+        size_t index = (advInfo & 0x02) ? 7 : 1;    // skip advInfo + MAC if present
+        if (index >= len)
+            return false;
+        log_buf_v(serviceData + index, len - index);
+        BTHOME_TRACE_SCOPE(TRACE_PARSE, mac);
+        return parseObjects(serviceData + index, len - index, out);
     }
 
-    // The remainder is payload
-    std::vector<uint8_t> payload(serviceData.begin() + index, serviceData.end());
-
-    String tempStr(reinterpret_cast<const char*>(payload.data()), payload.size());
-    String hexStr;
-    stringToHexString(tempStr, hexStr);
-    std::string hp = hexStr.c_str();
-    log_d("--DEBUG: mac=%s payload=%s", macString.c_str(), hp.c_str());
-
-    // If encrypted, decrypt
-    if (encryptionFlag) {
-        if (keyHex.size() != 32) {
-            // invalid key
-            return result;
-        }
-
-        uint8_t key[16];
-        for (int i = 0; i < 16; i++) {
-            String sub = String(keyHex.c_str() + i * 2, 2);
-            key[i] = (uint8_t)strtol(sub.c_str(), nullptr, 16);
-        }
-
-        // Convert MAC string to byte array (normal order)
-        uint8_t macBytes[6];
-        if (!macStringToBytes(macString, macBytes)) {
-            memset(macBytes, 0, 6); // fallback
-        }
-
-        // BTHome v2: last 8 bytes in payload => [counter(4) + mic(4)]
-        if (payload.size() < 8) {
-            return result;
-        }
-
-        size_t totalLen = payload.size();
-        size_t offsetCounter = totalLen - 8;
-        // size_t offsetMic     = totalLen - 4;
+    // Encrypted: decrypt into a stack buffer
+    BTHomeCipher c;
+    if (!key || !cipherParams(serviceData, len, mac, c))
+        return false;
+    uint8_t plain[256];
+    if (!decryptAESCCM(c, key, plain))
+        return false; // decryption failed
+    BTHOME_TRACE_SCOPE(TRACE_PARSE, mac);
+    return parseObjects(plain, c.cipherLen, out);
+}
 
-        uint8_t counter[4];
-        memcpy(counter, &payload[offsetCounter], 4);
+bool BTHomeDecoder::cipherParams(const uint8_t *serviceData, size_t len,
+                                 const uint8_t mac[6], BTHomeCipher &out) {
+    if (len < 1 || !(serviceData[0] & 0x01))
+        return false;
+    uint8_t advInfo = serviceData[0];
+    size_t index = (advInfo & 0x02) ? 7 : 1;
 
-        // Decrypt in-place
-        std::vector<uint8_t> decrypted(totalLen);
-        size_t outLen = 0;
-        bool ok = decryptAESCCM(payload.data(), totalLen,
-                                macBytes, advInfo,
-                                key, counter,
-                                decrypted.data(), outLen);
+    // BTHome v2: last 8 bytes in payload => [counter(4) + mic(4)]
+    if (len < index + 8 || len - index - 8 > 255)
+        return false;
+    const uint8_t *payload = serviceData + index;
+    size_t payloadLen = len - index;
+    const uint8_t *counter = payload + payloadLen - 8;
+
+    // Nonce => mac(6) + 0xD2 0xFC + advInfo(1) + counter(4) = 13
+    memcpy(out.nonce, mac, 6);
+    out.nonce[6] = 0xD2;
+    out.nonce[7] = 0xFC;
+    out.nonce[8] = advInfo;
+    memcpy(&out.nonce[9], counter, 4);
+
+    // Ciphertext is everything before the counter; MIC follows the counter
+    out.cipher = payload;
+    out.cipherLen = payloadLen - 8;
+    out.mic = payload + payloadLen - 4;
+    return true;
+}
 
-        if (!ok) {
-            return result; // decryption failed
-        }
+bool BTHomeDecoder::decodePlaintext(uint8_t advInfo, const uint8_t *payload,
+                                    size_t len, DecodedAdvert &out) {
+    setHeader(advInfo, out);
+    return parseObjects(payload, len, out);
+}
 
-        result.decryptionSucceeded = true;
-        // Replace payload with the plaintext
-        payload.resize(outLen);
-        memcpy(payload.data(), decrypted.data(), outLen);
-    } else {
-        result.decryptionSucceeded = true;
-    }
+void BTHomeDecoder::setHeader(uint8_t advInfo, DecodedAdvert &out) {
+    // The 0xFCD2 service UUID was matched by the caller
+    if (!out.protocol)
+        out.protocol = "bthome";
+    out.version = (advInfo >> 5) & 0x07;
+    out.isEncrypted = (advInfo & 0x01) != 0;
+    out.isTriggerBased = (advInfo & 0x04) != 0;
+}
 
-    // Parse objects
+bool BTHomeDecoder::parseObjects(const uint8_t *payload, size_t payloadLen,
+                                 DecodedAdvert &out) {
     size_t idx = 0;
-    while (idx < payload.size()) {
+    while (idx < payloadLen) {
         int dataLen;
-
-        log_v("DEBUG: idx=%d, payload.size()=%d", idx, payload.size());
-        if (idx + 1 > payload.size())
-            break;
         uint8_t objID = payload[idx];
         idx++; // skip over objId
         if (hasLengthByte(objID)) {
+            if (idx >= payloadLen)
+                break;
             // skip over length byte
             dataLen = payload[idx];
             idx++;
@@ -134,33 +127,81 @@ BTHomeDecodeResult BTHomeDecoder::parseBTHomeV2(
             log_d("DEBUG: Unknown objectID => stopping parse");
             break;
         }
-        if (idx + dataLen > payload.size()) {
-            log_d("DEBUG: Not enough bytes => stopping parse idx=%d dataLen=%d pl=%d", idx, dataLen, payload.size());
+        if (idx + dataLen > payloadLen) {
+            log_d("DEBUG: Not enough bytes => stopping parse idx=%d dataLen=%d pl=%d", idx, dataLen, payloadLen);
             break;
         }
 
-        float factor = getObjectFactor(objID);
-        bool isSigned = getObjectSignedNess(objID);
-        // if (objID == 0x02) isSigned = true; // example
-        float val = 0.0f;
-        if (isSigned) {
-            val = parseSignedLittle(&payload[idx], dataLen, factor);
-        } else {
-            val = parseUnsignedLittle(&payload[idx], dataLen, factor);
+        if (!out.wants(objID)) {
+            out.skipped++;
+            idx += dataLen;
+            continue;
         }
+        int64_t raw = readLittle(&payload[idx], dataLen, getObjectSignedNess(objID));
+        if (!out.add(objID, raw))
+            break;
+        log_d("DEBUG: objID=0x%02X => raw=%lld", objID, (long long)raw);
+
+        idx += dataLen;
+    }
+    return true;
+}
+
+// ----------------------------
+//  parseBTHomeV2
+// ----------------------------
+BTHomeDecodeResult BTHomeDecoder::parseBTHomeV2(
+    // const std::vector<uint8_t> &serviceData,
+    const std::string &serviceData,
+    const std::string &macString,
+    const std::string &keyHex) {
+    BTHOME_TRACE_SCOPE(TRACE_PARSE_V2, nullptr);
+    BTHomeDecodeResult result;
+    result.isBTHome = false;
+    result.isBTHomeV2 = false;
+    result.bthomeVersion = 0;
+    result.isEncrypted = false;
+    result.decryptionSucceeded = false;
+    result.isTriggerBased = false;
+
+    // Must have at least 1 byte to read the adv_info
+    if (serviceData.size() < 1) {
+        return result;
+    }
 
-        log_d("DEBUG: objID=0x%02X => val=%.2f, factor=%.3f", objID, val, factor);
+    // Convert MAC string to byte array (normal order)
+    uint8_t macBytes[6];
+    if (!macStringToBytes(macString, macBytes)) {
+        memset(macBytes, 0, 6); // fallback
+    }
+
+    uint8_t key[16];
+    bool haveKey = keyHex.size() == 32;
+    for (int i = 0; haveKey && i < 16; i++) {
+        char byteStr[3] = {keyHex[i * 2], keyHex[i * 2 + 1], '\0'};
+        key[i] = (uint8_t)strtol(byteStr, nullptr, 16);
+    }
+
+    DecodedAdvert dec;
+    dec.clear();
+    bool ok = decode((const uint8_t *)serviceData.data(), serviceData.size(),
+                     macBytes, haveKey ? key : nullptr, dec);
+
+    result.isBTHome = true; // because presumably the 0xFCD2 service UUID was matched externally
+    result.bthomeVersion = dec.version;
+    result.isBTHomeV2 = dec.version == 2;
+    result.isEncrypted = dec.isEncrypted;
+    result.isTriggerBased = dec.isTriggerBased;
+    result.decryptionSucceeded = ok;
 
+    for (uint8_t i = 0; i < dec.count; i++) {
         BTHomeMeasurement meas;
-        meas.objectID = objID;
-        meas.value = val;
-        meas.name = getObjectName(objID);
-        meas.unit = getObjectUnit(objID);
+        meas.objectID = dec.values[i].objectID;
+        meas.value = dec.values[i].value;
+        meas.name = dec.values[i].name;
+        meas.unit = dec.values[i].unit;
         meas.isValid = true;
-
         result.measurements.push_back(meas);
-
-        idx += dataLen;
     }
 
     return result;
@@ -185,47 +226,26 @@ bool BTHomeDecoder::macStringToBytes(const std::string &macStr, uint8_t macOut[6
     return true;
 }
 
-bool BTHomeDecoder::decryptAESCCM(
-    const uint8_t *ciphertext, size_t ciphertextLen,
-    const uint8_t *macBytes, uint8_t advInfo,
-    const uint8_t *key, const uint8_t *counter,
-    uint8_t *plaintextOut, size_t &plaintextLenOut) {
-    // BTHome Nonce => mac(6) + 0xD2 0xFC + advInfo(1) + counter(4) = 13
-    uint8_t nonce[13];
-    memcpy(nonce, macBytes, 6);
-    nonce[6] = 0xD2;
-    nonce[7] = 0xFC;
-    nonce[8] = advInfo;
-    memcpy(&nonce[9], counter, 4);
-
-    // last 4 bytes of ciphertext => MIC
-    if (ciphertextLen < 4)
-        return false;
-    size_t micLen = 4;
-    size_t rawCipherLen = ciphertextLen - micLen;
-
-    mbedtls_ccm_context ctx;
-    mbedtls_ccm_init(&ctx);
-    int ret = mbedtls_ccm_setkey(&ctx, MBEDTLS_CIPHER_ID_AES, key, 128);
-    if (ret != 0) {
-        mbedtls_ccm_free(&ctx);
-        return false;
+bool BTHomeDecoder::decryptAESCCM(const BTHomeCipher &c, const uint8_t *key,
+                                  uint8_t *plaintextOut) {
+    BTHOME_TRACE_SCOPE(TRACE_DECRYPT, c.nonce);     // the nonce starts with the MAC
+    if (!_ccmReady || memcmp(_ccmKey, key, 16) != 0) {
+        mbedtls_ccm_free(&_ccm);
+        mbedtls_ccm_init(&_ccm);
+        _ccmReady = mbedtls_ccm_setkey(&_ccm, MBEDTLS_CIPHER_ID_AES, key, 128) == 0;
+        if (!_ccmReady)
+            return false;
+        memcpy(_ccmKey, key, 16);
     }
 
-    ret = mbedtls_ccm_auth_decrypt(
-              &ctx,
-              rawCipherLen,
-              nonce, sizeof(nonce),
+    int ret = mbedtls_ccm_auth_decrypt(
+              &_ccm,
+              c.cipherLen,
+              c.nonce, sizeof(c.nonce),
               nullptr, 0, // no AAD
-              ciphertext, plaintextOut,
-              (uint8_t *)(ciphertext + rawCipherLen),
-              micLen);
-    mbedtls_ccm_free(&ctx);
-
-    if (ret != 0)
-        return false;
-    plaintextLenOut = rawCipherLen;
-    return true;
+              c.cipher, plaintextOut,
+              c.mic, 4);
+    return ret == 0;
 }
 
 bool BTHomeDecoder::hasLengthByte(uint8_t objID) {
@@ -307,6 +327,7 @@ int BTHomeDecoder::getObjectDataLength(uint8_t objID) {
         case 0x2E: // humidity (1 byte)
         case 0x2F: // soil moisture (1 byte)
         case 0x3A: // button
+        case 0x09: // count (uint8)
         case 0x57: // temperature (sint8)
         case 0x58: // temperature (sint8, factor 0.35)
             return 1;
@@ -321,6 +342,7 @@ int BTHomeDecoder::getObjectDataLength(uint8_t objID) {
             return 4;
         case 0x5D: // current (sint16)
         case 0x61: // rotational speed
+        case 0x3D: // count (uint16)
             return 2;
         case 0x60: // channel
             return 1;
@@ -418,7 +440,7 @@ bool BTHomeDecoder::getObjectSignedNess(uint8_t objID) {
     }
 }
 
-String BTHomeDecoder::getObjectUnit(uint8_t objID) {
+const char *BTHomeDecoder::getObjectUnit(uint8_t objID) {
     switch (objID) {
         case 0x01: // battery
         case 0x03: // humidity
@@ -488,7 +510,7 @@ String BTHomeDecoder::getObjectUnit(uint8_t objID) {
     }
 }
 
-String BTHomeDecoder::getObjectName(uint8_t objID) {
+const char *BTHomeDecoder::getObjectName(uint8_t objID) {
     switch (objID) {
         case 0x00:
             return "packet_id";
@@ -618,6 +640,9 @@ String BTHomeDecoder::getObjectName(uint8_t objID) {
         case 0x57:
         case 0x58:
             return "temperature";
+        case 0x09:
+        case 0x3D:
+        case 0x3E:
         case 0x59:
         case 0x5A:
         case 0x5B:
@@ -648,36 +673,15 @@ String BTHomeDecoder::getObjectName(uint8_t objID) {
     }
 }
 
-float BTHomeDecoder::parseSignedLittle(const uint8_t *data, size_t len, float factor) {
-    if (len == 1) {
-        int8_t raw = (int8_t)data[0];
-        return raw * factor;
-    } else if (len == 2) {
-        int16_t raw = (int16_t)((data[1] << 8) | data[0]);
-        return raw * factor;
-    } else if (len == 3) {
-        int32_t raw = (int32_t)((data[2] << 16) | (data[1] << 8) | data[0]);
-        return raw * factor;
-    } else if (len == 4) {
-        int32_t raw = (int32_t)((data[3] << 24) | (data[2] << 16) | (data[1] << 8) | data[0]);
-        return raw * factor;
-    }
-    return 0.0f;
+int64_t BTHomeDecoder::readLittle(const uint8_t *data, size_t len, bool isSigned) {
+    if (len == 0 || len > 4)
+        return 0;
+    uint32_t raw = 0;
+    for (size_t i = 0; i < len; i++)
+        raw |= (uint32_t)data[i] << (8 * i);
+    if (!isSigned)
+        return raw;
+    // Sign-extend from the top bit of the last byte
+    uint32_t signBit = 1u << (8 * len - 1);
+    return (int64_t)(int32_t)((raw ^ signBit) - signBit);
 }
-
-float BTHomeDecoder::parseUnsignedLittle(const uint8_t *data, size_t len, float factor) {
-    if (len == 1) {
-        uint8_t raw = data[0];
-        return raw * factor;
-    } else if (len == 2) {
-        uint16_t raw = (uint16_t)((data[1] << 8) | data[0]);
-        return raw * factor;
-    } else if (len == 3) {
-        uint32_t raw = (uint32_t)((data[2] << 16) | (data[1] << 8) | data[0]);
-        return raw * factor;
-    } else if (len == 4) {
-        uint32_t raw = (uint32_t)((data[3] << 24) | (data[2] << 16) | (data[1] << 8) | data[0]);
-        return raw * factor;
-    }
-    return 0.0f;
-}
\ No newline at end of file
@@ -26,13 +26,68 @@ struct BTHomeDecodeResult {
     std::vector<BTHomeMeasurement> measurements;
 };
 
+// ------------------------------------------------------------
+//  Zero-allocation results
+// ------------------------------------------------------------
+
+/// One decoded value, in BTHome object-id terms whatever the source protocol.
+struct BTHomeValue {
+    uint8_t objectID;   ///< BTHome object id
+    int64_t raw;        ///< Integer as transmitted, before the object factor
+    float value;        ///< raw * factor, in unit
+    const char *name;   ///< Static string
+    const char *unit;   ///< Static string, "" if unitless
+};
+
+/// Fixed-capacity decode result with static name/unit strings, filled without
+/// touching the heap by BTHomeDecoder::decode() and other device decoders.
+struct DecodedAdvert {
+    static constexpr uint8_t MAX_VALUES = 24;
+
+    const char *protocol;   ///< "bthome", "ruuvi", ... nullptr if nothing decoded
+    uint8_t version;        ///< Protocol/format version
+    bool isEncrypted;
+    bool isTriggerBased;
+    uint8_t count;
+    uint8_t skipped;        ///< Values left out because wanted excludes them
+    BTHomeValue values[MAX_VALUES];
+
+    /// Object ids to keep, a 256-bit mask (bit id & 31 of word id >> 5), or
+    /// nullptr for all. Set by the caller before decoding; clear() keeps it.
+    const uint32_t *wanted = nullptr;
+
+    void clear();
+
+    bool wants(uint8_t objectID) const {
+        return !wanted || (wanted[objectID >> 5] >> (objectID & 31)) & 1u;
+    }
+
+    /// Append raw scaled by the BTHome factor of objectID. name/unit default
+    /// to the BTHome tables. Objects wanted excludes are only counted in
+    /// skipped. Returns false when full.
+    bool add(uint8_t objectID, int64_t raw,
+             const char *name = nullptr, const char *unit = nullptr);
+};
+
+/// AES-CCM inputs of an encrypted BTHome payload (AES-128, 13-byte nonce,
+/// 4-byte MIC, no AAD), for callers that decrypt in batches.
+struct BTHomeCipher {
+    uint8_t nonce[13];
+    const uint8_t *cipher;  ///< Ciphertext, points into the service data
+    size_t cipherLen;
+    const uint8_t *mic;     ///< 4 bytes, points into the service data
+};
+
 // ------------------------------------------------------------
 //  BTHomeDecoder Class
 // ------------------------------------------------------------
 class BTHomeDecoder {
 public:
-    BTHomeDecoder() {}
-    ~BTHomeDecoder() {}
+    BTHomeDecoder() { mbedtls_ccm_init(&_ccm); }
+    ~BTHomeDecoder() { mbedtls_ccm_free(&_ccm); }
+
+    BTHomeDecoder(const BTHomeDecoder &) = delete;
+    BTHomeDecoder &operator=(const BTHomeDecoder &) = delete;
 
     BTHomeDecodeResult parseBTHomeV2(
         // const std::vector<uint8_t>& serviceData,
@@ -41,21 +96,47 @@ public:
         const std::string& keyHex
     );
 
+    /// Decode BTHome service data (the bytes after the 0xFCD2 UUID) into out
+    /// without heap allocation. mac is the advertiser address, most
+    /// significant byte first; key is 16 bytes or nullptr. Returns true if
+    /// the payload was plaintext or decrypted successfully; version and flags
+    /// in out are filled either way.
+    bool decode(const uint8_t *serviceData, size_t len,
+                const uint8_t mac[6], const uint8_t *key,
+                DecodedAdvert &out);
+
+    /// Split encrypted service data into its CCM inputs without decrypting.
+    /// Returns false if the payload is not encrypted or too short.
+    static bool cipherParams(const uint8_t *serviceData, size_t len,
+                             const uint8_t mac[6], BTHomeCipher &out);
+
+    /// Decode an already decrypted payload (the objects only); advInfo is
+    /// the first service data byte.
+    static bool decodePlaintext(uint8_t advInfo, const uint8_t *payload,
+                                size_t len, DecodedAdvert &out);
+
+    // Object tables (BTHome v2 object ids)
+    static bool        hasLengthByte(uint8_t objID);
+    static int         getObjectDataLength(uint8_t objID);
+    static float       getObjectFactor(uint8_t objID);
+    static bool        getObjectSignedNess(uint8_t objID);
+    static const char *getObjectUnit(uint8_t objID);
+    static const char *getObjectName(uint8_t objID);
+
 private:
     // Helper methods
     bool   macStringToBytes(const std::string &macStr, uint8_t macOut[6]);
-    bool   decryptAESCCM(const uint8_t* ciphertext, size_t ciphertextLen,
-                         const uint8_t* macBytes, uint8_t advInfo,
-                         const uint8_t* key, const uint8_t* counter,
-                         uint8_t* plaintextOut, size_t &plaintextLenOut);
-    bool hasLengthByte(uint8_t objID);
-    int    getObjectDataLength(uint8_t objID);
-    float  getObjectFactor(uint8_t objID);
-    bool   getObjectSignedNess(uint8_t objID);
-    String getObjectUnit(uint8_t objID);
-    String getObjectName(uint8_t objID);
-
-    float  parseSignedLittle(const uint8_t* data, size_t len, float factor);
-    float  parseUnsignedLittle(const uint8_t* data, size_t len, float factor);
-};
+    bool   decryptAESCCM(const BTHomeCipher &c, const uint8_t *key,
+                         uint8_t *plaintextOut);
 
+    static void setHeader(uint8_t advInfo, DecodedAdvert &out);
+    static bool parseObjects(const uint8_t *payload, size_t len, DecodedAdvert &out);
+
+    static int64_t readLittle(const uint8_t* data, size_t len, bool isSigned);
+
+    // Key schedule of the last key used. Setting a key up allocates the
+    // cipher context, so it is only redone when the key changes.
+    mbedtls_ccm_context _ccm;
+    uint8_t _ccmKey[16];
+    bool _ccmReady = false;
+};
@@ -0,0 +1,238 @@
+#include "BTHomeTrace.h"
+
+// The rings and everything using them only exist in trace builds
+#ifdef BTHOME_TRACE
+
+#include <atomic>
+#include <cinttypes>
+#include <cstdio>
+
+#ifdef ESP_PLATFORM
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#define TRACE_RINGS portNUM_PROCESSORS
+#else
+#include <chrono>
+#define TRACE_RINGS 4
+#endif
+
+static_assert((BTHOME_TRACE_EVENTS & (BTHOME_TRACE_EVENTS - 1)) == 0,
+              "BTHOME_TRACE_EVENTS must be a power of two");
+
+// ---------------------------------------------------------------------------
+// Rings
+// ---------------------------------------------------------------------------
+
+// seq is index + 1 once the event at index is complete, 0 while it is being
+// written, so a reader can tell a torn copy from a good one.
+struct TraceSlot {
+    std::atomic<uint32_t> seq;
+    TraceEvent ev;
+};
+
+struct TraceRing {
+    std::atomic<uint32_t> head;     ///< Index of the next event
+    std::atomic<uint32_t> floor;    ///< head at the last clear()
+    TraceSlot slots[BTHOME_TRACE_EVENTS];
+};
+
+static TraceRing s_rings[TRACE_RINGS];
+static std::atomic<bool> s_enabled{true};
+
+static const char *const STAGE_NAMES[TRACE_STAGES] = {
+    "sink", "queue", "decode", "bthome_decode", "decrypt", "parse",
+    "parse_v2", "route", "json", "frame", "fanout",
+};
+
+const char *BTHomeTrace::stageName(uint8_t stage) {
+    return stage < TRACE_STAGES ? STAGE_NAMES[stage] : "unknown";
+}
+
+#ifdef ESP_PLATFORM
+int64_t BTHomeTrace::nowNs() {
+    return esp_timer_get_time() * 1000;
+}
+
+static uint8_t currentCore() {
+    return (uint8_t)xPortGetCoreID();
+}
+
+static uint32_t currentTask() {
+    return (uint32_t)(uintptr_t)xTaskGetCurrentTaskHandle();
+}
+#else
+int64_t BTHomeTrace::nowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Threads are numbered in the order they first record
+static uint32_t threadNumber() {
+    static std::atomic<uint32_t> next{1};
+    thread_local uint32_t number = next.fetch_add(1, std::memory_order_relaxed);
+    return number;
+}
+
+static uint8_t currentCore() {
+    return (uint8_t)(threadNumber() % TRACE_RINGS);
+}
+
+static uint32_t currentTask() {
+    return threadNumber();
+}
+#endif
+
+static uint32_t macHash(const uint8_t *mac) {
+    if (!mac)
+        return 0;
+    uint32_t h = 2166136261u;
+    for (int i = 0; i < 6; i++) {
+        h ^= mac[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+void BTHomeTrace::record(uint8_t stage, int64_t startNs, uint32_t durNs, const uint8_t *mac) {
+    if (!s_enabled.load(std::memory_order_relaxed))
+        return;
+    uint8_t core = currentCore();
+    TraceRing &ring = s_rings[core % TRACE_RINGS];
+    uint32_t index = ring.head.fetch_add(1, std::memory_order_relaxed);
+    TraceSlot &slot = ring.slots[index & (BTHOME_TRACE_EVENTS - 1)];
+
+    slot.seq.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    slot.ev.startNs = startNs;
+    slot.ev.durNs = durNs;
+    slot.ev.macHash = macHash(mac);
+    slot.ev.task = currentTask();
+    slot.ev.stage = stage;
+    slot.ev.core = core;
+    slot.seq.store(index + 1, std::memory_order_release);
+}
+
+void BTHomeTrace::enable(bool on) {
+    s_enabled.store(on, std::memory_order_relaxed);
+}
+
+void BTHomeTrace::clear() {
+    for (TraceRing &ring : s_rings)
+        ring.floor.store(ring.head.load(std::memory_order_relaxed), std::memory_order_relaxed);
+}
+
+uint32_t BTHomeTrace::recorded() {
+    uint32_t n = 0;
+    for (const TraceRing &ring : s_rings)
+        n += ring.head.load(std::memory_order_relaxed) - ring.floor.load(std::memory_order_relaxed);
+    return n;
+}
+
+// Call fn for every complete event still held, oldest first per ring.
+template <typename Fn>
+static size_t forEachEvent(Fn fn) {
+    size_t n = 0;
+    for (TraceRing &ring : s_rings) {
+        uint32_t head = ring.head.load(std::memory_order_acquire);
+        uint32_t first = ring.floor.load(std::memory_order_relaxed);
+        if (head - first > BTHOME_TRACE_EVENTS)
+            first = head - BTHOME_TRACE_EVENTS;
+        for (uint32_t i = first; i != head; i++) {
+            TraceSlot &slot = ring.slots[i & (BTHOME_TRACE_EVENTS - 1)];
+            if (slot.seq.load(std::memory_order_acquire) != i + 1)
+                continue;
+            TraceEvent ev = slot.ev;
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (slot.seq.load(std::memory_order_relaxed) != i + 1)
+                continue;   // overwritten while copying
+            if (!fn(ev))
+                return n;
+            n++;
+        }
+    }
+    return n;
+}
+
+size_t BTHomeTrace::collect(TraceEvent *out, size_t max) {
+    size_t n = 0;
+    forEachEvent([&](const TraceEvent &ev) {
+        if (n == max)
+            return false;
+        out[n++] = ev;
+        return true;
+    });
+    return n;
+}
+
+// ---------------------------------------------------------------------------
+// Chrome trace export
+// ---------------------------------------------------------------------------
+
+// Chrome trace times are microseconds; keep the nanoseconds as decimals
+static const char *micros(int64_t ns, char *buf) {
+    snprintf(buf, 24, "%" PRId64 ".%03u", ns / 1000, (unsigned)(ns % 1000));
+    return buf;
+}
+
+size_t BTHomeTrace::dump(WriteFn write, void *ctx) {
+    // Stop recording while reading, so the dump is one consistent window
+    bool was = s_enabled.exchange(false);
+    char line[320];
+    int len = snprintf(line, sizeof(line),
+                       "{\"traceEvents\":[\n"
+                       "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"BTHome\"}}");
+    write(line, (size_t)len, ctx);
+
+#ifdef ESP_PLATFORM
+    // Name the rows of the tasks we know; others show their handle
+    static const char *const TASKS[] = {
+        "loopTask", "ble_scan", "ble_fanout", "btController", "BTC_TASK", "BTU_TASK",
+        "nimble_host",
+    };
+    for (const char *name : TASKS) {
+        TaskHandle_t h = xTaskGetHandle(name);
+        if (!h)
+            continue;
+        len = snprintf(line, sizeof(line),
+                       ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%" PRIu32
+                       ",\"args\":{\"name\":\"%s\"}}",
+                       (uint32_t)(uintptr_t)h, name);
+        write(line, (size_t)len, ctx);
+    }
+#endif
+
+    uint32_t id = 0;
+    char start[24], end[24];
+    size_t n = forEachEvent([&](const TraceEvent &ev) {
+        int l;
+        if (ev.stage == TRACE_QUEUE) {
+            // Queued adverts overlap each other: async slices, one lane each
+            id++;
+            l = snprintf(line, sizeof(line),
+                         ",\n{\"name\":\"queue\",\"cat\":\"bthome\",\"ph\":\"b\",\"id\":%" PRIu32
+                         ",\"ts\":%s,\"pid\":1,\"args\":{\"mac\":\"%08" PRIx32 "\"}}"
+                         ",\n{\"name\":\"queue\",\"cat\":\"bthome\",\"ph\":\"e\",\"id\":%" PRIu32
+                         ",\"ts\":%s,\"pid\":1}",
+                         id, micros(ev.startNs, start), ev.macHash, id,
+                         micros(ev.startNs + ev.durNs, end));
+        } else {
+            l = snprintf(line, sizeof(line),
+                         ",\n{\"name\":\"%s\",\"cat\":\"bthome\",\"ph\":\"X\",\"ts\":%s"
+                         ",\"dur\":%s,\"pid\":1,\"tid\":%" PRIu32
+                         ",\"args\":{\"core\":%u,\"mac\":\"%08" PRIx32 "\"}}",
+                         stageName(ev.stage), micros(ev.startNs, start), micros(ev.durNs, end),
+                         ev.task, (unsigned)ev.core, ev.macHash);
+        }
+        if (l > 0)
+            write(line, (size_t)l < sizeof(line) ? (size_t)l : sizeof(line) - 1, ctx);
+        return true;
+    });
+
+    len = snprintf(line, sizeof(line), "\n],\"displayTimeUnit\":\"ns\"}\n");
+    write(line, (size_t)len, ctx);
+    s_enabled.store(was);
+    return n;
+}
+
+#endif // BTHOME_TRACE
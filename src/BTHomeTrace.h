@@ -0,0 +1,136 @@
+/// @file BTHomeTrace.h
+/// @brief Trace points on the advert hot path, exported as Chrome trace JSON.
+///
+/// Build with -DBTHOME_TRACE (platformio.ini build_flags, so the library
+/// sees it too) and every stage an advert goes through records a span:
+/// start time, duration, stage, task, core and a hash of the device MAC.
+/// Spans go into a fixed ring per core; writers claim slots with one atomic
+/// add and never lock or allocate, so the BLE callback can record too. When
+/// a ring wraps the oldest spans are overwritten.
+///
+/// dump() writes the rings as Chrome trace JSON ({"traceEvents": [...]}),
+/// which chrome://tracing and ui.perfetto.dev open directly: one row per
+/// task, one slice per stage, nested as the calls are. Without BTHOME_TRACE
+/// the probes compile to nothing and the rings take no memory.
+///
+/// Timestamps come from esp_timer on the ESP32 (1 us resolution), the clock
+/// adverts are stamped with, and from std::chrono::steady_clock on the host.
+///
+/// @code
+///   // in loop(): send 'T' over serial, paste the output into a .json file
+///   if (Serial.read() == 'T')
+///       BTHomeTrace::dump(Serial);
+/// @endcode
+
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+#ifdef ARDUINO
+#include <Print.h>
+#endif
+
+/// Spans per core ring; a power of two.
+#ifndef BTHOME_TRACE_EVENTS
+#define BTHOME_TRACE_EVENTS 256
+#endif
+
+enum TraceStage : uint8_t {
+    TRACE_SINK,         ///< Advert callback: record, classify, enqueue
+    TRACE_QUEUE,        ///< Capture to dequeue
+    TRACE_DECODE,       ///< Decoder registry and device tracking
+    TRACE_BTHOME,       ///< BTHomeDecoder::decode()
+    TRACE_DECRYPT,      ///< AES-CCM decryption
+    TRACE_PARSE,        ///< BTHome object parsing
+    TRACE_PARSE_V2,     ///< Legacy parseBTHomeV2() wrapper
+    TRACE_ROUTE,        ///< Subscription routing
+    TRACE_JSON,         ///< JsonDocument building
+    TRACE_FRAME,        ///< Decoded frame encoding
+    TRACE_FANOUT,       ///< Copies into the consumer rings
+    TRACE_STAGES
+};
+
+/// One recorded span.
+struct TraceEvent {
+    int64_t startNs;    ///< Trace clock
+    uint32_t durNs;
+    uint32_t macHash;   ///< FNV-1a of the MAC, 0 if none
+    uint32_t task;      ///< Task handle (ESP32) or thread number (host)
+    uint8_t stage;      ///< TraceStage
+    uint8_t core;
+};
+
+class BTHomeTrace {
+public:
+    /// Name of a stage as it appears in the trace.
+    static const char *stageName(uint8_t stage);
+
+    /// Record a span of durNs starting at startNs (trace clock); mac may be
+    /// nullptr. Does nothing while disabled.
+    static void record(uint8_t stage, int64_t startNs, uint32_t durNs, const uint8_t *mac);
+
+    /// Trace clock: esp_timer on the ESP32 (1 us steps), steady_clock on
+    /// the host.
+    static int64_t nowNs();
+    static int64_t nowUs() { return nowNs() / 1000; }
+
+    /// Start or stop recording (on by default).
+    static void enable(bool on);
+
+    /// Forget everything recorded.
+    static void clear();
+
+    /// Copy the spans held, oldest first per ring, into out. Returns the
+    /// number copied. Spans overwritten while copying are skipped.
+    static size_t collect(TraceEvent *out, size_t max);
+
+    /// Spans recorded since start (or clear()), including overwritten ones.
+    static uint32_t recorded();
+
+    /// Write the spans held as Chrome trace JSON through write, which gets
+    /// pieces of the document in order. Returns the number of spans written.
+    typedef void (*WriteFn)(const char *data, size_t len, void *ctx);
+    static size_t dump(WriteFn write, void *ctx);
+
+#ifdef ARDUINO
+    static size_t dump(Print &out) {
+        return dump([](const char *data, size_t len, void *ctx) {
+            static_cast<Print *>(ctx)->write((const uint8_t *)data, len);
+        }, &out);
+    }
+#endif
+
+    /// Records the span from construction to destruction.
+    class Scope {
+    public:
+        Scope(uint8_t stage, const uint8_t *mac)
+            : _stage(stage), _mac(mac), _startNs(nowNs()) {}
+        ~Scope() { record(_stage, _startNs, (uint32_t)(nowNs() - _startNs), _mac); }
+
+        Scope(const Scope &) = delete;
+        Scope &operator=(const Scope &) = delete;
+
+    private:
+        uint8_t _stage;
+        const uint8_t *_mac;
+        int64_t _startNs;
+    };
+};
+
+#ifdef BTHOME_TRACE
+#define BTHOME_TRACE_CAT2(a, b) a##b
+#define BTHOME_TRACE_CAT(a, b) BTHOME_TRACE_CAT2(a, b)
+/// Trace the rest of the enclosing block as stage; mac may be nullptr.
+#define BTHOME_TRACE_SCOPE(stage, mac) \
+    BTHomeTrace::Scope BTHOME_TRACE_CAT(_bthomeTrace, __LINE__)(stage, mac)
+/// Record a span that started at startUs (trace clock) and ends now.
+#define BTHOME_TRACE_SINCE(stage, startUs, mac) do { \
+        int64_t _start = (int64_t)(startUs) * 1000; \
+        int64_t _dur = BTHomeTrace::nowNs() - _start; \
+        BTHomeTrace::record(stage, _start, \
+                            _dur < 0 ? 0 : _dur > UINT32_MAX ? UINT32_MAX : (uint32_t)_dur, mac); \
+    } while (0)
+#else
+#define BTHOME_TRACE_SCOPE(stage, mac) do {} while (0)
+#define BTHOME_TRACE_SINCE(stage, startUs, mac) do {} while (0)
+#endif